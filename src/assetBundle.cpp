@@ -0,0 +1,157 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "assetBundle.h"
+
+// Same order as MIME_TYPES in scripts/pack_ui.py.
+static const char *const mimeTypes[] = {
+    "application/octet-stream",
+    "text/html",
+    "application/javascript",
+    "text/css",
+    "application/json",
+    "image/svg+xml",
+    "image/png",
+    "image/x-icon",
+    "image/jpeg",
+    "font/woff2",
+    "text/plain",
+    "application/xml",
+};
+
+static uint32_t getLe(const uint8_t *src, uint8_t bytes)
+{
+    uint32_t value = 0;
+    for(uint8_t i = 0; i < bytes; i++)
+    {
+        value |= (uint32_t)src[i] << (8 * i);
+    }
+    return value;
+}
+
+bool AssetBundle::begin(fs::FS &fs, const char *path)
+{
+    end();
+    _file = fs.open(path, "r");
+    if(!_file)
+    {
+        return false;
+    }
+    uint8_t header[ASSET_BUNDLE_HEADER];
+    uint32_t size = _file.size();
+    if(_file.read(header, sizeof(header)) != sizeof(header) || getLe(header, 4) != ASSET_BUNDLE_MAGIC ||
+        header[4] != ASSET_BUNDLE_VERSION || getLe(header + 8, 4) != size)
+    {
+        end();
+        return false;
+    }
+    uint16_t count = getLe(header + 6, 2);
+    if(count == 0 || count > ASSET_BUNDLE_MAX_ENTRIES)
+    {
+        end();
+        return false;
+    }
+
+    for(uint16_t i = 0; i < count; i++)
+    {
+        uint8_t raw[ASSET_BUNDLE_ENTRY];
+        if(_file.read(raw, sizeof(raw)) != sizeof(raw))
+        {
+            end();
+            return false;
+        }
+        AssetEntry &entry = _entries[i];
+        entry.hash = getLe(raw, 4);
+        entry.offset = getLe(raw + 4, 4);
+        entry.length = getLe(raw + 8, 4);
+        entry.crc = getLe(raw + 12, 4);
+        entry.mime = raw[16];
+        entry.flags = raw[17];
+        if(entry.offset > size || entry.length > size - entry.offset)
+        {
+            end();
+            return false;
+        }
+
+        uint16_t slot = entry.hash & (SLOTS - 1);
+        while(_slots[slot] != 0)
+        {
+            if(_entries[_slots[slot] - 1].hash == entry.hash)
+            {
+                end();
+                return false;
+            }
+            slot = (slot + 1) & (SLOTS - 1);
+        }
+        _slots[slot] = i + 1;
+    }
+    _count = count;
+    return true;
+}
+
+void AssetBundle::end()
+{
+    if(_file)
+    {
+        _file.close();
+    }
+    memset(_slots, 0, sizeof(_slots));
+    _count = 0;
+}
+
+const AssetEntry *AssetBundle::find(const char *path)
+{
+    uint32_t hash = pathHash(path);
+    for(uint16_t slot = hash & (SLOTS - 1); _slots[slot] != 0; slot = (slot + 1) & (SLOTS - 1))
+    {
+        const AssetEntry &entry = _entries[_slots[slot] - 1];
+        if(entry.hash == hash)
+        {
+            _stats.hits++;
+            return &entry;
+        }
+    }
+    _stats.misses++;
+    return nullptr;
+}
+
+size_t AssetBundle::read(const AssetEntry &entry, size_t index, uint8_t *buffer, size_t size)
+{
+    if(!_file || index >= entry.length)
+    {
+        return 0;
+    }
+    if(size > entry.length - index)
+    {
+        size = entry.length - index;
+    }
+    if(!_file.seek(entry.offset + index))
+    {
+        return 0;
+    }
+    size_t n = _file.read(buffer, size);
+    _stats.bytesRead += n;
+    return n;
+}
+
+uint32_t AssetBundle::pathHash(const char *path)
+{
+    uint32_t hash = 2166136261UL;
+    while(*path)
+    {
+        hash = (hash ^ (uint8_t)*path++) * 16777619UL;
+    }
+    return hash;
+}
+
+const char *AssetBundle::mimeType(uint8_t mime)
+{
+    return mime < sizeof(mimeTypes) / sizeof(mimeTypes[0]) ? mimeTypes[mime] : mimeTypes[0];
+}
+
+LAYOUT_CHECK_DEFINE(AssetBundle)
@@ -0,0 +1,104 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef ASSETBUNDLE_H
+#define ASSETBUNDLE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "lruTable.h"
+#include "layoutCheck.h"
+
+#ifndef ASSET_BUNDLE_MAX_ENTRIES
+#define ASSET_BUNDLE_MAX_ENTRIES 64
+#endif
+
+/// "UDAB" read as a little endian u32
+#define ASSET_BUNDLE_MAGIC 0x42414455
+/// Layout version, bump it together with scripts/pack_ui.py when the layout changes.
+#define ASSET_BUNDLE_VERSION 1
+/// magic, version, flags, count, total size
+#define ASSET_BUNDLE_HEADER 12
+/// path hash, offset, length, crc32, mime, flags, reserved
+#define ASSET_BUNDLE_ENTRY 20
+/// The stored bytes are gzip, send them with Content-Encoding: gzip.
+#define ASSET_FLAG_GZIP 0x01
+
+struct AssetEntry
+{
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;
+    uint8_t mime;
+    uint8_t flags;
+};
+
+struct AssetBundleStats
+{
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint64_t bytesRead = 0;
+};
+
+/**
+ * Read-only UI assets packed into one flash file by scripts/pack_ui.py, little endian:
+ *
+ *   u32 magic      ASSET_BUNDLE_MAGIC
+ *   u8  version    ASSET_BUNDLE_VERSION
+ *   u8  flags      reserved, 0
+ *   u16 count
+ *   u32 size       of the whole file
+ *   per entry:
+ *   u32 hash       FNV-1a of the path below the packed directory, e.g. "/main.js"
+ *   u32 offset     of the stored bytes from the start of the file
+ *   u32 length
+ *   u32 crc32      of the stored bytes, used as ETag
+ *   u8  mime       index into the table of mimeType()
+ *   u8  flags      ASSET_FLAG_*
+ *   u16 reserved
+ *   stored bytes of every entry
+ *
+ * begin() loads the entry table into RAM and keeps the file open, so a lookup is a hash probe
+ * and serving an asset is a seek and reads from one file instead of a SPIFFS path search per
+ * file. Paths themselves are not stored; the packer refuses bundles with colliding hashes.
+ * Not thread safe, callers lock around it.
+ */
+class AssetBundle
+{
+    public:
+        bool begin(fs::FS &fs, const char *path);
+        void end();
+        bool loaded() const { return _count > 0; }
+        uint16_t count() const { return _count; }
+
+        /// @brief Entry for path, or NULL.
+        const AssetEntry *find(const char *path);
+        /// @brief Reads up to size stored bytes of entry starting at index, returns how many were read.
+        size_t read(const AssetEntry &entry, size_t index, uint8_t *buffer, size_t size);
+
+        const AssetBundleStats &stats() const { return _stats; }
+
+        static uint32_t pathHash(const char *path);
+        static const char *mimeType(uint8_t mime);
+
+    private:
+        enum : uint16_t { SLOTS = lruTableSlots(ASSET_BUNDLE_MAX_ENTRIES) };
+        static_assert(ASSET_BUNDLE_MAX_ENTRIES > 0 && ASSET_BUNDLE_MAX_ENTRIES <= 0x4000, "ASSET_BUNDLE_MAX_ENTRIES must be between 1 and 16384");
+
+        File _file;
+        AssetEntry _entries[ASSET_BUNDLE_MAX_ENTRIES];
+        // Entry index plus one by hash, zero marks an empty slot.
+        uint16_t _slots[SLOTS] = {};
+        uint16_t _count = 0;
+        AssetBundleStats _stats;
+};
+
+LAYOUT_CHECK(AssetBundle);
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "attrDispatcher.h"
+
+static_assert((ATTR_DISPATCH_TABLE_SIZE & (ATTR_DISPATCH_TABLE_SIZE - 1)) == 0, "ATTR_DISPATCH_TABLE_SIZE must be a power of two");
+static_assert(ATTR_DISPATCH_MAX_KEYS < 256, "table slots hold a one byte binding index");
+
+bool AttrDispatcher::bind(const char *key, bool &target, SemaphoreHandle_t *lock, AttrSetter after)
+{
+    return add(key, &target, sizeof(target), ATTR_BIND_BOOL, lock, after);
+}
+
+bool AttrDispatcher::bind(const char *key, uint8_t &target, SemaphoreHandle_t *lock, AttrSetter after)
+{
+    return add(key, &target, sizeof(target), ATTR_BIND_U8, lock, after);
+}
+
+bool AttrDispatcher::bind(const char *key, uint16_t &target, SemaphoreHandle_t *lock, AttrSetter after)
+{
+    return add(key, &target, sizeof(target), ATTR_BIND_U16, lock, after);
+}
+
+bool AttrDispatcher::bind(const char *key, int &target, SemaphoreHandle_t *lock, AttrSetter after)
+{
+    return add(key, &target, sizeof(target), ATTR_BIND_INT, lock, after);
+}
+
+bool AttrDispatcher::bind(const char *key, float &target, SemaphoreHandle_t *lock, AttrSetter after)
+{
+    return add(key, &target, sizeof(target), ATTR_BIND_FLOAT, lock, after);
+}
+
+bool AttrDispatcher::bind(const char *key, AttrSetter setter, SemaphoreHandle_t *lock)
+{
+    return setter != nullptr && add(key, nullptr, 0, ATTR_BIND_FN, lock, setter);
+}
+
+bool AttrDispatcher::add(const char *key, void *target, uint16_t size, uint8_t type, SemaphoreHandle_t *lock, AttrSetter setter)
+{
+    if(key == nullptr)
+    {
+        return false;
+    }
+    AttrBinding *binding = nullptr;
+    for(uint16_t i = 0; i < _count; i++)
+    {
+        if(strcmp(_bindings[i].key, key) == 0)
+        {
+            binding = &_bindings[i];
+            break;
+        }
+    }
+    if(binding == nullptr)
+    {
+        if(_count >= ATTR_DISPATCH_MAX_KEYS)
+        {
+            return false;
+        }
+        binding = &_bindings[_count++];
+    }
+    binding->key = key;
+    binding->target = target;
+    binding->size = size;
+    binding->type = type;
+    binding->lock = lock;
+    binding->setter = setter;
+    _built = false;
+    return true;
+}
+
+uint16_t AttrDispatcher::slot(const char *key) const
+{
+    uint32_t hash = 2166136261UL ^ _seed;
+    while(*key)
+    {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619UL;
+    }
+    hash ^= hash >> 15;
+    return hash & (ATTR_DISPATCH_TABLE_SIZE - 1);
+}
+
+bool AttrDispatcher::build()
+{
+    _built = true;
+    _perfect = false;
+    _stats.seedTries = 0;
+    for(uint32_t seed = 1; seed <= ATTR_DISPATCH_SEED_TRIES; seed++)
+    {
+        _seed = seed;
+        memset(_table, 0, sizeof(_table));
+        uint16_t i = 0;
+        for(; i < _count; i++)
+        {
+            uint16_t index = slot(_bindings[i].key);
+            if(_table[index] != 0)
+            {
+                break;
+            }
+            _table[index] = i + 1;
+        }
+        if(i == _count)
+        {
+            _perfect = true;
+            _stats.seedTries = seed;
+            return true;
+        }
+    }
+    return false;
+}
+
+const AttrBinding *AttrDispatcher::find(const char *key) const
+{
+    if(_perfect)
+    {
+        uint8_t entry = _table[slot(key)];
+        if(entry != 0 && strcmp(_bindings[entry - 1].key, key) == 0)
+        {
+            return &_bindings[entry - 1];
+        }
+        return nullptr;
+    }
+    for(uint16_t i = 0; i < _count; i++)
+    {
+        if(strcmp(_bindings[i].key, key) == 0)
+        {
+            return &_bindings[i];
+        }
+    }
+    return nullptr;
+}
+
+void AttrDispatcher::apply(const AttrBinding &binding, JsonVariantConst value)
+{
+    switch(binding.type)
+    {
+        case ATTR_BIND_BOOL:
+            *static_cast<bool *>(binding.target) = value.as<bool>();
+            break;
+        case ATTR_BIND_U8:
+            *static_cast<uint8_t *>(binding.target) = value.as<uint8_t>();
+            break;
+        case ATTR_BIND_U16:
+            *static_cast<uint16_t *>(binding.target) = value.as<uint16_t>();
+            break;
+        case ATTR_BIND_INT:
+            *static_cast<int *>(binding.target) = value.as<int>();
+            break;
+        case ATTR_BIND_FLOAT:
+            *static_cast<float *>(binding.target) = value.as<float>();
+            break;
+        case ATTR_BIND_STR:
+        {
+            const char *str = value.as<const char *>();
+            if(str != nullptr)
+            {
+                strlcpy(static_cast<char *>(binding.target), str, binding.size);
+            }
+            break;
+        }
+    }
+    if(binding.setter != nullptr)
+    {
+        binding.setter(value);
+    }
+}
+
+uint16_t AttrDispatcher::dispatch(JsonObjectConst obj)
+{
+    if(!_built)
+    {
+        build();
+    }
+    _stats.dispatches++;
+    uint16_t applied = 0;
+    SemaphoreHandle_t held = NULL;
+    for(JsonPairConst kv : obj)
+    {
+        const AttrBinding *binding = find(kv.key().c_str());
+        if(binding == nullptr)
+        {
+            _stats.unknown++;
+            continue;
+        }
+        SemaphoreHandle_t lock = binding->lock != nullptr ? *binding->lock : NULL;
+        // Keys of one struct usually arrive together, so a lock is kept until a key needs another one.
+        if(lock != held)
+        {
+            if(held != NULL)
+            {
+                xSemaphoreGive(held);
+                held = NULL;
+            }
+            if(lock != NULL)
+            {
+                if(xSemaphoreTake(lock, (TickType_t)1000) != pdTRUE)
+                {
+                    _stats.lockTimeouts++;
+                    continue;
+                }
+                held = lock;
+            }
+        }
+        apply(*binding, kv.value());
+        applied++;
+    }
+    if(held != NULL)
+    {
+        xSemaphoreGive(held);
+    }
+    _stats.applied += applied;
+    return applied;
+}
+
+LAYOUT_CHECK_DEFINE(AttrDispatcher)
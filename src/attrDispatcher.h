@@ -0,0 +1,109 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef ATTRDISPATCHER_H
+#define ATTRDISPATCHER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "layoutCheck.h"
+
+#ifndef ATTR_DISPATCH_MAX_KEYS
+#define ATTR_DISPATCH_MAX_KEYS 64
+#endif
+/// Hash table slots, a power of two and well above ATTR_DISPATCH_MAX_KEYS so a perfect seed is quick to find.
+#ifndef ATTR_DISPATCH_TABLE_SIZE
+#define ATTR_DISPATCH_TABLE_SIZE 256
+#endif
+#ifndef ATTR_DISPATCH_SEED_TRIES
+#define ATTR_DISPATCH_SEED_TRIES 20000
+#endif
+
+/// Binding types
+#define ATTR_BIND_BOOL 0
+#define ATTR_BIND_U8 1
+#define ATTR_BIND_U16 2
+#define ATTR_BIND_INT 3
+#define ATTR_BIND_FLOAT 4
+#define ATTR_BIND_STR 5
+#define ATTR_BIND_FN 6
+
+/// @brief Called with the new value, after a typed target was written or instead of it for ATTR_BIND_FN.
+typedef void (*AttrSetter)(JsonVariantConst value);
+
+struct AttrBinding
+{
+    const char *key;
+    void *target;
+    uint16_t size;
+    uint8_t type;
+    /// Held while the target is written and the setter runs. A pointer to the handle, which may not exist yet at bind time.
+    SemaphoreHandle_t *lock;
+    AttrSetter setter;
+};
+
+struct AttrDispatcherStats
+{
+    uint32_t dispatches = 0;
+    uint32_t applied = 0;
+    uint32_t unknown = 0;
+    uint32_t lockTimeouts = 0;
+    /// Seeds tried by the last build(), 0 if it fell back to a linear scan.
+    uint32_t seedTries = 0;
+};
+
+/**
+ * Routes the keys of a shared attribute update to typed setters in one pass over the object.
+ *
+ * Every key is bound once, by the library or the app. build() then searches a hash seed under which
+ * all bound keys land in different table slots (a perfect hash), so routing a key costs one hash and
+ * one strcmp, however many keys are bound. Should no seed turn up the dispatcher falls back to a
+ * linear scan of the bindings. Bind before the first update arrives, binding is not thread safe.
+ */
+class AttrDispatcher
+{
+    public:
+        bool bind(const char *key, bool &target, SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr);
+        bool bind(const char *key, uint8_t &target, SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr);
+        bool bind(const char *key, uint16_t &target, SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr);
+        bool bind(const char *key, int &target, SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr);
+        bool bind(const char *key, float &target, SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr);
+        template <size_t N>
+        bool bind(const char *key, char (&target)[N], SemaphoreHandle_t *lock = nullptr, AttrSetter after = nullptr)
+        {
+            return add(key, target, N, ATTR_BIND_STR, lock, after);
+        }
+        bool bind(const char *key, AttrSetter setter, SemaphoreHandle_t *lock = nullptr);
+
+        /// @brief Precomputes the hash table. Runs on the first dispatch() after a bind() when not called.
+        bool build();
+        /// @brief Applies every bound key of obj and returns how many were applied.
+        uint16_t dispatch(JsonObjectConst obj);
+
+        uint16_t size() const { return _count; }
+        const AttrDispatcherStats &stats() const { return _stats; }
+
+    private:
+        bool add(const char *key, void *target, uint16_t size, uint8_t type, SemaphoreHandle_t *lock, AttrSetter setter);
+        const AttrBinding *find(const char *key) const;
+        uint16_t slot(const char *key) const;
+        static void apply(const AttrBinding &binding, JsonVariantConst value);
+
+        AttrBinding _bindings[ATTR_DISPATCH_MAX_KEYS];
+        uint16_t _count = 0;
+        /// Binding index + 1 per slot, 0 when empty.
+        uint8_t _table[ATTR_DISPATCH_TABLE_SIZE] = {};
+        uint32_t _seed = 0;
+        bool _built = false;
+        bool _perfect = false;
+        AttrDispatcherStats _stats;
+};
+
+LAYOUT_CHECK(AttrDispatcher);
+
+#endif
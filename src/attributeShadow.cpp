@@ -0,0 +1,189 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "attributeShadow.h"
+
+uint32_t AttributeShadow::fnv1a(const char *data, size_t len, uint32_t hash)
+{
+    while(len--)
+    {
+        hash ^= (uint8_t)*data++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+AttributeShadow::Entry *AttributeShadow::find(uint32_t key, bool create)
+{
+    uint16_t start = key % ATTR_SHADOW_KEYS;
+    for(uint16_t i = 0; i < ATTR_SHADOW_KEYS; i++)
+    {
+        Entry &e = _entries[(start + i) % ATTR_SHADOW_KEYS];
+        if(e.used && e.key == key)
+        {
+            return &e;
+        }
+        if(!e.used)
+        {
+            if(!create)
+            {
+                return nullptr;
+            }
+            e = Entry();
+            e.used = true;
+            e.key = key;
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+void AttributeShadow::begin(bool full)
+{
+    _full = full;
+    _length = 0;
+    _stats.syncs++;
+}
+
+void AttributeShadow::add(JsonObjectConst obj)
+{
+    _stats.legacyMessages++;
+    _stats.legacyBytes += measureJson(obj);
+    for(JsonPairConst kv : obj)
+    {
+        add(kv.key().c_str(), kv.value());
+    }
+}
+
+void AttributeShadow::add(const char *key, JsonVariantConst value)
+{
+    _stats.keysChecked++;
+    char serialized[ATTR_SHADOW_VALUE_SIZE];
+    size_t valueLen = measureJson(value);
+    size_t keyLen = strlen(key);
+    // "key":value plus the separator and the braces of an otherwise empty message.
+    size_t pairLen = keyLen + 3 + valueLen;
+    if(valueLen >= sizeof(serialized) || pairLen + 2 > _maxPayload)
+    {
+        _stats.keysDropped++;
+        return;
+    }
+    serializeJson(value, serialized, sizeof(serialized));
+
+    uint32_t keyHash = fnv1a(key, keyLen);
+    uint32_t valueHash = fnv1a(serialized, valueLen);
+    Entry *e = find(keyHash, true);
+    if(!_full && e != nullptr)
+    {
+        // Unchanged if it matches what is in flight, or what was acknowledged when nothing is.
+        if(e->pendingId != 0 || e->staged)
+        {
+            if(e->pending == valueHash)
+            {
+                return;
+            }
+        }
+        else if(e->hasAcked && e->acked == valueHash)
+        {
+            return;
+        }
+    }
+
+    if(_length > 0 && _length + 1 + pairLen + 1 > _maxPayload)
+    {
+        flush();
+    }
+    _buffer[_length] = _length == 0 ? '{' : ',';
+    _length++;
+    _buffer[_length++] = '"';
+    memcpy(_buffer + _length, key, keyLen);
+    _length += keyLen;
+    _buffer[_length++] = '"';
+    _buffer[_length++] = ':';
+    memcpy(_buffer + _length, serialized, valueLen);
+    _length += valueLen;
+    _stats.keysSent++;
+
+    if(e != nullptr)
+    {
+        e->pending = valueHash;
+        e->staged = true;
+    }
+}
+
+void AttributeShadow::flush()
+{
+    if(_length == 0)
+    {
+        return;
+    }
+    _buffer[_length++] = '}';
+    _buffer[_length] = '\0';
+    uint32_t id = _publish != nullptr ? _publish(_buffer) : 0;
+    if(id != 0)
+    {
+        _stats.sentMessages++;
+        _stats.sentBytes += _length;
+    }
+    else
+    {
+        _stats.failedMessages++;
+    }
+    for(uint16_t i = 0; i < ATTR_SHADOW_KEYS; i++)
+    {
+        Entry &e = _entries[i];
+        if(e.used && e.staged)
+        {
+            e.staged = false;
+            e.pendingId = id;
+        }
+    }
+    _length = 0;
+}
+
+void AttributeShadow::end()
+{
+    flush();
+    _full = false;
+}
+
+void AttributeShadow::complete(uint32_t id, bool delivered)
+{
+    if(id == 0)
+    {
+        return;
+    }
+    if(!delivered)
+    {
+        _stats.failedMessages++;
+    }
+    for(uint16_t i = 0; i < ATTR_SHADOW_KEYS; i++)
+    {
+        Entry &e = _entries[i];
+        if(e.used && e.pendingId == id)
+        {
+            if(delivered)
+            {
+                e.acked = e.pending;
+                e.hasAcked = true;
+            }
+            e.pendingId = 0;
+        }
+    }
+}
+
+void AttributeShadow::reset()
+{
+    for(uint16_t i = 0; i < ATTR_SHADOW_KEYS; i++)
+    {
+        _entries[i] = Entry();
+    }
+    _length = 0;
+}
+
+LAYOUT_CHECK_DEFINE(AttributeShadow)
@@ -0,0 +1,100 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef ATTRIBUTESHADOW_H
+#define ATTRIBUTESHADOW_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "layoutCheck.h"
+
+#ifndef ATTR_SHADOW_KEYS
+#define ATTR_SHADOW_KEYS 64
+#endif
+#ifndef ATTR_SHADOW_PAYLOAD_SIZE
+#define ATTR_SHADOW_PAYLOAD_SIZE 512
+#endif
+#ifndef ATTR_SHADOW_VALUE_SIZE
+#define ATTR_SHADOW_VALUE_SIZE 128
+#endif
+
+struct AttributeShadowStats
+{
+    uint32_t syncs = 0;
+    uint32_t keysChecked = 0;
+    uint32_t keysSent = 0;
+    uint32_t keysDropped = 0;
+    /// What the same syncs cost when every group went out as its own message.
+    uint32_t legacyMessages = 0;
+    uint64_t legacyBytes = 0;
+    uint32_t sentMessages = 0;
+    uint64_t sentBytes = 0;
+    uint32_t failedMessages = 0;
+};
+
+/**
+ * Remembers a hash of the last value the broker acknowledged for every client attribute key,
+ * so a sync only publishes keys whose value changed since.
+ *
+ * A sync pass is begin(), add() for every key, end(). Changed keys are packed into messages of
+ * at most maxPayload bytes. Every message is handed to the publisher, which returns a message id.
+ * The keys stay "in flight" under that id until complete(id, delivered) commits or releases them,
+ * so a lost message is resent by the next sync. Not thread safe, callers lock around it.
+ */
+class AttributeShadow
+{
+    public:
+        /// @brief Publishes payload and returns an id for complete(), 0 if it was rejected.
+        typedef uint32_t (*PublishFn)(const char *payload);
+
+        AttributeShadow(PublishFn publish, size_t maxPayload)
+            : _publish(publish), _maxPayload(maxPayload < ATTR_SHADOW_PAYLOAD_SIZE ? maxPayload : ATTR_SHADOW_PAYLOAD_SIZE) {}
+
+        /// @brief Starts a sync pass. With full every key is sent, changed or not.
+        void begin(bool full = false);
+        void add(const char *key, JsonVariantConst value);
+        /// @brief Adds every member of obj, counted as one message of the old one-message-per-group sync.
+        void add(JsonObjectConst obj);
+        /// @brief Publishes what is still packed.
+        void end();
+
+        /// @brief Commits (delivered) or releases the keys that went out in message id.
+        void complete(uint32_t id, bool delivered);
+        /// @brief Forgets every acknowledged value, the next sync sends everything.
+        void reset();
+        const AttributeShadowStats &stats() const { return _stats; }
+
+        static uint32_t fnv1a(const char *data, size_t len, uint32_t hash = 2166136261UL);
+
+    private:
+        struct Entry
+        {
+            uint32_t key;
+            uint32_t acked;
+            uint32_t pending;
+            uint32_t pendingId;
+            bool used;
+            bool hasAcked;
+            bool staged;
+        };
+
+        Entry *find(uint32_t key, bool create);
+        void flush();
+
+        PublishFn _publish;
+        size_t _maxPayload;
+        bool _full = false;
+        Entry _entries[ATTR_SHADOW_KEYS] = {};
+        char _buffer[ATTR_SHADOW_PAYLOAD_SIZE];
+        size_t _length = 0;
+        AttributeShadowStats _stats;
+};
+
+LAYOUT_CHECK(AttributeShadow);
+
+#endif
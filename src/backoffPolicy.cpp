@@ -0,0 +1,29 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "backoffPolicy.h"
+
+unsigned long BackoffPolicy::ceiling() const
+{
+    unsigned long window = _baseMs;
+    for(uint16_t i = 0; i < _failures && window < _capMs; i++)
+    {
+        window <<= 1;
+    }
+    return window < _capMs ? window : _capMs;
+}
+
+unsigned long BackoffPolicy::next()
+{
+    unsigned long window = ceiling();
+    if(_failures < UINT16_MAX)
+    {
+        _failures++;
+    }
+    return (unsigned long)random(0, (long)window + 1);
+}
@@ -0,0 +1,37 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef BACKOFFPOLICY_H
+#define BACKOFFPOLICY_H
+
+#include <Arduino.h>
+
+/**
+ * Exponential backoff with full jitter: the n-th retry waits a uniformly random time in
+ * [0, min(cap, base * 2^n)]. Spreading every retry over the whole window keeps a fleet that
+ * lost the broker at the same moment from coming back in lockstep.
+ */
+class BackoffPolicy
+{
+    public:
+        BackoffPolicy(unsigned long baseMs, unsigned long capMs) : _baseMs(baseMs), _capMs(capMs) {}
+
+        /// @brief Returns the delay before the next retry and counts the failure.
+        unsigned long next();
+        /// @brief Upper bound of the window the next call to next() draws from.
+        unsigned long ceiling() const;
+        void reset() { _failures = 0; }
+        uint16_t failures() const { return _failures; }
+
+    private:
+        unsigned long _baseMs;
+        unsigned long _capMs;
+        uint16_t _failures = 0;
+};
+
+#endif
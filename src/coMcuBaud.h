@@ -0,0 +1,214 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef COMCUBAUD_H
+#define COMCUBAUD_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_system.h>
+#include "coMcuLink.h"
+#include "coMcuUpdater.h"
+#include "jsonLayout.h"
+
+// The CoMCU always boots at this rate; faster rates are only used after CoMCUBaudNegotiator agrees on them.
+#define COMCU_BAUD_DEFAULT 115200
+/// Pings that must pass before a new rate is accepted.
+#define COMCU_BAUD_CONFIRM_PINGS 3
+
+struct CoMCUBaudStats
+{
+    uint32_t pings = 0;
+    uint32_t pingFailures = 0;
+    uint32_t probes = 0;
+    uint32_t refused = 0;
+    uint32_t fallbacks = 0;
+    unsigned long elapsedMs = 0;
+};
+
+/**
+ * Agrees on the fastest UART rate both ends of the CoMCU link can hold:
+ *
+ *   ping  {"method":"ping","params":{"nonce":N}} -> {"nonce":N,"crc":C}  C is CRC-16/CCITT of N, 4 bytes LE
+ *   sBaud {"method":"sBaud","params":{"baud":B}} -> {"baud":B}           anything else is a refusal
+ *
+ * A switch is kept only after COMCU_BAUD_CONFIRM_PINGS pings pass at the new rate. If the CoMCU gets
+ * no valid frame for fallbackMs after a switch it drops back to COMCU_BAUD_DEFAULT on its own, and it
+ * obeys sBaud to the default at any time. So on every failure this side asks for the default, moves
+ * there itself and waits fallbackMs before it probes again.
+ * TSerial is HardwareSerial on the device, anything with baudRate() and updateBaudRate() elsewhere.
+ * Not thread safe, callers hold the CoMCU link for the whole negotiation.
+ */
+template <typename TSerial>
+class CoMCUBaudNegotiator
+{
+    public:
+        CoMCUBaudNegotiator(CoMCULink &link, TSerial &serial, unsigned long replyTimeout, unsigned long fallbackMs) :
+            _link(link), _serial(serial), _replyTimeout(replyTimeout), _fallbackMs(fallbackMs) {}
+
+        /// @brief Probes persisted first, unless it is the default, then rates from fastest to slowest.
+        /// A link that is not at COMCU_BAUD_DEFAULT, e.g. one that keeps garbling replies, is dropped
+        /// to the default before anything is probed.
+        /// @return The agreed rate, 0 when the CoMCU does not answer even at the default.
+        uint32_t negotiate(const uint32_t *rates, size_t count, uint32_t persisted)
+        {
+            unsigned long startMillis = millis();
+            _stats = CoMCUBaudStats();
+            uint32_t agreed = 0;
+            if(_serial.baudRate() != COMCU_BAUD_DEFAULT || !ping(1))
+            {
+                if(!fallBack() && !recall(rates, count))
+                {
+                    _stats.elapsedMs = millis() - startMillis;
+                    return 0;
+                }
+            }
+
+            // The default is where the link already is, probing it again would end the search.
+            bool persistedTried = persisted != 0 && persisted != COMCU_BAUD_DEFAULT;
+            if(persistedTried && probe(persisted))
+            {
+                agreed = persisted;
+            }
+            for(size_t i = 0; i < count && agreed == 0; i++)
+            {
+                if(rates[i] == 0 || (persistedTried && rates[i] == persisted))
+                {
+                    continue;
+                }
+                if(rates[i] == COMCU_BAUD_DEFAULT ? ping(COMCU_BAUD_CONFIRM_PINGS) : probe(rates[i]))
+                {
+                    agreed = rates[i];
+                }
+            }
+            if(agreed == 0)
+            {
+                agreed = COMCU_BAUD_DEFAULT;
+            }
+            _stats.elapsedMs = millis() - startMillis;
+            return agreed;
+        }
+
+        /// @brief Sends count pings and checks every echo.
+        bool ping(uint8_t count)
+        {
+            for(uint8_t i = 0; i < count; i++)
+            {
+                uint32_t nonce = esp_random();
+                char frame[64];
+                size_t len = libudawa::serializeJsonLayout(libudawa::jsonLayout(
+                    libudawa::jsonSlot("method", "ping"),
+                    libudawa::jsonSlot("params", libudawa::jsonLayout(libudawa::jsonSlot("nonce", nonce)))), frame, sizeof(frame));
+                StaticJsonDocument<64> doc;
+                _stats.pings++;
+                uint8_t nonceBytes[4] = {(uint8_t)nonce, (uint8_t)(nonce >> 8), (uint8_t)(nonce >> 16), (uint8_t)(nonce >> 24)};
+                if(!exchange(frame, len, doc) || doc["nonce"] == nullptr || doc["crc"] == nullptr ||
+                    doc["nonce"].template as<uint32_t>() != nonce ||
+                    doc["crc"].template as<uint16_t>() != CoMCUUpdater::crc16(nonceBytes, sizeof(nonceBytes)))
+                {
+                    _stats.pingFailures++;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const CoMCUBaudStats &stats() const { return _stats; }
+
+
+    private:
+        bool exchange(const char *frame, size_t len, JsonDocument &doc)
+        {
+            char reply[64];
+            _link.flush();
+            if(!_link.write(frame, len))
+            {
+                return false;
+            }
+            size_t n = _link.readFrame(reply, sizeof(reply), _replyTimeout);
+            return n > 0 && deserializeJson(doc, (const char *)reply, n) == DeserializationError::Ok;
+        }
+
+        /// @brief Asks the CoMCU to switch to baud and confirms it, falls back when either fails.
+        bool probe(uint32_t baud)
+        {
+            _stats.probes++;
+            char frame[64];
+            size_t len = libudawa::serializeJsonLayout(libudawa::jsonLayout(
+                libudawa::jsonSlot("method", "sBaud"),
+                libudawa::jsonSlot("params", libudawa::jsonLayout(libudawa::jsonSlot("baud", baud)))), frame, sizeof(frame));
+            StaticJsonDocument<64> doc;
+            if(!exchange(frame, len, doc) || doc["baud"].template as<uint32_t>() != baud)
+            {
+                _stats.refused++;
+                return false;
+            }
+            _serial.flush();
+            _serial.updateBaudRate(baud);
+            delay(20);
+            _link.flush();
+            if(ping(COMCU_BAUD_CONFIRM_PINGS))
+            {
+                return true;
+            }
+            fallBack();
+            return false;
+        }
+
+        /// @brief Returns this side to the default and gives the CoMCU its revert timer to follow.
+        bool fallBack()
+        {
+            _stats.fallbacks++;
+            if(_serial.baudRate() != COMCU_BAUD_DEFAULT)
+            {
+                // The CoMCU may still read this rate even when its replies come back garbled.
+                sendDefault();
+                _serial.updateBaudRate(COMCU_BAUD_DEFAULT);
+            }
+            delay(_fallbackMs);
+            _link.flush();
+            return ping(1);
+        }
+
+        /// @brief Sends sBaud to the default at every other rate, for a CoMCU that kept a rate agreed
+        /// before this side restarted, then checks the link at the default.
+        bool recall(const uint32_t *rates, size_t count)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                if(rates[i] == 0 || rates[i] == COMCU_BAUD_DEFAULT)
+                {
+                    continue;
+                }
+                _serial.updateBaudRate(rates[i]);
+                sendDefault();
+            }
+            _serial.updateBaudRate(COMCU_BAUD_DEFAULT);
+            delay(20);
+            _link.flush();
+            return ping(1);
+        }
+
+        void sendDefault()
+        {
+            char frame[64];
+            size_t len = libudawa::serializeJsonLayout(libudawa::jsonLayout(
+                libudawa::jsonSlot("method", "sBaud"),
+                libudawa::jsonSlot("params", libudawa::jsonLayout(libudawa::jsonSlot("baud", (uint32_t)COMCU_BAUD_DEFAULT)))), frame, sizeof(frame));
+            _link.write(frame, len);
+            _serial.flush();
+        }
+
+        CoMCULink &_link;
+        TSerial &_serial;
+        unsigned long _replyTimeout;
+        unsigned long _fallbackMs;
+        CoMCUBaudStats _stats;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "coMcuLink.h"
+
+bool CoMCULink::write(const char *frame, size_t len)
+{
+    if(_stream == nullptr)
+    {
+        return false;
+    }
+    if(_stream->write((const uint8_t *)frame, len) != len)
+    {
+        return false;
+    }
+    _stats.framesSent++;
+    return true;
+}
+
+size_t CoMCULink::readFrame(char *buffer, size_t size, unsigned long timeout)
+{
+    if(_stream == nullptr || size < 3)
+    {
+        return 0;
+    }
+    size_t len = 0;
+    uint16_t depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    bool overflow = false;
+    unsigned long start = millis();
+    while(millis() - start < timeout)
+    {
+        if(_stream->available() <= 0)
+        {
+            delay(1);
+            continue;
+        }
+        char c = _stream->read();
+        if(depth == 0 && c != '{')
+        {
+            _stats.garbage++;
+            continue;
+        }
+        if(len + 1 < size)
+        {
+            buffer[len++] = c;
+        }
+        else
+        {
+            overflow = true;
+        }
+
+        if(inString)
+        {
+            if(escaped)
+            {
+                escaped = false;
+            }
+            else if(c == '\\')
+            {
+                escaped = true;
+            }
+            else if(c == '"')
+            {
+                inString = false;
+            }
+        }
+        else if(c == '"')
+        {
+            inString = true;
+        }
+        else if(c == '{')
+        {
+            depth++;
+        }
+        else if(c == '}' && --depth == 0)
+        {
+            if(overflow)
+            {
+                _stats.oversized++;
+                return 0;
+            }
+            buffer[len] = '\0';
+            _stats.framesRead++;
+            return len;
+        }
+    }
+    _stats.timeouts++;
+    return 0;
+}
+
+void CoMCULink::flush()
+{
+    if(_stream == nullptr)
+    {
+        return;
+    }
+    while(_stream->available() > 0)
+    {
+        _stream->read();
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef COMCULINK_H
+#define COMCULINK_H
+
+#include <Arduino.h>
+
+struct CoMCULinkStats
+{
+    uint32_t framesSent = 0;
+    uint32_t framesRead = 0;
+    uint32_t timeouts = 0;
+    /// Frames that did not fit into the read buffer, they are consumed and dropped.
+    uint32_t oversized = 0;
+    /// Bytes skipped while looking for the start of a frame.
+    uint32_t garbage = 0;
+};
+
+/**
+ * Frames the JSON messages exchanged with the CoMCU. A frame is one JSON object, delimited by
+ * counting braces outside of strings, so a reply is read into a buffer before anything parses it.
+ * Line noise ahead of a frame is skipped and an oversized frame is consumed whole, so neither
+ * leaves the link out of step for the next exchange. Not thread safe, callers lock around it.
+ */
+class CoMCULink
+{
+    public:
+        void begin(Stream &stream) { _stream = &stream; }
+        Stream *stream() const { return _stream; }
+
+        /// @brief Writes len bytes of frame, false when no stream is bound or the write came up short.
+        bool write(const char *frame, size_t len);
+        /// @brief Reads the next frame into buffer and terminates it.
+        /// @return Length of the frame, 0 on timeout or when it did not fit into size.
+        size_t readFrame(char *buffer, size_t size, unsigned long timeout);
+        /// @brief Drops pending input, e.g. a late reply to an exchange that already timed out.
+        void flush();
+
+        const CoMCULinkStats &stats() const { return _stats; }
+
+    private:
+        Stream *_stream = nullptr;
+        CoMCULinkStats _stats;
+};
+
+#endif
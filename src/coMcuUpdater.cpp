@@ -0,0 +1,280 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include <ArduinoJson.h>
+#include "coMcuUpdater.h"
+
+uint16_t CoMCUUpdater::crc16(const uint8_t *data, size_t len, uint16_t crc)
+{
+    while(len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for(uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint32_t CoMCUUpdater::crc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *data++;
+        for(uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+uint32_t CoMCUUpdater::crc32(Stream &image, size_t size)
+{
+    uint8_t buffer[COMCU_UPDATE_BLOCK_SIZE];
+    uint32_t crc = 0;
+    while(size > 0)
+    {
+        size_t n = image.readBytes(buffer, size < sizeof(buffer) ? size : sizeof(buffer));
+        if(n == 0)
+        {
+            break;
+        }
+        crc = crc32(buffer, n, crc);
+        size -= n;
+    }
+    return crc;
+}
+
+int CoMCUUpdater::begin(size_t size, uint32_t crc, size_t &offset)
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "{\"method\":\"fwBegin\",\"params\":{\"size\":%u,\"crc\":%u,\"block\":%u,\"window\":%u}}",
+        (unsigned int)size, (unsigned int)crc, (unsigned int)COMCU_UPDATE_BLOCK_SIZE, (unsigned int)COMCU_UPDATE_WINDOW);
+    while(_link.available())
+    {
+        _link.read();
+    }
+    _link.print(buffer);
+
+    StaticJsonDocument<64> doc;
+    unsigned long timeout = _link.getTimeout();
+    _link.setTimeout(COMCU_UPDATE_ACK_TIMEOUT * 5);
+    DeserializationError err = deserializeJson(doc, _link);
+    _link.setTimeout(timeout);
+    if(err != DeserializationError::Ok || doc["offset"] == nullptr)
+    {
+        return COMCU_UPDATE_ERROR_BEGIN;
+    }
+    long resumeAt = doc["offset"].as<long>();
+    if(resumeAt < 0)
+    {
+        return COMCU_UPDATE_ERROR_REJECTED;
+    }
+    if(crc == 0 && resumeAt != 0)
+    {
+        // Without a CRC the held blocks may belong to another image of the same size.
+        return COMCU_UPDATE_ERROR_REJECTED;
+    }
+    // Only whole blocks can be resumed, anything else restarts from the block boundary below it.
+    offset = (size_t)resumeAt > size ? 0 : ((size_t)resumeAt / COMCU_UPDATE_BLOCK_SIZE) * COMCU_UPDATE_BLOCK_SIZE;
+    return COMCU_UPDATE_OK;
+}
+
+int CoMCUUpdater::end(uint32_t crc)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"method\":\"fwEnd\",\"params\":{\"crc\":%u}}", (unsigned int)crc);
+    _link.print(buffer);
+
+    StaticJsonDocument<32> doc;
+    unsigned long timeout = _link.getTimeout();
+    _link.setTimeout(COMCU_UPDATE_ACK_TIMEOUT * 5);
+    DeserializationError err = deserializeJson(doc, _link);
+    _link.setTimeout(timeout);
+    if(err != DeserializationError::Ok || doc["fwEnd"].as<int>() != 1)
+    {
+        return COMCU_UPDATE_ERROR_VERIFY;
+    }
+    return COMCU_UPDATE_OK;
+}
+
+void CoMCUUpdater::sendBlock(uint32_t index)
+{
+    uint8_t slot = index % COMCU_UPDATE_WINDOW;
+    uint16_t len = _windowLen[slot];
+    uint8_t header[5] = {
+        COMCU_UPDATE_FRAME_DATA,
+        (uint8_t)(index & 0xFF), (uint8_t)((index >> 8) & 0xFF),
+        (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)
+    };
+    uint16_t crc = crc16(header + 1, 4);
+    crc = crc16(_window[slot], len, crc);
+    uint8_t trailer[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+
+    _link.write(header, sizeof(header));
+    _link.write(_window[slot], len);
+    _link.write(trailer, sizeof(trailer));
+    _stats.blocksSent++;
+    _stats.bytesSent += sizeof(header) + len + sizeof(trailer);
+}
+
+int CoMCUUpdater::readReply(uint8_t &type, uint32_t &index, uint32_t base)
+{
+    unsigned long start = millis();
+    while(millis() - start < COMCU_UPDATE_ACK_TIMEOUT)
+    {
+        if(_link.available() < 3)
+        {
+            delay(1);
+            continue;
+        }
+        uint8_t c = _link.read();
+        if(c != COMCU_UPDATE_FRAME_ACK && c != COMCU_UPDATE_FRAME_NAK)
+        {
+            continue;
+        }
+        uint16_t seq = _link.read();
+        seq |= (uint16_t)_link.read() << 8;
+        type = c;
+        // Sequence numbers are 16 bit on the wire, widen them relative to the window base.
+        index = base + (uint16_t)(seq - (uint16_t)base);
+        return COMCU_UPDATE_OK;
+    }
+    return COMCU_UPDATE_ERROR_ACK_TIMEOUT;
+}
+
+size_t CoMCUUpdater::readImage(Stream &image, uint8_t *buffer, size_t len)
+{
+    size_t got = 0;
+    unsigned long start = millis();
+    while(got < len && millis() - start < 5000)
+    {
+        size_t n = image.readBytes(buffer + got, len - got);
+        if(n == 0)
+        {
+            delay(1);
+            continue;
+        }
+        got += n;
+    }
+    _imageCrc = crc32(buffer, got, _imageCrc);
+    return got;
+}
+
+int CoMCUUpdater::update(Stream &image, size_t size, uint32_t crc)
+{
+    unsigned long startMillis = millis();
+    _stats = CoMCUUpdateStats();
+    _stats.imageSize = size;
+    _imageCrc = 0;
+
+    size_t offset = 0;
+    int res = begin(size, crc, offset);
+    if(res != COMCU_UPDATE_OK)
+    {
+        return res;
+    }
+    _stats.resumedAt = offset;
+
+    // Skip what the bootloader already holds.
+    uint8_t *scratch = _window[0];
+    size_t skip = offset;
+    while(skip > 0)
+    {
+        size_t n = readImage(image, scratch, skip < COMCU_UPDATE_BLOCK_SIZE ? skip : COMCU_UPDATE_BLOCK_SIZE);
+        if(n == 0)
+        {
+            return COMCU_UPDATE_ERROR_IMAGE_READ;
+        }
+        skip -= n;
+    }
+
+    uint32_t total = (size + COMCU_UPDATE_BLOCK_SIZE - 1) / COMCU_UPDATE_BLOCK_SIZE;
+    uint32_t base = offset / COMCU_UPDATE_BLOCK_SIZE;
+    uint32_t next = base;
+    uint32_t rewoundAt = UINT32_MAX;
+    uint8_t retries = 0;
+
+    while(base < total)
+    {
+        while(next < total && next < base + COMCU_UPDATE_WINDOW)
+        {
+            uint8_t slot = next % COMCU_UPDATE_WINDOW;
+            size_t remaining = size - (size_t)next * COMCU_UPDATE_BLOCK_SIZE;
+            uint16_t len = remaining < COMCU_UPDATE_BLOCK_SIZE ? remaining : COMCU_UPDATE_BLOCK_SIZE;
+            if(readImage(image, _window[slot], len) != len)
+            {
+                return COMCU_UPDATE_ERROR_IMAGE_READ;
+            }
+            _windowLen[slot] = len;
+            sendBlock(next);
+            next++;
+        }
+
+        uint8_t type = 0;
+        uint32_t index = 0;
+        if(readReply(type, index, base) != COMCU_UPDATE_OK)
+        {
+            _stats.timeouts++;
+            if(++retries > COMCU_UPDATE_MAX_RETRIES)
+            {
+                _stats.elapsedMs = millis() - startMillis;
+                return COMCU_UPDATE_ERROR_ACK_TIMEOUT;
+            }
+            // Go back N: everything after the last acknowledged block is resent from the window.
+            rewoundAt = base;
+            for(uint32_t i = base; i < next; i++)
+            {
+                sendBlock(i);
+                _stats.blocksResent++;
+            }
+            continue;
+        }
+
+        if(index < base || index >= next)
+        {
+            continue;
+        }
+        retries = 0;
+        if(type == COMCU_UPDATE_FRAME_ACK)
+        {
+            base = index + 1;
+            if(_progressCb != nullptr)
+            {
+                size_t done = (size_t)base * COMCU_UPDATE_BLOCK_SIZE;
+                _progressCb(done > size ? size : done, size);
+            }
+        }
+        else if(index != rewoundAt)
+        {
+            // Blocks still in flight behind the bad one are NAKed too, rewind only once per gap.
+            rewoundAt = index;
+            base = index;
+            for(uint32_t i = base; i < next; i++)
+            {
+                sendBlock(i);
+                _stats.blocksResent++;
+            }
+        }
+    }
+
+    if(crc != 0 && _imageCrc != crc)
+    {
+        // The source changed or was corrupted in transit, never let the bootloader commit it.
+        _stats.elapsedMs = millis() - startMillis;
+        return COMCU_UPDATE_ERROR_VERIFY;
+    }
+    res = end(_imageCrc);
+    _stats.elapsedMs = millis() - startMillis;
+    return res;
+}
+
+LAYOUT_CHECK_DEFINE(CoMCUUpdater)
@@ -0,0 +1,105 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef COMCUUPDATER_H
+#define COMCUUPDATER_H
+
+#include <Arduino.h>
+#include "layoutCheck.h"
+
+#ifndef COMCU_UPDATE_BLOCK_SIZE
+#define COMCU_UPDATE_BLOCK_SIZE 128
+#endif
+#ifndef COMCU_UPDATE_WINDOW
+#define COMCU_UPDATE_WINDOW 8
+#endif
+#ifndef COMCU_UPDATE_ACK_TIMEOUT
+#define COMCU_UPDATE_ACK_TIMEOUT 1000
+#endif
+#ifndef COMCU_UPDATE_MAX_RETRIES
+#define COMCU_UPDATE_MAX_RETRIES 5
+#endif
+
+/// CoMCU update errors
+#define COMCU_UPDATE_OK                  (0)
+#define COMCU_UPDATE_ERROR_BEGIN         (-1)
+#define COMCU_UPDATE_ERROR_REJECTED      (-2)
+#define COMCU_UPDATE_ERROR_IMAGE_READ    (-3)
+#define COMCU_UPDATE_ERROR_ACK_TIMEOUT   (-4)
+#define COMCU_UPDATE_ERROR_VERIFY        (-5)
+
+/// Frame markers on the CoMCU bootloader link
+#define COMCU_UPDATE_FRAME_DATA  0xA5
+#define COMCU_UPDATE_FRAME_ACK   0x06
+#define COMCU_UPDATE_FRAME_NAK   0x15
+
+struct CoMCUUpdateStats
+{
+    size_t imageSize = 0;
+    size_t resumedAt = 0;
+    size_t bytesSent = 0;
+    uint32_t blocksSent = 0;
+    uint32_t blocksResent = 0;
+    uint32_t timeouts = 0;
+    unsigned long elapsedMs = 0;
+};
+
+/**
+ * Streams a firmware image to the CoMCU bootloader over the CoMCU link.
+ *
+ * Session:  {"method":"fwBegin","params":{"size":N,"crc":C,"block":B,"window":W}}
+ *           -> {"offset":K}  K is the block aligned byte count the bootloader already holds
+ *              for this size/crc, so an interrupted transfer resumes instead of restarting.
+ *              C is 0 when the CRC is not known up front (e.g. an HTTP download); the bootloader
+ *              then drops any partial image and answers 0, since size alone cannot tell two
+ *              images apart. update() refuses to resume such a transfer either way.
+ * Blocks:   A5 | seq u16 | len u16 | payload | crc16 u16   (little endian, CRC-16/CCITT over seq..payload)
+ * Replies:  06 | seq u16  cumulative ack, every block up to seq is committed
+ *           15 | seq u16  block seq is bad or missing, go back to it
+ * Finish:   {"method":"fwEnd","params":{"crc":C}} -> {"fwEnd":1}
+ *           C is the CRC-32 of the bytes actually streamed, so the bootloader verifies the image
+ *           even when the caller had no CRC to pass in.
+ *
+ * Up to COMCU_UPDATE_WINDOW blocks are in flight, so the link stays busy while the
+ * bootloader writes flash instead of idling for every stop-and-wait acknowledgement.
+ */
+class CoMCUUpdater
+{
+    public:
+        explicit CoMCUUpdater(Stream &link) : _link(link) {}
+
+        /// @brief Sends size bytes read from image. crc is the CRC-32 of the whole image, 0 when unknown,
+        /// which disables resuming. A known crc that does not match the bytes read fails the update
+        /// with COMCU_UPDATE_ERROR_VERIFY before the bootloader is told to commit.
+        int update(Stream &image, size_t size, uint32_t crc = 0);
+        void onProgress(void (*cb)(size_t done, size_t total)) { _progressCb = cb; }
+        const CoMCUUpdateStats &stats() const { return _stats; }
+
+        static uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+        static uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+        static uint32_t crc32(Stream &image, size_t size);
+
+    private:
+        int begin(size_t size, uint32_t crc, size_t &offset);
+        int end(uint32_t crc);
+        void sendBlock(uint32_t index);
+        int readReply(uint8_t &type, uint32_t &index, uint32_t base);
+        size_t readImage(Stream &image, uint8_t *buffer, size_t len);
+
+        Stream &_link;
+        uint8_t _window[COMCU_UPDATE_WINDOW][COMCU_UPDATE_BLOCK_SIZE];
+        uint16_t _windowLen[COMCU_UPDATE_WINDOW];
+        // CRC-32 of everything read from the image so far.
+        uint32_t _imageCrc = 0;
+        void (*_progressCb)(size_t done, size_t total) = nullptr;
+        CoMCUUpdateStats _stats;
+};
+
+LAYOUT_CHECK(CoMCUUpdater);
+
+#endif
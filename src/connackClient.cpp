@@ -0,0 +1,57 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "connackClient.h"
+
+int ConnackClient::connect(IPAddress ip, uint16_t port)
+{
+    _seen = 0;
+    _code = CONNACK_NONE;
+    return _transport.connect(ip, port);
+}
+
+int ConnackClient::connect(const char *host, uint16_t port)
+{
+    _seen = 0;
+    _code = CONNACK_NONE;
+    return _transport.connect(host, port);
+}
+
+int ConnackClient::read()
+{
+    int c = _transport.read();
+    if(c >= 0 && _seen < sizeof(_header))
+    {
+        uint8_t b = (uint8_t)c;
+        watch(&b, 1);
+    }
+    return c;
+}
+
+int ConnackClient::read(uint8_t *buf, size_t size)
+{
+    int len = _transport.read(buf, size);
+    if(len > 0 && _seen < sizeof(_header))
+    {
+        watch(buf, len);
+    }
+    return len;
+}
+
+void ConnackClient::watch(const uint8_t *buf, int len)
+{
+    for(int i = 0; i < len && _seen < sizeof(_header); i++)
+    {
+        _header[_seen++] = buf[i];
+    }
+    // Fixed header 0x20, remaining length 2, acknowledge flags, return code.
+    if(_seen == sizeof(_header) && _header[0] == 0x20 && _header[1] == 0x02)
+    {
+        _code = _header[3];
+    }
+}
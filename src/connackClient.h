@@ -0,0 +1,62 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef CONNACKCLIENT_H
+#define CONNACKCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// CONNACK return codes (MQTT 3.1.1, 3.2.2.3).
+#define CONNACK_NONE -1
+#define CONNACK_ACCEPTED 0
+#define CONNACK_REFUSED_PROTOCOL 1
+#define CONNACK_REFUSED_IDENTIFIER 2
+#define CONNACK_REFUSED_UNAVAILABLE 3
+#define CONNACK_REFUSED_CREDENTIALS 4
+#define CONNACK_REFUSED_NOT_AUTHORIZED 5
+
+/**
+ * Passes everything through to the transport it wraps and remembers the return code of the CONNACK,
+ * the first packet the broker sends on every connection. The MQTT client it is handed to keeps that
+ * code to itself, but it is the only thing that tells rejected credentials (4, 5) apart from a broker
+ * that is down or never answered (3, or no CONNACK at all).
+ */
+class ConnackClient : public Client
+{
+    public:
+        explicit ConnackClient(Client &transport) : _transport(transport) {}
+
+        int connect(IPAddress ip, uint16_t port) override;
+        int connect(const char *host, uint16_t port) override;
+        size_t write(uint8_t b) override { return _transport.write(b); }
+        size_t write(const uint8_t *buf, size_t size) override { return _transport.write(buf, size); }
+        int available() override { return _transport.available(); }
+        int read() override;
+        int read(uint8_t *buf, size_t size) override;
+        int peek() override { return _transport.peek(); }
+        void flush() override { _transport.flush(); }
+        void stop() override { _transport.stop(); }
+        uint8_t connected() override { return _transport.connected(); }
+        operator bool() override { return connected(); }
+
+        /// @brief Return code of the CONNACK on the last connection, CONNACK_NONE if none arrived.
+        int connackCode() const { return _code; }
+        /// @brief True when the broker refused the last CONNECT because of its credentials.
+        bool authRefused() const { return _code == CONNACK_REFUSED_CREDENTIALS || _code == CONNACK_REFUSED_NOT_AUTHORIZED; }
+
+    private:
+        void watch(const uint8_t *buf, int len);
+
+        Client &_transport;
+        uint8_t _header[4] = {};
+        uint8_t _seen = sizeof(_header);
+        int _code = CONNACK_NONE;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "deliveryWindow.h"
+
+DeliveryWindow::DeliveryWindow(DeliveredFn delivered, char *payloads, size_t payloadSize, size_t stampSize) :
+    _delivered(delivered), _payloadSize(payloadSize), _stampSize(stampSize)
+{
+    // Every slot keeps its payload buffer, entries move through them without allocating.
+    for(uint8_t i = 0; i < DELIVERY_WINDOW_SIZE; i++)
+    {
+        _entries[i] = DeliveryEntry();
+        _entries[i].payload = payloads + i * payloadSize;
+    }
+}
+
+bool DeliveryWindow::add(const DeliveryEntry &entry)
+{
+    size_t length = entry.payload != nullptr ? strlen(entry.payload) : 0;
+    if(full() || length == 0)
+    {
+        return false;
+    }
+    if(length + (entry.ts != 0 ? _stampSize : 0) >= _payloadSize)
+    {
+        _stats.oversize++;
+        return false;
+    }
+    for(uint8_t i = 0; i < _count; i++)
+    {
+        if(at(i).id == entry.id)
+        {
+            _stats.duplicates++;
+            return false;
+        }
+    }
+    DeliveryEntry &e = at(_count);
+    char *payload = e.payload;
+    e = entry;
+    e.payload = payload;
+    memcpy(e.payload, entry.payload, length + 1);
+    e.sent = false;
+    e.epoch = 0;
+    _count++;
+    return true;
+}
+
+uint8_t DeliveryWindow::pump(SendFn send, uint8_t max)
+{
+    uint8_t sent = 0;
+    uint8_t i = 0;
+    while(i < _count && sent < max)
+    {
+        DeliveryEntry &e = at(i);
+        if(e.sent)
+        {
+            i++;
+            continue;
+        }
+        uint8_t result = send(e);
+        // Keep the order: nothing newer goes out before an older message made it.
+        if(result == DELIVERY_SEND_RETRY)
+        {
+            break;
+        }
+        if(result == DELIVERY_SEND_REFUSED)
+        {
+            _stats.refused++;
+            if(_delivered != nullptr)
+            {
+                _delivered(e, false);
+            }
+            remove(i);
+            continue;
+        }
+        if(e.epoch != 0)
+        {
+            _stats.retransmits++;
+        }
+        e.sent = true;
+        e.epoch = _epoch;
+        _sentSinceFence++;
+        _stats.sent++;
+        sent++;
+        i++;
+    }
+    return sent;
+}
+
+void DeliveryWindow::remove(uint8_t i)
+{
+    // Close the gap, the freed payload slot moves to the end with the free entry.
+    char *payload = at(i).payload;
+    for(; i + 1 < _count; i++)
+    {
+        at(i) = at(i + 1);
+    }
+    at(_count - 1).payload = payload;
+    _count--;
+}
+
+int8_t DeliveryWindow::fenceSlot() const
+{
+    for(uint8_t i = 0; i < DELIVERY_FENCE_SLOTS; i++)
+    {
+        if(_slotEpochs[i] == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void DeliveryWindow::openFence(uint8_t slot, unsigned long now)
+{
+    _fenceEpoch = _epoch++;
+    _slotEpochs[slot % DELIVERY_FENCE_SLOTS] = _fenceEpoch;
+    _fenceOpen = true;
+    _fenceAt = now;
+    _fenceFailing = false;
+    _sentSinceFence = 0;
+    _stats.fences++;
+}
+
+void DeliveryWindow::fenceFailed(unsigned long now)
+{
+    _stats.fenceFailures++;
+    if(!_fenceFailing)
+    {
+        _fenceFailing = true;
+        _fenceFailingSince = now;
+    }
+}
+
+bool DeliveryWindow::fenceAcked(uint8_t slot, unsigned long now)
+{
+    slot %= DELIVERY_FENCE_SLOTS;
+    uint32_t epoch = _slotEpochs[slot];
+    if(epoch == 0)
+    {
+        // Requested on a connection that is gone.
+        return false;
+    }
+    _slotEpochs[slot] = 0;
+    if(!_fenceOpen || epoch != _fenceEpoch)
+    {
+        _stats.staleAnswers++;
+        return false;
+    }
+    _fenceOpen = false;
+    _stats.fenceRttLast = now - _fenceAt;
+    if(_stats.fenceRttLast > _stats.fenceRttMax)
+    {
+        _stats.fenceRttMax = _stats.fenceRttLast;
+    }
+    while(_count > 0 && at(0).sent && at(0).epoch <= _fenceEpoch)
+    {
+        DeliveryEntry &e = at(0);
+        _stats.delivered++;
+        if(_delivered != nullptr)
+        {
+            _delivered(e, true);
+        }
+        _head = (_head + 1) % DELIVERY_WINDOW_SIZE;
+        _count--;
+    }
+    return true;
+}
+
+bool DeliveryWindow::expireFence(unsigned long now, unsigned long timeout)
+{
+    if(!_fenceOpen || now - _fenceAt < timeout)
+    {
+        return false;
+    }
+    _stats.fenceTimeouts++;
+    _fenceOpen = false;
+    for(uint8_t i = 0; i < _count; i++)
+    {
+        DeliveryEntry &e = at(i);
+        if(e.sent && e.epoch <= _fenceEpoch)
+        {
+            // Not confirmed, so not delivered: pump() sends it again and counts a retransmit.
+            e.sent = false;
+        }
+    }
+    return true;
+}
+
+bool DeliveryWindow::fenceStalled(unsigned long now, unsigned long timeout) const
+{
+    return _fenceFailing && needsFence() && now - _fenceFailingSince >= timeout;
+}
+
+void DeliveryWindow::connectionLost()
+{
+    for(uint8_t i = 0; i < _count; i++)
+    {
+        // The epoch stays set, so pump() counts the next send as a retransmit.
+        at(i).sent = false;
+    }
+    // Requests of the old connection are never answered.
+    memset(_slotEpochs, 0, sizeof(_slotEpochs));
+    _fenceOpen = false;
+    _fenceFailing = false;
+    _sentSinceFence = 0;
+}
+
+LAYOUT_CHECK_DEFINE(DeliveryWindow)
@@ -0,0 +1,142 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef DELIVERYWINDOW_H
+#define DELIVERYWINDOW_H
+
+#include <Arduino.h>
+#include "layoutCheck.h"
+
+#ifndef DELIVERY_WINDOW_SIZE
+#define DELIVERY_WINDOW_SIZE 8
+#endif
+
+// Fences that can await an answer at once. libudawa.h has a request callback for each.
+#define DELIVERY_FENCE_SLOTS 4
+
+/// What a SendFn made of an entry
+#define DELIVERY_SEND_OK 0
+/// The connection is down, the entry goes out on the next one.
+#define DELIVERY_SEND_RETRY 1
+/// Refused on a connection that is up, sending it again would fail the same way.
+#define DELIVERY_SEND_REFUSED 2
+
+struct DeliveryEntry
+{
+    uint32_t id;
+    char type;
+    char *payload;
+    uint64_t ts;
+    unsigned long enqueuedAt;
+    void (*cb)(uint32_t id, uint8_t status);
+    bool sent;
+    uint32_t epoch;
+};
+
+struct DeliveryWindowStats
+{
+    uint32_t sent = 0;
+    uint32_t delivered = 0;
+    uint32_t retransmits = 0;
+    uint32_t duplicates = 0;
+    uint32_t oversize = 0;
+    uint32_t refused = 0;
+    uint32_t fences = 0;
+    uint32_t fenceTimeouts = 0;
+    /// Fences that could not be requested, every slot was awaiting an answer or the request failed.
+    uint32_t fenceFailures = 0;
+    /// Answers to a fence that had already timed out.
+    uint32_t staleAnswers = 0;
+    unsigned long fenceRttLast = 0;
+    unsigned long fenceRttMax = 0;
+};
+
+/**
+ * Sliding window of published messages that are not known to be delivered yet.
+ *
+ * MQTT at QoS 0 over one TCP connection either delivers everything in order or breaks the
+ * connection, so delivery is proven with a fence: a request the broker answers after it processed
+ * everything sent before it. When the answer arrives every message sent before the fence is
+ * delivered and leaves the window. When the connection drops first they are sent again after the
+ * reconnect, and when the fence gets no answer in time they are sent again at once, so each message
+ * arrives at least once. Each fence is requested through one of DELIVERY_FENCE_SLOTS slots and an
+ * answer only confirms the fence of its slot, so a late answer to a fence that timed out confirms
+ * nothing sent after it. A slot stays taken until its answer arrives or the connection drops. Ids are unique and the window refuses to hold
+ * one twice. Payloads are copied into slots of payloadSize bytes in the caller's payloads buffer,
+ * which holds DELIVERY_WINDOW_SIZE of them. An entry with a ts is sent with up to stampSize bytes
+ * more, which have to fit payloadSize too, so whatever add() takes can be sent. An entry the
+ * connection refuses is dropped rather than holding up the ones behind it; only a connection that
+ * is down keeps entries for the next one. Not thread safe, callers lock around it.
+ */
+class DeliveryWindow
+{
+    public:
+        /// @brief Returns one of DELIVERY_SEND_*.
+        typedef uint8_t (*SendFn)(const DeliveryEntry &entry);
+        /// @brief Called as an entry leaves the window, delivered is false when it was refused.
+        typedef void (*DeliveredFn)(DeliveryEntry &entry, bool delivered);
+
+        DeliveryWindow(DeliveredFn delivered, char *payloads, size_t payloadSize, size_t stampSize = 0);
+
+        /// @brief Copies entry.payload into the window. False when full, the id is already held or the
+        /// payload, stamped when entry.ts is set, does not fit a slot.
+        bool add(const DeliveryEntry &entry);
+        /// @brief Sends up to max messages that were not sent on this connection yet, oldest first. Stops
+        /// at the first DELIVERY_SEND_RETRY, drops entries refused with DELIVERY_SEND_REFUSED.
+        uint8_t pump(SendFn send, uint8_t max);
+
+        /// @brief True when messages went out since the last fence and no fence is open.
+        bool needsFence() const { return !_fenceOpen && _sentSinceFence > 0; }
+        bool fenceOpen() const { return _fenceOpen; }
+        /// @brief A slot no fence awaits an answer in, -1 when all are taken.
+        int8_t fenceSlot() const;
+        /// @brief The fence was requested through slot, its answer confirms what was sent so far.
+        void openFence(uint8_t slot, unsigned long now);
+        /// @brief The fence could not be requested, needsFence() stays true so the caller tries again.
+        void fenceFailed(unsigned long now);
+        /// @brief The broker answered the fence of slot. True when that confirmed the open fence, false
+        /// for an answer to one that timed out.
+        bool fenceAcked(uint8_t slot, unsigned long now);
+        /// @brief The open fence got no answer within timeout: what it covers is sent again. Its slot stays
+        /// taken until the late answer arrives.
+        bool expireFence(unsigned long now, unsigned long timeout);
+        /// @brief Fences could not be requested for timeout. Only a new connection frees the slots.
+        bool fenceStalled(unsigned long now, unsigned long timeout) const;
+        /// @brief Everything not acknowledged goes out again on the next connection.
+        void connectionLost();
+
+        bool full() const { return _count >= DELIVERY_WINDOW_SIZE; }
+        bool empty() const { return _count == 0; }
+        uint8_t count() const { return _count; }
+        const DeliveryWindowStats &stats() const { return _stats; }
+
+    private:
+        DeliveryEntry &at(uint8_t i) { return _entries[(_head + i) % DELIVERY_WINDOW_SIZE]; }
+        void remove(uint8_t i);
+
+        DeliveredFn _delivered;
+        size_t _payloadSize;
+        size_t _stampSize;
+        DeliveryEntry _entries[DELIVERY_WINDOW_SIZE];
+        uint8_t _head = 0;
+        uint8_t _count = 0;
+        uint32_t _epoch = 1;
+        uint32_t _fenceEpoch = 0;
+        /// Epoch of the fence awaiting an answer in each slot, 0 when it is free.
+        uint32_t _slotEpochs[DELIVERY_FENCE_SLOTS] = {};
+        bool _fenceOpen = false;
+        unsigned long _fenceAt = 0;
+        bool _fenceFailing = false;
+        unsigned long _fenceFailingSince = 0;
+        uint16_t _sentSinceFence = 0;
+        DeliveryWindowStats _stats;
+};
+
+LAYOUT_CHECK(DeliveryWindow);
+
+#endif
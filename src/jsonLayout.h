@@ -0,0 +1,315 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef JSONLAYOUT_H
+#define JSONLAYOUT_H
+
+#include <Arduino.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+
+namespace libudawa
+{
+
+/// @brief Sink that writes into a caller-provided char buffer and keeps it null terminated.
+class JsonBufferSink
+{
+  public:
+    JsonBufferSink(char *buffer, size_t size) : _buffer(buffer), _size(size), _length(0), _overflowed(size == 0) {}
+
+    void write(char c)
+    {
+      if(_length + 1 < _size){_buffer[_length++] = c;}
+      else{_overflowed = true;}
+    }
+
+    void write(const char *s, size_t n)
+    {
+      if(_length + n < _size){
+        memcpy(_buffer + _length, s, n);
+        _length += n;
+      }
+      else{_overflowed = true;}
+    }
+
+    /// @brief Terminates the buffer. Returns the length written, or 0 if the message did not fit.
+    size_t finish()
+    {
+      if(_size == 0){return 0;}
+      if(_overflowed){_length = 0;}
+      _buffer[_length] = '\0';
+      return _length;
+    }
+
+  private:
+    char *_buffer;
+    size_t _size;
+    size_t _length;
+    bool _overflowed;
+};
+
+/// @brief Sink that streams straight into any Arduino Print (Serial2, a response stream, a file...).
+class JsonPrintSink
+{
+  public:
+    explicit JsonPrintSink(Print &print) : _print(print), _length(0) {}
+
+    void write(char c){_length += _print.write((uint8_t)c);}
+    void write(const char *s, size_t n){_length += _print.write((const uint8_t*)s, n);}
+    size_t finish(){return _length;}
+
+  private:
+    Print &_print;
+    size_t _length;
+};
+
+/// @brief One typed "key":value slot of a fixed-shape JSON object.
+template <typename T>
+struct JsonSlot
+{
+  const char *key;
+  T value;
+};
+
+/// @brief A JSON object whose keys, order and value types are fixed at compile time.
+template <typename... TSlots>
+struct JsonLayout
+{
+  std::tuple<TSlots...> slots;
+};
+
+template <typename T>
+inline JsonSlot<T> jsonSlot(const char *key, T value)
+{
+  return JsonSlot<T>{key, value};
+}
+
+template <typename... TSlots>
+inline JsonLayout<TSlots...> jsonLayout(TSlots... slots)
+{
+  return JsonLayout<TSlots...>{std::tuple<TSlots...>(slots...)};
+}
+
+template <typename TSink>
+inline void writeJsonString(TSink &sink, const char *s)
+{
+  // Same escaping rules as ArduinoJson's TextFormatter so the output stays byte-identical.
+  sink.write('"');
+  const char *run = s;
+  for(; *s; s++){
+    char escaped = 0;
+    switch(*s){
+      case '"': escaped = '"'; break;
+      case '\\': escaped = '\\'; break;
+      case '\b': escaped = 'b'; break;
+      case '\f': escaped = 'f'; break;
+      case '\n': escaped = 'n'; break;
+      case '\r': escaped = 'r'; break;
+      case '\t': escaped = 't'; break;
+    }
+    if(escaped){
+      sink.write(run, s - run);
+      sink.write('\\');
+      sink.write(escaped);
+      run = s + 1;
+    }
+  }
+  sink.write(run, s - run);
+  sink.write('"');
+}
+
+template <typename TSink, typename TUInt>
+inline void writeJsonUnsigned(TSink &sink, TUInt value)
+{
+  char digits[20];
+  uint8_t n = sizeof(digits);
+  do{
+    digits[--n] = char('0' + value % 10);
+    value /= 10;
+  }while(value);
+  sink.write(digits + n, sizeof(digits) - n);
+}
+
+template <typename TSink>
+inline void writeJsonValue(TSink &sink, bool value)
+{
+  if(value){sink.write("true", 4);}
+  else{sink.write("false", 5);}
+}
+
+template <typename TSink>
+inline void writeJsonValue(TSink &sink, const char *value)
+{
+  if(value == nullptr){sink.write("null", 4); return;}
+  writeJsonString(sink, value);
+}
+
+template <typename TSink>
+inline void writeJsonValue(TSink &sink, char *value)
+{
+  writeJsonValue(sink, (const char*)value);
+}
+
+template <typename TSink, typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type
+writeJsonValue(TSink &sink, T value)
+{
+  writeJsonUnsigned(sink, value);
+}
+
+template <typename TSink, typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+writeJsonValue(TSink &sink, T value)
+{
+  typedef typename std::make_unsigned<T>::type TUnsigned;
+  if(value < 0){
+    sink.write('-');
+    writeJsonUnsigned(sink, TUnsigned(TUnsigned(0) - TUnsigned(value)));
+  }
+  else{
+    writeJsonUnsigned(sink, TUnsigned(value));
+  }
+}
+
+/// @brief Floats are widened to double and printed with ArduinoJson's FloatParts algorithm
+/// (9 significant decimals, exponent outside 1e-5..1e7, NaN/Inf as null).
+template <typename TSink, typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+writeJsonValue(TSink &sink, T floatValue)
+{
+  double value = floatValue;
+  if(isnan(value) || isinf(value)){sink.write("null", 4); return;}
+  if(value < 0.0){
+    sink.write('-');
+    value = -value;
+  }
+
+  static const double positivePowers[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+  static const double negativePowers[] = {1e-1, 1e-2, 1e-4, 1e-8, 1e-16, 1e-32, 1e-64, 1e-128, 1e-256};
+  static const double negativePowersPlusOne[] = {1e0, 1e-1, 1e-3, 1e-7, 1e-15, 1e-31, 1e-63, 1e-127, 1e-255};
+
+  int16_t exponent = 0;
+  int8_t index = 8;
+  int bit = 1 << index;
+  if(value >= 1e7){
+    for(; index >= 0; index--){
+      if(value >= positivePowers[index]){
+        value *= negativePowers[index];
+        exponent = int16_t(exponent + bit);
+      }
+      bit >>= 1;
+    }
+  }
+  if(value > 0 && value <= 1e-5){
+    for(; index >= 0; index--){
+      if(value < negativePowersPlusOne[index]){
+        value *= positivePowers[index];
+        exponent = int16_t(exponent - bit);
+      }
+      bit >>= 1;
+    }
+  }
+
+  uint32_t maxDecimalPart = 1000000000;
+  int8_t decimalPlaces = 9;
+  uint32_t integral = uint32_t(value);
+  for(uint32_t tmp = integral; tmp >= 10; tmp /= 10){
+    maxDecimalPart /= 10;
+    decimalPlaces--;
+  }
+  double remainder = (value - double(integral)) * double(maxDecimalPart);
+  uint32_t decimal = uint32_t(remainder);
+  remainder = remainder - double(decimal);
+  decimal += uint32_t(remainder * 2);
+  if(decimal >= maxDecimalPart){
+    decimal = 0;
+    integral++;
+    if(exponent && integral >= 10){
+      exponent++;
+      integral = 1;
+    }
+  }
+  while(decimal % 10 == 0 && decimalPlaces > 0){
+    decimal /= 10;
+    decimalPlaces--;
+  }
+
+  writeJsonUnsigned(sink, integral);
+  if(decimalPlaces){
+    char digits[10];
+    int8_t n = decimalPlaces;
+    while(n--){
+      digits[n] = char('0' + decimal % 10);
+      decimal /= 10;
+    }
+    sink.write('.');
+    sink.write(digits, decimalPlaces);
+  }
+  if(exponent){
+    sink.write('e');
+    writeJsonValue(sink, exponent);
+  }
+}
+
+template <typename TSink, typename... TSlots>
+inline void writeJsonValue(TSink &sink, const JsonLayout<TSlots...> &layout);
+
+template <size_t I, size_t N>
+struct JsonSlotsWriter
+{
+  template <typename TSink, typename TTuple>
+  static void write(TSink &sink, const TTuple &slots)
+  {
+    if(I > 0){sink.write(',');}
+    writeJsonString(sink, std::get<I>(slots).key);
+    sink.write(':');
+    writeJsonValue(sink, std::get<I>(slots).value);
+    JsonSlotsWriter<I + 1, N>::write(sink, slots);
+  }
+};
+
+template <size_t N>
+struct JsonSlotsWriter<N, N>
+{
+  template <typename TSink, typename TTuple>
+  static void write(TSink &, const TTuple &) {}
+};
+
+template <typename TSink, typename... TSlots>
+inline void writeJsonValue(TSink &sink, const JsonLayout<TSlots...> &layout)
+{
+  sink.write('{');
+  JsonSlotsWriter<0, sizeof...(TSlots)>::write(sink, layout.slots);
+  sink.write('}');
+}
+
+/// @brief Serializes a fixed layout into buffer without touching the heap.
+/// Unlike serializeJson(), a message that does not fit is not truncated: 0 is returned and buffer is left empty.
+template <typename... TSlots>
+inline size_t serializeJsonLayout(const JsonLayout<TSlots...> &layout, char *buffer, size_t size)
+{
+  JsonBufferSink sink(buffer, size);
+  writeJsonValue(sink, layout);
+  return sink.finish();
+}
+
+/// @brief Streams a fixed layout straight into a Print. Returns the number of bytes written.
+template <typename... TSlots>
+inline size_t serializeJsonLayout(const JsonLayout<TSlots...> &layout, Print &print)
+{
+  JsonPrintSink sink(print);
+  writeJsonValue(sink, layout);
+  return sink.finish();
+}
+
+} // namespace libudawa
+#endif
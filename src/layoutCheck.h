@@ -0,0 +1,39 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef LAYOUTCHECK_H
+#define LAYOUTCHECK_H
+
+#include <stddef.h>
+
+template <size_t Size>
+struct LayoutSize {};
+
+/**
+ * Tunables such as OFFLINE_STORE_RAM_SIZE size members of classes whose code is compiled in the
+ * library's own .cpp files. A #define in the sketch (main.h) is only seen by the sketch, so the two
+ * sides would disagree on the object they share and write past each other. Override them as build
+ * flags, which every translation unit sees:
+ *
+ *   build_flags = -DOFFLINE_STORE_RAM_SIZE=8192 -DRPC_REGISTRY_SIZE=48
+ *
+ * This holds for every tunable of a header that includes this file and marks its class with
+ * LAYOUT_CHECK(T); the headers do not repeat it.
+ *
+ * LAYOUT_CHECK(T) in a header refers to a function named after sizeof(T) as the including file sees
+ * it, LAYOUT_CHECK_DEFINE(T) in the .cpp defines the one for the size the library was built with.
+ * A mismatch fails the link with "undefined reference to layoutCheck(T const*, LayoutSize<N>)"
+ * instead of corrupting memory at run time.
+ */
+#define LAYOUT_CHECK(T) \
+    void layoutCheck(const T *, LayoutSize<sizeof(T)>); \
+    static void (*const layoutCheck##T)(const T *, LayoutSize<sizeof(T)>) __attribute__((used)) = &layoutCheck
+#define LAYOUT_CHECK_DEFINE(T) \
+    void layoutCheck(const T *, LayoutSize<sizeof(T)>) {}
+
+#endif
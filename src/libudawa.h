@@ -38,14 +38,15 @@
 #include <Crypto.h>
 #include <SHA256.h>
 #include "mbedtls/md.h"
-#include <map>
 #ifdef USE_ASYNC_WEB
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #endif
 #ifndef USE_ASYNC_WEB
 #include <WebServer.h>
+#include <uri/UriBraces.h>
 #include <WebSocketsServer.h>
+#include <lwip/sockets.h>
 #endif
 #endif
 #ifdef USE_SDCARD_LOG
@@ -57,10 +58,188 @@
 #include <ErriezDS3231.h>
 #endif
 #include "BinDownloader.h"
+#include "jsonLayout.h"
+#include "coMcuUpdater.h"
+#include "coMcuLink.h"
+#include "coMcuBaud.h"
+#include "telemetryBatcher.h"
+#include "sampleBatcher.h"
+#include "wsSession.h"
+#include "lruTable.h"
+#include "sharedBufferPool.h"
+#include "assetBundle.h"
+#include "offlineStore.h"
+#include "attributeShadow.h"
+#include "backoffPolicy.h"
+#include "tlsSessionClient.h"
+#include "payloadCodec.h"
+#include "rpcRegistry.h"
+#include "attrDispatcher.h"
+#include "deliveryWindow.h"
+#include "connackClient.h"
 #define countof(a) (sizeof(a) / sizeof(a[0]))
 #define COMPILED __DATE__ " " __TIME__
 #define S2_RX 16
 #define S2_TX 17
+#ifndef COMCU_BAUD_RATES
+  #define COMCU_BAUD_RATES 921600, 460800, 230400, 115200
+#endif
+#ifndef COMCU_BAUD_FALLBACK_MS
+  #define COMCU_BAUD_FALLBACK_MS 600
+#endif
+#ifdef USE_OFFLINE_STORE
+#ifndef OFFLINE_STORE_FS
+  #define OFFLINE_STORE_FS SPIFFS
+#endif
+#ifndef OFFLINE_REPLAY_INTERVAL
+  #define OFFLINE_REPLAY_INTERVAL 200
+#endif
+#endif
+#ifndef TB_PUBLISH_QUEUE_SIZE
+  #define TB_PUBLISH_QUEUE_SIZE 16
+#endif
+#ifndef TB_PUBLISH_DRAIN_MAX
+  #define TB_PUBLISH_DRAIN_MAX 4
+#endif
+#ifndef TB_BACKOFF_TLS_BASE
+  #define TB_BACKOFF_TLS_BASE 1000
+#endif
+#ifndef TB_BACKOFF_TLS_CAP
+  #define TB_BACKOFF_TLS_CAP 60000
+#endif
+#ifndef TB_BACKOFF_AUTH_BASE
+  #define TB_BACKOFF_AUTH_BASE 5000
+#endif
+#ifndef TB_BACKOFF_AUTH_CAP
+  #define TB_BACKOFF_AUTH_CAP 600000
+#endif
+// Only rejected credentials lead back to provisioning, an unreachable broker never does.
+#ifndef TB_AUTH_FAILURES_REPROVISION
+  #define TB_AUTH_FAILURES_REPROVISION 5
+#endif
+#ifndef TB_PROVISION_TIMEOUT
+  #define TB_PROVISION_TIMEOUT 10000
+#endif
+// After this many failed provisioning rounds in a row the device stops asking for TB_PROVISION_PAUSE.
+#ifndef TB_PROVISION_RETRIES
+  #define TB_PROVISION_RETRIES 5
+#endif
+#ifndef TB_PROVISION_PAUSE
+  #define TB_PROVISION_PAUSE 1800000
+#endif
+#ifdef USE_WEB_IFACE
+// Topics a client gets after authenticating, before it sent a subscription of its own.
+#ifndef WS_TOPIC_DEFAULT
+  #define WS_TOPIC_DEFAULT WS_TOPIC_ALL
+#endif
+// Capacity of the per client and per IP tables. The least recently used entry makes room when one is full.
+#ifndef WS_CLIENT_TABLE_SIZE
+  #define WS_CLIENT_TABLE_SIZE 16
+#endif
+#ifndef WS_IP_TABLE_SIZE
+  #define WS_IP_TABLE_SIZE 32
+#endif
+// 1: also accept the older login that answers a client chosen {"salt"} instead of the server nonce, for
+// UIs that predate the nonce. Such an answer can be replayed, so it is off unless a build opts in.
+#ifndef WS_AUTH_CLIENT_SALT
+  #define WS_AUTH_CLIENT_SALT 0
+#endif
+// UI assets whose ETag is remembered, so a revalidation does not read the whole file again.
+#ifndef UI_ETAG_CACHE_SIZE
+  #define UI_ETAG_CACHE_SIZE 16
+#endif
+// Sent with assets that carry a content hash in their file name, anything else is revalidated with its ETag.
+#ifndef UI_CACHE_IMMUTABLE
+  #define UI_CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+#endif
+// Packed UI written by scripts/pack_ui.py. When it loads, UI requests are served from it before loose files.
+#ifndef UI_BUNDLE_PATH
+  #define UI_BUNDLE_PATH "/ui.bundle"
+#endif
+#ifndef UI_BUNDLE_CHUNK
+  #define UI_BUNDLE_CHUNK 512
+#endif
+// Largest JSON body accepted by POST /api/cmd/<name>.
+#ifndef API_BODY_MAX
+  #define API_BODY_MAX DOCSIZE_MIN
+#endif
+#endif
+#if defined(USE_WEB_IFACE) && !defined(USE_ASYNC_WEB)
+#define WEB_PORT 80
+#define WS_PORT 81
+// 1: ifaceTR sleeps in select() until a web or WebSocket socket is readable. 0: polls every WEB_POLL_INTERVAL ms.
+#ifndef WEB_EVENT_LOOP
+  #define WEB_EVENT_LOOP 1
+#endif
+// Longest select() wait. Also bounds how late wsStreamPoll() flushes a sample frame.
+#ifndef WEB_EVENT_TIMEOUT
+  #define WEB_EVENT_TIMEOUT 50
+#endif
+#ifndef WEB_POLL_INTERVAL
+  #define WEB_POLL_INTERVAL 3
+#endif
+#endif
+#if defined(USE_WEB_IFACE) && defined(USE_ASYNC_WEB)
+// Broadcast payloads that can be queued on clients at the same time.
+#ifndef WS_SHARED_BUFFERS
+  #define WS_SHARED_BUFFERS 8
+#endif
+// Frames queued on a client without its TCP send buffer draining in between before it counts as backlogged.
+#ifndef WS_CLIENT_HIGH_WATER
+  #define WS_CLIENT_HIGH_WATER 8
+#endif
+// A client that stays backlogged this long is disconnected.
+#ifndef WS_CLIENT_STUCK_TIMEOUT
+  #define WS_CLIENT_STUCK_TIMEOUT 15000
+#endif
+// Top level keys of periodic frames. A backlogged client is only sent the latest of each once it drains.
+#ifndef WS_COALESCE_KEYS
+  #define WS_COALESCE_KEYS "devTel", "sensors"
+#endif
+#ifndef WS_FLOW_SLOTS
+  #define WS_FLOW_SLOTS DEFAULT_MAX_WS_CLIENTS
+#endif
+#endif
+#ifdef USE_TB_DELIVERY_ACK
+// Answered by the broker only after it processed what was published before the request.
+#ifndef TB_DELIVERY_FENCE_KEY
+  #define TB_DELIVERY_FENCE_KEY FW_VER_KEY
+#endif
+#ifndef TB_DELIVERY_FENCE_TIMEOUT
+  #define TB_DELIVERY_FENCE_TIMEOUT 10000
+#endif
+#endif
+#ifdef USE_MSGPACK_PAYLOAD
+// Stock ThingsBoard only reads JSON, packed payloads go to topics a MessagePack aware endpoint subscribes to.
+#ifndef TB_MSGPACK_TELEMETRY_TOPIC
+  #define TB_MSGPACK_TELEMETRY_TOPIC "v1/devices/me/telemetry/msgpack"
+#endif
+#ifndef TB_MSGPACK_ATTRIBUTE_TOPIC
+  #define TB_MSGPACK_ATTRIBUTE_TOPIC "v1/devices/me/attributes/msgpack"
+#endif
+// Client attribute the probe writes through TB_MSGPACK_ATTRIBUTE_TOPIC and reads back the usual way.
+#ifndef TB_MSGPACK_PROBE_KEY
+  #define TB_MSGPACK_PROBE_KEY "pEncProbe"
+#endif
+#ifndef TB_MSGPACK_PROBE_TIMEOUT
+  #define TB_MSGPACK_PROBE_TIMEOUT 10000
+#endif
+// Time the server gets to store the packed probe before it is asked for it.
+#ifndef TB_MSGPACK_PROBE_SETTLE
+  #define TB_MSGPACK_PROBE_SETTLE 1000
+#endif
+// Wait after a probe the server did not confirm, it most likely does not read the MessagePack topics.
+#ifndef TB_MSGPACK_PROBE_INTERVAL
+  #define TB_MSGPACK_PROBE_INTERVAL 600000
+#endif
+#endif
+#if defined(USE_TLS_RESUMPTION) && defined(USE_TLS_SESSION_RTC)
+// Serialized sessions keep the broker certificate, size this for the chain the broker sends.
+#ifndef TLS_SESSION_RTC_SIZE
+  #define TLS_SESSION_RTC_SIZE 2048
+#endif
+#define TLS_SESSION_RTC_MAGIC 0x544c5353
+#endif
 #ifndef STACKSIZE_WIFIKEEPER 
   #define STACKSIZE_WIFIKEEPER 4096
 #endif
@@ -70,12 +249,20 @@
 #ifndef STACKSIZE_WIFIOTA 
 #define STACKSIZE_WIFIOTA 4096
 #endif
+// TBTR runs the connection state machine, the TLS handshake and the publish drain. mbedtls handshakes
+// alone want most of the 8 KB the Arduino loop task gets, see "stackFree" under tbConn in /api/metrics.
 #ifndef STACKSIZE_TB 
-#define STACKSIZE_TB 4096
+#define STACKSIZE_TB 8192
 #endif
 #ifndef STACKSIZE_IFACE 
 #define STACKSIZE_IFACE 4096
 #endif
+#ifndef STACKSIZE_RPCWORKER
+#define STACKSIZE_RPCWORKER 6144
+#endif
+#ifndef RPC_JOB_QUEUE_SIZE
+  #define RPC_JOB_QUEUE_SIZE 4
+#endif
 #ifndef DOCSIZE
   #define DOCSIZE 1024
 #endif
@@ -85,6 +272,19 @@
 #ifndef DOCSIZE_SETTINGS
   #define DOCSIZE_SETTINGS 2048
 #endif
+#define TB_TELEMETRY_TOPIC "v1/devices/me/telemetry"
+#define TB_ATTRIBUTE_TOPIC "v1/devices/me/attributes"
+// Largest payload tb can publish on topic: PubSubClient keeps 5 bytes for the fixed header, 2 for the
+// topic length and the topic itself free in its DOCSIZE_MIN buffer.
+#define TB_PAYLOAD_MAX(topic) (DOCSIZE_MIN - 5 - 2 - (sizeof(topic) - 1))
+#ifndef TELEMETRY_BATCH_SIZE
+  // Batch buffer including the terminator, a larger batch could never be published.
+  #define TELEMETRY_BATCH_SIZE (TB_PAYLOAD_MAX(TB_TELEMETRY_TOPIC) + 1)
+#endif
+// Payload held in each tbPublish() queue slot, the telemetry topic is the shorter one.
+#define TB_PUBLISH_PAYLOAD_SIZE (TB_PAYLOAD_MAX(TB_TELEMETRY_TOPIC) + 1)
+// Bytes tbSendPayload() adds when it stamps telemetry as {"ts":<up to 20 digits>,"values":...}.
+#define TB_STAMP_SIZE (sizeof("{\"ts\":,\"values\":}") - 1 + 20)
 
 namespace libudawa
 {
@@ -129,6 +329,7 @@ struct Config
 
   char logIP[16] = "255.255.255.255";
   uint16_t logPrt = 29514;
+  uint8_t pEnc = PAYLOAD_ENCODING_JSON;
 
   #ifdef USE_WEB_IFACE
   uint8_t wsCount = 0;
@@ -154,6 +355,7 @@ struct ConfigCoMCU
   uint8_t pLG;
   uint8_t pLB;
   uint8_t lON;
+  uint32_t bdR;
 };
 
 #ifdef USE_WIFI_LOGGER
@@ -165,8 +367,10 @@ class ESP32UDPLogger : public ILogHandler
 #endif
 
 #ifdef USE_WEB_IFACE
-std::map<uint32_t, bool> clientAuthenticationStatus;
-std::map<IPAddress, unsigned long> clientAuthAttemptTimestamps; 
+LruTable<uint32_t, bool, WS_CLIENT_TABLE_SIZE> clientAuthenticationStatus;
+LruTable<IPAddress, unsigned long, WS_IP_TABLE_SIZE> clientAuthAttemptTimestamps;
+// Last failed /api authorization per IP, apart from the WS login attempts that also record successes.
+LruTable<IPAddress, unsigned long, WS_IP_TABLE_SIZE> apiFailedAttempts;
 #endif
 
 uint32_t micro2milli(uint32_t hi, uint32_t lo);
@@ -191,11 +395,16 @@ void processProvisionResponse(const Provision_Data &data);
 void processSharedAttributeRequest(const Shared_Attribute_Data &data);
 void processClientAttributeRequest(const Shared_Attribute_Data &data);
 void processSharedAttributeUpdate(const Shared_Attribute_Data &data);
+void attrBindDefaults();
+void onLogLevAttr(JsonVariantConst value);
 void (*processSharedAttributeUpdateCb)(const Shared_Attribute_Data &data);
 void startup();
 void wifiKeeperTR(void *arg);
 void serialWriteToCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, bool isRpc, int wait = 50);
+void serialWriteToCoMcu(const char *buffer, int wait = 50);
 void serialReadFromCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, int wait = 50);
+void setCoMCUStream(Stream &stream);
+uint32_t negotiateCoMCUBaud();
 void syncConfigCoMCU();
 void readSettings(StaticJsonDocument<DOCSIZE_SETTINGS> &doc,const char* path);
 void writeSettings(StaticJsonDocument<DOCSIZE_SETTINGS> &doc, const char* path);
@@ -212,24 +421,77 @@ void (*emitAlarmCb)(const int code);
 #ifdef USE_ASYNC_WEB
 void hashApiKeyWithSalt(const char *apiKey, const char *salt, char *hashResultHex);
 void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len);
+void wsAuthorized(AsyncWebSocketClient *client, const char *token);
 #endif
 #ifndef USE_ASYNC_WEB
 void onWsEventCb(uint8_t num, WStype_t type, uint8_t * payload, size_t length);
 void webSendFile(String path, String type);
+bool webSendAsset(String uri);
+bool webWaitForEvent(uint32_t timeoutMs);
+bool webPending();
 #endif
 void (*wsEventCb)(const JsonObject &payload);
+/// WebSocket topics, one bit each in the subscription mask of a client
+#define WS_TOPIC_ATTR    (1 << 0)
+#define WS_TOPIC_CFG     (1 << 1)
+#define WS_TOPIC_ALARM   (1 << 2)
+#define WS_TOPIC_CARD    (1 << 3)
+#define WS_TOPIC_DEVTEL  (1 << 4)
+#define WS_TOPIC_SENSORS (1 << 5)
+/// Binary sample frames, see sampleBatcher.h
+#define WS_TOPIC_STREAM  (1 << 6)
+/// Bits from here up are free for the app, named with wsTopicName()
+#define WS_TOPIC_APP_FIRST 8
+#define WS_TOPIC_COUNT 16
+#define WS_TOPIC_ALL 0xFFFF
 bool wsSendTXT(uint32_t id, const char *buffer);
-bool wsBroadcastTXT(const char *buffer);
+bool wsBroadcastTXT(const char *buffer, uint16_t topic = WS_TOPIC_ALL);
+bool wsBroadcastBIN(const uint8_t *data, size_t length, uint16_t topic = WS_TOPIC_STREAM);
+bool wsBroadcastFrame(const uint8_t *data, size_t length, uint16_t topic, bool binary);
+bool wsStreamSample(uint8_t channel, const float *values, uint8_t count);
+bool wsStreamPublish(const uint8_t *frame, size_t length);
+void wsStreamPoll();
+bool wsHasSubscribers(uint16_t topic);
+bool wsTopicName(uint8_t bit, const char *name);
+uint16_t wsTopicMask(JsonVariantConst names);
+void wsTopicsSet(uint32_t id, uint16_t mask);
+void wsTopicsDrop(uint32_t id);
+void wsTopicsChanged();
+bool wsProcessSubscription(uint32_t id, const JsonObject &doc);
+void uiAssetEtag(File &file, const char *path, char *etag, size_t size);
+void uiEtagFormat(char *etag, size_t size, uint32_t crc, uint32_t length);
+/// Writes one /api response body into a Print, returns the bytes written
+typedef size_t (*ApiWriter)(Print &out);
+void apiBegin();
+int apiAuthorize(const char *authorization, IPAddress ip);
+int apiCommand(const char *cmd, const char *body, size_t length);
+size_t apiWriteStatus(Print &out);
+size_t apiWriteMetrics(Print &out);
+size_t apiWriteConfig(Print &out);
+size_t apiWriteReply(Print &out, int code);
+bool uiAssetHashed(const char *path);
+#ifdef USE_ASYNC_WEB
+struct WsClientFlow;
+WsClientFlow *wsClientFlow(uint32_t id);
+void wsReleaseFlow(WsClientFlow *flow);
+bool wsClientBacklogged(AsyncWebSocketClient *client, WsClientFlow *flow);
+int8_t wsCoalesceIndex(const char *buffer);
+void wsServiceClients();
+#endif
 void ifaceTR(void *arg);
 #endif
 #ifdef USE_WIFI_OTA
 void wifiOtaTR(void *arg);
 #endif
 void TBTR(void *arg);
+void tbOnConnected();
+void tbBackoff(bool authFailure);
+void tbProvisionFailed(bool authFailure);
 void tbOtaFinishedCb(const bool& success);
 void tbOtaProgressCb(const uint32_t& currentChunk, const uint32_t& totalChuncks);
 void (*httpOtaOnUpdateFinishedCb)(const int partition);
 void updateSpiffs();
+void updateCoMCU(const char *source);
 void (*onTbDisconnectedCb)();
 void (*onTbConnectedCb)();
 RPC_Response processConfigSave(const RPC_Data &data);
@@ -238,15 +500,62 @@ RPC_Response processSaveSettings(const RPC_Data &data);
 RPC_Response processSetPanic(const RPC_Data &data);
 void (*processSetPanicCb)(const RPC_Data &data);
 RPC_Response processUpdateSpiffs(const RPC_Data &data);
+RPC_Response processUpdateCoMCU(const RPC_Data &data);
 RPC_Response processReboot(const RPC_Data &data);
 RPC_Response processGenericClientRPC(const RPC_Data &data);
 RPC_Response (*processGenericClientRPCCb)(const RPC_Data &data);
+bool rpcRegister(const char *name, RpcHandler handler, bool async = false);
+bool rpcUnregister(const char *name);
+bool rpcWorkerStart();
+void rpcWorkerTR(void *arg);
 RPC_Response processUpdateApp(const RPC_Data &data);
 void processFwCheckAttributeRequest(const Shared_Attribute_Data &data);
-void syncClientAttr(uint8_t direction);
+void syncClientAttr(uint8_t direction, bool full = false);
+uint32_t attrShadowPublish(const char *buffer);
+void attrShadowPublishCb(uint32_t id, uint8_t status);
 void (*onSyncClientAttrCb)(uint8_t);
+/// Message types on the publish queue, shared with the offline store records
+#define TB_MSG_TELEMETRY OFFLINE_RECORD_TELEMETRY
+#define TB_MSG_ATTRIBUTE OFFLINE_RECORD_ATTRIBUTE
+/// Publish completion status
+#define TB_PUBLISH_SENT   0
+#define TB_PUBLISH_STORED 1
+#define TB_PUBLISH_FAILED 2
+typedef void (*TbPublishCb)(uint32_t id, uint8_t status);
+/// Queue buffer for publishing through tbPublish(). True once it is queued, also while the broker is not
+/// connected: it goes out after the reconnect, or into the offline store with USE_OFFLINE_STORE. False
+/// only when it was rejected (not JSON, too large, queue full). Before the publish queue these published
+/// right away and returned false when not connected; pass a TbPublishCb to tbPublish() to learn the outcome.
 bool tbSendAttribute(const char *buffer);
 bool tbSendTelemetry(const char *buffer);
+template <typename T>
+bool tbQueueTelemetry(const char *key, T value, uint64_t ts = 0);
+bool tbFlushTelemetry();
+uint64_t tbTimestamp();
+uint32_t tbPublish(char type, const char *buffer, TbPublishCb cb = NULL);
+void tbPublishDrain();
+void tbPublishDone(uint32_t id, unsigned long enqueuedAt, uint8_t status, TbPublishCb cb);
+bool tbSendPayload(char type, const char *payload, uint64_t ts = 0);
+#ifdef USE_MSGPACK_PAYLOAD
+void tbMsgPackProbe();
+void tbMsgPackProbeCb(const Shared_Attribute_Data &data);
+#endif
+#ifdef USE_TB_DELIVERY_ACK
+uint8_t tbSendDeliveryEntry(const DeliveryEntry &entry);
+void tbDelivered(DeliveryEntry &entry, bool delivered);
+/// One callback per fence slot: the SDK does not tell which request an answer belongs to.
+template <uint8_t slot>
+void tbDeliveryFenceCb(const Shared_Attribute_Data &data);
+#endif
+#ifdef USE_OFFLINE_STORE
+bool offlineStoreAppend(char type, const char *buffer, uint64_t ts);
+void offlineStoreReplay();
+void offlineStoreSync();
+#endif
+#ifdef USE_TLS_RESUMPTION
+void tlsSessionRestore();
+void tlsSessionPersist();
+#endif
 void (*tbloggerCb)(const char *error);
 void onTbLogger(const char *error);
 void (*onMQTTUpdateStartCb)();
@@ -279,12 +588,19 @@ ESP32UDPLogger udp_logger;
 WiFiUDP udp;
 #endif
 LogManager *log_manager = LogManager::GetInstance(LogLevel::VERBOSE);
+#ifdef USE_TLS_RESUMPTION
+// Caches the broker session so reconnects resume it instead of repeating the full handshake.
+TlsSessionClient ssl;
+#else
 WiFiClientSecure ssl = WiFiClientSecure();
+#endif
 WiFiMulti wifiMulti;
 Config config;
 ConfigCoMCU configcomcu;
 Espressif_Updater updater;
-Arduino_MQTT_Client mqttClient(ssl);
+// Keeps the CONNACK return code, which tells a refused token apart from a broker that is down.
+ConnackClient mqttTransport(ssl);
+Arduino_MQTT_Client mqttClient(mqttTransport);
 ThingsBoardSized<32, TBLogger> tb(mqttClient, DOCSIZE_MIN);
 ESP32Time rtc(0);
 WiFiUDP ntpUDP;
@@ -296,13 +612,174 @@ ErriezDS3231 rtcHw;
 #ifdef USE_ASYNC_WEB
 AsyncWebServer web(80);
 AsyncWebSocket ws("/ws");
+// Login nonces and session tokens, only used from onWsEventCb on the async_tcp task.
+WsSessionStore wsSessions;
+// Logins with a client chosen salt, accepted with WS_AUTH_CLIENT_SALT 1.
+uint32_t wsLegacyLogins = 0;
+// Every client's queued message points into one of these, freed when no message references it any more.
+// Guarded by xSemaphoreWSSend.
+SharedBufferPool<AsyncWebSocketMessageBuffer, WS_SHARED_BUFFERS> wsSharedBuffers;
+struct WsBroadcastStats
+{
+  uint32_t broadcasts;
+  uint32_t deliveries;
+  uint32_t sharedBuffers;
+  // Broadcasts to at most one client, sent as a plain copy.
+  uint32_t directSends;
+  // Broadcasts to several clients that found every shared buffer still queued.
+  uint32_t copyFallbacks;
+  uint64_t bytesNotCopied;
+};
+WsBroadcastStats wsBroadcastStats = {};
+const char *wsCoalesceKeys[] = {WS_COALESCE_KEYS};
+#define WS_COALESCE_COUNT (sizeof(wsCoalesceKeys) / sizeof(wsCoalesceKeys[0]))
+// Outbound accounting of one connected client, guarded by xSemaphoreWSSend.
+struct WsClientFlow
+{
+  uint32_t id;
+  bool used;
+  bool backlogged;
+  // Frames queued since the TCP send buffer was last seen empty, the library queue can only hold more than that.
+  uint16_t queued;
+  size_t maxSpace;
+  unsigned long backlogSince;
+  // Latest coalescible frame per key held back from a backlogged client, with a reference taken on it.
+  AsyncWebSocketMessageBuffer *latest[WS_COALESCE_COUNT];
+};
+WsClientFlow wsClientFlows[WS_FLOW_SLOTS] = {};
+struct WsFlowStats
+{
+  uint32_t backlogs;
+  uint32_t coalesced;
+  uint32_t dropped;
+  uint32_t flushed;
+  uint32_t evicted;
+};
+WsFlowStats wsFlowStats = {};
+/**
+ * Serves the UI from SPIFFS like serveStatic, but prefers a precompressed path.gz (sent with
+ * Content-Encoding: gzip by AsyncFileResponse), answers If-None-Match with 304 using a content
+ * hash ETag and lets browsers keep assets with a hash in their name for a year.
+ */
+class UiAssetHandler : public AsyncWebHandler
+{
+  public:
+    UiAssetHandler(const char *uri, const char *path, const char *username, const char *password)
+      : _uri(uri), _path(path), _username(username), _password(password) {}
+    bool canHandle(AsyncWebServerRequest *request) override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+
+  private:
+    String _uri;
+    String _path;
+    String _username;
+    String _password;
+};
 #endif
 #ifndef USE_ASYNC_WEB
-WebServer web(80);
-WebSocketsServer ws = WebSocketsServer(81);
+WebServer web(WEB_PORT);
+// WebSocketsServer that tells whether a client holds bytes its WiFiClient already read off the socket.
+class WebSocketsServerPeek : public WebSocketsServer
+{
+  public:
+    explicit WebSocketsServerPeek(uint16_t port) : WebSocketsServer(port) {}
+    bool pending();
+};
+WebSocketsServerPeek ws(WS_PORT);
+struct WebLoopStats
+{
+  // millis() when ifaceTR started serving, the rates in /api/metrics are taken against it.
+  uint32_t since;
+  uint32_t iterations;
+  uint32_t wakeups;
+  uint32_t timeouts;
+  // Wakeups that came sooner than WEB_POLL_INTERVAL after the previous pass and waited for it, see ifaceTR().
+  uint32_t throttled;
+  // Events onWsEventCb handled.
+  uint32_t wsEvents;
+  // Passes followed by another one without select(), the last did work or data was left buffered.
+  uint32_t skippedWaits;
+  // Time ifaceTR ran instead of blocking: the servers' loops and the socket scan of webWaitForEvent().
+  uint64_t busyUs;
+  // From select() finding a socket readable to the end of the pass that served it, throttling included.
+  uint64_t wakeLatencyUs;
+  uint32_t wakeLatencyMaxUs;
+};
+WebLoopStats webLoopStats = {};
+// Print that forwards into a chunked WebServer response, a small buffer at a time.
+class WebContentPrint : public Print
+{
+  public:
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    void flush() override;
+
+  private:
+    char _buffer[128];
+    size_t _length = 0;
+};
+#endif
+// Subscription mask of every authenticated client, guarded by xSemaphoreWSSend.
+LruTable<uint32_t, uint16_t, WS_CLIENT_TABLE_SIZE> clientTopics;
+// Union of all subscription masks, so senders can skip building frames nobody listens to.
+volatile uint16_t wsTopicSubscribed = 0;
+const char *wsTopicNames[WS_TOPIC_COUNT] = {"attr", "cfg", "alarm", "card", "devTel", "sensors", "stream"};
+// Batches wsStreamSample() calls into binary frames, guarded by xSemaphoreWsStream.
+SampleBatcher wsSampleBatcher(wsStreamPublish);
+struct UiEtag
+{
+  uint32_t size;
+  uint32_t crc;
+};
+// ETags of served assets by hash of the file path, only used from the task serving HTTP.
+LruTable<uint32_t, UiEtag, UI_ETAG_CACHE_SIZE> uiEtags;
+struct UiAssetStats
+{
+  uint32_t requests;
+  uint32_t notModified;
+  uint32_t gzipped;
+  uint64_t bytesSent;
+};
+UiAssetStats uiAssetStats = {};
+// Index of UI_BUNDLE_PATH, only used from the task serving HTTP.
+AssetBundle uiBundle;
 #endif
+// Transport used to talk to the CoMCU. Defaults to Serial2, can be swapped for any Stream (e.g. a simulator).
+Stream *coMcuStream = NULL;
+// Frames the JSON exchanged over coMcuStream, only used under the CoMCU serial semaphores.
+CoMCULink coMcuLink;
+// Points queued with tbQueueTelemetry() are published together as one ThingsBoard batch message.
+char telemetryBatchBuffer[TELEMETRY_BATCH_SIZE];
+TelemetryBatcher telemetryBatcher(tbSendTelemetry, telemetryBatchBuffer, sizeof(telemetryBatchBuffer));
+#ifdef USE_MSGPACK_PAYLOAD
+// Packs outbound payloads once the server asked for MessagePack through the pEnc shared attribute and
+// proved on this connection that it decodes it.
+PayloadCodec payloadCodec;
+bool FLAG_MSGPACK_CONFIRMED = false;
+bool FLAG_MSGPACK_PROBE_ASKED = false;
+bool FLAG_MSGPACK_PROBE_FAILED = false;
+uint32_t MSGPACK_PROBE_NONCE = 0;
+unsigned long TIMER_MSGPACK_PROBE = 0;
+uint32_t MSGPACK_PROBE_FAILURES = 0;
+#endif
+#ifdef USE_OFFLINE_STORE
+// Messages that could not be published while the broker was unreachable, replayed by TBTR after reconnect.
+OfflineStore offlineStore;
+unsigned long TIMER_OFFLINE_REPLAY = 0;
 #endif
 unsigned long LAST_TB_CONNECTED = 0;
+#if defined(USE_TLS_RESUMPTION) && defined(USE_TLS_SESSION_RTC)
+// Survives a software reset (not a power cycle), the magic and CRC tell a kept session from noise.
+struct TlsSessionRtc
+{
+  uint32_t magic;
+  uint32_t crc;
+  uint32_t length;
+  uint8_t data[TLS_SESSION_RTC_SIZE];
+};
+RTC_NOINIT_ATTR TlsSessionRtc tlsSessionRtc;
+uint32_t TLS_SESSION_PERSISTED = 0;
+#endif
 bool FLAG_SAVE_SETTINGS = false;
 bool FLAG_SAVE_CONFIG = false;
 bool FLAG_SAVE_CONFIGCOMCU = false;
@@ -311,23 +788,29 @@ bool FLAG_SAVE_STATES = false;
 bool FLAG_SYNC_CLIENT_ATTR_0 = false;
 bool FLAG_SYNC_CLIENT_ATTR_1 = false;
 bool FLAG_SYNC_CLIENT_ATTR_2 = false;
+bool FLAG_SYNC_CLIENT_ATTR_FULL = false;
 bool FLAG_TB_OTA_ACTIVATED = false;
 bool FLAG_UPDATE_SPIFFS = false;
+bool FLAG_UPDATE_COMCU = false;
+bool FLAG_COMCU_BAUD_NEGOTIATED = false;
+uint8_t COMCU_READ_ERRORS = 0;
 bool FLAG_ECP_UPDATED = false;
 bool FLAG_SM_CLEARED = false;
 bool FLAG_WS_STREAM_SDCARD = false;
 bool FLAG_REBOOT_COUNTDOWN = false;
 uint32_t GLOBAL_TARGET_CLIENT_ID = 0;
 String GLOBAL_LOG_FILE_NAME = "";
+String GLOBAL_COMCU_FW_SOURCE = "";
 unsigned long TIMER_FLAG_REBOOT_COUNTDOWN;
 int REBOOT_COUNTDOWN = 10;
 
 // Client-side RPC that can be executed from cloud
-const std::array<RPC_Callback, 8U> clientRPCCallbacks = {
+const std::array<RPC_Callback, 9U> clientRPCCallbacks = {
   RPC_Callback{ PSTR("configSave"),    processConfigSave },
   RPC_Callback{ PSTR("configCoMCUSave"), processConfigCoMCUSave },
   RPC_Callback{ PSTR("saveSettings"), processSaveSettings },
   RPC_Callback{ PSTR("updateSpiffs"), processUpdateSpiffs },
+  RPC_Callback{ PSTR("updateCoMCU"), processUpdateCoMCU },
   RPC_Callback{ PSTR("setPanic"), processSetPanic }, 
   RPC_Callback{ PSTR("reboot"),  processReboot},
   RPC_Callback{ PSTR("updateApp"), processUpdateApp },
@@ -339,6 +822,28 @@ constexpr std::array<const char*, 1U> REQUESTED_FW_CHECK_SHARED_ATTRIBUTES = {
   FW_VER_KEY
 };
 const Attribute_Request_Callback fwCheckCb(&processFwCheckAttributeRequest, REQUESTED_FW_CHECK_SHARED_ATTRIBUTES.cbegin(), REQUESTED_FW_CHECK_SHARED_ATTRIBUTES.cend());
+#ifdef USE_TB_DELIVERY_ACK
+constexpr std::array<const char*, 1U> TB_DELIVERY_FENCE_ATTRIBUTES = {
+  TB_DELIVERY_FENCE_KEY
+};
+static_assert(DELIVERY_FENCE_SLOTS == 4, "tbDeliveryFenceCallbacks needs a callback for every fence slot");
+const Attribute_Request_Callback tbDeliveryFenceCallbacks[DELIVERY_FENCE_SLOTS] = {
+  Attribute_Request_Callback(&tbDeliveryFenceCb<0>, TB_DELIVERY_FENCE_ATTRIBUTES.cbegin(), TB_DELIVERY_FENCE_ATTRIBUTES.cend()),
+  Attribute_Request_Callback(&tbDeliveryFenceCb<1>, TB_DELIVERY_FENCE_ATTRIBUTES.cbegin(), TB_DELIVERY_FENCE_ATTRIBUTES.cend()),
+  Attribute_Request_Callback(&tbDeliveryFenceCb<2>, TB_DELIVERY_FENCE_ATTRIBUTES.cbegin(), TB_DELIVERY_FENCE_ATTRIBUTES.cend()),
+  Attribute_Request_Callback(&tbDeliveryFenceCb<3>, TB_DELIVERY_FENCE_ATTRIBUTES.cbegin(), TB_DELIVERY_FENCE_ATTRIBUTES.cend())
+};
+// Published messages the broker has not confirmed yet, sent again after a reconnect. Stamped telemetry
+// has to fit the MQTT buffer as well, so the window takes only payloads that do with their stamp.
+char tbDeliveryPayloads[DELIVERY_WINDOW_SIZE * TB_PUBLISH_PAYLOAD_SIZE];
+DeliveryWindow tbDeliveryWindow(tbDelivered, tbDeliveryPayloads, TB_PUBLISH_PAYLOAD_SIZE, TB_STAMP_SIZE);
+#endif
+#ifdef USE_MSGPACK_PAYLOAD
+constexpr std::array<const char*, 1U> TB_MSGPACK_PROBE_ATTRIBUTES = {
+  TB_MSGPACK_PROBE_KEY
+};
+const Attribute_Request_Callback tbMsgPackProbeCallback(&tbMsgPackProbeCb, TB_MSGPACK_PROBE_ATTRIBUTES.cbegin(), TB_MSGPACK_PROBE_ATTRIBUTES.cend());
+#endif
 
 const OTA_Update_Callback tbOtaCb(&tbOtaProgressCb, &tbOtaFinishedCb, CURRENT_FIRMWARE_TITLE, CURRENT_FIRMWARE_VERSION, &updater, 40, 4096);
 const Shared_Attribute_Callback tbSharedAttrUpdateCb(&processSharedAttributeUpdate);
@@ -349,6 +854,7 @@ BaseType_t xReturnedAlarm;
 BaseType_t xReturnedWifiOta;
 #endif
 BaseType_t xReturnedTB;
+BaseType_t xReturnedRpcWorker;
 BaseType_t xReturnedIface;
 
 TaskHandle_t xHandleWifiKeeper = NULL;
@@ -357,6 +863,7 @@ TaskHandle_t xHandleAlarm = NULL;
 TaskHandle_t xHandleWifiOta;
 #endif
 TaskHandle_t xHandleTB;
+TaskHandle_t xHandleRpcWorker = NULL;
 #ifdef USE_WEB_IFACE
 TaskHandle_t xHandleIface;
 #endif
@@ -368,8 +875,15 @@ SemaphoreHandle_t xSemaphoreSettings = NULL;
 SemaphoreHandle_t xSemaphoreConfig = NULL;
 SemaphoreHandle_t xSemaphoreConfigCoMCU = NULL;
 SemaphoreHandle_t xSemaphoreTBSend = NULL;
+SemaphoreHandle_t xSemaphoreTBPublish = NULL;
 SemaphoreHandle_t xSemaphoreWSSend = NULL;
+SemaphoreHandle_t xSemaphoreWsStream = NULL;
 SemaphoreHandle_t xSemaphoreCardLogger = NULL;
+SemaphoreHandle_t xSemaphoreTelemetryBatch = NULL;
+SemaphoreHandle_t xSemaphoreRpcRegistry = NULL;
+#ifdef USE_OFFLINE_STORE
+SemaphoreHandle_t xSemaphoreOfflineStore = NULL;
+#endif
 
 struct AlarmMessage
 {
@@ -380,13 +894,105 @@ struct AlarmMessage
 };
 QueueHandle_t xQueueAlarm;
 
+struct TbPublishMessage
+{
+  uint32_t id;
+  char type;
+  char payload[TB_PUBLISH_PAYLOAD_SIZE];
+  uint64_t ts;
+  unsigned long enqueuedAt;
+  TbPublishCb cb;
+};
+struct TbPublishStats
+{
+  uint32_t enqueued;
+  uint32_t published;
+  uint32_t stored;
+  uint32_t failed;
+  uint32_t rejected;
+  uint32_t depthMax;
+  unsigned long latencyLast;
+  unsigned long latencyMax;
+  uint64_t latencySum;
+};
+QueueHandle_t xQueueTBPublish = NULL;
+// A message is a few hundred bytes, so it is built and drained in these instead of on the stack. The
+// first is guarded by xSemaphoreTBPublish, the second only touched by TBTR.
+TbPublishMessage tbPublishSlot;
+TbPublishMessage tbDrainSlot;
+TbPublishStats tbPublishStats = {};
+portMUX_TYPE tbPublishMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t TB_PUBLISH_SEQ = 0;
+
+// Routes shared attribute keys to config fields. Apps bind their own settings to it before startup().
+AttrDispatcher attrDispatcher;
+
+// Commands of the generic RPC, looked up by name. Async ones run on rpcWorkerTR.
+RpcRegistry rpcRegistry;
+struct RpcJob
+{
+  uint32_t rid;
+  RpcHandler handler;
+  char method[RPC_NAME_SIZE];
+  char *params;
+};
+QueueHandle_t xQueueRpcJob = NULL;
+uint32_t RPC_JOB_SEQ = 0;
+
+enum TbConnState : uint8_t
+{
+  TB_STATE_DISCONNECTED,
+  TB_STATE_CONNECTING,
+  TB_STATE_PROVISIONING,
+  TB_STATE_PROVISION_WAIT,
+  TB_STATE_CONNECTED,
+  TB_STATE_BACKOFF
+};
+struct TbConnStats
+{
+  uint32_t attempts;
+  uint32_t connects;
+  uint32_t disconnects;
+  uint32_t tlsFailures;
+  uint32_t authFailures;
+  uint32_t provisions;
+  uint32_t provisionFailures;
+  uint32_t provisionTimeouts;
+  unsigned long lastProvisionMs;
+  uint32_t reprovisions;
+  unsigned long lastConnectMs;
+  unsigned long lastBackoffMs;
+  unsigned long totalBackoffMs;
+  int lastTlsError;
+  int lastConnack;
+};
+TbConnState tbState = TB_STATE_DISCONNECTED;
+TbConnStats tbConnStats = {};
+unsigned long TIMER_TB_BACKOFF_UNTIL = 0;
+unsigned long TIMER_TB_PROVISION_START = 0;
+uint8_t TB_PROVISION_FAILURES = 0;
+BackoffPolicy tbTlsBackoff(TB_BACKOFF_TLS_BASE, TB_BACKOFF_TLS_CAP);
+BackoffPolicy tbAuthBackoff(TB_BACKOFF_AUTH_BASE, TB_BACKOFF_AUTH_CAP);
+
+struct AttrShadowAck
+{
+  uint32_t id;
+  uint8_t status;
+};
+QueueHandle_t xQueueAttrShadowAck = NULL;
+// The MQTT buffer also holds the fixed header and the v1/devices/me/attributes topic.
+AttributeShadow attrShadow(attrShadowPublish, TB_PAYLOAD_MAX(TB_ATTRIBUTE_TOPIC));
+
 
 void startup() {
   ssl.setCACert(CA_CERT);
-  const char *ssl_protos[] = {"mqtt"};
+  static const char *ssl_protos[] = {"mqtt", NULL};
   ssl.setAlpnProtocols(ssl_protos);
   tbloggerCb = &onTbLogger;
+  attrBindDefaults();
   xQueueAlarm = xQueueCreate( 10, sizeof( struct AlarmMessage ) );
+  xQueueTBPublish = xQueueCreate( TB_PUBLISH_QUEUE_SIZE, sizeof( struct TbPublishMessage ) );
+  xQueueAttrShadowAck = xQueueCreate( TB_PUBLISH_QUEUE_SIZE, sizeof( struct AttrShadowAck ) );
 
   if(xSemaphoreSerialCoMCUWrite == NULL){xSemaphoreSerialCoMCUWrite = xSemaphoreCreateMutex();}
   if(xSemaphoreSerialCoMCURead == NULL){xSemaphoreSerialCoMCURead = xSemaphoreCreateMutex();}
@@ -395,8 +1001,15 @@ void startup() {
   if(xSemaphoreConfig == NULL){xSemaphoreConfig = xSemaphoreCreateMutex();}
   if(xSemaphoreConfigCoMCU == NULL){xSemaphoreConfigCoMCU = xSemaphoreCreateMutex();}
   if(xSemaphoreTBSend == NULL){xSemaphoreTBSend = xSemaphoreCreateMutex();}
+  if(xSemaphoreTBPublish == NULL){xSemaphoreTBPublish = xSemaphoreCreateMutex();}
   if(xSemaphoreWSSend == NULL){xSemaphoreWSSend = xSemaphoreCreateMutex();}
+  if(xSemaphoreWsStream == NULL){xSemaphoreWsStream = xSemaphoreCreateMutex();}
   if(xSemaphoreCardLogger == NULL){xSemaphoreCardLogger = xSemaphoreCreateMutex();}
+  if(xSemaphoreTelemetryBatch == NULL){xSemaphoreTelemetryBatch = xSemaphoreCreateMutex();}
+  if(xSemaphoreRpcRegistry == NULL){xSemaphoreRpcRegistry = xSemaphoreCreateMutex();}
+  #ifdef USE_OFFLINE_STORE
+  if(xSemaphoreOfflineStore == NULL){xSemaphoreOfflineStore = xSemaphoreCreateMutex();}
+  #endif
 
   // put your setup code here, to run once:
   Serial.begin(115200);
@@ -436,7 +1049,8 @@ void startup() {
   
   #ifdef USE_SERIAL2
     log_manager->debug(PSTR(__func__), PSTR("Serial 2 - CoMCU Activated!\n"));
-    Serial2.begin(115200, SERIAL_8N1, S2_RX, S2_TX);
+    Serial2.begin(COMCU_BAUD_DEFAULT, SERIAL_8N1, S2_RX, S2_TX);
+    if(coMcuStream == NULL){setCoMCUStream(Serial2);}
   #endif
 
   if(!config.SM)
@@ -450,6 +1064,18 @@ void startup() {
     rtcUpdate(0);
   }
 
+  #ifdef USE_TLS_RESUMPTION
+  tlsSessionRestore();
+  #endif
+
+  #ifdef USE_OFFLINE_STORE
+  // The attribute topic is the longer one, so its limit holds for both record types.
+  offlineStore.begin(OFFLINE_STORE_FS, OFFLINE_STORE_DIR, TB_PAYLOAD_MAX(TB_ATTRIBUTE_TOPIC));
+  if(!offlineStore.empty()){
+    log_manager->info(PSTR(__func__), PSTR("Offline store holds %d bytes to replay.\n"), offlineStore.diskBytes());
+  }
+  #endif
+
   log_manager->debug(PSTR(__func__), PSTR("Startup time: %s\n"), rtc.getDateTime().c_str());
 
   int tBytes = SPIFFS.totalBytes(); 
@@ -479,6 +1105,9 @@ void udawa(){
   if(FLAG_REBOOT_COUNTDOWN){
     if( (millis() - TIMER_FLAG_REBOOT_COUNTDOWN) >= (REBOOT_COUNTDOWN * 1000)){
       log_manager->warn(PSTR(__func__),PSTR("Device rebooting...\n"));
+      #ifdef USE_OFFLINE_STORE
+      offlineStoreSync();
+      #endif
       ESP.restart();
     }
     else{
@@ -523,6 +1152,11 @@ void udawa(){
     FLAG_UPDATE_SPIFFS = false;
     updateSpiffs();
   }
+  if(FLAG_UPDATE_COMCU && !FLAG_TB_OTA_ACTIVATED){
+    FLAG_UPDATE_COMCU = false;
+    updateCoMCU(GLOBAL_COMCU_FW_SOURCE.c_str());
+    GLOBAL_COMCU_FW_SOURCE = "";
+  }
 
   if(!FLAG_ECP_UPDATED && millis() > 30000 && !FLAG_TB_OTA_ACTIVATED){
     config.ECP = millis();
@@ -599,59 +1233,8 @@ void processSharedAttributeUpdate(const Shared_Attribute_Data &data){
       serializeJson(data, buffer); 
       log_manager->verbose(PSTR(__func__), PSTR("%s \n"), buffer.c_str());
     }
-    if( xSemaphoreConfig != NULL ){
-      if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
-      {
-        if(data["model"] != nullptr){strlcpy(config.model, data["model"].as<const char*>(), sizeof(config.model));}
-        if(data["group"] != nullptr){strlcpy(config.group, data["group"].as<const char*>(), sizeof(config.group));}
-        if(data["broker"] != nullptr){strlcpy(config.broker, data["broker"].as<const char*>(), sizeof(config.broker));}
-        if(data["port"] != nullptr){config.port = data["port"].as<uint16_t>();}
-        if(data["wssid"] != nullptr){strlcpy(config.wssid, data["wssid"].as<const char*>(), sizeof(config.wssid));}
-        if(data["wpass"] != nullptr){strlcpy(config.wpass, data["wpass"].as<const char*>(), sizeof(config.wpass));}
-        if(data["dssid"] != nullptr){strlcpy(config.dssid, data["dssid"].as<const char*>(), sizeof(config.dssid));}
-        if(data["dpass"] != nullptr){strlcpy(config.dpass, data["dpass"].as<const char*>(), sizeof(config.dpass));}
-        if(data["upass"] != nullptr){strlcpy(config.upass, data["upass"].as<const char*>(), sizeof(config.upass));}
-        if(data["accTkn"] != nullptr){strlcpy(config.accTkn, data["accTkn"].as<const char*>(), sizeof(config.accTkn));}
-        if(data["provDK"] != nullptr){strlcpy(config.provDK, data["provDK"].as<const char*>(), sizeof(config.provDK));}
-        if(data["provDS"] != nullptr){strlcpy(config.provDS, data["provDS"].as<const char*>(), sizeof(config.provDS));}
-        if(data["logLev"] != nullptr){config.logLev = data["logLev"].as<uint8_t>(); log_manager->set_log_level(PSTR("*"), (LogLevel) config.logLev);}
-        if(data["gmtOff"] != nullptr){config.gmtOff = data["gmtOff"].as<int>();}
-        if(data["htU"] != nullptr){strlcpy(config.htU, data["htU"].as<const char*>(), sizeof(config.htU));}
-        if(data["htP"] != nullptr){strlcpy(config.htP, data["htP"].as<const char*>(), sizeof(config.htP));}
-        if(data["fWOTA"] != nullptr){config.fWOTA = data["fWOTA"].as<bool>();}
-        if(data["fIface"] != nullptr){config.fIface = data["fIface"].as<bool>();}
-        if(data["fIoT"] != nullptr){config.fIoT = data["fIoT"].as<bool>();}
-        if(data["hname"] != nullptr){strlcpy(config.hname, data["hname"].as<const char*>(), sizeof(config.hname));}
-        if(data["logIP"] != nullptr){strlcpy(config.logIP, data["logIP"].as<const char*>(), sizeof(config.logIP));}
-        if(data["webApiKey"] != nullptr){strlcpy(config.webApiKey, data["webApiKey"].as<const char*>(), sizeof(config.webApiKey));}
-        if(data["logPrt"] != nullptr){config.logPrt = data["logPrt"].as<uint16_t>();}
-        xSemaphoreGive( xSemaphoreConfig );
-      }
-      else
-      {
-        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-      }
-    }
-
-    if( xSemaphoreConfigCoMCU != NULL ){
-      if( xSemaphoreTake( xSemaphoreConfigCoMCU, ( TickType_t ) 1000 ) == pdTRUE )
-      {
-        if(data["fP"] != nullptr){configcomcu.fP = data["fP"].as<bool>();}
-        if(data["bFr"] != nullptr){configcomcu.bFr = data["bFr"].as<uint16_t>();}
-        if(data["fB"] != nullptr){configcomcu.fB = data["fB"].as<bool>();}
-        if(data["pBz"] != nullptr){configcomcu.pBz = data["pBz"].as<uint8_t>();}
-        if(data["pLR"] != nullptr){configcomcu.pLR = data["pLR"].as<uint8_t>();}
-        if(data["pLG"] != nullptr){configcomcu.pLG = data["pLG"].as<uint8_t>();}
-        if(data["pLB"] != nullptr){configcomcu.pLB = data["pLB"].as<uint8_t>();}
-        if(data["lON"] != nullptr){configcomcu.lON = data["lON"].as<uint8_t>();}
-        xSemaphoreGive( xSemaphoreConfigCoMCU );
-      }
-      else
-      {
-        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-      }
-    }
-    processSharedAttributeUpdateCb(data);
+    attrDispatcher.dispatch(data);
+    if(processSharedAttributeUpdateCb != NULL){processSharedAttributeUpdateCb(data);}
     FLAG_SYNC_CLIENT_ATTR_2 = true;
     setAlarm(0, 0, 1, 50);
     xSemaphoreGive( xSemaphoreTBSend );
@@ -662,6 +1245,50 @@ void processSharedAttributeUpdate(const Shared_Attribute_Data &data){
   }
 }
 
+/// @brief Binds every shared attribute the library understands to its config field.
+void attrBindDefaults(){
+  attrDispatcher.bind(PSTR("model"), config.model, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("group"), config.group, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("broker"), config.broker, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("port"), config.port, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("wssid"), config.wssid, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("wpass"), config.wpass, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("dssid"), config.dssid, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("dpass"), config.dpass, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("upass"), config.upass, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("accTkn"), config.accTkn, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("provDK"), config.provDK, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("provDS"), config.provDS, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("logLev"), config.logLev, &xSemaphoreConfig, onLogLevAttr);
+  attrDispatcher.bind(PSTR("gmtOff"), config.gmtOff, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("htU"), config.htU, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("htP"), config.htP, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("fWOTA"), config.fWOTA, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("fIface"), config.fIface, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("fIoT"), config.fIoT, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("hname"), config.hname, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("logIP"), config.logIP, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("webApiKey"), config.webApiKey, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("logPrt"), config.logPrt, &xSemaphoreConfig);
+  attrDispatcher.bind(PSTR("pEnc"), config.pEnc, &xSemaphoreConfig);
+
+  attrDispatcher.bind(PSTR("fP"), configcomcu.fP, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("bFr"), configcomcu.bFr, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("fB"), configcomcu.fB, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("pBz"), configcomcu.pBz, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("pLR"), configcomcu.pLR, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("pLG"), configcomcu.pLG, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("pLB"), configcomcu.pLB, &xSemaphoreConfigCoMCU);
+  attrDispatcher.bind(PSTR("lON"), configcomcu.lON, &xSemaphoreConfigCoMCU);
+  if(!attrDispatcher.build()){
+    log_manager->warn(PSTR(__func__), PSTR("No perfect hash for %d shared attributes, using a linear scan.\n"), attrDispatcher.size());
+  }
+}
+
+void onLogLevAttr(JsonVariantConst value){
+  log_manager->set_log_level(PSTR("*"), (LogLevel) value.as<uint8_t>());
+}
+
 void tbOtaFinishedCb(const bool& success){
   onMQTTUpdateEndCb();
   if(success){
@@ -678,16 +1305,15 @@ void tbOtaProgressCb(const uint32_t& currentChunk, const uint32_t& totalChuncks)
 
 #ifdef USE_WEB_IFACE
 void ifaceTR(void *arg){
+  if(uiBundle.begin(SPIFFS, UI_BUNDLE_PATH)){
+    log_manager->info(PSTR(__func__), PSTR("Serving %d UI assets from %s.\n"), uiBundle.count(), UI_BUNDLE_PATH);
+  }
   #ifdef USE_ASYNC_WEB
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "Content-Type");
   #ifdef USE_INTERNAL_UI
-    #ifdef USE_INTERNAL_UI_DIGEST
-      web.serveStatic("/ui", SPIFFS, "/ui").setDefaultFile("index.html").setAuthentication(config.htU,config.htP).setAuthentication(config.htU,config.htP);
-    #else
-      web.serveStatic("/ui", SPIFFS, "/ui").setDefaultFile("index.html").setAuthentication(config.htU,config.htP);
-    #endif
+  web.addHandler(new UiAssetHandler("/ui", "/ui", config.htU, config.htP));
   #else
   web.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
     DynamicJsonDocument jsonDoc(128);
@@ -701,6 +1327,7 @@ void ifaceTR(void *arg){
     request->send(200, "application/json", jsonResponse);
   });
   #endif
+  apiBegin();
   web.begin();
   #ifdef USE_SPIFFS_LOG
     #ifdef USE_INTERNAL_UI_DIGEST
@@ -718,34 +1345,88 @@ void ifaceTR(void *arg){
     #endif
   }
   #endif
+  wsSessions.begin();
   ws.onEvent(onWsEventCb);
   ws.enable(true);
   web.addHandler(&ws);
 
   while(true){
-    ws.cleanupClients();
+    wsStreamPoll();
+    wsServiceClients();
     vTaskDelay((const TickType_t) 1000 / portTICK_PERIOD_MS);
   }
   #endif
 
   #ifndef USE_ASYNC_WEB
-  web.on(PSTR("/"), []() { webSendFile("/www/index.html", "text/html"); });
-  web.on(PSTR("/runtime.js"), []() { webSendFile("/www/runtime.js", "application/javascript"); });
-  web.on(PSTR("/polyfills.js"), []() { webSendFile("/www/polyfills.js", "application/javascript"); });
-  web.on(PSTR("/main.js"), []() { webSendFile("/www/main.js", "application/javascript"); });
-  web.on(PSTR("/styles.css"), []() { webSendFile("/www/styles.css", "text/css"); });
-  web.on(PSTR("/assets/img/logo.svg"), []() { webSendFile("/www/assets/img/logo.svg", "image/svg+xml"); });
-  web.on(PSTR("/favicon"), []() { webSendFile("/www/favicon.ico", "image/x-icon"); });
+  if(uiBundle.loaded()){
+    web.onNotFound([]() {
+      if(!webSendAsset(web.uri())){
+        web.send(404, PSTR("text/plain"), PSTR("Not found."));
+      }
+    });
+  }
+  else{
+    web.on(PSTR("/"), []() { webSendFile("/www/index.html", "text/html"); });
+    web.on(PSTR("/runtime.js"), []() { webSendFile("/www/runtime.js", "application/javascript"); });
+    web.on(PSTR("/polyfills.js"), []() { webSendFile("/www/polyfills.js", "application/javascript"); });
+    web.on(PSTR("/main.js"), []() { webSendFile("/www/main.js", "application/javascript"); });
+    web.on(PSTR("/styles.css"), []() { webSendFile("/www/styles.css", "text/css"); });
+    web.on(PSTR("/assets/img/logo.svg"), []() { webSendFile("/www/assets/img/logo.svg", "image/svg+xml"); });
+    web.on(PSTR("/favicon"), []() { webSendFile("/www/favicon.ico", "image/x-icon"); });
+  }
 
+  apiBegin();
+  const char *headerKeys[] = {"If-None-Match", "Authorization"};
+  web.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
   web.begin();
 
   ws.begin();
   ws.onEvent(onWsEventCb);
 
+  const TickType_t pollTicks = WEB_POLL_INTERVAL / portTICK_PERIOD_MS > 0 ? WEB_POLL_INTERVAL / portTICK_PERIOD_MS : 1;
+  TickType_t lastPass = xTaskGetTickCount() - pollTicks;
+  bool woke = false;
+  uint32_t wokeAt = 0;
+  webLoopStats.since = millis();
   while(true){
+    #if WEB_EVENT_LOOP
+    // A server can leave readable data unconsumed (WebServer takes one HTTP client at a time), which would
+    // make select() return at once forever. Passes start at least WEB_POLL_INTERVAL apart, so the loop is
+    // never busier than polling, while the first event after a quiet spell is served right away.
+    TickType_t sinceLastPass = xTaskGetTickCount() - lastPass;
+    if(sinceLastPass < pollTicks){
+      webLoopStats.throttled++;
+      vTaskDelay(pollTicks - sinceLastPass);
+    }
+    lastPass = xTaskGetTickCount();
+    #endif
+    uint32_t passStart = micros();
+    uint32_t wsEvents = webLoopStats.wsEvents;
     ws.loop();
+    wsStreamPoll();
     web.handleClient();
-    vTaskDelay((const TickType_t) 3 / portTICK_PERIOD_MS);
+    uint32_t passEnd = micros();
+    webLoopStats.iterations++;
+    webLoopStats.busyUs += passEnd - passStart;
+    if(woke){
+      uint32_t latency = passEnd - wokeAt;
+      webLoopStats.wakeLatencyUs += latency;
+      webLoopStats.wakeLatencyMaxUs = latency > webLoopStats.wakeLatencyMaxUs ? latency : webLoopStats.wakeLatencyMaxUs;
+    }
+    #if WEB_EVENT_LOOP
+    // select() only sees what is still in the lwIP socket. A frame or request body a WiFiClient already
+    // read into its own buffer leaves the socket quiet and would wait for WEB_EVENT_TIMEOUT, so after a
+    // pass that did work, or with data left buffered, go round again at the throttled pace instead.
+    if(webLoopStats.wsEvents != wsEvents || webPending()){
+      webLoopStats.skippedWaits++;
+      woke = false;
+      continue;
+    }
+    woke = webWaitForEvent(WEB_EVENT_TIMEOUT);
+    wokeAt = micros();
+    #else
+    vTaskDelay((const TickType_t) WEB_POLL_INTERVAL / portTICK_PERIOD_MS);
+    #endif
   }
   #endif
 }
@@ -822,6 +1503,8 @@ void processProvisionResponse(const Provision_Data &data)
           strlcpy(config.accTkn, data[CREDENTIALS_VALUE].as<std::string>().c_str(), sizeof(config.accTkn));
           config.provSent = true;  
           FLAG_SAVE_CONFIG = true;
+          // A freshly provisioned device has no client attributes on the server yet.
+          FLAG_SYNC_CLIENT_ATTR_FULL = true;
           log_manager->verbose(PSTR(__func__),PSTR("Access token provision response saved.\n"));
         }
         else if (strncmp(data[CREDENTIALS_TYPE], PSTR("MQTT_BASIC"), strlen(PSTR("MQTT_BASIC"))) == 0) {
@@ -851,72 +1534,228 @@ void processProvisionResponse(const Provision_Data &data)
 }
 
 
-void TBTR(void *arg){
-  while(true){
-    if(!config.provSent){
-      if (tb.connect(config.broker, "provision", config.port)) {
-        const Provision_Callback provisionCallback(Access_Token(), &processProvisionResponse, config.provDK, config.provDS, config.name);
-        if(tb.Provision_Request(provisionCallback))
-        {
-          log_manager->info(PSTR(__func__),PSTR("Connected to provisioning server: %s:%d. Sending provisioning response: DK: %s, DS: %s, Name: %s \n"),  
-            config.broker, config.port, config.provDK, config.provDS, config.name);
-        }
+/// @brief Schedules the next attempt. Transport and TLS failures back off quickly since they clear up on
+/// their own; rejected credentials back off much longer and eventually trigger provisioning again.
+void tbBackoff(bool authFailure){
+  BackoffPolicy &policy = authFailure ? tbAuthBackoff : tbTlsBackoff;
+  unsigned long delayMs = policy.next();
+  tbConnStats.lastBackoffMs = delayMs;
+  tbConnStats.totalBackoffMs += delayMs;
+  TIMER_TB_BACKOFF_UNTIL = millis() + delayMs;
+  tbState = TB_STATE_BACKOFF;
+  log_manager->debug(PSTR(__func__), PSTR("%s failure #%d, next attempt in %dms.\n"),
+    authFailure ? PSTR("Auth") : PSTR("TLS"), policy.failures(), delayMs);
+
+  if(authFailure && config.provSent && tbAuthBackoff.failures() >= TB_AUTH_FAILURES_REPROVISION){
+    if( xSemaphoreConfig != NULL ){
+      if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
+      {
+        config.provSent = 0;
+        xSemaphoreGive( xSemaphoreConfig );
+        tbConnStats.reprovisions++;
+        tbAuthBackoff.reset();
+        log_manager->warn(PSTR(__func__), PSTR("Broker keeps rejecting the access token, provisioning again.\n"));
       }
       else
       {
-        log_manager->warn(PSTR(__func__),PSTR("Failed to connect to provisioning server: %s:%d\n"),  config.broker, config.port);
-      }
-      unsigned long timer = millis();
-      while(true){
-        tb.loop();
-        if(config.provSent || (millis() - timer) > 10000){break;}
-        vTaskDelay((const TickType_t)10 / portTICK_PERIOD_MS);
+        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
       }
     }
-    else{
-      if(!tb.connected())
-      {
-        log_manager->warn(PSTR(__func__),PSTR("IoT disconnected!\n"));
+  }
+}
+
+/// @brief Schedules the next provisioning round. Rounds back off like connects, and after
+/// TB_PROVISION_RETRIES failures in a row the device waits TB_PROVISION_PAUSE before asking again.
+void tbProvisionFailed(bool authFailure){
+  tbConnStats.provisionFailures++;
+  if(++TB_PROVISION_FAILURES < TB_PROVISION_RETRIES){
+    tbBackoff(authFailure);
+    return;
+  }
+  TB_PROVISION_FAILURES = 0;
+  tbAuthBackoff.reset();
+  tbTlsBackoff.reset();
+  TIMER_TB_BACKOFF_UNTIL = millis() + TB_PROVISION_PAUSE;
+  tbState = TB_STATE_BACKOFF;
+  log_manager->warn(PSTR(__func__), PSTR("Provisioning failed %d times, pausing for %ds.\n"), TB_PROVISION_RETRIES, TB_PROVISION_PAUSE / 1000);
+}
+
+void tbOnConnected(){
+  bool tbSharedUpdate_status = tb.Shared_Attributes_Subscribe(tbSharedAttrUpdateCb);
+  bool tbClientRPC_status = tb.RPC_Subscribe(clientRPCCallbacks.cbegin(), clientRPCCallbacks.cend());
+  tb.Firmware_Send_Info(CURRENT_FIRMWARE_TITLE, CURRENT_FIRMWARE_VERSION); 
+  tb.Firmware_Send_State(PSTR("updated"));
+  tb.Shared_Attributes_Request(fwCheckCb);
+
+  LAST_TB_CONNECTED = millis();
+  tbTlsBackoff.reset();
+  tbAuthBackoff.reset();
+  tbConnStats.connects++;
+
+  setAlarm(0, 0, 3, 50);
+  log_manager->info(PSTR(__func__),PSTR("IoT Connected! (attempt %d, %dms)\n"), tbConnStats.attempts, tbConnStats.lastConnectMs);
+  #ifdef USE_TLS_RESUMPTION
+  tlsSessionPersist();
+  const TlsHandshakeStats &tls = ssl.stats();
+  // The handshake ran on this stack, the high-water mark includes it.
+  log_manager->debug(PSTR(__func__), PSTR("TLS handshake %dms (%s). Full: %d, avg %dms. Resumed: %d, avg %dms. Not resumed: %d. Stack: %d of %d bytes never used.\n"),
+    tls.lastMs, tls.lastResumed ? PSTR("resumed") : PSTR("full"),
+    tls.full, tls.full > 0 ? (unsigned long)(tls.fullMs / tls.full) : 0,
+    tls.resumed, tls.resumed > 0 ? (unsigned long)(tls.resumedMs / tls.resumed) : 0, tls.resumeMisses,
+    uxTaskGetStackHighWaterMark(NULL), STACKSIZE_TB);
+  #endif
+}
+
+void TBTR(void *arg){
+  while(true){
+    switch(tbState){
+      case TB_STATE_DISCONNECTED:
         onTbDisconnectedCb();
+        log_manager->debug(PSTR(__func__), PSTR("Publish queue: %d sent, %d stored, %d failed, %d rejected, depth max %d, latency avg %dms max %dms.\n"),
+          tbPublishStats.published, tbPublishStats.stored, tbPublishStats.failed, tbPublishStats.rejected, tbPublishStats.depthMax,
+          tbPublishStats.published > 0 ? (unsigned long)(tbPublishStats.latencySum / tbPublishStats.published) : 0, tbPublishStats.latencyMax);
+        log_manager->debug(PSTR(__func__), PSTR("Connection: %d attempts, %d connects, %d disconnects, %d TLS / %d auth failures, %d reprovisions, %dms backed off.\n"),
+          tbConnStats.attempts, tbConnStats.connects, tbConnStats.disconnects, tbConnStats.tlsFailures, tbConnStats.authFailures,
+          tbConnStats.reprovisions, tbConnStats.totalBackoffMs);
+        log_manager->debug(PSTR(__func__), PSTR("Stack: %d of %d bytes never used.\n"), uxTaskGetStackHighWaterMark(NULL), STACKSIZE_TB);
+        log_manager->debug(PSTR(__func__), PSTR("Provisioning: %d rounds, %d failed, %d timed out, last took %dms.\n"),
+          tbConnStats.provisions, tbConnStats.provisionFailures, tbConnStats.provisionTimeouts, tbConnStats.lastProvisionMs);
+        #ifdef USE_TB_DELIVERY_ACK
+        log_manager->debug(PSTR(__func__), PSTR("Delivery: %d sent, %d confirmed, %d retransmitted, %d refused, %d too large, %d in flight, %d fences (%d unanswered, %d late, %d not requested), fence rtt %dms max %dms.\n"),
+          tbDeliveryWindow.stats().sent, tbDeliveryWindow.stats().delivered, tbDeliveryWindow.stats().retransmits, tbDeliveryWindow.stats().refused,
+          tbDeliveryWindow.stats().oversize, tbDeliveryWindow.count(),
+          tbDeliveryWindow.stats().fences, tbDeliveryWindow.stats().fenceTimeouts, tbDeliveryWindow.stats().staleAnswers,
+          tbDeliveryWindow.stats().fenceFailures, tbDeliveryWindow.stats().fenceRttLast, tbDeliveryWindow.stats().fenceRttMax);
+        #endif
+        #ifdef USE_MSGPACK_PAYLOAD
+        if(payloadCodec.stats().encoded > 0){
+          const PayloadCodecStats &codec = payloadCodec.stats();
+          log_manager->debug(PSTR(__func__), PSTR("MessagePack: %d payloads, %d -> %d bytes, %dus avg, %d sent as JSON, %d unparsable, %d probes unanswered.\n"),
+            codec.encoded, (uint32_t)codec.jsonBytes, (uint32_t)codec.encodedBytes, (uint32_t)(codec.encodeMicros / codec.encoded),
+            codec.skipped, codec.failed, MSGPACK_PROBE_FAILURES);
+        }
+        #endif
+        // Even the first retry is jittered, every device saw the same outage end at the same time.
+        tbBackoff(false);
+        break;
+
+      case TB_STATE_BACKOFF:
+        if((long)(millis() - TIMER_TB_BACKOFF_UNTIL) >= 0 && WiFi.isConnected()){
+          tbState = config.provSent ? TB_STATE_CONNECTING : TB_STATE_PROVISIONING;
+        }
+        break;
+
+      case TB_STATE_CONNECTING:
+      {
         log_manager->info(PSTR(__func__),PSTR("Connecting to broker %s:%d\n"), config.broker, config.port);
-        uint8_t tbDisco = 0;
-        while(!tb.connect(config.broker, config.accTkn, config.port, config.name)){  
-          tbDisco++;
-          log_manager->warn(PSTR(__func__),PSTR("Failed to connect to IoT Broker %s (%d)\n"), config.broker, tbDisco);
-          if(tbDisco >= 10){
-            if( xSemaphoreConfig != NULL ){
-              if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
-              {
-                config.provSent = 0;
-                xSemaphoreGive( xSemaphoreConfig );
-              }
-              else
-              {
-                log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-              }
-            }
-            tbDisco = 0;
-            break;
+        tbConnStats.attempts++;
+        unsigned long startMillis = millis();
+        if(tb.connect(config.broker, config.accTkn, config.port, config.name)){
+          tbConnStats.lastConnectMs = millis() - startMillis;
+          tbState = TB_STATE_CONNECTED;
+          tbOnConnected();
+        }
+        else{
+          char error[64];
+          tbConnStats.lastTlsError = ssl.lastError(error, sizeof(error));
+          tbConnStats.lastConnack = mqttTransport.connackCode();
+          // Only a CONNACK refusing the credentials counts against the token. A broker that is unavailable
+          // or never answers the CONNECT says nothing about it and must not make the device provision again.
+          bool authFailure = mqttTransport.authRefused();
+          if(authFailure){tbConnStats.authFailures++;}
+          else{tbConnStats.tlsFailures++;}
+          if(tbConnStats.lastConnack > CONNACK_ACCEPTED){
+            snprintf(error, sizeof(error), PSTR("CONNACK %d"), tbConnStats.lastConnack);
           }
-          vTaskDelay((const TickType_t)1000 / portTICK_PERIOD_MS);
+          log_manager->warn(PSTR(__func__),PSTR("Failed to connect to IoT Broker %s (%s)\n"), config.broker,
+            authFailure ? PSTR("rejected") : error);
+          tbBackoff(authFailure);
         }
+        break;
+      }
 
-        if(tb.connected()){
-          bool tbSharedUpdate_status = tb.Shared_Attributes_Subscribe(tbSharedAttrUpdateCb);
-          bool tbClientRPC_status = tb.RPC_Subscribe(clientRPCCallbacks.cbegin(), clientRPCCallbacks.cend());
-          tb.Firmware_Send_Info(CURRENT_FIRMWARE_TITLE, CURRENT_FIRMWARE_VERSION); 
-          tb.Firmware_Send_State(PSTR("updated"));
-          tb.Shared_Attributes_Request(fwCheckCb);
+      case TB_STATE_PROVISIONING:
+        tbConnStats.provisions++;
+        TIMER_TB_PROVISION_START = millis();
+        if (tb.connect(config.broker, "provision", config.port)) {
+          const Provision_Callback provisionCallback(Access_Token(), &processProvisionResponse, config.provDK, config.provDS, config.name);
+          if(tb.Provision_Request(provisionCallback))
+          {
+            log_manager->info(PSTR(__func__),PSTR("Connected to provisioning server: %s:%d. Sending provisioning response: DK: %s, DS: %s, Name: %s \n"),  
+              config.broker, config.port, config.provDK, config.provDS, config.name);
+            // The answer arrives through tb.loop() below, the task keeps draining and looping meanwhile.
+            tbState = TB_STATE_PROVISION_WAIT;
+          }
+          else
+          {
+            tb.disconnect();
+            tbProvisionFailed(false);
+          }
+        }
+        else
+        {
+          log_manager->warn(PSTR(__func__),PSTR("Failed to connect to provisioning server: %s:%d\n"),  config.broker, config.port);
+          tbProvisionFailed(false);
+        }
+        break;
 
-          LAST_TB_CONNECTED = millis();
+      case TB_STATE_PROVISION_WAIT:
+        if(config.provSent){
+          tbConnStats.lastProvisionMs = millis() - TIMER_TB_PROVISION_START;
+          TB_PROVISION_FAILURES = 0;
+          tbAuthBackoff.reset();
+          tbTlsBackoff.reset();
+          log_manager->info(PSTR(__func__), PSTR("Provisioned in %dms.\n"), tbConnStats.lastProvisionMs);
+          // With USE_TLS_RESUMPTION this connect resumes the session of the provisioning connection.
+          tbState = TB_STATE_CONNECTING;
+        }
+        else if(!tb.connected()){
+          // processProvisionResponse() hangs up after an answer, without credentials it was a refusal.
+          tbProvisionFailed(true);
+        }
+        else if(millis() - TIMER_TB_PROVISION_START > TB_PROVISION_TIMEOUT){
+          tbConnStats.provisionTimeouts++;
+          tb.disconnect();
+          tbProvisionFailed(false);
+        }
+        break;
 
-          setAlarm(0, 0, 3, 50);
-          log_manager->info(PSTR(__func__),PSTR("IoT Connected!\n"));
+      case TB_STATE_CONNECTED:
+        if(!tb.connected()){
+          tbConnStats.disconnects++;
+          #ifdef USE_TB_DELIVERY_ACK
+          tbDeliveryWindow.connectionLost();
+          #endif
+          #ifdef USE_MSGPACK_PAYLOAD
+          // The next connection may end up at an endpoint that only reads JSON, it has to prove itself again.
+          FLAG_MSGPACK_CONFIRMED = false;
+          MSGPACK_PROBE_NONCE = 0;
+          #endif
+          log_manager->warn(PSTR(__func__),PSTR("IoT disconnected!\n"));
+          tbState = TB_STATE_DISCONNECTED;
         }
-      }
+        break;
     }
 
     tb.loop();
+    #ifdef USE_MSGPACK_PAYLOAD
+    tbMsgPackProbe();
+    #endif
+    tbPublishDrain();
+    #ifdef USE_OFFLINE_STORE
+    if(tb.connected() && !offlineStore.empty() && (millis() - LAST_TB_CONNECTED) > 2000 &&
+      (millis() - TIMER_OFFLINE_REPLAY) >= OFFLINE_REPLAY_INTERVAL){
+      TIMER_OFFLINE_REPLAY = millis();
+      offlineStoreReplay();
+    }
+    #endif
+    if(tb.connected() && !telemetryBatcher.empty()){
+      if( xSemaphoreTelemetryBatch != NULL && xSemaphoreTake( xSemaphoreTelemetryBatch, ( TickType_t ) 0 ) == pdTRUE )
+      {
+        telemetryBatcher.poll();
+        xSemaphoreGive( xSemaphoreTelemetryBatch );
+      }
+    }
     vTaskDelay((const TickType_t) 1 / portTICK_PERIOD_MS);
   }
 }
@@ -924,10 +1763,8 @@ void TBTR(void *arg){
 
 void emitAlarm(int code){
   if(tb.connected()){
-    StaticJsonDocument<32> doc;
-    doc[PSTR("alarm")] = code;
     char buffer[32];
-    serializeJson(doc, buffer);
+    serializeJsonLayout(jsonLayout(jsonSlot(PSTR("alarm"), code)), buffer, sizeof(buffer));
     tbSendTelemetry(buffer);
   }
   emitAlarmCb(code);
@@ -1069,6 +1906,8 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
         // Remove client from maps
         clientAuthenticationStatus.erase(client->id());
         clientAuthAttemptTimestamps.erase(clientIP);
+        wsTopicsDrop(client->id());
+        wsSessions.dropNonce(client->id());
 
         if( xSemaphoreConfig != NULL ){
           if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
@@ -1094,7 +1933,10 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
         log_manager->verbose(PSTR(__func__), PSTR("New client arrived [%s]\n"), client->remoteIP().toString().c_str());
         // Initialize client as unauthenticated
         clientAuthenticationStatus[client->id()] = false;
-        // Initialize timestamp for rate limiting
+        // Challenge for the login, a client holding a session token may ignore it
+        char challenge[96];
+        snprintf(challenge, sizeof(challenge), PSTR("{\"challenge\": {\"nonce\": \"%s\"}}"), wsSessions.issueNonce(client->id(), millis()));
+        client->text(challenge);
       }
       break;
     case WS_EVT_DATA:
@@ -1112,6 +1954,24 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
         // If client is not authenticated, check credentials
         if(!clientAuthenticationStatus[client->id()]) {
           unsigned long currentTime = millis();
+
+          // A token from an earlier login resumes the session, without a challenge and outside the rate limit.
+          if(doc["token"].is<const char*>()){
+            char token[WS_TOKEN_SIZE];
+            strlcpy(token, doc["token"].as<const char*>(), sizeof(token));
+            if(wsSessions.resume(token, sizeof(token), currentTime)){
+              log_manager->debug(PSTR(__func__), PSTR("ws [%u] resumed its session.\n"), client->id());
+              wsAuthorized(client, token);
+            }
+            else{
+              char reply[128];
+              snprintf(reply, sizeof(reply), PSTR("{\"status\": {\"code\": 401, \"msg\": \"Session expired.\", \"nonce\": \"%s\"}}"),
+                wsSessions.issueNonce(client->id(), currentTime));
+              client->text(reply);
+            }
+            return;
+          }
+
           unsigned long lastAttemptTime = clientAuthAttemptTimestamps[clientIP];
 
           if (currentTime - lastAttemptTime < config.rateLimitInterval) {
@@ -1131,39 +1991,39 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
             return;
           }
           else{
-            if(doc["salt"] == nullptr || doc["auth"] == nullptr){
+            if(doc["auth"] == nullptr){
               //client->text(PSTR("{\"status\": {\"code\": 401, \"msg\": \"Unauthorized.\"}}"));
               //client->close();
               return;
             }
 
-            const char* salt = doc["salt"];
             const char* auth = doc["auth"];
-
-            char hashedApiKey[65];          
-            hashApiKeyWithSalt(config.webApiKey, salt, hashedApiKey);
+            char hashedApiKey[WS_HMAC_HEX_SIZE];
+            bool challenged = false;
+            bool legacy = false;
+            #if WS_AUTH_CLIENT_SALT
+            if(doc["salt"] != nullptr){
+              hashApiKeyWithSalt(config.webApiKey, doc["salt"].as<const char*>(), hashedApiKey);
+              challenged = true;
+              legacy = true;
+            }
+            #endif
+            if(!challenged){
+              // The nonce is gone after this attempt, whatever its outcome, so an answer works once.
+              char nonce[WS_NONCE_SIZE];
+              if(wsSessions.takeNonce(client->id(), nonce, sizeof(nonce), currentTime)){
+                hashApiKeyWithSalt(config.webApiKey, nonce, hashedApiKey);
+                challenged = true;
+              }
+            }
           
-            if (strcmp(auth, hashedApiKey) == 0) {
-              // Client authenticated successfully, update the status in the map
-              clientAuthenticationStatus[client->id()] = true;
-              if( xSemaphoreConfig != NULL ){
-                if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
-                {
-                  config.wsCount++;
-                  xSemaphoreGive( xSemaphoreConfig );
-                }
-                else
-                {
-                    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-                }
+            char token[WS_TOKEN_SIZE];
+            if (challenged && WsSessionStore::equals(auth, hashedApiKey) && wsSessions.issueToken(token, sizeof(token), currentTime)) {
+              if(legacy){
+                wsLegacyLogins++;
+                log_manager->warn(PSTR(__func__), PSTR("Client %d logged in with its own salt, that answer can be replayed.\n"), client->id());
               }
-              char broadcastModel[128];
-              sprintf(broadcastModel, PSTR("{\"status\": {\"code\": 200, \"msg\": \"Authorized.\", \"model\": \"%s\"}}"), config.model);
-              client->text(broadcastModel);
-              log_manager->debug(PSTR(__func__), PSTR("ws [%u] authenticated. WsCount: %d\n"), client->id(), config.wsCount);
-              doc["evType"] = (int)WS_EVT_CONNECT;
-              doc["num"] = client->id();
-              wsEventCb(doc);
+              wsAuthorized(client, token);
             } else {
               // Unauthorized, you can choose to disconnect the client
               client->text(PSTR("{\"status\": {\"code\": 401, \"msg\": \"Unauthorized.\"}}"));
@@ -1179,6 +2039,9 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
           if (err == DeserializationError::Ok)
           {
             log_manager->debug(PSTR(__func__), PSTR("WS message parsing %s\n"), err.c_str());
+            if(wsProcessSubscription(client->id(), doc)){
+              return;
+            }
             doc["evType"] = (int)WS_EVT_DATA;
             doc["num"] = client->id();
             wsEventCb(doc);
@@ -1200,9 +2063,38 @@ void onWsEventCb(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEven
       break;	
   }
 }
+
+/// @brief Marks client as logged in and hands it the session token it can resume with.
+void wsAuthorized(AsyncWebSocketClient *client, const char *token){
+  // Client authenticated successfully, update the status in the map
+  clientAuthenticationStatus[client->id()] = true;
+  wsTopicsSet(client->id(), WS_TOPIC_DEFAULT);
+  if( xSemaphoreConfig != NULL ){
+    if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      config.wsCount++;
+      xSemaphoreGive( xSemaphoreConfig );
+    }
+    else
+    {
+        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  char broadcastModel[224];
+  snprintf(broadcastModel, sizeof(broadcastModel), PSTR("{\"status\": {\"code\": 200, \"msg\": \"Authorized.\", \"model\": \"%s\", \"token\": \"%s\", \"ttl\": %lu}}"),
+    config.model, token, (unsigned long)WS_SESSION_TTL / 1000);
+  client->text(broadcastModel);
+  log_manager->debug(PSTR(__func__), PSTR("ws [%u] authenticated. WsCount: %d\n"), client->id(), config.wsCount);
+  StaticJsonDocument<64> root;
+  JsonObject doc = root.to<JsonObject>();
+  doc["evType"] = (int)WS_EVT_CONNECT;
+  doc["num"] = client->id();
+  wsEventCb(doc);
+}
 #endif
 #ifndef USE_ASYNC_WEB
 void onWsEventCb(uint8_t num, WStype_t type, uint8_t * data, size_t length){
+  webLoopStats.wsEvents++;
   StaticJsonDocument<DOCSIZE_MIN> root;
   JsonObject doc = root.to<JsonObject>();
   switch(type) {
@@ -1222,6 +2114,7 @@ void onWsEventCb(uint8_t num, WStype_t type, uint8_t * data, size_t length){
           }
         }
         
+        wsTopicsDrop(num);
         log_manager->debug(PSTR(__func__), PSTR("ws [%u] disconnect. WsCount: %d\n"), num, config.wsCount);
         doc["evType"] = (int)WStype_DISCONNECTED;
         doc["num"] = num;
@@ -1241,6 +2134,7 @@ void onWsEventCb(uint8_t num, WStype_t type, uint8_t * data, size_t length){
               log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
           }
         }
+        wsTopicsSet(num, WS_TOPIC_DEFAULT);
         log_manager->debug(PSTR(__func__), PSTR("ws [%u] connect. WsCount: %d\n"), num, config.wsCount);
         doc["evType"] = (int)WStype_CONNECTED;
         doc["num"] = num;
@@ -1253,6 +2147,9 @@ void onWsEventCb(uint8_t num, WStype_t type, uint8_t * data, size_t length){
         if (err == DeserializationError::Ok)
         {
           log_manager->debug(PSTR(__func__), PSTR("WS message parsing %s\n"), err.c_str());
+          if(wsProcessSubscription(num, doc)){
+            return;
+          }
           doc["evType"] = (int)WStype_TEXT;
           doc["num"] = num;
           wsEventCb(doc);
@@ -1277,24 +2174,27 @@ void onWsEventCb(uint8_t num, WStype_t type, uint8_t * data, size_t length){
 #endif
 
 void setBuzzer(int32_t beepCount, uint16_t beepDelay){
-  StaticJsonDocument<DOCSIZE_MIN> doc;
-  JsonObject params = doc.createNestedObject("params");
-  doc["method"] = "sBuz";
-  params["beepCount"] = beepCount;
-  params["beepDelay"] = beepDelay;
-  serialWriteToCoMcu(doc, 0);
+  char buffer[128];
+  serializeJsonLayout(jsonLayout(
+    jsonSlot("params", jsonLayout(
+      jsonSlot("beepCount", beepCount),
+      jsonSlot("beepDelay", beepDelay))),
+    jsonSlot("method", "sBuz")), buffer, sizeof(buffer));
+  serialWriteToCoMcu(buffer);
 }
 
 void setLed(uint8_t r, uint8_t g, uint8_t b, uint8_t isBlink, int32_t blinkCount, uint16_t blinkDelay){
-  StaticJsonDocument<DOCSIZE_MIN> doc;
-  JsonObject params = doc.createNestedObject("params");
-  params["r"] = r;
-  params["g"] = g;
-  params["b"] = b;
-  params["isBlink"] = isBlink;
-  params["blinkCount"] = blinkCount;
-  params["blinkDelay"] = blinkDelay;
-  serialWriteToCoMcu(doc, 0);
+  char buffer[128];
+  serializeJsonLayout(jsonLayout(
+    jsonSlot("params", jsonLayout(
+      jsonSlot("r", r),
+      jsonSlot("g", g),
+      jsonSlot("b", b),
+      jsonSlot("isBlink", isBlink),
+      jsonSlot("blinkCount", blinkCount),
+      jsonSlot("blinkDelay", blinkDelay))),
+    jsonSlot("method", "sLed")), buffer, sizeof(buffer));
+  serialWriteToCoMcu(buffer);
 }
 
 void setLed(uint8_t color, uint8_t isBlink, int32_t blinkCount, uint16_t blinkDelay){
@@ -1342,16 +2242,17 @@ uint8_t r, g, b;
     g = configcomcu.lON;
     b = configcomcu.lON;
   }
-  StaticJsonDocument<DOCSIZE_MIN> doc;
-  doc["method"] = "sLed";
-  JsonObject params = doc.createNestedObject("params");
-  params["r"] = r;
-  params["g"] = g;
-  params["b"] = b;
-  params["isBlink"] = isBlink;
-  params["blinkCount"] = blinkCount;
-  params["blinkDelay"] = blinkDelay;
-  serialWriteToCoMcu(doc, 0);
+  char buffer[128];
+  serializeJsonLayout(jsonLayout(
+    jsonSlot("method", "sLed"),
+    jsonSlot("params", jsonLayout(
+      jsonSlot("r", r),
+      jsonSlot("g", g),
+      jsonSlot("b", b),
+      jsonSlot("isBlink", isBlink),
+      jsonSlot("blinkCount", blinkCount),
+      jsonSlot("blinkDelay", blinkDelay)))), buffer, sizeof(buffer));
+  serialWriteToCoMcu(buffer);
 }
 
 void setAlarm(uint16_t code, uint8_t color, int32_t blinkCount, uint16_t blinkDelay){
@@ -1395,6 +2296,9 @@ void reboot(int countdown = 0)
   }
   else{
     log_manager->warn(PSTR(__func__),PSTR("Device rebooting...\n"));
+    #ifdef USE_OFFLINE_STORE
+    offlineStoreSync();
+    #endif
     /*esp_task_wdt_init(1,true);
     esp_task_wdt_add(NULL);
     while(true);*/
@@ -1458,6 +2362,7 @@ void configReset()
 
       doc["logIP"] = "255.255.255.255";
       doc["logPrt"] = 29514;
+      doc["pEnc"] = PAYLOAD_ENCODING_JSON;
 
       doc["webApiKey"] = webApiKey;
 
@@ -1537,6 +2442,7 @@ void configLoadFailSafe()
       strlcpy(config.htP, "defaultkey", sizeof(config.htP));
       strlcpy(config.logIP, "255.255.255.255", sizeof(config.logIP));
       config.logPrt = 29514;
+      config.pEnc = PAYLOAD_ENCODING_JSON;
 
       xSemaphoreGive( xSemaphoreConfig );
     }
@@ -1616,6 +2522,7 @@ void configLoad()
         if(doc["logIP"] != nullptr){strlcpy(config.logIP, doc["logIP"].as<const char*>(), sizeof(config.logIP));}
         if(doc["webApiKey"] != nullptr){strlcpy(config.webApiKey, doc["webApiKey"].as<const char*>(), sizeof(config.webApiKey));}
         if(doc["logPrt"] != nullptr){config.logPrt = doc["logPrt"].as<uint16_t>();}
+        if(doc["pEnc"] != nullptr){config.pEnc = doc["pEnc"].as<uint8_t>();}
 
         int jsonSize = JSON_STRING_SIZE(measureJson(doc));
         char buffer[jsonSize];
@@ -1678,6 +2585,7 @@ void configSave()
 
       doc["logIP"] = config.logIP;
       doc["logPrt"] = config.logPrt;
+      doc["pEnc"] = config.pEnc;
 
       serializeJson(doc, file);
       file.close();
@@ -1717,6 +2625,7 @@ void configCoMCUReset()
       doc["pLG"] = 5;
       doc["pLB"] = 6;
       doc["lON"] = 0;
+      doc["bdR"] = COMCU_BAUD_DEFAULT;
 
       serializeJson(doc, file);
       file.close();
@@ -1758,6 +2667,7 @@ void configCoMCULoad()
         if(doc["pLG"] != nullptr){configcomcu.pLG = doc["pLG"].as<uint8_t>();}
         if(doc["pLB"] != nullptr){configcomcu.pLB = doc["pLB"].as<uint8_t>();}
         if(doc["lON"] != nullptr){configcomcu.lON = doc["lON"].as<uint8_t>();}
+        if(doc["bdR"] != nullptr){configcomcu.bdR = doc["bdR"].as<uint32_t>();}
 
         log_manager->info(PSTR(__func__),PSTR("ConfigCoMCU loaded successfuly.\n"));
       }
@@ -1800,6 +2710,7 @@ void configCoMCUSave()
       doc["pLG"] = configcomcu.pLG;
       doc["pLB"] = configcomcu.pLB;
       doc["lON"] = configcomcu.lON;
+      doc["bdR"] = configcomcu.bdR;
 
       serializeJson(doc, file);
       file.close();
@@ -1816,6 +2727,9 @@ void configCoMCUSave()
 void syncConfigCoMCU()
 {
   configCoMCULoad();
+  if(!FLAG_COMCU_BAUD_NEGOTIATED){
+    negotiateCoMCUBaud();
+  }
   if( xSemaphoreConfigCoMCU != NULL ){
     if( xSemaphoreTake( xSemaphoreConfigCoMCU, ( TickType_t ) 1000 ) == pdTRUE )
     {
@@ -1860,9 +2774,15 @@ bool loadFile(const char* filePath, char *buffer)
   return true;
 }
 
+void setCoMCUStream(Stream &stream)
+{
+  coMcuStream = &stream;
+  coMcuLink.begin(stream);
+}
+
 void serialWriteToCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, bool isRpc, int wait)
 {
-  if( xSemaphoreSerialCoMCUWrite != NULL ){
+  if( xSemaphoreSerialCoMCUWrite != NULL && coMcuStream != NULL ){
       /* See if we can obtain the semaphore.  If the semaphore is not
       available wait 10 ticks to see if it becomes free. */
       if( xSemaphoreTake( xSemaphoreSerialCoMCUWrite, ( TickType_t ) wait ) == pdTRUE )
@@ -1871,17 +2791,27 @@ void serialWriteToCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, bool isRpc, int wa
           shared resource. */
 
           //long startMillis = millis();
-          serializeJson(doc, Serial2);
-          StringPrint stream;
-          serializeJson(doc, stream);
-          String result = stream.str();
+          char frame[DOCSIZE_MIN];
+          size_t len = measureJson(doc) < sizeof(frame) ? serializeJson(doc, frame, sizeof(frame)) : 0;
+          if(len == 0)
+          {
+            log_manager->warn(PSTR(__func__), PSTR("Message does not fit into a CoMCU frame, not sent.\n"));
+            doc.clear();
+            xSemaphoreGive( xSemaphoreSerialCoMCUWrite );
+            return;
+          }
+          if(isRpc)
+          {
+            // A reply that arrived after its exchange timed out would otherwise be taken for this one.
+            coMcuLink.flush();
+          }
+          coMcuLink.write(frame, len);
           if(config.logLev == 6){
-            log_manager->verbose(PSTR(__func__),PSTR("Sent to CoMCU: %s\n"), result.c_str());
+            log_manager->verbose(PSTR(__func__),PSTR("Sent to CoMCU: %s\n"), frame);
           }
           
           if(isRpc)
           {
-            vTaskDelay((const TickType_t) wait / portTICK_PERIOD_MS);
             doc.clear();
             serialReadFromCoMcu(doc, wait);
           }
@@ -1900,9 +2830,31 @@ void serialWriteToCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, bool isRpc, int wa
   }
 }
 
+void serialWriteToCoMcu(const char *buffer, int wait)
+{
+  if(*buffer == 0x00){
+    log_manager->verbose(PSTR(__func__),PSTR("Empty message, nothing sent to CoMCU.\n"));
+    return;
+  }
+  if( xSemaphoreSerialCoMCUWrite != NULL && coMcuStream != NULL ){
+      if( xSemaphoreTake( xSemaphoreSerialCoMCUWrite, ( TickType_t ) wait ) == pdTRUE )
+      {
+          coMcuLink.write(buffer, strlen(buffer));
+          if(config.logLev == 6){
+            log_manager->verbose(PSTR(__func__),PSTR("Sent to CoMCU: %s\n"), buffer);
+          }
+          xSemaphoreGive( xSemaphoreSerialCoMCUWrite );
+      }
+      else
+      {
+          log_manager->debug(PSTR(__func__), PSTR("Unable to get semaphore.\n"));
+      }
+  }
+}
+
 void serialReadFromCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, int wait)
 {
-  if( xSemaphoreSerialCoMCURead != NULL ){
+  if( xSemaphoreSerialCoMCURead != NULL && coMcuStream != NULL ){
       /* See if we can obtain the semaphore.  If the semaphore is not
       available wait 10 ticks to see if it becomes free. */
       if( xSemaphoreTake( xSemaphoreSerialCoMCURead, ( TickType_t ) 10000 ) == pdTRUE )
@@ -1911,21 +2863,28 @@ void serialReadFromCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, int wait)
           shared resource. */
 
           //long startMillis = millis();
-          StringPrint stream;
-          String result;
-          ReadLoggingStream loggingStream(Serial2, stream);
-          DeserializationError err = deserializeJson(doc, loggingStream);
-          result = stream.str();
+          // The frame is read whole first, so noise or a truncated reply is skipped by the framer
+          // instead of being left on the link for the next exchange.
+          char frame[DOCSIZE_MIN];
+          size_t len = coMcuLink.readFrame(frame, sizeof(frame), coMcuStream->getTimeout());
+          DeserializationError err = len > 0 ? deserializeJson(doc, (const char*)frame, len) : DeserializationError::IncompleteInput;
           if (err == DeserializationError::Ok)
           {
+            COMCU_READ_ERRORS = 0;
             if(config.logLev == 6){
-              log_manager->verbose(PSTR(__func__),PSTR("Received from CoMCU: %s\n"), result.c_str());
+              log_manager->verbose(PSTR(__func__),PSTR("Received from CoMCU: %s\n"), frame);
             }
           }
           else
           {
-            log_manager->verbose(PSTR(__func__),PSTR("Serial2CoMCU DeserializeJson() returned: %s, content: %s\n"), err.c_str(), result.c_str());
-            return;
+            log_manager->verbose(PSTR(__func__),PSTR("Serial2CoMCU DeserializeJson() returned: %s, content: %s\n"), err.c_str(), len > 0 ? frame : "");
+            doc.clear();
+            // A link that keeps garbling replies is renegotiated, which falls back to a slower rate.
+            if(++COMCU_READ_ERRORS >= 3 && FLAG_COMCU_BAUD_NEGOTIATED){
+              COMCU_READ_ERRORS = 0;
+              FLAG_COMCU_BAUD_NEGOTIATED = false;
+              FLAG_SYNC_CONFIGCOMCU = true;
+            }
           }
           //log_manager->verbose(PSTR(__func__), PSTR("Executed (%dms).\n"), millis() - startMillis);
 
@@ -1943,6 +2902,70 @@ void serialReadFromCoMcu(StaticJsonDocument<DOCSIZE_MIN> &doc, int wait)
 }
 
 
+/// @brief Agrees on the fastest baud rate the CoMCU link holds, see CoMCUBaudNegotiator.
+/// The persisted configcomcu.bdR is tried first, then COMCU_BAUD_RATES from fastest to slowest.
+/// A link that was renegotiated because it kept garbling replies drops to COMCU_BAUD_DEFAULT first.
+/// @return The agreed baud rate, or 0 when the CoMCU does not answer or the link is not a negotiable UART.
+uint32_t negotiateCoMCUBaud()
+{
+  #ifdef USE_SERIAL2
+  if(coMcuStream != &Serial2){
+    FLAG_COMCU_BAUD_NEGOTIATED = true;
+    return 0;
+  }
+  const uint32_t rates[] = {COMCU_BAUD_RATES};
+  uint32_t agreed = 0;
+  if( xSemaphoreSerialCoMCUWrite != NULL && xSemaphoreSerialCoMCURead != NULL &&
+    xSemaphoreTake( xSemaphoreSerialCoMCUWrite, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    if( xSemaphoreTake( xSemaphoreSerialCoMCURead, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      CoMCUBaudNegotiator<HardwareSerial> negotiator(coMcuLink, Serial2, coMcuStream->getTimeout(), COMCU_BAUD_FALLBACK_MS);
+      agreed = negotiator.negotiate(rates, countof(rates), configcomcu.bdR);
+      CoMCUBaudStats stats = negotiator.stats();
+      xSemaphoreGive( xSemaphoreSerialCoMCURead );
+      xSemaphoreGive( xSemaphoreSerialCoMCUWrite );
+      if(agreed == 0){
+        // Left unflagged so the next sync tries again, the link already sits at the default.
+        log_manager->warn(PSTR(__func__), PSTR("CoMCU does not answer at %d baud.\n"), COMCU_BAUD_DEFAULT);
+        return 0;
+      }
+      log_manager->info(PSTR(__func__), PSTR("CoMCU link agreed at %d baud (%dms, %d probes, %d fallbacks, %d/%d pings failed).\n"),
+        agreed, stats.elapsedMs, stats.probes, stats.fallbacks, stats.pingFailures, stats.pings);
+    }
+    else
+    {
+      xSemaphoreGive( xSemaphoreSerialCoMCUWrite );
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+      return 0;
+    }
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    return 0;
+  }
+  FLAG_COMCU_BAUD_NEGOTIATED = true;
+
+  if(configcomcu.bdR != agreed){
+    if( xSemaphoreConfigCoMCU != NULL && xSemaphoreTake( xSemaphoreConfigCoMCU, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      configcomcu.bdR = agreed;
+      xSemaphoreGive( xSemaphoreConfigCoMCU );
+      FLAG_SAVE_CONFIGCOMCU = true;
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  return agreed;
+  #else
+  FLAG_COMCU_BAUD_NEGOTIATED = true;
+  return 0;
+  #endif
+}
+
 void readSettings(StaticJsonDocument<DOCSIZE_SETTINGS> &doc, const char* path)
 {
   if( xSemaphoreSettings != NULL ){
@@ -2052,16 +3075,565 @@ void ESP32UDPLogger::log_message(const char *tag, LogLevel level, const char *fm
 #endif
 
 #ifdef USE_WEB_IFACE
+void uiAssetEtag(File &file, const char *path, char *etag, size_t size){
+  // Cached by path hash, a stale entry is caught by its size.
+  uint32_t key = AssetBundle::pathHash(path);
+  uint32_t length = file.size();
+  UiEtag *cached = uiEtags.find(key);
+  if(cached == nullptr || cached->size != length){
+    UiEtag computed = {length, CoMCUUpdater::crc32(file, length)};
+    file.seek(0);
+    cached = &uiEtags.put(key, computed);
+  }
+  uiEtagFormat(etag, size, cached->crc, cached->size);
+}
+
+void uiEtagFormat(char *etag, size_t size, uint32_t crc, uint32_t length){
+  snprintf(etag, size, "\"%08x-%x\"", (unsigned int)crc, (unsigned int)length);
+}
+
+bool uiAssetHashed(const char *path){
+  // Bundlers name files like main.3f9a0c1d2b4e5f60.js or chunk-5XK2QZ7B.js: a run of 8 or more lower case
+  // hex or upper case base32 characters with a digit among them, between a dot or dash and the extension.
+  const char *name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  for(const char *c = name; *c; c++){
+    if(*c != '.' && *c != '-'){
+      continue;
+    }
+    size_t length = 0;
+    bool digit = false, lower = false, upper = false;
+    for(const char *h = c + 1; isdigit((unsigned char)*h) || (*h >= 'a' && *h <= 'f') || isupper((unsigned char)*h); h++, length++){
+      digit = digit || isdigit((unsigned char)*h);
+      lower = lower || islower((unsigned char)*h);
+      upper = upper || isupper((unsigned char)*h);
+    }
+    if(length >= 8 && digit && !(lower && upper) && c[length + 1] == '.'){
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef USE_ASYNC_WEB
+bool UiAssetHandler::canHandle(AsyncWebServerRequest *request){
+  if((request->method() != HTTP_GET && request->method() != HTTP_HEAD) || !request->url().startsWith(_uri)){
+    return false;
+  }
+  request->addInterestingHeader("If-None-Match");
+  return true;
+}
+
+void UiAssetHandler::handleRequest(AsyncWebServerRequest *request){
+  if(_username.length() && _password.length() && !request->authenticate(_username.c_str(), _password.c_str())){
+    return request->requestAuthentication();
+  }
+  String path = _path + request->url().substring(_uri.length());
+  if(path.endsWith("/")){
+    path += "index.html";
+  }
+  else if(path == _path){
+    path += "/index.html";
+  }
+
+  char etag[24];
+  const char *cacheControl = uiAssetHashed(path.c_str()) ? UI_CACHE_IMMUTABLE : "no-cache";
+  bool notModified = false;
+  AsyncWebServerResponse *response = nullptr;
+  const AssetEntry *asset = uiBundle.loaded() ? uiBundle.find(path.c_str() + _path.length()) : nullptr;
+  if(asset != nullptr){
+    AssetEntry entry = *asset;
+    uiEtagFormat(etag, sizeof(etag), entry.crc, entry.length);
+    notModified = request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag;
+    if(!notModified){
+      // Filled on the async_tcp task as the socket drains, straight from the bundle.
+      response = request->beginResponse(AssetBundle::mimeType(entry.mime), entry.length, [entry](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        return uiBundle.read(entry, index, buffer, maxLen);
+      });
+      if(entry.flags & ASSET_FLAG_GZIP){
+        response->addHeader("Content-Encoding", "gzip");
+        uiAssetStats.gzipped++;
+      }
+      uiAssetStats.bytesSent += entry.length;
+    }
+  }
+  else{
+    String served = path;
+    bool gzipped = false;
+    if(!SPIFFS.exists(served)){
+      served += ".gz";
+      gzipped = true;
+      if(!SPIFFS.exists(served)){
+        return request->send(404);
+      }
+    }
+    File file = SPIFFS.open(served, "r");
+    if(!file){
+      return request->send(503);
+    }
+    uiAssetEtag(file, served.c_str(), etag, sizeof(etag));
+    notModified = request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag;
+    if(notModified){
+      file.close();
+    }
+    else{
+      uiAssetStats.bytesSent += file.size();
+      if(gzipped){
+        uiAssetStats.gzipped++;
+      }
+      // Content type comes from the requested path, the .gz name of the file adds Content-Encoding.
+      response = request->beginResponse(file, path);
+    }
+  }
+  uiAssetStats.requests++;
+  if(notModified){
+    response = request->beginResponse(304);
+    uiAssetStats.notModified++;
+  }
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", cacheControl);
+  request->send(response);
+}
+#endif
+
 #ifndef USE_ASYNC_WEB
 void webSendFile(String path, String type){
-  File file = SPIFFS.open(path.c_str(), FILE_READ);
+  String served = path;
+  if(!SPIFFS.exists(served) && SPIFFS.exists(served + ".gz")){
+    served += ".gz";
+  }
+  File file = SPIFFS.open(served.c_str(), FILE_READ);
   if(file){
-    web.streamFile(file, type.c_str(), 200);
+    char etag[24];
+    uiAssetEtag(file, served.c_str(), etag, sizeof(etag));
+    web.sendHeader("ETag", etag);
+    web.sendHeader("Cache-Control", uiAssetHashed(path.c_str()) ? UI_CACHE_IMMUTABLE : "no-cache");
+    uiAssetStats.requests++;
+    if(web.header("If-None-Match") == etag){
+      web.send(304);
+      uiAssetStats.notModified++;
+    }
+    else{
+      // streamFile adds Content-Encoding: gzip by itself when the file name ends in .gz.
+      uiAssetStats.bytesSent += web.streamFile(file, type.c_str(), 200);
+      if(served != path){
+        uiAssetStats.gzipped++;
+      }
+    }
   }else{
     web.send(503, PSTR("text/plain"), PSTR("Server error."));
   }
   file.close();
 }
+
+bool webSendAsset(String uri){
+  if(uri.endsWith("/")){
+    uri += "index.html";
+  }
+  const AssetEntry *asset = uiBundle.loaded() ? uiBundle.find(uri.c_str()) : nullptr;
+  if(asset == nullptr){
+    return false;
+  }
+  AssetEntry entry = *asset;
+  char etag[24];
+  uiEtagFormat(etag, sizeof(etag), entry.crc, entry.length);
+  web.sendHeader("ETag", etag);
+  web.sendHeader("Cache-Control", uiAssetHashed(uri.c_str()) ? UI_CACHE_IMMUTABLE : "no-cache");
+  uiAssetStats.requests++;
+  if(web.header("If-None-Match") == etag){
+    web.send(304);
+    uiAssetStats.notModified++;
+    return true;
+  }
+  if(entry.flags & ASSET_FLAG_GZIP){
+    web.sendHeader("Content-Encoding", "gzip");
+    uiAssetStats.gzipped++;
+  }
+  web.setContentLength(entry.length);
+  web.send(200, AssetBundle::mimeType(entry.mime), "");
+  uint8_t buffer[UI_BUNDLE_CHUNK];
+  for(size_t index = 0; index < entry.length; ){
+    size_t n = uiBundle.read(entry, index, buffer, sizeof(buffer));
+    if(n == 0){
+      break;
+    }
+    web.sendContent((const char *)buffer, n);
+    index += n;
+  }
+  uiAssetStats.bytesSent += entry.length;
+  return true;
+}
+#endif
+
+/// @brief Bearer authentication with the WebSocket API key. An IP gets 429 for rateLimitInterval after a failed attempt.
+int apiAuthorize(const char *authorization, IPAddress ip){
+  unsigned long now = millis();
+  unsigned long *lastFailure = apiFailedAttempts.find(ip);
+  if(lastFailure != nullptr && (long)(now - *lastFailure) < (long)config.rateLimitInterval){
+    return 429;
+  }
+  if(config.webApiKey[0] != '\0' && authorization != nullptr && strncmp(authorization, "Bearer ", 7) == 0 &&
+    WsSessionStore::equals(authorization + 7, config.webApiKey)){
+    apiFailedAttempts.erase(ip);
+    return 200;
+  }
+  apiFailedAttempts.put(ip, now);
+  return 401;
+}
+
+/// @brief Hands cmd with the JSON object in body to wsEventCb, the same way a WS message is. Returns the HTTP status.
+int apiCommand(const char *cmd, const char *body, size_t length){
+  if(wsEventCb == nullptr){
+    return 501;
+  }
+  if(cmd == nullptr || cmd[0] == '\0'){
+    return 404;
+  }
+  StaticJsonDocument<DOCSIZE_MIN> root;
+  if(length > 0 && (deserializeJson(root, body, length) != DeserializationError::Ok || !root.is<JsonObject>())){
+    return 400;
+  }
+  JsonObject doc = length > 0 ? root.as<JsonObject>() : root.to<JsonObject>();
+  // No "num": the command did not come from a WebSocket client.
+  #ifdef USE_ASYNC_WEB
+  int evType = (int)WS_EVT_DATA;
+  #else
+  int evType = (int)WStype_TEXT;
+  #endif
+  if(!doc["cmd"].set(cmd) || !doc["evType"].set(evType)){
+    return 413;
+  }
+  log_manager->debug(PSTR(__func__), PSTR("HTTP command: %s\n"), cmd);
+  wsEventCb(doc);
+  return 202;
+}
+
+size_t apiWriteStatus(Print &out){
+  return serializeJsonLayout(jsonLayout(
+    jsonSlot(PSTR("model"), config.model),
+    jsonSlot(PSTR("name"), config.name),
+    jsonSlot(PSTR("hwid"), config.hwid),
+    jsonSlot(PSTR("fwVer"), CURRENT_FIRMWARE_VERSION),
+    jsonSlot(PSTR("ipad"), WiFi.localIP().toString().c_str()),
+    jsonSlot(PSTR("rssi"), WiFi.RSSI()),
+    jsonSlot(PSTR("heap"), heap_caps_get_free_size(MALLOC_CAP_8BIT)),
+    jsonSlot(PSTR("heapMin"), heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)),
+    jsonSlot(PSTR("uptime"), millis() / 1000),
+    jsonSlot(PSTR("dt"), rtc.getEpoch()),
+    jsonSlot(PSTR("iot"), tbState == TB_STATE_CONNECTED),
+    jsonSlot(PSTR("wsCount"), config.wsCount),
+    jsonSlot(PSTR("SM"), config.SM)), out);
+}
+
+size_t apiWriteMetrics(Print &out){
+  TbPublishStats publish;
+  portENTER_CRITICAL(&tbPublishMux);
+  publish = tbPublishStats;
+  portEXIT_CRITICAL(&tbPublishMux);
+  TbConnStats conn = tbConnStats;
+  TelemetryBatchStats telemetry = telemetryBatcher.stats();
+
+  size_t n = out.print("{\"tbConn\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("attempts", conn.attempts),
+    jsonSlot("connects", conn.connects),
+    jsonSlot("disconnects", conn.disconnects),
+    jsonSlot("tlsFailures", conn.tlsFailures),
+    jsonSlot("authFailures", conn.authFailures),
+    jsonSlot("lastConnack", conn.lastConnack),
+    jsonSlot("totalBackoffMs", conn.totalBackoffMs),
+    jsonSlot("stackFree", xHandleTB != NULL ? (uint32_t)uxTaskGetStackHighWaterMark(xHandleTB) : 0)), out);
+  n += out.print(",\"tbPublish\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("enqueued", publish.enqueued),
+    jsonSlot("published", publish.published),
+    jsonSlot("stored", publish.stored),
+    jsonSlot("failed", publish.failed),
+    jsonSlot("rejected", publish.rejected),
+    jsonSlot("depthMax", publish.depthMax),
+    jsonSlot("latencyMax", publish.latencyMax)), out);
+  n += out.print(",\"telemetry\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("pointsAdded", telemetry.pointsAdded),
+    jsonSlot("pointsDropped", telemetry.pointsDropped),
+    jsonSlot("messagesSent", telemetry.messagesSent),
+    jsonSlot("messagesFailed", telemetry.messagesFailed)), out);
+  n += out.print(",\"ws\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("clients", config.wsCount)
+    #ifdef USE_ASYNC_WEB
+    , jsonSlot("tokensIssued", wsSessions.stats().tokensIssued),
+    jsonSlot("resumes", wsSessions.stats().resumes),
+    jsonSlot("rejected", wsSessions.stats().rejected),
+    jsonSlot("legacyLogins", wsLegacyLogins),
+    jsonSlot("broadcasts", wsBroadcastStats.broadcasts),
+    jsonSlot("deliveries", wsBroadcastStats.deliveries),
+    jsonSlot("backlogs", wsFlowStats.backlogs),
+    jsonSlot("dropped", wsFlowStats.dropped),
+    jsonSlot("evicted", wsFlowStats.evicted)
+    #endif
+    ), out);
+  n += out.print(",\"ui\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("requests", uiAssetStats.requests),
+    jsonSlot("notModified", uiAssetStats.notModified),
+    jsonSlot("gzipped", uiAssetStats.gzipped),
+    jsonSlot("bytesSent", uiAssetStats.bytesSent)), out);
+  #ifdef USE_TLS_RESUMPTION
+  const TlsHandshakeStats &tls = ssl.stats();
+  n += out.print(",\"tls\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("full", tls.full),
+    jsonSlot("resumed", tls.resumed),
+    jsonSlot("resumeMisses", tls.resumeMisses),
+    jsonSlot("failed", tls.failed),
+    jsonSlot("fullMs", tls.fullMs),
+    jsonSlot("resumedMs", tls.resumedMs)), out);
+  #endif
+  #ifndef USE_ASYNC_WEB
+  n += out.print(",\"webLoop\":");
+  n += serializeJsonLayout(jsonLayout(
+    jsonSlot("uptimeMs", millis() - webLoopStats.since),
+    jsonSlot("iterations", webLoopStats.iterations),
+    jsonSlot("wakeups", webLoopStats.wakeups),
+    jsonSlot("timeouts", webLoopStats.timeouts),
+    jsonSlot("throttled", webLoopStats.throttled),
+    jsonSlot("skippedWaits", webLoopStats.skippedWaits),
+    jsonSlot("wsEvents", webLoopStats.wsEvents),
+    jsonSlot("busyUs", webLoopStats.busyUs),
+    jsonSlot("wakeLatencyUs", webLoopStats.wakeLatencyUs),
+    jsonSlot("wakeLatencyMaxUs", webLoopStats.wakeLatencyMaxUs)), out);
+  #endif
+  n += out.print("}");
+  return n;
+}
+
+/// @brief Settings without the secrets (passwords, tokens, API key).
+size_t apiWriteConfig(Print &out){
+  size_t n = 0;
+  if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    n = serializeJsonLayout(jsonLayout(
+      jsonSlot(PSTR("hwid"), config.hwid),
+      jsonSlot(PSTR("name"), config.name),
+      jsonSlot(PSTR("model"), config.model),
+      jsonSlot(PSTR("group"), config.group),
+      jsonSlot(PSTR("logLev"), config.logLev),
+      jsonSlot(PSTR("broker"), config.broker),
+      jsonSlot(PSTR("port"), config.port),
+      jsonSlot(PSTR("wssid"), config.wssid),
+      jsonSlot(PSTR("dssid"), config.dssid),
+      jsonSlot(PSTR("gmtOff"), config.gmtOff),
+      jsonSlot(PSTR("fIoT"), config.fIoT),
+      jsonSlot(PSTR("fWOTA"), config.fWOTA),
+      jsonSlot(PSTR("fIface"), config.fIface),
+      jsonSlot(PSTR("hname"), config.hname),
+      jsonSlot(PSTR("htU"), config.htU),
+      jsonSlot(PSTR("logIP"), config.logIP),
+      jsonSlot(PSTR("logPrt"), config.logPrt),
+      jsonSlot(PSTR("pEnc"), config.pEnc)), out);
+    xSemaphoreGive( xSemaphoreConfig );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    n = apiWriteReply(out, 503);
+  }
+  return n;
+}
+
+size_t apiWriteReply(Print &out, int code){
+  const char *msg;
+  switch(code){
+    case 202: msg = "Accepted."; break;
+    case 400: msg = "Bad request."; break;
+    case 401: msg = "Unauthorized."; break;
+    case 404: msg = "Not found."; break;
+    case 413: msg = "Payload too large."; break;
+    case 429: msg = "Too many authentication attempts."; break;
+    case 501: msg = "Not implemented."; break;
+    default: msg = "Server error."; break;
+  }
+  return serializeJsonLayout(jsonLayout(
+    jsonSlot("status", jsonLayout(
+      jsonSlot("code", code),
+      jsonSlot("msg", msg)))), out);
+}
+
+#ifdef USE_ASYNC_WEB
+void apiReply(AsyncWebServerRequest *request, int code){
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->setCode(code);
+  if(code == 401){
+    response->addHeader("WWW-Authenticate", "Bearer");
+  }
+  apiWriteReply(*response, code);
+  request->send(response);
+}
+
+void apiRespond(AsyncWebServerRequest *request, ApiWriter writer){
+  int code = apiAuthorize(request->hasHeader("Authorization") ? request->header("Authorization").c_str() : nullptr, request->client()->remoteIP());
+  if(code != 200){
+    return apiReply(request, code);
+  }
+  // Written into the response buffer piece by piece, no String holds the whole body.
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->addHeader("Cache-Control", "no-store");
+  writer(*response);
+  request->send(response);
+}
+
+/// @brief Routes of the HTTP API, GET for state and POST /api/cmd/<name> for the WebSocket commands.
+void apiBegin(){
+  web.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request){ apiRespond(request, apiWriteStatus); });
+  web.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request){ apiRespond(request, apiWriteMetrics); });
+  web.on("/api/config", HTTP_GET, [](AsyncWebServerRequest *request){ apiRespond(request, apiWriteConfig); });
+  web.on("/api/cmd/*", HTTP_POST, [](AsyncWebServerRequest *request){
+    int code = apiAuthorize(request->hasHeader("Authorization") ? request->header("Authorization").c_str() : nullptr, request->client()->remoteIP());
+    if(code == 200){
+      size_t length = request->contentLength();
+      if(length > 0 && request->_tempObject == nullptr){
+        code = 413;
+      }
+      else{
+        code = apiCommand(request->url().c_str() + strlen("/api/cmd/"), (const char *)request->_tempObject, length);
+      }
+    }
+    apiReply(request, code);
+  }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
+    // Gathered into _tempObject, which the request frees. Bodies over API_BODY_MAX are not kept.
+    if(total > API_BODY_MAX){
+      return;
+    }
+    if(index == 0){
+      request->_tempObject = malloc(total);
+    }
+    if(request->_tempObject != nullptr){
+      memcpy((uint8_t *)request->_tempObject + index, data, len);
+    }
+  });
+}
+#endif
+
+#ifndef USE_ASYNC_WEB
+size_t WebContentPrint::write(uint8_t c){
+  return write(&c, 1);
+}
+
+size_t WebContentPrint::write(const uint8_t *data, size_t length){
+  for(size_t i = 0; i < length; i++){
+    if(_length == sizeof(_buffer)){
+      flush();
+    }
+    _buffer[_length++] = (char)data[i];
+  }
+  return length;
+}
+
+void WebContentPrint::flush(){
+  if(_length > 0){
+    web.sendContent(_buffer, _length);
+    _length = 0;
+  }
+}
+
+bool WebSocketsServerPeek::pending(){
+  for(uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++){
+    if(_clients[i].tcp != nullptr && _clients[i].tcp->available() > 0){
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief True when a web or WebSocket client has data its WiFiClient buffered, which select() cannot see.
+bool webPending(){
+  return ws.pending() || web.client().available() > 0;
+}
+
+/// @brief Blocks until a socket of the web or WebSocket server, listening or connected, is readable or timeoutMs passed.
+/// The sockets are found by their local port, so neither library has to expose its descriptors.
+bool webWaitForEvent(uint32_t timeoutMs){
+  uint32_t scanStart = micros();
+  fd_set readable;
+  FD_ZERO(&readable);
+  int maxFd = -1;
+  for(int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; fd++){
+    struct sockaddr_in local;
+    socklen_t length = sizeof(local);
+    if(getsockname(fd, (struct sockaddr *)&local, &length) != 0 || local.sin_family != AF_INET){
+      continue;
+    }
+    uint16_t port = ntohs(local.sin_port);
+    if(port == WEB_PORT || port == WS_PORT){
+      FD_SET(fd, &readable);
+      maxFd = fd > maxFd ? fd : maxFd;
+    }
+  }
+  webLoopStats.busyUs += micros() - scanStart;
+  if(maxFd < 0){
+    // Not listening yet, e.g. WiFi is still down.
+    vTaskDelay((const TickType_t) timeoutMs / portTICK_PERIOD_MS);
+    webLoopStats.timeouts++;
+    return false;
+  }
+  struct timeval timeout;
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+  int ready = select(maxFd + 1, &readable, NULL, NULL, &timeout);
+  if(ready > 0){
+    webLoopStats.wakeups++;
+    return true;
+  }
+  if(ready < 0){
+    // A socket closed between the scan and select(), the next scan will not see it.
+    vTaskDelay(1);
+  }
+  webLoopStats.timeouts++;
+  return false;
+}
+
+void apiReply(int code){
+  if(code == 401){
+    web.sendHeader("WWW-Authenticate", "Bearer");
+  }
+  web.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  web.send(code, "application/json", "");
+  WebContentPrint out;
+  apiWriteReply(out, code);
+  out.flush();
+  web.sendContent("");
+}
+
+void apiRespond(ApiWriter writer){
+  int code = apiAuthorize(web.header("Authorization").c_str(), web.client().remoteIP());
+  if(code != 200){
+    return apiReply(code);
+  }
+  // Sent as chunks while it is written, no String holds the whole body.
+  web.sendHeader("Cache-Control", "no-store");
+  web.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  web.send(200, "application/json", "");
+  WebContentPrint out;
+  writer(out);
+  out.flush();
+  web.sendContent("");
+}
+
+/// @brief Routes of the HTTP API, GET for state and POST /api/cmd/<name> for the WebSocket commands.
+void apiBegin(){
+  web.on("/api/status", HTTP_GET, []() { apiRespond(apiWriteStatus); });
+  web.on("/api/metrics", HTTP_GET, []() { apiRespond(apiWriteMetrics); });
+  web.on("/api/config", HTTP_GET, []() { apiRespond(apiWriteConfig); });
+  web.on(UriBraces("/api/cmd/{}"), HTTP_POST, []() {
+    int code = apiAuthorize(web.header("Authorization").c_str(), web.client().remoteIP());
+    if(code == 200){
+      const String &body = web.arg("plain");
+      code = body.length() > API_BODY_MAX ? 413 : apiCommand(web.pathArg(0).c_str(), body.c_str(), body.length());
+    }
+    apiReply(code);
+  });
+}
 #endif
 #endif
 
@@ -2182,6 +3754,96 @@ void updateSpiffs()
     log_manager->verbose(PSTR(__func__), PSTR("Executed (%dms).\n"), millis() - startMillis);    
 }
 
+void coMcuUpdateProgressCb(size_t done, size_t total)
+{
+  log_manager->verbose(PSTR(__func__), PSTR("CoMCU Updater: %d/%d\n"), (int)done, (int)total);
+}
+
+/// @brief Streams a CoMCU firmware image to the CoMCU bootloader.
+/// @param source SPIFFS path of the image, or an http(s) URL that is streamed through BinDownloader without staging it in flash.
+void updateCoMCU(const char *source)
+{
+  long startMillis = millis();
+  if(coMcuStream == NULL){
+    log_manager->warn(PSTR(__func__), PSTR("CoMCU link is not available.\n"));
+    return;
+  }
+
+  BinDownloader _http;
+  File file;
+  Stream *image = nullptr;
+  size_t imageSize = 0;
+  uint32_t imageCrc = 0;
+  bool fromHttp = strncmp(source, "http", 4) == 0;
+
+  if(fromHttp){
+    log_manager->info(PSTR(__func__), PSTR("Downloading CoMCU firmware: %s.\n"), source);
+    _http.begin(source);
+    int httpCode = _http.GET();
+    if(httpCode != HTTP_CODE_OK){
+      log_manager->warn(PSTR(__func__), PSTR("Server responded with HTTP Status %d.\n"), httpCode);
+      return;
+    }
+    int size = _http.getSize();
+    image = _http.getStreamPtr();
+    if(size <= 0 || image == nullptr){
+      log_manager->warn(PSTR(__func__), PSTR("Response is empty or has no content length!\n"));
+      return;
+    }
+    imageSize = size;
+    // The CRC is not known before the download ends, so the transfer cannot resume and starts over
+    // on every attempt. fwEnd still verifies it against the CRC computed while streaming.
+  }
+  else{
+    // Hashing the file first lets the bootloader tell whether a partial image can be resumed.
+    file = SPIFFS.open(source, FILE_READ);
+    if(!file || file.isDirectory()){
+      log_manager->warn(PSTR(__func__), PSTR("Failed to open CoMCU firmware %s!\n"), source);
+      return;
+    }
+    imageSize = file.size();
+    imageCrc = CoMCUUpdater::crc32(file, imageSize);
+    file.seek(0);
+    image = &file;
+  }
+
+  if( xSemaphoreSerialCoMCUWrite != NULL && xSemaphoreTake( xSemaphoreSerialCoMCUWrite, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    if( xSemaphoreSerialCoMCURead != NULL && xSemaphoreTake( xSemaphoreSerialCoMCURead, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      setAlarm(0, 3, 1000, 25);
+      CoMCUUpdater updater(*coMcuStream);
+      updater.onProgress(coMcuUpdateProgressCb);
+      int res = updater.update(*image, imageSize, imageCrc);
+      const CoMCUUpdateStats &stats = updater.stats();
+      if(res == COMCU_UPDATE_OK){
+        log_manager->info(PSTR(__func__), PSTR("CoMCU update completed: %d bytes (resumed at %d) in %dms, %d B/s, %d blocks resent.\n"),
+          (int)stats.imageSize, (int)stats.resumedAt, (int)stats.elapsedMs,
+          stats.elapsedMs > 0 ? (int)((stats.imageSize - stats.resumedAt) * 1000 / stats.elapsedMs) : 0, (int)stats.blocksResent);
+      }
+      else{
+        log_manager->warn(PSTR(__func__), PSTR("CoMCU update failed (%d) after %d/%d bytes, it will %s on the next attempt.\n"),
+          res, (int)stats.bytesSent, (int)stats.imageSize, imageCrc != 0 ? PSTR("resume") : PSTR("start over"));
+      }
+      setAlarm(0, 0, 0, 1000);
+      xSemaphoreGive( xSemaphoreSerialCoMCURead );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+    xSemaphoreGive( xSemaphoreSerialCoMCUWrite );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+  }
+
+  if(!fromHttp){file.close();}
+  FLAG_SYNC_CONFIGCOMCU = true;
+  log_manager->verbose(PSTR(__func__), PSTR("Executed (%dms).\n"), millis() - startMillis);
+}
+
 RPC_Response processConfigSave(const RPC_Data &data){
   if( xSemaphoreTBSend != NULL && WiFi.isConnected() && config.provSent && tb.connected()){
     if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
@@ -2270,6 +3932,25 @@ RPC_Response processUpdateSpiffs(const RPC_Data &data){
   return RPC_Response(PSTR("updateSpiffs"), 1);
 }
 
+RPC_Response processUpdateCoMCU(const RPC_Data &data){
+  if( xSemaphoreTBSend != NULL && WiFi.isConnected() && config.provSent && tb.connected()){
+    if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      GLOBAL_COMCU_FW_SOURCE = data[PSTR("src")] != nullptr ? data[PSTR("src")].as<String>() : String(PSTR("/comcu.bin"));
+      FLAG_UPDATE_COMCU = true;
+      StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+      doc[PSTR("updateCoMCU")] = 1;
+      xSemaphoreGive( xSemaphoreTBSend );
+      return RPC_Response(doc);
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  return RPC_Response(PSTR("updateCoMCU"), 1);
+}
+
 
 RPC_Response processReboot(const RPC_Data &data){
   if( xSemaphoreTBSend != NULL && WiFi.isConnected() && config.provSent && tb.connected()){
@@ -2289,36 +3970,179 @@ RPC_Response processReboot(const RPC_Data &data){
   return RPC_Response(PSTR("cdown"), 1);
 }
 
+/// @brief Runs the registered handler of data["cmd"]. Async handlers are queued for rpcWorkerTR and answered
+/// right away with the rid their result will be published under. Unregistered commands go to processGenericClientRPCCb.
 RPC_Response processGenericClientRPC(const RPC_Data &data){
   String buffer;
   serializeJson(data, buffer);
   log_manager->verbose(PSTR(__func__), PSTR("Received generic client rpc: %s.\n"), buffer.c_str());
-  return processGenericClientRPCCb(data);
-}
-
-void syncClientAttr(uint8_t direction){
-  String ip = WiFi.localIP().toString();
-  
-  StaticJsonDocument<DOCSIZE_MIN> doc;
-  char buffer[384];
 
-  if(tb.connected() && (direction == 0 || direction == 1) ){
-    doc[PSTR("ipad")] = ip;
+  RpcMethod method;
+  bool found = false;
+  const char *cmd = data[PSTR("cmd")].as<const char *>();
+  if( cmd != NULL && xSemaphoreRpcRegistry != NULL ){
+    if( xSemaphoreTake( xSemaphoreRpcRegistry, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      const RpcMethod *registered = rpcRegistry.find(cmd);
+      if(registered != NULL){
+        method = *registered;
+        found = true;
+      }
+      xSemaphoreGive( xSemaphoreRpcRegistry );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  if(!found){
+    return processGenericClientRPCCb(data);
+  }
+
+  StaticJsonDocument<DOCSIZE_MIN> doc;
+  JsonObject reply = doc.to<JsonObject>();
+  reply[PSTR("cmd")] = method.name;
+  if(!method.async){
+    method.handler(data, reply);
+    return RPC_Response(doc);
+  }
+
+  RpcJob job;
+  job.rid = data[PSTR("rid")] | ++RPC_JOB_SEQ;
+  job.handler = method.handler;
+  strlcpy(job.method, method.name, sizeof(job.method));
+  job.params = xHandleRpcWorker != NULL ? strdup(buffer.c_str()) : NULL;
+  reply[PSTR("rid")] = job.rid;
+  if(job.params != NULL && xQueueSend(xQueueRpcJob, &job, 0) == pdTRUE){
+    reply[PSTR("status")] = PSTR("queued");
+  }
+  else{
+    free(job.params);
+    reply[PSTR("status")] = PSTR("busy");
+  }
+  return RPC_Response(doc);
+}
+
+/// @brief Registers handler for the generic RPC command name, replacing an earlier one. An async handler
+/// runs on its own task; its reply is published as {"rpcRes":{"cmd":..,"rid":..,...}} telemetry.
+bool rpcRegister(const char *name, RpcHandler handler, bool async){
+  bool res = false;
+  if(xSemaphoreRpcRegistry == NULL){xSemaphoreRpcRegistry = xSemaphoreCreateMutex();}
+  if( xSemaphoreTake( xSemaphoreRpcRegistry, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    res = rpcRegistry.add(name, handler, async);
+    xSemaphoreGive( xSemaphoreRpcRegistry );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+  }
+  if(!res){
+    log_manager->warn(PSTR(__func__), PSTR("Could not register RPC %s.\n"), name);
+  }
+  else if(async){
+    rpcWorkerStart();
+  }
+  return res;
+}
+
+bool rpcUnregister(const char *name){
+  bool res = false;
+  if( xSemaphoreRpcRegistry != NULL && xSemaphoreTake( xSemaphoreRpcRegistry, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    res = rpcRegistry.remove(name);
+    xSemaphoreGive( xSemaphoreRpcRegistry );
+  }
+  return res;
+}
+
+/// @brief Creates the job queue and the task async handlers run on, once, when the first one is registered.
+/// Handlers are usually registered in setup() before startup() has loaded the config, so it does not wait for it.
+bool rpcWorkerStart(){
+  if(xQueueRpcJob == NULL){
+    xQueueRpcJob = xQueueCreate( RPC_JOB_QUEUE_SIZE, sizeof( struct RpcJob ) );
+    if(xQueueRpcJob == NULL){
+      log_manager->error(PSTR(__func__), PSTR("Could not create the RPC job queue.\n"));
+      return false;
+    }
+  }
+  if(xHandleRpcWorker == NULL){
+    xReturnedRpcWorker = xTaskCreatePinnedToCore(rpcWorkerTR, "rpcWorker", STACKSIZE_RPCWORKER, NULL, 1, &xHandleRpcWorker, 1);
+    if(xReturnedRpcWorker != pdPASS){
+      xHandleRpcWorker = NULL;
+      log_manager->error(PSTR(__func__), PSTR("Could not create task rpcWorker.\n"));
+      return false;
+    }
+    log_manager->warn(PSTR(__func__), PSTR("Task rpcWorker has been created.\n"));
+  }
+  return true;
+}
+
+/// @brief Runs queued async RPC handlers one at a time, away from the MQTT loop, and publishes their replies.
+void rpcWorkerTR(void *arg){
+  RpcJob job;
+  while(true){
+    if(xQueueRpcJob != NULL && xQueueReceive(xQueueRpcJob, &job, portMAX_DELAY) == pdTRUE){
+      unsigned long startMillis = millis();
+      StaticJsonDocument<DOCSIZE_MIN> params;
+      DeserializationError err = deserializeJson(params, job.params);
+      free(job.params);
+
+      StaticJsonDocument<DOCSIZE_MIN> doc;
+      JsonObject reply = doc.createNestedObject(PSTR("rpcRes"));
+      reply[PSTR("cmd")] = job.method;
+      reply[PSTR("rid")] = job.rid;
+      if(err == DeserializationError::Ok){
+        job.handler(params.as<JsonVariantConst>(), reply);
+      }
+      else{
+        reply[PSTR("status")] = PSTR("badParams");
+      }
+
+      char buffer[DOCSIZE_MIN];
+      serializeJson(doc, buffer, sizeof(buffer));
+      tbPublish(TB_MSG_TELEMETRY, buffer);
+      log_manager->verbose(PSTR(__func__), PSTR("RPC %s (rid %d) done (%dms).\n"), job.method, job.rid, millis() - startMillis);
+    }
+  }
+}
+
+/// @brief Publishes client attributes to the broker (direction 0 or 1) and pushes them to web clients (0 or 2).
+/// Only attributes whose value changed since the broker last acknowledged them are published, unless full is set.
+void syncClientAttr(uint8_t direction, bool full){
+  String ip = WiFi.localIP().toString();
+  
+  StaticJsonDocument<DOCSIZE_MIN> doc;
+  char buffer[384];
+
+  if(tb.connected() && (direction == 0 || direction == 1) ){
+    AttrShadowAck ack;
+    while(xQueueAttrShadowAck != NULL && xQueueReceive(xQueueAttrShadowAck, &ack, 0) == pdTRUE){
+      attrShadow.complete(ack.id, ack.status != TB_PUBLISH_FAILED);
+    }
+    if(FLAG_SYNC_CLIENT_ATTR_FULL){
+      FLAG_SYNC_CLIENT_ATTR_FULL = false;
+      full = true;
+    }
+    if(full){
+      attrShadow.reset();
+    }
+    attrShadow.begin(full);
+
+    doc[PSTR("ipad")] = ip;
     doc[PSTR("compdate")] = COMPILED;
     doc[PSTR("fmTitle")] = CURRENT_FIRMWARE_TITLE;
     doc[PSTR("fmVersion")] = CURRENT_FIRMWARE_VERSION;
     doc[PSTR("stamac")] = WiFi.macAddress();
     doc[PSTR("apmac")] = WiFi.softAPmacAddress();
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("flFree")] = ESP.getFreeSketchSpace();
     doc[PSTR("fwSize")] = ESP.getSketchSize();
     doc[PSTR("flSize")] = ESP.getFlashChipSize();
     doc[PSTR("dSize")] = (int)SPIFFS.totalBytes(); 
     doc[PSTR("dUsed")] = (int)SPIFFS.usedBytes();
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("sdkVer")] = ESP.getSdkVersion();
     doc[PSTR("model")] = config.model;
@@ -2326,67 +4150,65 @@ void syncClientAttr(uint8_t direction){
     doc[PSTR("group")] = config.group;
     doc[PSTR("broker")] = config.broker;
     doc[PSTR("port")] = config.port;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("wssid")] = config.wssid;
     doc[PSTR("ap")] = WiFi.SSID();
     doc[PSTR("wpass")] = config.wpass;
     doc[PSTR("dssid")] = config.dssid;
     doc[PSTR("dpass")] = config.dpass;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("upass")] = config.upass;
     doc[PSTR("accTkn")] = config.accTkn;
     doc[PSTR("webApiKey")] = config.webApiKey;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("provDK")] = config.provDK;
     doc[PSTR("provDS")] = config.provDS;
     doc[PSTR("logLev")] = config.logLev;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("gmtOff")] = config.gmtOff;
     doc[PSTR("bFr")] = configcomcu.bFr;
     doc[PSTR("fP")] = (int)configcomcu.fP;
     doc[PSTR("fB")] = (int)configcomcu.fB;
     doc[PSTR("fIoT")] = (int)config.fIoT;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("fWOTA")] = (int)config.fWOTA;
     doc[PSTR("fIface")] = (int)config.fIface;
     doc[PSTR("hname")] = config.hname;
     doc[PSTR("logIP")] = config.logIP;
     doc[PSTR("logPrt")] = config.logPrt;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("pBz")] = configcomcu.pBz;
     doc[PSTR("pLR")] = configcomcu.pLR;
     doc[PSTR("pLG")] = configcomcu.pLG;
     doc[PSTR("pLB")] = configcomcu.pLB;
     doc[PSTR("htU")] = config.htU;
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
     doc[PSTR("htP")] = config.htP;
     doc[PSTR("lON")] = configcomcu.lON;
+    doc[PSTR("pEnc")] = config.pEnc;
     #ifdef USE_SDCARD_LOG
     doc[PSTR("crByte")] = config.cardByte;
     doc[PSTR("crSize")] = config.cardSize;
     doc[PSTR("crUsed")] = config.cardUsed;
     #endif
-    serializeJson(doc, buffer);
-    tbSendAttribute(buffer);
+    attrShadow.add(doc.as<JsonObjectConst>());
     doc.clear();
+    attrShadow.end();
+
+    const AttributeShadowStats &stats = attrShadow.stats();
+    log_manager->verbose(PSTR(__func__), PSTR("Attribute sync totals: %d of %d keys sent in %d messages (%d bytes), %d messages (%d bytes) without the shadow.\n"),
+      stats.keysSent, stats.keysChecked, stats.sentMessages, (uint32_t)stats.sentBytes, stats.legacyMessages, (uint32_t)stats.legacyBytes);
   }
 
   #ifdef USE_WEB_IFACE
-  if(config.wsCount > 0 && (direction == 0 || direction == 2)){
+  if(wsHasSubscribers(WS_TOPIC_ATTR | WS_TOPIC_CFG) && (direction == 0 || direction == 2)){
     JsonObject attr = doc.createNestedObject("attr");
     attr[PSTR("ipad")] = ip.c_str();
     attr[PSTR("compdate")] = COMPILED;
@@ -2406,7 +4228,7 @@ void syncClientAttr(uint8_t direction){
     attr[PSTR("crUsed")] = config.cardUsed;
     #endif
     serializeJson(doc, buffer);
-    wsBroadcastTXT(buffer);
+    wsBroadcastTXT(buffer, WS_TOPIC_ATTR);
     doc.clear();
     JsonObject cfg = doc.createNestedObject("cfg");
     cfg[PSTR("name")] = config.name;
@@ -2418,7 +4240,7 @@ void syncClientAttr(uint8_t direction){
     cfg[PSTR("fIoT")] = (int)config.fIoT;
     cfg[PSTR("hname")] = config.hname;
     serializeJson(doc, buffer);
-    wsBroadcastTXT(buffer);
+    wsBroadcastTXT(buffer, WS_TOPIC_CFG);
   }
   #endif
 
@@ -2426,18 +4248,371 @@ void syncClientAttr(uint8_t direction){
 }
 
 bool tbSendAttribute(const char *buffer){
-  bool res = false;
+  return tbPublish(TB_MSG_ATTRIBUTE, buffer) != 0;
+}
+
+uint32_t attrShadowPublish(const char *buffer){
+  return tbPublish(TB_MSG_ATTRIBUTE, buffer, attrShadowPublishCb);
+}
+
+/// @brief Runs on the TB task, the shadow itself is only touched by syncClientAttr.
+void attrShadowPublishCb(uint32_t id, uint8_t status){
+  AttrShadowAck ack = {id, status};
+  if(xQueueAttrShadowAck != NULL){
+    xQueueSend(xQueueAttrShadowAck, &ack, 0);
+  }
+}
+
+bool tbSendTelemetry(const char * buffer){
+  return tbPublish(TB_MSG_TELEMETRY, buffer) != 0;
+}
+
+/// @brief Wall clock time in milliseconds, 0 while the clock has not been synced yet.
+uint64_t tbTimestamp(){
+  return rtc.getEpoch() > 1600000000 ? (uint64_t)rtc.getEpoch() * 1000ULL + rtc.getMillis() : 0;
+}
+
+/// @brief Hands buffer to the TB task for publishing and returns right away. The queue holds a copy, so
+/// buffer can be reused as soon as this returns.
+/// cb, if set, is called from the TB task once the message was sent, stored offline or given up on.
+/// @return Message id passed to cb, 0 if the message was rejected, also when it is too large to publish.
+uint32_t tbPublish(char type, const char *buffer, TbPublishCb cb){
   int length = strlen(buffer);
-  if (buffer[length - 1] != '}') {
+  if (length == 0 || (buffer[length - 1] != '}' && (type != TB_MSG_TELEMETRY || buffer[length - 1] != ']'))) {
       log_manager->verbose(PSTR(__func__),PSTR("The buffer is not JSON formatted!\n"));
+      return 0;
+  }
+  if(xQueueTBPublish == NULL || xSemaphoreTBPublish == NULL){
+    return 0;
+  }
+  if(length > (type == TB_MSG_ATTRIBUTE ? TB_PAYLOAD_MAX(TB_ATTRIBUTE_TOPIC) : TB_PAYLOAD_MAX(TB_TELEMETRY_TOPIC))){
+    portENTER_CRITICAL(&tbPublishMux);
+    tbPublishStats.rejected++;
+    portEXIT_CRITICAL(&tbPublishMux);
+    log_manager->warn(PSTR(__func__), PSTR("Payload of %d bytes does not fit the MQTT buffer, message dropped.\n"), length);
+    return 0;
+  }
+
+  uint32_t id = 0;
+  uint64_t ts = tbTimestamp();
+  bool queued = false;
+  if( xSemaphoreTake( xSemaphoreTBPublish, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    TbPublishMessage &msg = tbPublishSlot;
+    msg.type = type;
+    msg.cb = cb;
+    msg.enqueuedAt = millis();
+    msg.ts = ts;
+    portENTER_CRITICAL(&tbPublishMux);
+    msg.id = ++TB_PUBLISH_SEQ;
+    if(msg.id == 0){msg.id = ++TB_PUBLISH_SEQ;}
+    tbPublishStats.enqueued++;
+    portEXIT_CRITICAL(&tbPublishMux);
+    id = msg.id;
+
+    memcpy(msg.payload, buffer, length + 1);
+    queued = xQueueSend(xQueueTBPublish, &msg, 0) == pdTRUE;
+    xSemaphoreGive( xSemaphoreTBPublish );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+  }
+  if(queued){
+    UBaseType_t depth = uxQueueMessagesWaiting(xQueueTBPublish);
+    portENTER_CRITICAL(&tbPublishMux);
+    if(depth > tbPublishStats.depthMax){tbPublishStats.depthMax = depth;}
+    portEXIT_CRITICAL(&tbPublishMux);
+    return id;
+  }
+
+  #ifdef USE_OFFLINE_STORE
+  // The TB task is stuck reconnecting, keep the message instead of making the caller wait for it.
+  if(id != 0 && offlineStoreAppend(type, buffer, ts)){
+    portENTER_CRITICAL(&tbPublishMux);
+    tbPublishStats.stored++;
+    portEXIT_CRITICAL(&tbPublishMux);
+    if(cb != NULL){cb(id, TB_PUBLISH_STORED);}
+    return id;
+  }
+  #endif
+  portENTER_CRITICAL(&tbPublishMux);
+  tbPublishStats.rejected++;
+  portEXIT_CRITICAL(&tbPublishMux);
+  log_manager->verbose(PSTR(__func__), PSTR("Publish queue is full, message dropped.\n"));
+  return 0;
+}
+
+/// @brief Publishes one JSON payload, as MessagePack once tbMsgPackProbe() confirmed the server reads it. Falls
+/// back to JSON when packing does not pay off. A telemetry object is stamped with ts when set, so sending it twice
+/// writes the same point. Callers hold xSemaphoreTBSend.
+bool tbSendPayload(char type, const char *payload, uint64_t ts){
+  if(ts != 0 && type == TB_MSG_TELEMETRY && payload[0] == '{'){
+    static char stamped[TB_PUBLISH_PAYLOAD_SIZE];
+    size_t length = snprintf(stamped, sizeof(stamped), PSTR("{\"ts\":%llu,\"values\":%s}"), (unsigned long long)ts, payload);
+    // Unstamped it would no longer write the same point when sent twice.
+    if(length >= sizeof(stamped)){
       return false;
+    }
+    payload = stamped;
   }
-  if( xSemaphoreTBSend != NULL && WiFi.isConnected() && config.provSent && tb.connected() && config.accTkn != NULL){
-    if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+  #ifdef USE_MSGPACK_PAYLOAD
+  if(FLAG_MSGPACK_CONFIRMED && config.pEnc == PAYLOAD_ENCODING_MSGPACK){
+    static uint8_t packed[TB_PAYLOAD_MAX(TB_MSGPACK_TELEMETRY_TOPIC)];
+    size_t length = payloadCodec.encodeMsgPack(payload, packed,
+      type == TB_MSG_ATTRIBUTE ? TB_PAYLOAD_MAX(TB_MSGPACK_ATTRIBUTE_TOPIC) : TB_PAYLOAD_MAX(TB_MSGPACK_TELEMETRY_TOPIC));
+    if(length > 0){
+      return mqttClient.publish(type == TB_MSG_ATTRIBUTE ? TB_MSGPACK_ATTRIBUTE_TOPIC : TB_MSGPACK_TELEMETRY_TOPIC, packed, length);
+    }
+  }
+  #endif
+  return type == TB_MSG_ATTRIBUTE ? tb.sendAttributeJSON(payload) : tb.sendTelemetryJson(payload);
+}
+
+#ifdef USE_MSGPACK_PAYLOAD
+/// @brief Switches publishing to MessagePack once the server acknowledged it on this connection. The probe
+/// writes a random nonce as client attribute TB_MSGPACK_PROBE_KEY through TB_MSGPACK_ATTRIBUTE_TOPIC and
+/// asks for it back a moment later; only a server that decoded the packed message can answer with it.
+/// Stock ThingsBoard ignores the topic, so it keeps getting JSON. Only called from TBTR, which owns tb.
+void tbMsgPackProbe(){
+  if(config.pEnc != PAYLOAD_ENCODING_MSGPACK){
+    FLAG_MSGPACK_CONFIRMED = false;
+    FLAG_MSGPACK_PROBE_FAILED = false;
+    MSGPACK_PROBE_NONCE = 0;
+    return;
+  }
+  if(FLAG_MSGPACK_CONFIRMED || !tb.connected() || !config.provSent){
+    return;
+  }
+  unsigned long now = millis();
+  if(MSGPACK_PROBE_NONCE != 0){
+    if(!FLAG_MSGPACK_PROBE_ASKED && now - TIMER_MSGPACK_PROBE >= TB_MSGPACK_PROBE_SETTLE){
+      if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+      {
+        FLAG_MSGPACK_PROBE_ASKED = tb.Client_Attributes_Request(tbMsgPackProbeCallback);
+        xSemaphoreGive( xSemaphoreTBSend );
+      }
+      else
+      {
+        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+      }
+    }
+    else if(now - TIMER_MSGPACK_PROBE > TB_MSGPACK_PROBE_SETTLE + TB_MSGPACK_PROBE_TIMEOUT){
+      MSGPACK_PROBE_NONCE = 0;
+      MSGPACK_PROBE_FAILURES++;
+      FLAG_MSGPACK_PROBE_FAILED = true;
+      TIMER_MSGPACK_PROBE = now;
+      log_manager->warn(PSTR(__func__), PSTR("Server did not confirm MessagePack, publishing JSON.\n"));
+    }
+    return;
+  }
+  if(FLAG_MSGPACK_PROBE_FAILED && now - TIMER_MSGPACK_PROBE < TB_MSGPACK_PROBE_INTERVAL){
+    return;
+  }
+
+  uint32_t nonce = 0;
+  while(nonce == 0){nonce = esp_random();}
+  char json[48];
+  uint8_t packed[sizeof(json)];
+  serializeJsonLayout(jsonLayout(jsonSlot(PSTR(TB_MSGPACK_PROBE_KEY), nonce)), json, sizeof(json));
+  bool sent = false;
+  if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    size_t length = payloadCodec.encodeMsgPack(json, packed, sizeof(packed));
+    sent = length > 0 && mqttClient.publish(TB_MSGPACK_ATTRIBUTE_TOPIC, packed, length);
+    xSemaphoreGive( xSemaphoreTBSend );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    return;
+  }
+  TIMER_MSGPACK_PROBE = now;
+  FLAG_MSGPACK_PROBE_ASKED = false;
+  if(sent){
+    MSGPACK_PROBE_NONCE = nonce;
+  }
+  else{
+    MSGPACK_PROBE_FAILURES++;
+    FLAG_MSGPACK_PROBE_FAILED = true;
+  }
+}
+
+void tbMsgPackProbeCb(const Shared_Attribute_Data &data){
+  JsonVariantConst value = data[TB_MSGPACK_PROBE_KEY];
+  if(value.isNull()){
+    value = data[PSTR("client")][TB_MSGPACK_PROBE_KEY];
+  }
+  if(MSGPACK_PROBE_NONCE == 0){
+    return;
+  }
+  if(value.as<uint32_t>() == MSGPACK_PROBE_NONCE){
+    FLAG_MSGPACK_CONFIRMED = true;
+    FLAG_MSGPACK_PROBE_FAILED = false;
+    log_manager->info(PSTR(__func__), PSTR("Server confirmed MessagePack in %dms, publishing packed payloads.\n"), millis() - TIMER_MSGPACK_PROBE);
+  }
+  else{
+    MSGPACK_PROBE_FAILURES++;
+    FLAG_MSGPACK_PROBE_FAILED = true;
+    TIMER_MSGPACK_PROBE = millis();
+    log_manager->warn(PSTR(__func__), PSTR("Server answered the MessagePack probe without it, publishing JSON.\n"));
+  }
+  MSGPACK_PROBE_NONCE = 0;
+}
+#endif
+
+/// @brief Counts the outcome of a queued message and tells its publisher.
+void tbPublishDone(uint32_t id, unsigned long enqueuedAt, uint8_t status, TbPublishCb cb){
+  unsigned long latency = millis() - enqueuedAt;
+  portENTER_CRITICAL(&tbPublishMux);
+  if(status == TB_PUBLISH_SENT){
+    tbPublishStats.published++;
+    tbPublishStats.latencyLast = latency;
+    tbPublishStats.latencySum += latency;
+    if(latency > tbPublishStats.latencyMax){tbPublishStats.latencyMax = latency;}
+  }
+  else if(status == TB_PUBLISH_STORED){tbPublishStats.stored++;}
+  else{tbPublishStats.failed++;}
+  portEXIT_CRITICAL(&tbPublishMux);
+
+  if(cb != NULL){cb(id, status);}
+}
+
+#ifdef USE_TB_DELIVERY_ACK
+/// @brief Moves queued messages into the delivery window and sends what it holds. Messages are reported
+/// TB_PUBLISH_SENT only once a fence proved the broker got them. Only called from TBTR, which owns tb.
+void tbPublishDrain(){
+  TbPublishMessage &msg = tbDrainSlot;
+  while(!tbDeliveryWindow.full() && xQueueReceive(xQueueTBPublish, &msg, 0) == pdTRUE){
+    #ifdef USE_OFFLINE_STORE
+    // Attributes are last writer wins, so while a backlog replays new ones have to queue behind it.
+    if(msg.type == TB_MSG_ATTRIBUTE && !offlineStore.empty()){
+      uint8_t status = offlineStoreAppend(msg.type, msg.payload, msg.ts) ? TB_PUBLISH_STORED : TB_PUBLISH_FAILED;
+      tbPublishDone(msg.id, msg.enqueuedAt, status, msg.cb);
+      continue;
+    }
+    #endif
+    DeliveryEntry entry = {};
+    entry.id = msg.id;
+    entry.type = msg.type;
+    entry.payload = msg.payload;
+    entry.ts = msg.ts;
+    entry.enqueuedAt = msg.enqueuedAt;
+    entry.cb = msg.cb;
+    if(!tbDeliveryWindow.add(entry)){
+      log_manager->warn(PSTR(__func__), PSTR("Message %d does not fit the MQTT buffer once stamped, dropped.\n"), msg.id);
+      tbPublishDone(msg.id, msg.enqueuedAt, TB_PUBLISH_FAILED, msg.cb);
+    }
+  }
+
+  if(tbDeliveryWindow.empty() || !WiFi.isConnected() || !config.provSent || !tb.connected()){
+    return;
+  }
+  if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    tbDeliveryWindow.pump(tbSendDeliveryEntry, TB_PUBLISH_DRAIN_MAX);
+    // One fence per round trip: everything sent while it is open waits for the next one. A fence that
+    // could not be requested is tried again on the next drain.
+    if(tbDeliveryWindow.needsFence()){
+      int8_t slot = tbDeliveryWindow.fenceSlot();
+      if(slot >= 0 && tb.Shared_Attributes_Request(tbDeliveryFenceCallbacks[slot])){
+        tbDeliveryWindow.openFence(slot, millis());
+      }
+      else{
+        tbDeliveryWindow.fenceFailed(millis());
+      }
+    }
+    if(tbDeliveryWindow.expireFence(millis(), TB_DELIVERY_FENCE_TIMEOUT)){
+      log_manager->verbose(PSTR(__func__), PSTR("Delivery fence unanswered, connection still up, messages sent again.\n"));
+    }
+    if(tbDeliveryWindow.fenceStalled(millis(), TB_DELIVERY_FENCE_TIMEOUT)){
+      // Unanswered requests hold the fence slots and the SDK's callbacks until the connection goes.
+      log_manager->warn(PSTR(__func__), PSTR("Delivery fences could not be requested for %dms, reconnecting.\n"), TB_DELIVERY_FENCE_TIMEOUT);
+      tb.disconnect();
+    }
+    xSemaphoreGive( xSemaphoreTBSend );
+  }
+  else
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+  }
+}
+
+/// @brief A publish that fails while tb stays connected would fail again, so the window drops it.
+uint8_t tbSendDeliveryEntry(const DeliveryEntry &entry){
+  log_manager->verbose(PSTR(__func__), PSTR("Sending %s %d to broker: %s\n"),
+    entry.type == TB_MSG_ATTRIBUTE ? PSTR("attribute") : PSTR("telemetry"), entry.id, entry.payload);
+  if(tbSendPayload(entry.type, entry.payload, entry.ts)){
+    return DELIVERY_SEND_OK;
+  }
+  if(tb.connected()){
+    log_manager->warn(PSTR(__func__), PSTR("Broker connection refused message %d, dropped.\n"), entry.id);
+    return DELIVERY_SEND_REFUSED;
+  }
+  return DELIVERY_SEND_RETRY;
+}
+
+void tbDelivered(DeliveryEntry &entry, bool delivered){
+  tbPublishDone(entry.id, entry.enqueuedAt, delivered ? TB_PUBLISH_SENT : TB_PUBLISH_FAILED, entry.cb);
+}
+
+template <uint8_t slot>
+void tbDeliveryFenceCb(const Shared_Attribute_Data &data){
+  if(!tbDeliveryWindow.fenceAcked(slot, millis())){
+    log_manager->verbose(PSTR(__func__), PSTR("Answer to delivery fence slot %d came after it timed out, ignored.\n"), slot);
+  }
+}
+#else
+/// @brief Publishes up to TB_PUBLISH_DRAIN_MAX queued messages. Only called from TBTR, which owns tb.
+void tbPublishDrain(){
+  TbPublishMessage &msg = tbDrainSlot;
+  for(uint8_t i = 0; i < TB_PUBLISH_DRAIN_MAX && xQueueReceive(xQueueTBPublish, &msg, 0) == pdTRUE; i++){
+    uint8_t status = TB_PUBLISH_FAILED;
+    bool deferred = false;
+    #ifdef USE_OFFLINE_STORE
+    // Attributes are last writer wins, so while a backlog replays new ones have to queue behind it.
+    deferred = msg.type == TB_MSG_ATTRIBUTE && !offlineStore.empty();
+    #endif
+    if(!deferred && WiFi.isConnected() && config.provSent && tb.connected() && config.accTkn != NULL){
+      if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+      {
+        log_manager->verbose(PSTR(__func__), PSTR("Sending %s to broker: %s\n"),
+          msg.type == TB_MSG_ATTRIBUTE ? PSTR("attribute") : PSTR("telemetry"), msg.payload);
+        bool res = tbSendPayload(msg.type, msg.payload);
+        if(res){status = TB_PUBLISH_SENT;}
+        xSemaphoreGive( xSemaphoreTBSend );
+      }
+      else
+      {
+        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+      }
+    }
+    #ifdef USE_OFFLINE_STORE
+    if(status != TB_PUBLISH_SENT && offlineStoreAppend(msg.type, msg.payload, msg.ts)){
+      status = TB_PUBLISH_STORED;
+    }
+    #endif
+
+    tbPublishDone(msg.id, msg.enqueuedAt, status, msg.cb);
+  }
+}
+#endif
+
+#ifdef USE_OFFLINE_STORE
+/// @brief Keeps a message that could not be published. Telemetry is stamped with ts, the time it was
+/// produced, so it lands at the right place in the timeline when it is replayed hours later.
+/// With ts 0 (clock not synced yet) the server time at replay is the better guess.
+bool offlineStoreAppend(char type, const char *buffer, uint64_t ts){
+  bool res = false;
+  if( xSemaphoreOfflineStore != NULL ){
+    if( xSemaphoreTake( xSemaphoreOfflineStore, ( TickType_t ) 1000 ) == pdTRUE )
     {
-      log_manager->verbose(PSTR(__func__), PSTR("Sending attribute to broker: %s\n"), buffer);
-      res = tb.sendAttributeJSON(buffer);
-      xSemaphoreGive( xSemaphoreTBSend );
+      uint8_t pressure = offlineStore.pressure();
+      res = offlineStore.append(type, buffer, ts);
+      if(offlineStore.pressure() >= 80 && pressure < 80){
+        log_manager->warn(PSTR(__func__), PSTR("Offline store is %d%% full, oldest data will be evicted.\n"), offlineStore.pressure());
+      }
+      xSemaphoreGive( xSemaphoreOfflineStore );
     }
     else
     {
@@ -2447,24 +4622,140 @@ bool tbSendAttribute(const char *buffer){
   return res;
 }
 
-bool tbSendTelemetry(const char * buffer){
+/// @brief Publishes the oldest stored message. Called by TBTR every OFFLINE_REPLAY_INTERVAL while connected,
+/// so a long backlog drains at a steady pace next to live traffic instead of flooding the broker.
+void offlineStoreReplay(){
+  static char buffer[OFFLINE_STORE_RECORD_SIZE];
+  char type = 0;
+  size_t length = 0;
+  if( xSemaphoreOfflineStore != NULL && xSemaphoreTake( xSemaphoreOfflineStore, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    length = offlineStore.peek(type, buffer, sizeof(buffer));
+    xSemaphoreGive( xSemaphoreOfflineStore );
+  }
+  if(length == 0){
+    return;
+  }
+
   bool res = false;
-  int length = strlen(buffer);
-  if (buffer[length - 1] != '}') {
-      log_manager->verbose(PSTR(__func__),PSTR("The buffer is not JSON formatted!\n"));
-      return false;
+  if( xSemaphoreTBSend != NULL && xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    log_manager->verbose(PSTR(__func__), PSTR("Replaying stored message: %s\n"), buffer);
+    res = tbSendPayload(type, buffer);
+    xSemaphoreGive( xSemaphoreTBSend );
   }
-  if( xSemaphoreTBSend != NULL && WiFi.isConnected() && config.provSent && tb.connected() && config.accTkn != NULL){
-    if( xSemaphoreTake( xSemaphoreTBSend, ( TickType_t ) 1000 ) == pdTRUE )
+  if(!res){
+    // Refused while connected, the record itself is the problem and retrying forever would stall the backlog.
+    if(tb.connected() && xSemaphoreOfflineStore != NULL && xSemaphoreTake( xSemaphoreOfflineStore, ( TickType_t ) 1000 ) == pdTRUE )
     {
-      log_manager->verbose(PSTR(__func__), PSTR("Sending telemetry to broker: %s\n"), buffer);
-      res = tb.sendTelemetryJson(buffer); 
-      xSemaphoreGive( xSemaphoreTBSend );
+      if(offlineStore.fail()){
+        log_manager->warn(PSTR(__func__), PSTR("Dropped a stored message after %d failed replays.\n"), OFFLINE_STORE_MAX_ATTEMPTS);
+      }
+      xSemaphoreGive( xSemaphoreOfflineStore );
+    }
+    return;
+  }
+
+  if( xSemaphoreOfflineStore != NULL && xSemaphoreTake( xSemaphoreOfflineStore, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    offlineStore.pop();
+    if(offlineStore.empty()){
+      const OfflineStoreStats &stats = offlineStore.stats();
+      log_manager->info(PSTR(__func__), PSTR("Offline backlog replayed. Stored: %d, replayed: %d, dropped: %d, evicted: %d bytes.\n"),
+        stats.stored, stats.replayed, stats.dropped, stats.evictedBytes);
+    }
+    xSemaphoreGive( xSemaphoreOfflineStore );
+  }
+}
+
+/// @brief Moves RAM buffered messages to flash so they survive a reboot.
+void offlineStoreSync(){
+  if( xSemaphoreOfflineStore != NULL && xSemaphoreTake( xSemaphoreOfflineStore, ( TickType_t ) 1000 ) == pdTRUE )
+  {
+    offlineStore.sync();
+    xSemaphoreGive( xSemaphoreOfflineStore );
+  }
+}
+#endif
+
+#ifdef USE_TLS_RESUMPTION
+/// @brief Hands the session kept in RTC memory over the last reboot back to the MQTT client, so even
+/// the first connect after a software reset can resume.
+void tlsSessionRestore(){
+  #ifdef USE_TLS_SESSION_RTC
+  if(tlsSessionRtc.magic != TLS_SESSION_RTC_MAGIC || tlsSessionRtc.length == 0 || tlsSessionRtc.length > TLS_SESSION_RTC_SIZE ||
+    CoMCUUpdater::crc32(tlsSessionRtc.data, tlsSessionRtc.length) != tlsSessionRtc.crc){
+    tlsSessionRtc.magic = 0;
+    return;
+  }
+  if(ssl.loadSession(tlsSessionRtc.data, tlsSessionRtc.length)){
+    TLS_SESSION_PERSISTED = ssl.sessionGeneration();
+    log_manager->debug(PSTR(__func__), PSTR("Restored TLS session (%d bytes).\n"), tlsSessionRtc.length);
+  }
+  else{
+    tlsSessionRtc.magic = 0;
+  }
+  #endif
+}
+
+/// @brief Copies the session of the last handshake to RTC memory. Called by TBTR after every connect.
+void tlsSessionPersist(){
+  #ifdef USE_TLS_SESSION_RTC
+  if(!ssl.hasSession() || ssl.sessionGeneration() == TLS_SESSION_PERSISTED){
+    return;
+  }
+  tlsSessionRtc.magic = 0;
+  size_t length = ssl.saveSession(tlsSessionRtc.data, sizeof(tlsSessionRtc.data));
+  if(length == 0){
+    log_manager->debug(PSTR(__func__), PSTR("TLS session does not fit TLS_SESSION_RTC_SIZE, not kept over reboot.\n"));
+    return;
+  }
+  tlsSessionRtc.length = length;
+  tlsSessionRtc.crc = CoMCUUpdater::crc32(tlsSessionRtc.data, length);
+  tlsSessionRtc.magic = TLS_SESSION_RTC_MAGIC;
+  TLS_SESSION_PERSISTED = ssl.sessionGeneration();
+  #endif
+}
+#endif
+
+/// @brief Queues one telemetry point for the next batch message instead of publishing it right away.
+/// ts is in milliseconds since epoch; 0 stamps it with the current second so points taken together share one group.
+template <typename T>
+bool tbQueueTelemetry(const char *key, T value, uint64_t ts){
+  bool res = false;
+  if(ts == 0){
+    ts = (uint64_t)rtc.getEpoch() * 1000ULL;
+  }
+  if( xSemaphoreTelemetryBatch != NULL ){
+    if( xSemaphoreTake( xSemaphoreTelemetryBatch, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      res = telemetryBatcher.add(key, value, ts);
+      xSemaphoreGive( xSemaphoreTelemetryBatch );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  return res;
+}
+
+/// @brief Publishes the pending telemetry batch now.
+bool tbFlushTelemetry(){
+  bool res = false;
+  if( xSemaphoreTelemetryBatch != NULL ){
+    if( xSemaphoreTake( xSemaphoreTelemetryBatch, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      res = telemetryBatcher.flush();
+      const TelemetryBatchStats &stats = telemetryBatcher.stats();
+      log_manager->verbose(PSTR(__func__), PSTR("Batches: %d sent, %d failed. Points: %d queued, %d dropped. Saved %d messages, %d bytes.\n"),
+        stats.messagesSent, stats.messagesFailed, stats.pointsAdded, stats.pointsDropped, stats.messagesSaved(), (int32_t)stats.bytesSaved());
+      xSemaphoreGive( xSemaphoreTelemetryBatch );
     }
     else
     {
       log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-    }   
+    }
   }
   return res;
 }
@@ -2520,51 +4811,239 @@ void processFwCheckAttributeRequest(const Shared_Attribute_Data &data){
 }
 
 #ifdef USE_WEB_IFACE
-bool wsBroadcastTXT(const char *buffer){
+bool wsBroadcastTXT(const char *buffer, uint16_t topic){
+  if(!wsHasSubscribers(topic)){
+    return false;
+  }
+  int length = strlen(buffer);
+  if (length == 0 || buffer[length - 1] != '}') {
+      log_manager->verbose(PSTR(__func__),PSTR("The buffer is not JSON formatted!\n"));
+      return false;
+  }
+  return wsBroadcastFrame((const uint8_t *)buffer, length, topic, false);
+}
+
+/// @brief Sends a binary frame, e.g. from wsSampleBatcher, to the clients subscribed to topic.
+bool wsBroadcastBIN(const uint8_t *data, size_t length, uint16_t topic){
+  if(!wsHasSubscribers(topic) || length == 0){
+    return false;
+  }
+  return wsBroadcastFrame(data, length, topic, true);
+}
+
+bool wsBroadcastFrame(const uint8_t *data, size_t length, uint16_t topic, bool binary){
   bool res = false;
-  if(config.fIface && config.wsCount > 0){
-    int length = strlen(buffer);
-    if (buffer[length - 1] != '}') {
-        log_manager->verbose(PSTR(__func__),PSTR("The buffer is not JSON formatted!\n"));
-        return false;
-    }
-    if( xSemaphoreWSSend != NULL){
-      if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) == pdTRUE )
-      {
-        #ifdef USE_ASYNC_WEB
-        ws.cleanupClients(); // remove disconnected clients
-        for(auto& it : clientAuthenticationStatus) {
-            if(it.second) { // if the client is authenticated
-                AsyncWebSocketClient* client = ws.client(it.first); // get the client using the client id
-                if(client != nullptr) {
-                    client->text(buffer);
-                    if(config.logLev == 6){
-                      log_manager->verbose(PSTR(__func__),PSTR("Broadcasted to websocket: %s\n"), buffer);
+  const char *buffer = (const char *)data;
+  if( xSemaphoreWSSend != NULL){
+    if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      #ifdef USE_ASYNC_WEB
+      ws.cleanupClients(); // remove disconnected clients
+      // One payload copy for all clients instead of one per client. The shared buffer is an allocation of
+      // its own, so it only pays off from two receivers on; a single dashboard gets a plain copy.
+      uint8_t receivers = 0;
+      for(auto& it : clientTopics){
+        if((it.value & topic) && ws.client(it.key) != nullptr && ++receivers > 1){break;}
+      }
+      AsyncWebSocketMessageBuffer *shared = receivers > 1 ? wsSharedBuffers.make(data, length) : nullptr;
+      if(shared != nullptr){
+        shared->lock();
+        wsBroadcastStats.sharedBuffers++;
+      }
+      int8_t coalesce = binary ? -1 : wsCoalesceIndex(buffer);
+      uint16_t deliveries = 0;
+      for(auto& it : clientTopics) { // authenticated clients only
+          if(it.value & topic) { // if the client subscribed to the topic
+              AsyncWebSocketClient* client = ws.client(it.key); // get the client using the client id
+              if(client != nullptr) {
+                  WsClientFlow *flow = wsClientFlow(client->id());
+                  if(flow != nullptr && coalesce >= 0 && flow->latest[coalesce] != nullptr){
+                    // Superseded by this frame, whether it goes out now or is held back too.
+                    (*flow->latest[coalesce])--;
+                    flow->latest[coalesce] = nullptr;
+                    wsFlowStats.coalesced++;
+                  }
+                  if(flow != nullptr && wsClientBacklogged(client, flow)){
+                    if(coalesce >= 0 && shared == nullptr && receivers <= 1){
+                      // Held back, the frame needs a buffer that outlives this call.
+                      shared = wsSharedBuffers.make(data, length);
+                      if(shared != nullptr){
+                        shared->lock();
+                        wsBroadcastStats.sharedBuffers++;
+                      }
                     }
-                }
-            }
+                    if(coalesce >= 0 && shared != nullptr){
+                      (*shared)++;
+                      flow->latest[coalesce] = shared;
+                      continue;
+                    }
+                    if(coalesce >= 0 || client->queueIsFull()){
+                      wsFlowStats.dropped++;
+                      continue;
+                    }
+                  }
+                  if(binary){
+                    if(shared != nullptr){client->binary(shared);}
+                    else{client->binary(data, length);}
+                  }
+                  else{
+                    if(shared != nullptr){client->text(shared);}
+                    else{client->text(buffer, length);}
+                  }
+                  if(flow != nullptr){flow->queued++;}
+                  deliveries++;
+              }
+          }
+      }
+      if(shared != nullptr){shared->unlock();}
+      wsBroadcastStats.broadcasts++;
+      wsBroadcastStats.deliveries += deliveries;
+      if(receivers <= 1){wsBroadcastStats.directSends++;}
+      else if(shared == nullptr){wsBroadcastStats.copyFallbacks++;}
+      else if(deliveries > 1){wsBroadcastStats.bytesNotCopied += (uint64_t)length * (deliveries - 1);}
+      if(config.logLev == 6){
+        if(binary){
+          log_manager->verbose(PSTR(__func__),PSTR("Broadcasted to %d websocket clients: %u binary bytes\n"), deliveries, length);
+        }
+        else{
+          log_manager->verbose(PSTR(__func__),PSTR("Broadcasted to %d websocket clients: %s\n"), deliveries, buffer);
         }
-        res = true;
-        #endif
-        #ifndef USE_ASYNC_WEB
-        res = ws.broadcastTXT(buffer);
-        #endif
-        xSemaphoreGive( xSemaphoreWSSend );
       }
-      else
-      {
-        log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+      res = true;
+      #endif
+      #ifndef USE_ASYNC_WEB
+      for(auto& it : clientTopics) {
+          if(it.value & topic) {
+              if(binary){res = ws.sendBIN(it.key, data, length) || res;}
+              else{res = ws.sendTXT(it.key, data, length) || res;}
+          }
       }
+      #endif
+      xSemaphoreGive( xSemaphoreWSSend );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
     }
   }
   return res;
 }
 
+#ifdef USE_ASYNC_WEB
+/// @brief Index into wsCoalesceKeys of the top level key buffer starts with, -1 if it is not coalescible.
+int8_t wsCoalesceIndex(const char *buffer){
+  if(buffer[0] != '{' || buffer[1] != '"'){
+    return -1;
+  }
+  for(uint8_t i = 0; i < WS_COALESCE_COUNT; i++){
+    size_t len = strlen(wsCoalesceKeys[i]);
+    if(strncmp(buffer + 2, wsCoalesceKeys[i], len) == 0 && buffer[2 + len] == '"'){
+      return i;
+    }
+  }
+  return -1;
+}
+
+/// @brief Accounting slot of a client, taken on first use. NULL when all slots are in use,
+/// the client is then sent to without backpressure. Callers hold xSemaphoreWSSend.
+WsClientFlow *wsClientFlow(uint32_t id){
+  WsClientFlow *slot = nullptr;
+  for(uint8_t i = 0; i < WS_FLOW_SLOTS; i++){
+    if(wsClientFlows[i].used && wsClientFlows[i].id == id){
+      return &wsClientFlows[i];
+    }
+    if(!wsClientFlows[i].used && slot == nullptr){
+      slot = &wsClientFlows[i];
+    }
+  }
+  if(slot != nullptr){
+    *slot = WsClientFlow();
+    slot->id = id;
+    slot->used = true;
+  }
+  return slot;
+}
+
+void wsReleaseFlow(WsClientFlow *flow){
+  for(uint8_t t = 0; t < WS_COALESCE_COUNT; t++){
+    if(flow->latest[t] != nullptr){
+      (*flow->latest[t])--;
+    }
+  }
+  *flow = WsClientFlow();
+}
+
+/// @brief Updates the accounting of a client and tells whether it stopped keeping up.
+/// The library sends queued frames as soon as the TCP send buffer has room, so once that buffer
+/// is seen empty again every frame queued before went out and the count starts over.
+bool wsClientBacklogged(AsyncWebSocketClient *client, WsClientFlow *flow){
+  size_t space = client->client()->space();
+  if(space > flow->maxSpace){
+    flow->maxSpace = space;
+  }
+  if(space >= flow->maxSpace){
+    flow->queued = 0;
+  }
+  bool backlogged = client->queueIsFull() || flow->queued >= WS_CLIENT_HIGH_WATER;
+  if(backlogged && !flow->backlogged){
+    flow->backlogSince = millis();
+    wsFlowStats.backlogs++;
+    log_manager->verbose(PSTR(__func__), PSTR("ws [%u] is backlogged with %d frames queued.\n"), flow->id, flow->queued);
+  }
+  flow->backlogged = backlogged;
+  return backlogged;
+}
+
+/// @brief Runs once a second from ifaceTR: removes closed clients, sends the held back frames to
+/// clients that drained and disconnects clients that stayed backlogged for WS_CLIENT_STUCK_TIMEOUT.
+void wsServiceClients(){
+  if( xSemaphoreWSSend == NULL ){
+    return;
+  }
+  if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) != pdTRUE ){
+    log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    return;
+  }
+  ws.cleanupClients(); // remove disconnected clients
+  for(uint8_t i = 0; i < WS_FLOW_SLOTS; i++){
+    WsClientFlow *flow = &wsClientFlows[i];
+    if(!flow->used){
+      continue;
+    }
+    AsyncWebSocketClient *client = ws.client(flow->id);
+    if(client == nullptr){
+      wsReleaseFlow(flow);
+      continue;
+    }
+    if(!wsClientBacklogged(client, flow)){
+      for(uint8_t t = 0; t < WS_COALESCE_COUNT; t++){
+        if(flow->latest[t] != nullptr){
+          client->text(flow->latest[t]);
+          (*flow->latest[t])--;
+          flow->latest[t] = nullptr;
+          flow->queued++;
+          wsFlowStats.flushed++;
+        }
+      }
+    }
+    else if(millis() - flow->backlogSince >= WS_CLIENT_STUCK_TIMEOUT){
+      wsFlowStats.evicted++;
+      log_manager->warn(PSTR(__func__), PSTR("ws [%u] stuck for %lu ms, disconnecting. Backlogs: %u, coalesced: %u, dropped: %u, flushed: %u, evicted: %u\n"),
+        flow->id, millis() - flow->backlogSince, wsFlowStats.backlogs, wsFlowStats.coalesced, wsFlowStats.dropped, wsFlowStats.flushed, wsFlowStats.evicted);
+      // A close frame would wait behind the stuck queue, so the TCP connection is dropped right away.
+      client->client()->close(true);
+      wsReleaseFlow(flow);
+    }
+  }
+  xSemaphoreGive( xSemaphoreWSSend );
+}
+#endif
+
 bool wsSendTXT(uint32_t id, const char *buffer){
   bool res = false;
   if(config.fIface && config.wsCount > 0){
     int length = strlen(buffer);
-    if (buffer[length - 1] != '}') {
+    if (length == 0 || buffer[length - 1] != '}') {
         log_manager->verbose(PSTR(__func__),PSTR("The buffer is not JSON formatted!\n"));
         return false;
     }
@@ -2591,6 +5070,157 @@ bool wsSendTXT(uint32_t id, const char *buffer){
   }
   return res;
 }
+
+/// @brief True when an authenticated client subscribed to any of the topic bits. Check it before building a frame.
+bool wsHasSubscribers(uint16_t topic){
+  return config.fIface && config.wsCount > 0 && (wsTopicSubscribed & topic) != 0;
+}
+
+/// @brief Names an app topic bit (WS_TOPIC_APP_FIRST and up) so clients can subscribe to it.
+bool wsTopicName(uint8_t bit, const char *name){
+  if(bit < WS_TOPIC_APP_FIRST || bit >= WS_TOPIC_COUNT || name == nullptr){
+    return false;
+  }
+  wsTopicNames[bit] = name;
+  return true;
+}
+
+/// @brief Mask of a topic name or an array of them, unknown names are ignored. "*" stands for all topics.
+uint16_t wsTopicMask(JsonVariantConst names){
+  uint16_t mask = 0;
+  if(names.is<JsonArrayConst>()){
+    for(JsonVariantConst name : names.as<JsonArrayConst>()){
+      mask |= wsTopicMask(name);
+    }
+    return mask;
+  }
+  const char *name = names.as<const char *>();
+  if(name == nullptr){
+    return 0;
+  }
+  if(strcmp(name, "*") == 0){
+    return WS_TOPIC_ALL;
+  }
+  for(uint8_t i = 0; i < WS_TOPIC_COUNT; i++){
+    if(wsTopicNames[i] != nullptr && strcmp(wsTopicNames[i], name) == 0){
+      mask |= (1 << i);
+    }
+  }
+  return mask;
+}
+
+/// @brief Recomputes wsTopicSubscribed, callers hold xSemaphoreWSSend.
+void wsTopicsChanged(){
+  uint16_t any = 0;
+  for(auto& it : clientTopics){
+    any |= it.value;
+  }
+  wsTopicSubscribed = any;
+}
+
+void wsTopicsSet(uint32_t id, uint16_t mask){
+  if( xSemaphoreWSSend != NULL ){
+    if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      clientTopics[id] = mask;
+      wsTopicsChanged();
+      xSemaphoreGive( xSemaphoreWSSend );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+}
+
+void wsTopicsDrop(uint32_t id){
+  if( xSemaphoreWSSend != NULL ){
+    if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      clientTopics.erase(id);
+      wsTopicsChanged();
+      xSemaphoreGive( xSemaphoreWSSend );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+}
+
+/// @brief Handles {"topics": [...]} (replace), {"sub": [...]} and {"unsub": [...]} from an authenticated client.
+/// Answers with the resulting mask and returns false when doc is not a subscription message.
+bool wsProcessSubscription(uint32_t id, const JsonObject &doc){
+  bool replace = doc.containsKey("topics");
+  if(!replace && !doc.containsKey("sub") && !doc.containsKey("unsub")){
+    return false;
+  }
+  uint16_t mask = 0;
+  if( xSemaphoreWSSend != NULL ){
+    if( xSemaphoreTake( xSemaphoreWSSend, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+      uint16_t *topics = clientTopics.find(id);
+      if(topics != nullptr){
+        if(replace){
+          *topics = wsTopicMask(doc["topics"]);
+        }
+        *topics |= wsTopicMask(doc["sub"]);
+        *topics &= ~wsTopicMask(doc["unsub"]);
+        mask = *topics;
+        wsTopicsChanged();
+      }
+      xSemaphoreGive( xSemaphoreWSSend );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+      return true;
+    }
+  }
+  char reply[64];
+  snprintf(reply, sizeof(reply), PSTR("{\"status\": {\"code\": 200, \"msg\": \"Subscribed.\", \"topics\": %u}}"), mask);
+  wsSendTXT(id, reply);
+  log_manager->debug(PSTR(__func__), PSTR("ws [%u] topics: 0x%04x\n"), id, mask);
+  return true;
+}
+
+/// @brief Queues one sample for the binary stream, a frame goes out every SAMPLE_FRAME_MAX_AGE ms
+/// or when it is full. Returns false right away when no client subscribed to the stream topic.
+bool wsStreamSample(uint8_t channel, const float *values, uint8_t count){
+  if(!wsHasSubscribers(WS_TOPIC_STREAM)){
+    return false;
+  }
+  bool res = false;
+  if( xSemaphoreWsStream != NULL ){
+    if( xSemaphoreTake( xSemaphoreWsStream, ( TickType_t ) 100 ) == pdTRUE )
+    {
+      uint64_t ts = tbTimestamp();
+      res = wsSampleBatcher.add(channel, values, count, ts != 0 ? ts : millis());
+      wsSampleBatcher.poll();
+      xSemaphoreGive( xSemaphoreWsStream );
+    }
+    else
+    {
+      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
+    }
+  }
+  return res;
+}
+
+bool wsStreamPublish(const uint8_t *frame, size_t length){
+  return wsBroadcastBIN(frame, length, WS_TOPIC_STREAM);
+}
+
+/// @brief Sends the pending stream frame once it is old enough, for when samples stopped coming.
+void wsStreamPoll(){
+  if( xSemaphoreWsStream != NULL && !wsSampleBatcher.empty() ){
+    if( xSemaphoreTake( xSemaphoreWsStream, ( TickType_t ) 0 ) == pdTRUE )
+    {
+      wsSampleBatcher.poll();
+      xSemaphoreGive( xSemaphoreWsStream );
+    }
+  }
+}
 #endif
 
 #ifdef USE_DISK_LOG
@@ -2792,13 +5422,13 @@ void wsStreamCardLogger(uint32_t id, String fileName)
         doc[PSTR("src")] = PSTR("card-end");
         serializeJson(doc, buffer);
         //wsSendTXT(id, buffer);
-        wsBroadcastTXT(buffer);
+        wsBroadcastTXT(buffer, WS_TOPIC_CARD);
         break;
       };
       doc[PSTR("src")] = PSTR("card");
       serializeJson(doc, buffer);
       //wsSendTXT(id, buffer);
-      wsBroadcastTXT(buffer);
+      wsBroadcastTXT(buffer, WS_TOPIC_CARD);
       vTaskDelay((const TickType_t) 50 / portTICK_PERIOD_MS);
     }
 
@@ -0,0 +1,246 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef LRUTABLE_H
+#define LRUTABLE_H
+
+#include <Arduino.h>
+
+/// @brief Default key hash for integer like keys, IPAddress included through its uint32_t conversion.
+template <typename K>
+inline uint32_t lruKeyHash(const K &key)
+{
+    uint32_t h = (uint32_t)key;
+    h ^= h >> 16;
+    h *= 0x45d9f3bUL;
+    h ^= h >> 16;
+    return h;
+}
+
+/// @brief Index slots for n entries: the power of two at or above 2n, which keeps the load at or below one half.
+constexpr uint16_t lruTableSlots(uint16_t n, uint16_t s = 1)
+{
+    return s >= 2 * n ? s : lruTableSlots(n, s * 2);
+}
+
+/**
+ * Map with a fixed capacity of N entries that never allocates.
+ *
+ * Keys are found through an open addressing index of twice the capacity (linear probing, entries
+ * removed with backward shift so there are no tombstones), lookups and updates are O(1). Entries
+ * are kept in least recently used order; inserting into a full table evicts the entry that was not
+ * looked up for the longest time. Iterating visits the entries without changing that order.
+ * Not thread safe, callers lock around it.
+ */
+template <typename K, typename V, uint16_t N>
+class LruTable
+{
+    public:
+        struct Entry
+        {
+            K key;
+            V value;
+            uint16_t prev;
+            uint16_t next;
+            bool used;
+        };
+
+        class Iterator
+        {
+            public:
+                Iterator(Entry *entries, uint16_t i) : _entries(entries), _i(i) { skip(); }
+                Entry &operator*() const { return _entries[_i]; }
+                Entry *operator->() const { return &_entries[_i]; }
+                Iterator &operator++() { _i++; skip(); return *this; }
+                bool operator!=(const Iterator &other) const { return _i != other._i; }
+
+            private:
+                void skip() { while(_i < N && !_entries[_i].used) { _i++; } }
+                Entry *_entries;
+                uint16_t _i;
+        };
+
+        LruTable() { clear(); }
+
+        void clear()
+        {
+            memset(_index, 0, sizeof(_index));
+            for(uint16_t i = 0; i < N; i++)
+            {
+                _entries[i].used = false;
+                _entries[i].next = i + 1 < N ? i + 1 : NIL;
+            }
+            _free = 0;
+            _head = NIL;
+            _tail = NIL;
+            _size = 0;
+        }
+
+        /// @brief Value of key, or NULL. Marks the entry as recently used.
+        V *find(const K &key)
+        {
+            int32_t slot = lookup(key);
+            if(slot < 0)
+            {
+                return nullptr;
+            }
+            uint16_t e = _index[slot] - 1;
+            touch(e);
+            return &_entries[e].value;
+        }
+
+        bool contains(const K &key) const { return lookup(key) >= 0; }
+
+        /// @brief Value of key, inserted value initialized when missing, like std::map.
+        V &operator[](const K &key)
+        {
+            V *value = find(key);
+            return value != nullptr ? *value : insert(key, V());
+        }
+
+        V &put(const K &key, const V &value)
+        {
+            V *current = find(key);
+            if(current != nullptr)
+            {
+                *current = value;
+                return *current;
+            }
+            return insert(key, value);
+        }
+
+        bool erase(const K &key)
+        {
+            int32_t slot = lookup(key);
+            if(slot < 0)
+            {
+                return false;
+            }
+            remove((uint16_t)slot);
+            return true;
+        }
+
+        uint16_t size() const { return _size; }
+        static uint16_t capacity() { return N; }
+        uint32_t evictions() const { return _evictions; }
+
+        Iterator begin() { return Iterator(_entries, 0); }
+        Iterator end() { return Iterator(_entries, N); }
+
+    private:
+        enum : uint16_t { NIL = 0xFFFF, SLOTS = lruTableSlots(N) };
+        static_assert(N > 0 && N <= 0x4000, "LruTable capacity must be between 1 and 16384");
+
+        uint16_t home(const K &key) const { return lruKeyHash(key) & (SLOTS - 1); }
+
+        int32_t lookup(const K &key) const
+        {
+            for(uint16_t i = home(key), probes = 0; probes < SLOTS; i = (i + 1) & (SLOTS - 1), probes++)
+            {
+                if(_index[i] == 0)
+                {
+                    return -1;
+                }
+                if(_entries[_index[i] - 1].key == key)
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        V &insert(const K &key, const V &value)
+        {
+            if(_free == NIL)
+            {
+                _evictions++;
+                remove((uint16_t)lookup(_entries[_tail].key));
+            }
+            uint16_t e = _free;
+            _free = _entries[e].next;
+            Entry &entry = _entries[e];
+            entry.key = key;
+            entry.value = value;
+            entry.used = true;
+            link(e);
+            uint16_t i = home(key);
+            while(_index[i] != 0)
+            {
+                i = (i + 1) & (SLOTS - 1);
+            }
+            _index[i] = e + 1;
+            _size++;
+            return entry.value;
+        }
+
+        void remove(uint16_t slot)
+        {
+            uint16_t e = _index[slot] - 1;
+            unlink(e);
+            _entries[e].used = false;
+            _entries[e].value = V();
+            _entries[e].next = _free;
+            _free = e;
+            _size--;
+
+            // Backward shift: pull later entries of the probe run into the hole when that keeps them reachable.
+            uint16_t hole = slot;
+            for(uint16_t i = (hole + 1) & (SLOTS - 1); _index[i] != 0; i = (i + 1) & (SLOTS - 1))
+            {
+                uint16_t h = home(_entries[_index[i] - 1].key);
+                bool reachable = hole <= i ? (h > hole && h <= i) : (h > hole || h <= i);
+                if(!reachable)
+                {
+                    _index[hole] = _index[i];
+                    hole = i;
+                }
+            }
+            _index[hole] = 0;
+        }
+
+        void link(uint16_t e)
+        {
+            _entries[e].prev = NIL;
+            _entries[e].next = _head;
+            if(_head != NIL)
+            {
+                _entries[_head].prev = e;
+            }
+            _head = e;
+            if(_tail == NIL)
+            {
+                _tail = e;
+            }
+        }
+
+        void unlink(uint16_t e)
+        {
+            Entry &entry = _entries[e];
+            if(entry.prev != NIL) { _entries[entry.prev].next = entry.next; } else { _head = entry.next; }
+            if(entry.next != NIL) { _entries[entry.next].prev = entry.prev; } else { _tail = entry.prev; }
+        }
+
+        void touch(uint16_t e)
+        {
+            if(_head != e)
+            {
+                unlink(e);
+                link(e);
+            }
+        }
+
+        uint16_t _index[SLOTS];
+        Entry _entries[N];
+        uint16_t _free;
+        uint16_t _head;
+        uint16_t _tail;
+        uint16_t _size;
+        uint32_t _evictions = 0;
+};
+
+#endif
@@ -0,0 +1,409 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "offlineStore.h"
+
+bool OfflineStore::begin(fs::FS &fs, const char *dir, size_t maxPayload)
+{
+    _fs = &fs;
+    _maxPayload = maxPayload;
+    _attempts = 0;
+    strlcpy(_dir, dir, sizeof(_dir));
+    _hasDisk = false;
+    _diskBytes = 0;
+    _readOffset = 0;
+    _peekLen = 0;
+
+    File root = _fs->open(_dir);
+    if(!root || !root.isDirectory())
+    {
+        // SPIFFS has no real directories and lists nothing until the first segment exists.
+        _fs->mkdir(_dir);
+        return true;
+    }
+    while(File file = root.openNextFile())
+    {
+        const char *name = strrchr(file.name(), '/');
+        name = name != nullptr ? name + 1 : file.name();
+        const char *ext = strstr(name, ".seg");
+        if(ext != nullptr && ext[4] == '\0')
+        {
+            uint32_t seg = strtoul(name, nullptr, 10);
+            if(!_hasDisk || seg < _firstSeg)
+            {
+                _firstSeg = seg;
+            }
+            if(!_hasDisk || seg > _lastSeg)
+            {
+                _lastSeg = seg;
+            }
+            _hasDisk = true;
+            _diskBytes += file.size();
+        }
+        file.close();
+    }
+
+    if(_hasDisk)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "%s/cursor", _dir);
+        File cursor = _fs->open(path, FILE_READ);
+        if(cursor)
+        {
+            unsigned long seg = 0, offset = 0;
+            String line = cursor.readStringUntil('\n');
+            if(sscanf(line.c_str(), "%lu %lu", &seg, &offset) == 2 && seg == _firstSeg)
+            {
+                _readOffset = offset;
+            }
+            cursor.close();
+        }
+    }
+    return true;
+}
+
+void OfflineStore::segmentPath(uint32_t seg, char *path)
+{
+    snprintf(path, 32, "%s/%08lu.seg", _dir, (unsigned long)seg);
+}
+
+void OfflineStore::saveCursor()
+{
+    _popsSinceCursor = 0;
+    if(_fs == nullptr)
+    {
+        return;
+    }
+    char path[32];
+    snprintf(path, sizeof(path), "%s/cursor", _dir);
+    File cursor = _fs->open(path, FILE_WRITE);
+    if(cursor)
+    {
+        cursor.printf("%lu %lu\n", (unsigned long)_firstSeg, (unsigned long)_readOffset);
+        cursor.close();
+    }
+}
+
+bool OfflineStore::append(char type, const char *payload, uint64_t ts)
+{
+    char prefix[40];
+    size_t prefixLen = 0;
+    if(type == OFFLINE_RECORD_TELEMETRY && ts != 0 && payload[0] == '{')
+    {
+        prefixLen = snprintf(prefix, sizeof(prefix), "{\"ts\":%llu,\"values\":", (unsigned long long)ts);
+    }
+    size_t payloadLen = strlen(payload);
+    size_t len = 1 + prefixLen + payloadLen + (prefixLen > 0 ? 1 : 0) + 1;
+    if(payloadLen == 0 || len > OFFLINE_STORE_RECORD_SIZE || len > sizeof(_ram) || len - 2 > _maxPayload)
+    {
+        _stats.dropped++;
+        return false;
+    }
+
+    if(_ramTail + len > sizeof(_ram))
+    {
+        if(!spill())
+        {
+            // No usable flash, keep the newest data in RAM.
+            while(_ramHead != _ramTail && _ramTail - _ramHead + len > sizeof(_ram))
+            {
+                evictOldestRamRecord();
+            }
+            if(_ramHead > 0)
+            {
+                memmove(_ram, _ram + _ramHead, _ramTail - _ramHead);
+                _ramTail -= _ramHead;
+                _ramHead = 0;
+                if(!_peekFromDisk)
+                {
+                    _peekLen = 0;
+                }
+            }
+        }
+    }
+
+    char *dst = _ram + _ramTail;
+    *dst++ = type;
+    memcpy(dst, prefix, prefixLen);
+    dst += prefixLen;
+    for(size_t i = 0; i < payloadLen; i++)
+    {
+        // Records are newline delimited, serializers never emit raw newlines but be safe.
+        char c = payload[i];
+        *dst++ = (c == '\n' || c == '\r') ? ' ' : c;
+    }
+    if(prefixLen > 0)
+    {
+        *dst++ = '}';
+    }
+    *dst = '\n';
+    _ramTail += len;
+    _stats.stored++;
+    return true;
+}
+
+void OfflineStore::evictOldestRamRecord()
+{
+    const char *end = (const char*)memchr(_ram + _ramHead, '\n', _ramTail - _ramHead);
+    size_t len = end != nullptr ? (end - (_ram + _ramHead)) + 1 : _ramTail - _ramHead;
+    _ramHead += len;
+    _attempts = 0;
+    _stats.evictedRamRecords++;
+    _stats.evictedBytes += len;
+    if(!_peekFromDisk)
+    {
+        _peekLen = 0;
+    }
+}
+
+bool OfflineStore::removeOldestSegment(bool evict)
+{
+    if(!_hasDisk || _fs == nullptr)
+    {
+        return false;
+    }
+    char path[32];
+    segmentPath(_firstSeg, path);
+    File file = _fs->open(path, FILE_READ);
+    size_t size = file ? file.size() : 0;
+    if(file)
+    {
+        file.close();
+    }
+    _fs->remove(path);
+    _diskBytes = _diskBytes > size ? _diskBytes - size : 0;
+    if(evict)
+    {
+        _attempts = 0;
+        _stats.evictedSegments++;
+        _stats.evictedBytes += size > _readOffset ? size - _readOffset : 0;
+    }
+    if(_peekFromDisk)
+    {
+        _peekLen = 0;
+    }
+    _readOffset = 0;
+    if(_firstSeg == _lastSeg)
+    {
+        _hasDisk = false;
+        _diskBytes = 0;
+        _firstSeg = ++_lastSeg;
+    }
+    else
+    {
+        _firstSeg++;
+    }
+    saveCursor();
+    return true;
+}
+
+bool OfflineStore::spill()
+{
+    size_t n = _ramTail - _ramHead;
+    if(n == 0)
+    {
+        return true;
+    }
+    if(_fs == nullptr || n > OFFLINE_STORE_MAX_BYTES)
+    {
+        return false;
+    }
+    while(_hasDisk && _diskBytes + n > OFFLINE_STORE_MAX_BYTES)
+    {
+        removeOldestSegment(true);
+    }
+
+    char path[32];
+    size_t segSize = 0;
+    if(_hasDisk)
+    {
+        segmentPath(_lastSeg, path);
+        File last = _fs->open(path, FILE_READ);
+        if(last)
+        {
+            segSize = last.size();
+            last.close();
+        }
+        if(segSize > 0 && segSize + n > OFFLINE_STORE_SEGMENT_SIZE)
+        {
+            _lastSeg++;
+            segSize = 0;
+        }
+    }
+    else
+    {
+        _firstSeg = _lastSeg;
+        _readOffset = 0;
+    }
+
+    segmentPath(_lastSeg, path);
+    File file = _fs->open(path, FILE_APPEND);
+    size_t written = 0;
+    if(file)
+    {
+        written = file.write((const uint8_t*)_ram + _ramHead, n);
+        file.close();
+    }
+    if(written != n)
+    {
+        // Start a fresh segment so the torn line is not glued to the next record.
+        if(written > 0)
+        {
+            _diskBytes += written;
+            _hasDisk = true;
+            _lastSeg++;
+        }
+        // The file system is fuller than our budget assumed, make room by dropping the oldest data.
+        if(_hasDisk && _firstSeg != _lastSeg)
+        {
+            removeOldestSegment(true);
+        }
+        return false;
+    }
+
+    if(!_hasDisk)
+    {
+        saveCursor();
+    }
+    _hasDisk = true;
+    _diskBytes += n;
+    _ramHead = _ramTail = 0;
+    if(!_peekFromDisk)
+    {
+        _peekLen = 0;
+    }
+    _stats.spills++;
+    return true;
+}
+
+bool OfflineStore::sync()
+{
+    return spill();
+}
+
+size_t OfflineStore::peek(char &type, char *buffer, size_t size)
+{
+    _peekLen = 0;
+    while(_hasDisk && _fs != nullptr)
+    {
+        char path[32];
+        segmentPath(_firstSeg, path);
+        File file = _fs->open(path, FILE_READ);
+        if(!file || _readOffset >= file.size())
+        {
+            if(file)
+            {
+                file.close();
+            }
+            removeOldestSegment(false);
+            continue;
+        }
+        file.setTimeout(0);
+        file.seek(_readOffset);
+        type = file.read();
+        size_t n = file.readBytesUntil('\n', buffer, size - 1);
+        size_t consumed = file.position() - _readOffset;
+        if(n >= size - 1 && file.peek() != '\n' && file.available())
+        {
+            // Longer than the caller can hold, skip the rest of the line.
+            file.find((char*)"\n");
+            _readOffset = file.position();
+            file.close();
+            _stats.dropped++;
+            continue;
+        }
+        file.close();
+        if(n == 0 || consumed != n + 2)
+        {
+            // Empty line, or a record torn by a failed write.
+            _readOffset += consumed;
+            if(n > 0)
+            {
+                _stats.dropped++;
+            }
+            continue;
+        }
+        buffer[n] = '\0';
+        _peekLen = consumed;
+        _peekFromDisk = true;
+        return n;
+    }
+
+    if(_ramHead == _ramTail)
+    {
+        return 0;
+    }
+    const char *start = _ram + _ramHead;
+    const char *end = (const char*)memchr(start, '\n', _ramTail - _ramHead);
+    size_t lineLen = (end - start) + 1;
+    size_t n = lineLen - 2;
+    if(n >= size)
+    {
+        _ramHead += lineLen;
+        _stats.dropped++;
+        return peek(type, buffer, size);
+    }
+    type = start[0];
+    memcpy(buffer, start + 1, n);
+    buffer[n] = '\0';
+    _peekLen = lineLen;
+    _peekFromDisk = false;
+    return n;
+}
+
+void OfflineStore::pop()
+{
+    if(_peekLen == 0)
+    {
+        return;
+    }
+    consume();
+    _stats.replayed++;
+}
+
+bool OfflineStore::fail()
+{
+    if(_peekLen == 0 || ++_attempts < OFFLINE_STORE_MAX_ATTEMPTS)
+    {
+        return false;
+    }
+    consume();
+    _stats.dropped++;
+    return true;
+}
+
+void OfflineStore::consume()
+{
+    if(_peekFromDisk)
+    {
+        _readOffset += _peekLen;
+        if(++_popsSinceCursor >= OFFLINE_STORE_CURSOR_EVERY)
+        {
+            saveCursor();
+        }
+    }
+    else
+    {
+        _ramHead += _peekLen;
+        if(_ramHead >= _ramTail)
+        {
+            _ramHead = _ramTail = 0;
+        }
+    }
+    _peekLen = 0;
+    _attempts = 0;
+}
+
+uint8_t OfflineStore::pressure() const
+{
+    size_t used = _diskBytes + (_ramTail - _ramHead);
+    size_t capacity = (_fs != nullptr ? OFFLINE_STORE_MAX_BYTES : 0) + sizeof(_ram);
+    return used >= capacity ? 100 : (uint8_t)(used * 100 / capacity);
+}
+
+LAYOUT_CHECK_DEFINE(OfflineStore)
@@ -0,0 +1,124 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef OFFLINESTORE_H
+#define OFFLINESTORE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "layoutCheck.h"
+
+#ifndef OFFLINE_STORE_DIR
+#define OFFLINE_STORE_DIR "/ofl"
+#endif
+#ifndef OFFLINE_STORE_RAM_SIZE
+#define OFFLINE_STORE_RAM_SIZE 4096
+#endif
+#ifndef OFFLINE_STORE_SEGMENT_SIZE
+#define OFFLINE_STORE_SEGMENT_SIZE 16384
+#endif
+#ifndef OFFLINE_STORE_MAX_BYTES
+#define OFFLINE_STORE_MAX_BYTES 131072
+#endif
+#ifndef OFFLINE_STORE_RECORD_SIZE
+#define OFFLINE_STORE_RECORD_SIZE 1200
+#endif
+/// The replay cursor is written to flash every N replayed records, so a reboot replays at most N duplicates.
+#ifndef OFFLINE_STORE_CURSOR_EVERY
+#define OFFLINE_STORE_CURSOR_EVERY 16
+#endif
+/// Failed replays of one record before it is dropped, so a record the broker never takes cannot stall the backlog.
+#ifndef OFFLINE_STORE_MAX_ATTEMPTS
+#define OFFLINE_STORE_MAX_ATTEMPTS 3
+#endif
+
+/// Record types
+#define OFFLINE_RECORD_TELEMETRY 't'
+#define OFFLINE_RECORD_ATTRIBUTE 'a'
+
+struct OfflineStoreStats
+{
+    uint32_t stored = 0;
+    uint32_t replayed = 0;
+    uint32_t dropped = 0;
+    uint32_t spills = 0;
+    uint32_t evictedSegments = 0;
+    uint32_t evictedRamRecords = 0;
+    size_t evictedBytes = 0;
+};
+
+/**
+ * Store and forward queue for messages that could not be published.
+ *
+ * Records are "<type><json>\n" lines. They collect in a RAM buffer first, and the whole buffer is
+ * appended to the newest segment file (<dir>/<seq>.seg) when it fills, so flash sees a few large
+ * writes instead of one per message. Segments are capped at OFFLINE_STORE_SEGMENT_SIZE and the log
+ * at OFFLINE_STORE_MAX_BYTES. When full, the oldest segment is deleted. Without a usable file system
+ * the oldest RAM records are evicted instead.
+ *
+ * Replay is oldest first: disk segments, then RAM. peek() returns the next record and pop() consumes
+ * it once it has been delivered. fail() counts a publish that did not go through, the record is retried
+ * later and dropped after OFFLINE_STORE_MAX_ATTEMPTS. Not thread safe, callers lock around it.
+ */
+class OfflineStore
+{
+    public:
+        /// @brief Opens the log in dir on fs and resumes after the last persisted replay cursor.
+        /// Records are limited to maxPayload bytes of JSON, the most the publisher can send in one message.
+        bool begin(fs::FS &fs, const char *dir = OFFLINE_STORE_DIR, size_t maxPayload = OFFLINE_STORE_RECORD_SIZE - 2);
+        /// @brief Queues payload. A telemetry object with ts != 0 is stored as {"ts":ts,"values":payload}
+        /// so it keeps its original time when replayed. A record longer than maxPayload is refused.
+        bool append(char type, const char *payload, uint64_t ts = 0);
+        /// @brief Copies the oldest record's payload into buffer and returns its length, 0 when empty.
+        size_t peek(char &type, char *buffer, size_t size);
+        /// @brief Consumes the record returned by the last peek().
+        void pop();
+        /// @brief Counts a failed publish of the record returned by the last peek().
+        /// @return True when that was its last attempt and it was consumed as dropped.
+        bool fail();
+        /// @brief Writes pending RAM records to flash, e.g. before a reboot.
+        bool sync();
+
+        bool empty() const { return !_hasDisk && _ramHead == _ramTail; }
+        size_t diskBytes() const { return _diskBytes; }
+        size_t ramBytes() const { return _ramTail - _ramHead; }
+        /// @brief How full the store is, 0..100. Producers can slow down as it rises.
+        uint8_t pressure() const;
+        const OfflineStoreStats &stats() const { return _stats; }
+
+    private:
+        bool spill();
+        /// @brief Deletes the oldest segment. evict is false when it was simply replayed to the end.
+        bool removeOldestSegment(bool evict);
+        void evictOldestRamRecord();
+        void segmentPath(uint32_t seg, char *path);
+        void saveCursor();
+        void consume();
+
+        fs::FS *_fs = nullptr;
+        char _dir[16] = {0};
+        char _ram[OFFLINE_STORE_RAM_SIZE];
+        size_t _ramHead = 0;
+        size_t _ramTail = 0;
+        bool _hasDisk = false;
+        uint32_t _firstSeg = 0;
+        uint32_t _lastSeg = 0;
+        size_t _readOffset = 0;
+        size_t _diskBytes = 0;
+        size_t _peekLen = 0;
+        bool _peekFromDisk = false;
+        uint16_t _popsSinceCursor = 0;
+        size_t _maxPayload = OFFLINE_STORE_RECORD_SIZE - 2;
+        // Failed publishes of the oldest record.
+        uint8_t _attempts = 0;
+        OfflineStoreStats _stats;
+};
+
+LAYOUT_CHECK(OfflineStore);
+
+#endif
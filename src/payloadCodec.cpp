@@ -0,0 +1,33 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "payloadCodec.h"
+
+size_t PayloadCodec::encodeMsgPack(const char *json, uint8_t *out, size_t size)
+{
+    unsigned long start = micros();
+    size_t jsonLength = strlen(json);
+    _doc.clear();
+    if(deserializeJson(_doc, json, jsonLength) != DeserializationError::Ok)
+    {
+        _stats.failed++;
+        return 0;
+    }
+    size_t length = measureMsgPack(_doc);
+    if(length >= jsonLength || length > size)
+    {
+        _stats.skipped++;
+        return 0;
+    }
+    serializeMsgPack(_doc, out, size);
+    _stats.encodeMicros += micros() - start;
+    _stats.encoded++;
+    _stats.jsonBytes += jsonLength;
+    _stats.encodedBytes += length;
+    return length;
+}
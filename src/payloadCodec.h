@@ -0,0 +1,52 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef PAYLOADCODEC_H
+#define PAYLOADCODEC_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#ifndef PAYLOAD_CODEC_DOC_SIZE
+#define PAYLOAD_CODEC_DOC_SIZE 2048
+#endif
+
+/// Payload encodings, selected by the pEnc shared attribute.
+#define PAYLOAD_ENCODING_JSON 0
+#define PAYLOAD_ENCODING_MSGPACK 1
+
+struct PayloadCodecStats
+{
+    uint32_t encoded = 0;
+    /// Payloads sent as JSON anyway because packing did not make them smaller or did not fit.
+    uint32_t skipped = 0;
+    uint32_t failed = 0;
+    uint64_t jsonBytes = 0;
+    uint64_t encodedBytes = 0;
+    uint64_t encodeMicros = 0;
+};
+
+/**
+ * Re-encodes outbound JSON payloads as MessagePack. Keys and the message structure stay the same,
+ * numbers and booleans lose their text form and strings their quotes, which is where most of a
+ * UDAWA telemetry or attribute message goes. Not thread safe, callers lock around it.
+ */
+class PayloadCodec
+{
+    public:
+        /// @brief Packs json into out and returns the packed length. 0 means send the JSON instead:
+        /// it did not parse, did not fit into size or would not have been smaller.
+        size_t encodeMsgPack(const char *json, uint8_t *out, size_t size);
+        const PayloadCodecStats &stats() const { return _stats; }
+
+    private:
+        StaticJsonDocument<PAYLOAD_CODEC_DOC_SIZE> _doc;
+        PayloadCodecStats _stats;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "rpcRegistry.h"
+
+static_assert((RPC_REGISTRY_SIZE & (RPC_REGISTRY_SIZE - 1)) == 0, "RPC_REGISTRY_SIZE must be a power of two");
+
+static uint32_t rpcNameHash(const char *name)
+{
+    uint32_t hash = 2166136261UL;
+    while(*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+int16_t RpcRegistry::slot(const char *name, uint32_t hash, bool create)
+{
+    int16_t free = -1;
+    for(uint16_t i = 0; i < RPC_REGISTRY_SIZE; i++)
+    {
+        uint16_t index = (hash + i) & (RPC_REGISTRY_SIZE - 1);
+        if(!create)
+        {
+            _stats.probes++;
+        }
+        if(_state[index] == SLOT_EMPTY)
+        {
+            if(!create)
+            {
+                return -1;
+            }
+            return free >= 0 ? free : index;
+        }
+        if(_state[index] == SLOT_DELETED)
+        {
+            if(free < 0)
+            {
+                free = index;
+            }
+            continue;
+        }
+        if(_methods[index].hash == hash && strcmp(_methods[index].name, name) == 0)
+        {
+            return index;
+        }
+    }
+    return create ? free : -1;
+}
+
+bool RpcRegistry::add(const char *name, RpcHandler handler, bool async)
+{
+    if(name == nullptr || handler == nullptr || strlen(name) >= RPC_NAME_SIZE)
+    {
+        return false;
+    }
+    uint32_t hash = rpcNameHash(name);
+    int16_t index = slot(name, hash, true);
+    if(index < 0)
+    {
+        return false;
+    }
+    RpcMethod &method = _methods[index];
+    if(_state[index] == SLOT_USED)
+    {
+        if(method.async)
+        {
+            _async--;
+        }
+    }
+    else
+    {
+        _size++;
+        method.hash = hash;
+        strlcpy(method.name, name, sizeof(method.name));
+        _state[index] = SLOT_USED;
+    }
+    method.handler = handler;
+    method.async = async;
+    if(async)
+    {
+        _async++;
+    }
+    return true;
+}
+
+bool RpcRegistry::remove(const char *name)
+{
+    if(name == nullptr)
+    {
+        return false;
+    }
+    int16_t index = slot(name, rpcNameHash(name), false);
+    if(index < 0)
+    {
+        return false;
+    }
+    if(_methods[index].async)
+    {
+        _async--;
+    }
+    _methods[index] = RpcMethod();
+    // A tombstone keeps the probe chains of later entries intact.
+    _state[index] = SLOT_DELETED;
+    _size--;
+    return true;
+}
+
+const RpcMethod *RpcRegistry::find(const char *name)
+{
+    if(name == nullptr)
+    {
+        return nullptr;
+    }
+    _stats.lookups++;
+    int16_t index = slot(name, rpcNameHash(name), false);
+    if(index < 0)
+    {
+        _stats.misses++;
+        return nullptr;
+    }
+    return &_methods[index];
+}
+
+LAYOUT_CHECK_DEFINE(RpcRegistry)
@@ -0,0 +1,76 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef RPCREGISTRY_H
+#define RPCREGISTRY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "layoutCheck.h"
+
+/// Table slots, a power of two. Keep it at least twice the number of registered methods.
+#ifndef RPC_REGISTRY_SIZE
+#define RPC_REGISTRY_SIZE 32
+#endif
+#ifndef RPC_NAME_SIZE
+#define RPC_NAME_SIZE 24
+#endif
+
+/// @brief Handles one call. params is the whole RPC params object, fields added to reply are sent back.
+typedef void (*RpcHandler)(const JsonVariantConst &params, JsonObject reply);
+
+struct RpcMethod
+{
+    uint32_t hash;
+    char name[RPC_NAME_SIZE];
+    RpcHandler handler;
+    /// Runs on the RPC worker task and replies later instead of inside the MQTT loop.
+    bool async;
+};
+
+struct RpcRegistryStats
+{
+    uint32_t lookups = 0;
+    uint32_t misses = 0;
+    uint32_t probes = 0;
+};
+
+/**
+ * Method name to handler table. Open addressing on the FNV-1a hash of the name with linear probing,
+ * so a lookup hashes the name once and usually compares a single entry, however many methods are
+ * registered. Not thread safe, callers lock around it.
+ */
+class RpcRegistry
+{
+    public:
+        /// @brief Registers or replaces name. False when the name is too long or the table is full.
+        bool add(const char *name, RpcHandler handler, bool async = false);
+        bool remove(const char *name);
+        /// @brief The method registered as name, nullptr if there is none.
+        const RpcMethod *find(const char *name);
+
+        uint8_t size() const { return _size; }
+        uint8_t asyncCount() const { return _async; }
+        const RpcRegistryStats &stats() const { return _stats; }
+
+    private:
+        enum SlotState : uint8_t { SLOT_EMPTY, SLOT_USED, SLOT_DELETED };
+
+        /// @brief Index of name's slot, or where it would go with create. -1 if absent / no room.
+        int16_t slot(const char *name, uint32_t hash, bool create);
+
+        RpcMethod _methods[RPC_REGISTRY_SIZE] = {};
+        SlotState _state[RPC_REGISTRY_SIZE] = {};
+        uint8_t _size = 0;
+        uint8_t _async = 0;
+        RpcRegistryStats _stats;
+};
+
+LAYOUT_CHECK(RpcRegistry);
+
+#endif
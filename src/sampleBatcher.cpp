@@ -0,0 +1,100 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "sampleBatcher.h"
+
+static_assert(SAMPLE_FRAME_SIZE >= SAMPLE_FRAME_HEADER + SAMPLE_RECORD_HEADER + SAMPLE_MAX_VALUES * 4, "SAMPLE_FRAME_SIZE must fit the largest record");
+
+static void putLe(uint8_t *dst, uint64_t value, uint8_t bytes)
+{
+    for(uint8_t i = 0; i < bytes; i++)
+    {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+bool SampleBatcher::add(uint8_t channel, const float *values, uint8_t count, uint64_t ts)
+{
+    _stats.samplesAdded++;
+    if(values == nullptr || count == 0 || count > SAMPLE_MAX_VALUES)
+    {
+        _stats.samplesDropped++;
+        return false;
+    }
+    size_t recordLen = SAMPLE_RECORD_HEADER + (size_t)count * 4;
+    if(_records > 0 && (ts < _baseTs || ts - _baseTs > 0xFFFF || _records == 0xFF || _length + recordLen > sizeof(_buffer)))
+    {
+        flush(SAMPLE_FLUSH_SIZE);
+    }
+    if(_records == 0)
+    {
+        _buffer[0] = SAMPLE_FRAME_VERSION;
+        putLe(_buffer + 2, ts, 8);
+        _length = SAMPLE_FRAME_HEADER;
+        _baseTs = ts;
+        _openedAt = millis();
+    }
+
+    uint8_t *dst = _buffer + _length;
+    putLe(dst, ts - _baseTs, 2);
+    dst[2] = channel;
+    dst[3] = count;
+    dst += SAMPLE_RECORD_HEADER;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        putLe(dst, bits, 4);
+        dst += 4;
+    }
+    _length += recordLen;
+    _records++;
+    _buffer[1] = _records;
+    return true;
+}
+
+bool SampleBatcher::poll()
+{
+    if(_records == 0 || millis() - _openedAt < _maxAgeMs)
+    {
+        return false;
+    }
+    return flush(SAMPLE_FLUSH_AGE);
+}
+
+bool SampleBatcher::flush(uint8_t reason)
+{
+    if(_records == 0)
+    {
+        return false;
+    }
+    bool ok = _publish != nullptr && _publish(_buffer, _length);
+    if(ok)
+    {
+        _stats.framesSent++;
+        _stats.frameBytes += _length;
+    }
+    else
+    {
+        _stats.framesFailed++;
+        _stats.samplesDropped += _records;
+    }
+    if(reason == SAMPLE_FLUSH_SIZE)
+    {
+        _stats.sizeFlushes++;
+    }
+    else if(reason == SAMPLE_FLUSH_AGE)
+    {
+        _stats.ageFlushes++;
+    }
+    _length = 0;
+    _records = 0;
+    return ok;
+}
+
+LAYOUT_CHECK_DEFINE(SampleBatcher)
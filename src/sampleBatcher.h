@@ -0,0 +1,95 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef SAMPLEBATCHER_H
+#define SAMPLEBATCHER_H
+
+#include <Arduino.h>
+#include "layoutCheck.h"
+
+#ifndef SAMPLE_FRAME_SIZE
+#define SAMPLE_FRAME_SIZE 512
+#endif
+#ifndef SAMPLE_FRAME_MAX_AGE
+#define SAMPLE_FRAME_MAX_AGE 200
+#endif
+
+/// Frame layout version, first byte of every frame. Bump it when the layout changes.
+#define SAMPLE_FRAME_VERSION 1
+/// version, records, base timestamp
+#define SAMPLE_FRAME_HEADER 10
+/// offset, channel, count
+#define SAMPLE_RECORD_HEADER 4
+#define SAMPLE_MAX_VALUES 16
+
+/// Why a frame was handed to the publisher
+#define SAMPLE_FLUSH_EXPLICIT 0
+#define SAMPLE_FLUSH_SIZE     1
+#define SAMPLE_FLUSH_AGE      2
+
+struct SampleBatchStats
+{
+    uint32_t samplesAdded = 0;
+    uint32_t samplesDropped = 0;
+    uint32_t framesSent = 0;
+    uint32_t framesFailed = 0;
+    uint32_t sizeFlushes = 0;
+    uint32_t ageFlushes = 0;
+    uint64_t frameBytes = 0;
+};
+
+/**
+ * Packs sensor samples into compact binary frames for streaming over a WebSocket at 10-50 Hz.
+ * All fields are little endian:
+ *
+ *   u8  version    SAMPLE_FRAME_VERSION
+ *   u8  records
+ *   u64 baseTs     milliseconds, timestamp of the first record
+ *   per record:
+ *   u16 offset     milliseconds after baseTs
+ *   u8  channel
+ *   u8  count
+ *   f32 values[count]
+ *
+ * A frame is handed to the publisher when the next sample would not fit, lies more than 65535 ms
+ * after baseTs or before it, when the first sample is SAMPLE_FRAME_MAX_AGE old (see poll()),
+ * or on flush(). Not thread safe, callers lock around it.
+ */
+class SampleBatcher
+{
+    public:
+        typedef bool (*PublishFn)(const uint8_t *frame, size_t length);
+
+        explicit SampleBatcher(PublishFn publish, unsigned long maxAgeMs = SAMPLE_FRAME_MAX_AGE)
+            : _publish(publish), _maxAgeMs(maxAgeMs) {}
+
+        /// @brief Adds count values of channel taken at ts (milliseconds).
+        bool add(uint8_t channel, const float *values, uint8_t count, uint64_t ts);
+        /// @brief Publishes the pending frame, if any.
+        bool flush() { return flush(SAMPLE_FLUSH_EXPLICIT); }
+        /// @brief Publishes the pending frame once its first sample is older than maxAgeMs.
+        bool poll();
+        bool empty() const { return _records == 0; }
+        const SampleBatchStats &stats() const { return _stats; }
+
+    private:
+        bool flush(uint8_t reason);
+
+        PublishFn _publish;
+        unsigned long _maxAgeMs;
+        uint8_t _buffer[SAMPLE_FRAME_SIZE];
+        size_t _length = 0;
+        uint8_t _records = 0;
+        uint64_t _baseTs = 0;
+        unsigned long _openedAt = 0;
+        SampleBatchStats _stats;
+};
+
+LAYOUT_CHECK(SampleBatcher);
+
+#endif
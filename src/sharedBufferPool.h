@@ -0,0 +1,97 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef SHAREDBUFFERPOOL_H
+#define SHAREDBUFFERPOOL_H
+
+#include <Arduino.h>
+
+struct SharedBufferPoolStats
+{
+    uint32_t made = 0;
+    uint32_t freed = 0;
+    /// make() calls that found every slot still referenced.
+    uint32_t exhausted = 0;
+};
+
+/**
+ * Up to N reference counted message buffers, e.g. AsyncWebSocketMessageBuffer, that many clients
+ * queue at once instead of each getting a copy of the payload.
+ *
+ * Buffer needs a (uint8_t *data, size_t length) constructor that copies data, get() and a
+ * canDelete() that is true once no queued message references it and it is not locked. A buffer
+ * stays in its slot until a later make() or release() finds it unreferenced and frees it.
+ * Not thread safe, callers lock around it.
+ */
+template <typename Buffer, uint8_t N>
+class SharedBufferPool
+{
+    public:
+        ~SharedBufferPool() { release(); }
+
+        /// @brief Copies data into a new buffer, nullptr when every slot is still referenced or it could not be allocated.
+        Buffer *make(const uint8_t *data, size_t length)
+        {
+            int8_t slot = -1;
+            for(uint8_t i = 0; i < N; i++)
+            {
+                if(_buffers[i] != nullptr && _buffers[i]->canDelete())
+                {
+                    free(i);
+                }
+                if(_buffers[i] == nullptr && slot < 0)
+                {
+                    slot = i;
+                }
+            }
+            if(slot < 0)
+            {
+                _stats.exhausted++;
+                return nullptr;
+            }
+            Buffer *buffer = new Buffer(const_cast<uint8_t *>(data), length);
+            if(buffer == nullptr || buffer->get() == nullptr)
+            {
+                delete buffer;
+                return nullptr;
+            }
+            _buffers[slot] = buffer;
+            _stats.made++;
+            return buffer;
+        }
+
+        /// @brief Frees every buffer no message references any more and returns how many are still held.
+        uint8_t release()
+        {
+            uint8_t held = 0;
+            for(uint8_t i = 0; i < N; i++)
+            {
+                if(_buffers[i] != nullptr && _buffers[i]->canDelete())
+                {
+                    free(i);
+                }
+                held += _buffers[i] != nullptr;
+            }
+            return held;
+        }
+
+        const SharedBufferPoolStats &stats() const { return _stats; }
+
+    private:
+        void free(uint8_t i)
+        {
+            delete _buffers[i];
+            _buffers[i] = nullptr;
+            _stats.freed++;
+        }
+
+        Buffer *_buffers[N] = {};
+        SharedBufferPoolStats _stats;
+};
+
+#endif
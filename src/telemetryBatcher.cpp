@@ -0,0 +1,135 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "telemetryBatcher.h"
+
+/// Closing "}}]" plus the terminating null are always kept free at the end of the buffer.
+#define TELEMETRY_BATCH_TAIL 4
+
+size_t TelemetryBatcher::writeGroupHeader(char *dst, uint64_t ts)
+{
+    libudawa::JsonBufferSink sink(dst, 40);
+    sink.write("{\"ts\":", 6);
+    libudawa::writeJsonValue(sink, ts);
+    sink.write(",\"values\":{", 11);
+    return sink.finish();
+}
+
+bool TelemetryBatcher::append(const char *point, size_t len, uint64_t ts)
+{
+    _stats.pointsAdded++;
+    _stats.standaloneBytes += len + 2;
+
+    for(uint8_t attempt = 0; attempt < 2; attempt++)
+    {
+        char header[40];
+        size_t headerLen = 0;
+        size_t prefixLen;
+        if(_length == 0)
+        {
+            headerLen = writeGroupHeader(header, ts);
+            prefixLen = 1 + headerLen;
+        }
+        else if(ts == _ts)
+        {
+            prefixLen = 1;
+        }
+        else
+        {
+            headerLen = writeGroupHeader(header, ts);
+            prefixLen = 3 + headerLen;
+        }
+
+        if(_length + prefixLen + len + TELEMETRY_BATCH_TAIL > _size)
+        {
+            if(_length == 0)
+            {
+                break;
+            }
+            flush(TELEMETRY_FLUSH_SIZE);
+            continue;
+        }
+
+        if(_length == 0)
+        {
+            _buffer[_length++] = '[';
+            _openedAt = millis();
+        }
+        else if(ts == _ts)
+        {
+            _buffer[_length++] = ',';
+        }
+        else
+        {
+            memcpy(_buffer + _length, "}},", 3);
+            _length += 3;
+        }
+        if(headerLen > 0)
+        {
+            memcpy(_buffer + _length, header, headerLen);
+            _length += headerLen;
+        }
+        memcpy(_buffer + _length, point, len);
+        _length += len;
+        _ts = ts;
+        _pendingPoints++;
+        return true;
+    }
+
+    _stats.pointsDropped++;
+    return false;
+}
+
+bool TelemetryBatcher::flush(uint8_t reason)
+{
+    if(_length == 0)
+    {
+        return true;
+    }
+    memcpy(_buffer + _length, "}}]", 3);
+    _length += 3;
+    _buffer[_length] = '\0';
+
+    bool res = _publish != nullptr && _publish(_buffer);
+    if(res)
+    {
+        _stats.messagesSent++;
+        _stats.payloadBytes += _length;
+        if(reason == TELEMETRY_FLUSH_SIZE)
+        {
+            _stats.sizeFlushes++;
+        }
+        else if(reason == TELEMETRY_FLUSH_AGE)
+        {
+            _stats.ageFlushes++;
+        }
+        else
+        {
+            _stats.explicitFlushes++;
+        }
+    }
+    else
+    {
+        _stats.messagesFailed++;
+        _stats.pointsDropped += _pendingPoints;
+    }
+
+    _length = 0;
+    _pendingPoints = 0;
+    _buffer[0] = '\0';
+    return res;
+}
+
+bool TelemetryBatcher::poll()
+{
+    if(_length == 0 || millis() - _openedAt < _maxAgeMs)
+    {
+        return true;
+    }
+    return flush(TELEMETRY_FLUSH_AGE);
+}
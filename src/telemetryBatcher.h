@@ -0,0 +1,117 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef TELEMETRYBATCHER_H
+#define TELEMETRYBATCHER_H
+
+#include <Arduino.h>
+#include "jsonLayout.h"
+
+#ifndef TELEMETRY_BATCH_MAX_AGE
+#define TELEMETRY_BATCH_MAX_AGE 5000
+#endif
+#ifndef TELEMETRY_BATCH_POINT_SIZE
+#define TELEMETRY_BATCH_POINT_SIZE 96
+#endif
+/// Rough MQTT PUBLISH cost per message on the telemetry topic (fixed header, topic length and topic).
+#ifndef TELEMETRY_BATCH_MQTT_OVERHEAD
+#define TELEMETRY_BATCH_MQTT_OVERHEAD 28
+#endif
+
+/// Why a batch was handed to the publisher
+#define TELEMETRY_FLUSH_EXPLICIT 0
+#define TELEMETRY_FLUSH_SIZE     1
+#define TELEMETRY_FLUSH_AGE      2
+
+struct TelemetryBatchStats
+{
+    uint32_t pointsAdded = 0;
+    uint32_t pointsDropped = 0;
+    uint32_t messagesSent = 0;
+    uint32_t messagesFailed = 0;
+    uint32_t sizeFlushes = 0;
+    uint32_t ageFlushes = 0;
+    uint32_t explicitFlushes = 0;
+    /// Bytes the same points would have cost as one {"key":value} message each.
+    uint64_t standaloneBytes = 0;
+    uint64_t payloadBytes = 0;
+
+    uint32_t messagesSaved() const
+    {
+        uint32_t sent = pointsAdded - pointsDropped;
+        return sent > messagesSent ? sent - messagesSent : 0;
+    }
+    int64_t bytesSaved() const
+    {
+        return (int64_t)(standaloneBytes + (uint64_t)(pointsAdded - pointsDropped) * TELEMETRY_BATCH_MQTT_OVERHEAD)
+            - (int64_t)(payloadBytes + (uint64_t)messagesSent * TELEMETRY_BATCH_MQTT_OVERHEAD);
+    }
+};
+
+/**
+ * Collects single telemetry points into one ThingsBoard batch message:
+ *
+ *   [{"ts":1700000000000,"values":{"temp":24.5,"hum":61}},{"ts":1700000001000,"values":{...}}]
+ *
+ * Consecutive points with the same ts share a "values" object. The batch is built in place in the
+ * buffer given to the constructor and handed to the publisher when the next point would not fit, when
+ * the oldest point is TELEMETRY_BATCH_MAX_AGE old (see poll()), or on flush(). Size the buffer to the
+ * largest payload the transport takes plus the terminator. Not thread safe, callers lock around it.
+ */
+class TelemetryBatcher
+{
+    public:
+        typedef bool (*PublishFn)(const char *payload);
+
+        TelemetryBatcher(PublishFn publish, char *buffer, size_t size, unsigned long maxAgeMs = TELEMETRY_BATCH_MAX_AGE)
+            : _publish(publish), _maxAgeMs(maxAgeMs), _buffer(buffer), _size(size) {}
+
+        /// @brief Adds key:value at ts (milliseconds since epoch). Supports bool, integers, floats and strings.
+        template <typename T>
+        bool add(const char *key, T value, uint64_t ts)
+        {
+            char point[TELEMETRY_BATCH_POINT_SIZE];
+            libudawa::JsonBufferSink sink(point, sizeof(point));
+            libudawa::writeJsonString(sink, key);
+            sink.write(':');
+            libudawa::writeJsonValue(sink, value);
+            size_t len = sink.finish();
+            if(len == 0)
+            {
+                _stats.pointsAdded++;
+                _stats.pointsDropped++;
+                return false;
+            }
+            return append(point, len, ts);
+        }
+
+        /// @brief Publishes the pending batch, if any.
+        bool flush() { return flush(TELEMETRY_FLUSH_EXPLICIT); }
+        /// @brief Publishes the pending batch once its oldest point is older than maxAgeMs. Call it periodically.
+        bool poll();
+        bool empty() const { return _length == 0; }
+        size_t pendingPoints() const { return _pendingPoints; }
+        const TelemetryBatchStats &stats() const { return _stats; }
+
+    private:
+        bool append(const char *point, size_t len, uint64_t ts);
+        bool flush(uint8_t reason);
+        size_t writeGroupHeader(char *dst, uint64_t ts);
+
+        PublishFn _publish;
+        unsigned long _maxAgeMs;
+        char *_buffer;
+        size_t _size;
+        size_t _length = 0;
+        size_t _pendingPoints = 0;
+        uint64_t _ts = 0;
+        unsigned long _openedAt = 0;
+        TelemetryBatchStats _stats;
+};
+
+#endif
@@ -0,0 +1,425 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "tlsSessionClient.h"
+#include "mbedtls/error.h"
+#include "mbedtls/net_sockets.h"
+#include <lwip/sockets.h>
+
+TlsSessionClient::TlsSessionClient()
+{
+    mbedtls_ssl_init(&_ssl);
+    mbedtls_ssl_config_init(&_conf);
+    mbedtls_entropy_init(&_entropy);
+    mbedtls_ctr_drbg_init(&_drbg);
+    mbedtls_x509_crt_init(&_ca);
+    mbedtls_ssl_session_init(&_session);
+}
+
+TlsSessionClient::~TlsSessionClient()
+{
+    stop();
+    mbedtls_ssl_free(&_ssl);
+    mbedtls_ssl_session_free(&_session);
+    mbedtls_ssl_config_free(&_conf);
+    mbedtls_x509_crt_free(&_ca);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+}
+
+void TlsSessionClient::setCACert(const char *rootCA)
+{
+    _caCert = rootCA;
+    _configured = false;
+}
+
+void TlsSessionClient::setAlpnProtocols(const char **alpnProtocols)
+{
+    uint8_t i = 0;
+    while(alpnProtocols != nullptr && alpnProtocols[i] != nullptr && i < TLS_ALPN_MAX)
+    {
+        _alpn[i] = alpnProtocols[i];
+        i++;
+    }
+    _alpn[i] = nullptr;
+    _configured = false;
+}
+
+bool TlsSessionClient::configure()
+{
+    if(_configured)
+    {
+        return true;
+    }
+    mbedtls_ssl_config_free(&_conf);
+    mbedtls_ssl_config_init(&_conf);
+    mbedtls_x509_crt_free(&_ca);
+    mbedtls_x509_crt_init(&_ca);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_ctr_drbg_init(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+    mbedtls_entropy_init(&_entropy);
+
+    int ret = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, NULL, 0);
+    if(ret == 0 && _caCert != nullptr)
+    {
+        ret = mbedtls_x509_crt_parse(&_ca, (const unsigned char *)_caCert, strlen(_caCert) + 1);
+    }
+    if(ret == 0)
+    {
+        ret = mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if(ret == 0)
+    {
+        mbedtls_ssl_conf_authmode(&_conf, _caCert != nullptr ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_ca_chain(&_conf, &_ca, NULL);
+        mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+        mbedtls_ssl_conf_verify(&_conf, verifyCb, this);
+        #if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+        #endif
+        if(_alpn[0] != nullptr)
+        {
+            ret = mbedtls_ssl_conf_alpn_protocols(&_conf, _alpn);
+        }
+    }
+    _configured = ret == 0;
+    if(!_configured)
+    {
+        _lastError = ret;
+    }
+    return _configured;
+}
+
+int TlsSessionClient::connect(IPAddress ip, uint16_t port)
+{
+    return connect(ip.toString().c_str(), port);
+}
+
+int TlsSessionClient::connect(const char *host, uint16_t port)
+{
+    stop();
+    _peeked = -1;
+    _lastError = 0;
+    if(!configure())
+    {
+        return 0;
+    }
+    unsigned long startMillis = millis();
+    if(!_tcp.connect(host, port))
+    {
+        fail(MBEDTLS_ERR_NET_CONNECT_FAILED);
+        return 0;
+    }
+
+    unsigned long handshakeMillis = millis();
+    bool offered = false;
+    int ret = mbedtls_ssl_setup(&_ssl, &_conf);
+    if(ret == 0)
+    {
+        ret = mbedtls_ssl_set_hostname(&_ssl, host);
+    }
+    if(ret == 0 && _hasSession && mbedtls_ssl_set_session(&_ssl, &_session) == 0)
+    {
+        offered = true;
+    }
+    if(ret != 0)
+    {
+        _stats.failed++;
+        fail(ret);
+        return 0;
+    }
+    mbedtls_ssl_set_bio(&_ssl, &_tcp, netSend, netRecv, NULL);
+
+    _certificateSeen = false;
+    while((ret = mbedtls_ssl_handshake(&_ssl)) != 0)
+    {
+        bool pending = ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+        if(!pending || !waitSocket(ret, startMillis))
+        {
+            // A server that chokes on the offered session gets a plain full handshake next time.
+            if(offered)
+            {
+                clearSession();
+            }
+            _stats.failed++;
+            fail(pending ? MBEDTLS_ERR_SSL_TIMEOUT : ret);
+            return 0;
+        }
+    }
+    // Without a CA nothing was verified, mbedtls reports the skipped verification as a failure.
+    if(_caCert != nullptr && mbedtls_ssl_get_verify_result(&_ssl) != 0)
+    {
+        _stats.failed++;
+        fail(MBEDTLS_ERR_X509_CERT_VERIFY_FAILED);
+        return 0;
+    }
+
+    // A resumed handshake, by session ID or ticket, skips the server's Certificate message, so only a
+    // full one gets the chain verified. Handshakes without a CA verify nothing and count as full.
+    mbedtls_ssl_session_free(&_session);
+    mbedtls_ssl_session_init(&_session);
+    _hasSession = mbedtls_ssl_get_session(&_ssl, &_session) == 0;
+    if(_hasSession)
+    {
+        _generation++;
+    }
+    bool resumed = offered && _caCert != nullptr && !_certificateSeen;
+
+    unsigned long elapsed = millis() - handshakeMillis;
+    _stats.lastMs = elapsed;
+    _stats.lastResumed = resumed;
+    if(resumed)
+    {
+        _stats.resumed++;
+        _stats.resumedMs += elapsed;
+    }
+    else
+    {
+        _stats.full++;
+        _stats.fullMs += elapsed;
+        if(offered)
+        {
+            _stats.resumeMisses++;
+        }
+    }
+    _connected = true;
+    return 1;
+}
+
+size_t TlsSessionClient::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t TlsSessionClient::write(const uint8_t *buf, size_t size)
+{
+    if(!_connected)
+    {
+        return 0;
+    }
+    size_t written = 0;
+    unsigned long startMillis = millis();
+    while(written < size)
+    {
+        int ret = mbedtls_ssl_write(&_ssl, buf + written, size - written);
+        if(ret > 0)
+        {
+            written += ret;
+            continue;
+        }
+        bool pending = ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ;
+        if(!pending || !waitSocket(ret, startMillis))
+        {
+            fail(pending ? MBEDTLS_ERR_SSL_TIMEOUT : ret);
+            break;
+        }
+    }
+    return written;
+}
+
+int TlsSessionClient::available()
+{
+    if(!_connected)
+    {
+        return _peeked >= 0 ? 1 : 0;
+    }
+    // A zero length read processes whatever records arrived without consuming application data.
+    int ret = mbedtls_ssl_read(&_ssl, NULL, 0);
+    if(ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        fail(ret);
+        return _peeked >= 0 ? 1 : 0;
+    }
+    return mbedtls_ssl_get_bytes_avail(&_ssl) + (_peeked >= 0 ? 1 : 0);
+}
+
+int TlsSessionClient::read()
+{
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsSessionClient::read(uint8_t *buf, size_t size)
+{
+    if(size == 0)
+    {
+        return 0;
+    }
+    int copied = 0;
+    if(_peeked >= 0)
+    {
+        buf[0] = (uint8_t)_peeked;
+        _peeked = -1;
+        copied = 1;
+        if(--size == 0)
+        {
+            return copied;
+        }
+        buf++;
+    }
+    if(!_connected)
+    {
+        return copied > 0 ? copied : -1;
+    }
+    int ret = mbedtls_ssl_read(&_ssl, buf, size);
+    if(ret > 0)
+    {
+        return copied + ret;
+    }
+    if(ret == 0)
+    {
+        stop();
+    }
+    else if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        fail(ret);
+    }
+    return copied > 0 ? copied : -1;
+}
+
+int TlsSessionClient::peek()
+{
+    if(_peeked < 0)
+    {
+        uint8_t b;
+        if(read(&b, 1) == 1)
+        {
+            _peeked = b;
+        }
+    }
+    return _peeked;
+}
+
+void TlsSessionClient::stop()
+{
+    if(_connected)
+    {
+        mbedtls_ssl_close_notify(&_ssl);
+    }
+    _tcp.stop();
+    // The session lives in _session, the context itself is rebuilt for every connection.
+    mbedtls_ssl_free(&_ssl);
+    mbedtls_ssl_init(&_ssl);
+    _connected = false;
+}
+
+uint8_t TlsSessionClient::connected()
+{
+    if(!_connected)
+    {
+        return _peeked >= 0;
+    }
+    if(!_tcp.connected() && mbedtls_ssl_get_bytes_avail(&_ssl) == 0)
+    {
+        stop();
+        return _peeked >= 0;
+    }
+    return 1;
+}
+
+int TlsSessionClient::lastError(char *buf, const size_t size)
+{
+    if(buf != nullptr && size > 0)
+    {
+        buf[0] = '\0';
+        if(_lastError != 0)
+        {
+            mbedtls_strerror(_lastError, buf, size);
+        }
+    }
+    return _lastError;
+}
+
+size_t TlsSessionClient::saveSession(uint8_t *buf, size_t size) const
+{
+    size_t length = 0;
+    if(!_hasSession || mbedtls_ssl_session_save(&_session, buf, size, &length) != 0)
+    {
+        return 0;
+    }
+    return length;
+}
+
+bool TlsSessionClient::loadSession(const uint8_t *buf, size_t len)
+{
+    clearSession();
+    _hasSession = mbedtls_ssl_session_load(&_session, buf, len) == 0;
+    if(!_hasSession)
+    {
+        clearSession();
+    }
+    return _hasSession;
+}
+
+void TlsSessionClient::clearSession()
+{
+    mbedtls_ssl_session_free(&_session);
+    mbedtls_ssl_session_init(&_session);
+    _hasSession = false;
+}
+
+void TlsSessionClient::fail(int error)
+{
+    _lastError = error;
+    stop();
+}
+
+bool TlsSessionClient::waitSocket(int want, unsigned long startMillis)
+{
+    unsigned long elapsed = millis() - startMillis;
+    int fd = _tcp.fd();
+    if(elapsed >= _handshakeTimeout || fd < 0)
+    {
+        return false;
+    }
+    // netRecv() only asks for more once the WiFiClient buffer is empty, so select() sees every byte
+    // still to come. The task sleeps until then instead of polling.
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(fd, &ready);
+    unsigned long remaining = _handshakeTimeout - elapsed;
+    struct timeval timeout;
+    timeout.tv_sec = remaining / 1000;
+    timeout.tv_usec = (remaining % 1000) * 1000;
+    // A socket error is left to the next mbedtls call, it reads it through netSend() or netRecv().
+    select(fd + 1, want == MBEDTLS_ERR_SSL_WANT_READ ? &ready : NULL, want == MBEDTLS_ERR_SSL_WANT_WRITE ? &ready : NULL, NULL, &timeout);
+    return true;
+}
+
+int TlsSessionClient::verifyCb(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    static_cast<TlsSessionClient *>(ctx)->_certificateSeen = true;
+    return 0;
+}
+
+int TlsSessionClient::netSend(void *ctx, const unsigned char *buf, size_t len)
+{
+    WiFiClient *tcp = static_cast<WiFiClient *>(ctx);
+    if(!tcp->connected())
+    {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    size_t sent = tcp->write(buf, len);
+    return sent > 0 ? (int)sent : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int TlsSessionClient::netRecv(void *ctx, unsigned char *buf, size_t len)
+{
+    WiFiClient *tcp = static_cast<WiFiClient *>(ctx);
+    int received = tcp->read(buf, len);
+    if(received > 0)
+    {
+        return received;
+    }
+    if(!tcp->connected())
+    {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    return MBEDTLS_ERR_SSL_WANT_READ;
+}
@@ -0,0 +1,114 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef TLSSESSIONCLIENT_H
+#define TLSSESSIONCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <WiFiClient.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+
+#ifndef TLS_HANDSHAKE_TIMEOUT
+#define TLS_HANDSHAKE_TIMEOUT 15000
+#endif
+#ifndef TLS_ALPN_MAX
+#define TLS_ALPN_MAX 4
+#endif
+
+struct TlsHandshakeStats
+{
+    uint32_t full = 0;
+    uint32_t resumed = 0;
+    uint32_t failed = 0;
+    /// Handshakes that offered a cached session the server did not take.
+    uint32_t resumeMisses = 0;
+    uint64_t fullMs = 0;
+    uint64_t resumedMs = 0;
+    unsigned long lastMs = 0;
+    bool lastResumed = false;
+};
+
+/**
+ * TLS client for the MQTT transport that keeps the session of its last handshake and offers it
+ * (session ID or ticket) on the next connect, so a reconnect costs an abbreviated handshake
+ * instead of a full certificate exchange and key agreement.
+ *
+ * Drop-in for the parts of WiFiClientSecure the library uses: setCACert(), setAlpnProtocols()
+ * and lastError(). The parsed CA chain and the seeded RNG are also kept between connects.
+ * saveSession()/loadSession() serialize the cached session so it can outlive a reboot.
+ */
+class TlsSessionClient : public Client
+{
+    public:
+        TlsSessionClient();
+        ~TlsSessionClient();
+
+        void setCACert(const char *rootCA);
+        /// @brief alpnProtocols is a NULL terminated list of string literals.
+        void setAlpnProtocols(const char **alpnProtocols);
+        void setHandshakeTimeout(unsigned long ms) { _handshakeTimeout = ms; }
+
+        int connect(IPAddress ip, uint16_t port) override;
+        int connect(const char *host, uint16_t port) override;
+        size_t write(uint8_t b) override;
+        size_t write(const uint8_t *buf, size_t size) override;
+        int available() override;
+        int read() override;
+        int read(uint8_t *buf, size_t size) override;
+        int peek() override;
+        void flush() override {}
+        void stop() override;
+        uint8_t connected() override;
+        operator bool() override { return connected(); }
+
+        /// @brief Last mbedtls error of this client (negative), 0 when the last connect went through.
+        int lastError(char *buf, const size_t size);
+
+        bool hasSession() const { return _hasSession; }
+        /// @brief Increments every time a handshake caches a new session.
+        uint32_t sessionGeneration() const { return _generation; }
+        /// @brief Serializes the cached session into buf and returns its length, 0 if none or too big.
+        size_t saveSession(uint8_t *buf, size_t size) const;
+        bool loadSession(const uint8_t *buf, size_t len);
+        void clearSession();
+        const TlsHandshakeStats &stats() const { return _stats; }
+
+    private:
+        bool configure();
+        void fail(int error);
+        /// @brief Sleeps until the socket is ready for what mbedtls asked for. False once the timeout passed.
+        bool waitSocket(int want, unsigned long startMillis);
+        static int verifyCb(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+        static int netSend(void *ctx, const unsigned char *buf, size_t len);
+        static int netRecv(void *ctx, unsigned char *buf, size_t len);
+
+        WiFiClient _tcp;
+        mbedtls_ssl_context _ssl;
+        mbedtls_ssl_config _conf;
+        mbedtls_entropy_context _entropy;
+        mbedtls_ctr_drbg_context _drbg;
+        mbedtls_x509_crt _ca;
+        mbedtls_ssl_session _session;
+        bool _configured = false;
+        bool _connected = false;
+        bool _hasSession = false;
+        bool _certificateSeen = false;
+        const char *_caCert = nullptr;
+        const char *_alpn[TLS_ALPN_MAX + 1] = {};
+        unsigned long _handshakeTimeout = TLS_HANDSHAKE_TIMEOUT;
+        int _lastError = 0;
+        int _peeked = -1;
+        uint32_t _generation = 0;
+        TlsHandshakeStats _stats;
+};
+
+#endif
@@ -0,0 +1,222 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "wsSession.h"
+#include <esp_system.h>
+#include "mbedtls/md.h"
+
+static void toHex(const uint8_t *data, size_t length, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for(size_t i = 0; i < length; i++)
+    {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0x0F];
+    }
+    out[length * 2] = '\0';
+}
+
+void WsSessionStore::begin()
+{
+    esp_fill_random(_key, sizeof(_key));
+    _keyed = true;
+    memset(_sessions, 0, sizeof(_sessions));
+}
+
+const char *WsSessionStore::issueNonce(uint32_t clientId, unsigned long now)
+{
+    Nonce *slot = nullptr;
+    for(uint8_t i = 0; i < WS_NONCE_SLOTS && slot == nullptr; i++)
+    {
+        if(_nonces[i].used && _nonces[i].clientId == clientId)
+        {
+            slot = &_nonces[i];
+        }
+    }
+    for(uint8_t i = 0; i < WS_NONCE_SLOTS && slot == nullptr; i++)
+    {
+        if(!_nonces[i].used)
+        {
+            slot = &_nonces[i];
+        }
+    }
+    if(slot == nullptr)
+    {
+        slot = &_nonces[0];
+        for(uint8_t i = 1; i < WS_NONCE_SLOTS; i++)
+        {
+            if((long)(_nonces[i].issuedAt - slot->issuedAt) < 0)
+            {
+                slot = &_nonces[i];
+            }
+        }
+        _stats.evicted++;
+    }
+    uint8_t raw[WS_NONCE_BYTES];
+    esp_fill_random(raw, sizeof(raw));
+    toHex(raw, sizeof(raw), slot->value);
+    slot->clientId = clientId;
+    slot->issuedAt = now;
+    slot->used = true;
+    _stats.noncesIssued++;
+    return slot->value;
+}
+
+bool WsSessionStore::takeNonce(uint32_t clientId, char *nonce, size_t size, unsigned long now)
+{
+    for(uint8_t i = 0; i < WS_NONCE_SLOTS; i++)
+    {
+        Nonce &n = _nonces[i];
+        if(!n.used || n.clientId != clientId)
+        {
+            continue;
+        }
+        n.used = false;
+        if(now - n.issuedAt >= WS_NONCE_TTL)
+        {
+            _stats.noncesExpired++;
+            return false;
+        }
+        strlcpy(nonce, n.value, size);
+        return true;
+    }
+    return false;
+}
+
+void WsSessionStore::dropNonce(uint32_t clientId)
+{
+    for(uint8_t i = 0; i < WS_NONCE_SLOTS; i++)
+    {
+        if(_nonces[i].used && _nonces[i].clientId == clientId)
+        {
+            _nonces[i].used = false;
+        }
+    }
+}
+
+void WsSessionStore::sign(const char *header, char *out) const
+{
+    hmacHex(_key, sizeof(_key), (const uint8_t *)header, WS_TOKEN_HEADER, out);
+}
+
+bool WsSessionStore::issueToken(char *token, size_t size, unsigned long now)
+{
+    if(!_keyed || size < WS_TOKEN_SIZE)
+    {
+        return false;
+    }
+    Session *slot = &_sessions[0];
+    for(uint8_t i = 0; i < WS_SESSION_SLOTS; i++)
+    {
+        Session &s = _sessions[i];
+        if(!s.used || expired(s.expiresAt, now))
+        {
+            slot = &s;
+            break;
+        }
+        if((long)(s.expiresAt - slot->expiresAt) < 0)
+        {
+            slot = &s;
+        }
+    }
+    if(slot->used && !expired(slot->expiresAt, now))
+    {
+        _stats.evicted++;
+    }
+    do
+    {
+        slot->id = esp_random();
+    } while(slot->id == 0);
+    slot->expiresAt = now + WS_SESSION_TTL;
+    slot->used = true;
+
+    snprintf(token, size, "%08x%08x", (unsigned int)slot->id, (unsigned int)slot->expiresAt);
+    sign(token, token + WS_TOKEN_HEADER);
+    _stats.tokensIssued++;
+    return true;
+}
+
+bool WsSessionStore::resume(char *token, size_t size, unsigned long now)
+{
+    if(!_keyed || token == nullptr || strlen(token) != WS_TOKEN_SIZE - 1)
+    {
+        _stats.rejected++;
+        return false;
+    }
+    char header[WS_TOKEN_HEADER + 1];
+    memcpy(header, token, WS_TOKEN_HEADER);
+    header[WS_TOKEN_HEADER] = '\0';
+    char expected[WS_HMAC_HEX_SIZE];
+    sign(header, expected);
+    if(!equals(token + WS_TOKEN_HEADER, expected))
+    {
+        _stats.rejected++;
+        return false;
+    }
+
+    char part[9];
+    memcpy(part, header, 8);
+    part[8] = '\0';
+    uint32_t id = strtoul(part, nullptr, 16);
+    for(uint8_t i = 0; i < WS_SESSION_SLOTS; i++)
+    {
+        Session &s = _sessions[i];
+        if(!s.used || s.id != id)
+        {
+            continue;
+        }
+        // One token per session: the presented one stops working once it is rotated.
+        s.used = false;
+        if(expired(s.expiresAt, now))
+        {
+            break;
+        }
+        _stats.resumes++;
+        return issueToken(token, size, now);
+    }
+    _stats.rejected++;
+    return false;
+}
+
+void WsSessionStore::hmacHex(const uint8_t *key, size_t keyLength, const uint8_t *message, size_t messageLength, char *out)
+{
+    uint8_t hmac[32];
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&ctx, key, keyLength);
+    mbedtls_md_hmac_update(&ctx, message, messageLength);
+    mbedtls_md_hmac_finish(&ctx, hmac);
+    mbedtls_md_free(&ctx);
+    toHex(hmac, sizeof(hmac), out);
+}
+
+bool WsSessionStore::equals(const char *actual, const char *expected)
+{
+    if(actual == nullptr || expected == nullptr)
+    {
+        return false;
+    }
+    size_t length = strlen(expected);
+    uint8_t diff = 0;
+    bool ended = false;
+    for(size_t i = 0; i < length; i++)
+    {
+        // Keep reading expected past the end of actual so the time does not tell the length.
+        char a = ended ? 0 : actual[i];
+        ended = ended || a == '\0';
+        diff |= (uint8_t)(a ^ expected[i]);
+    }
+    if(!ended)
+    {
+        diff |= (uint8_t)actual[length];
+    }
+    return diff == 0;
+}
+
+LAYOUT_CHECK_DEFINE(WsSessionStore)
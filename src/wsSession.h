@@ -0,0 +1,107 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef WSSESSION_H
+#define WSSESSION_H
+
+#include <Arduino.h>
+#include "layoutCheck.h"
+
+#ifndef WS_NONCE_SLOTS
+#define WS_NONCE_SLOTS 8
+#endif
+#ifndef WS_NONCE_TTL
+#define WS_NONCE_TTL 30000
+#endif
+#ifndef WS_SESSION_SLOTS
+#define WS_SESSION_SLOTS 8
+#endif
+#ifndef WS_SESSION_TTL
+#define WS_SESSION_TTL 3600000
+#endif
+
+#define WS_NONCE_BYTES 16
+/// Hex nonce plus the terminating null
+#define WS_NONCE_SIZE (WS_NONCE_BYTES * 2 + 1)
+/// Session id and expiry, 8 hex digits each, then the hex HMAC-SHA256 over them
+#define WS_TOKEN_HEADER 16
+#define WS_TOKEN_SIZE (WS_TOKEN_HEADER + 64 + 1)
+/// Hex HMAC-SHA256 plus the terminating null
+#define WS_HMAC_HEX_SIZE 65
+
+struct WsSessionStats
+{
+    uint32_t noncesIssued = 0;
+    uint32_t noncesExpired = 0;
+    uint32_t tokensIssued = 0;
+    uint32_t resumes = 0;
+    uint32_t rejected = 0;
+    uint32_t evicted = 0;
+};
+
+/**
+ * Server issued challenges and short lived session tokens for the WebSocket login.
+ *
+ * A new client gets a one-time nonce and proves the API key with HMAC(key, nonce). The nonce is
+ * consumed by the first attempt, so a captured answer cannot be replayed. (libudawa.h built with
+ * WS_AUTH_CLIENT_SALT 1 also takes answers to a client chosen salt, which can.) After a login the client
+ * gets a token, HMAC signed with a key drawn at boot, which lets it resume on a new connection
+ * without another challenge. Tokens are checked in constant time, expire after WS_SESSION_TTL
+ * (or on reboot) and are rotated on every resume. Both tables have a fixed size; when one is full
+ * the entry closest to expiry makes room. Not thread safe, callers lock around it.
+ */
+class WsSessionStore
+{
+    public:
+        /// @brief Draws a new signing key, which invalidates every token issued before.
+        void begin();
+
+        /// @brief New nonce for clientId as hex, replacing any nonce the client had.
+        const char *issueNonce(uint32_t clientId, unsigned long now);
+        /// @brief Copies and removes the nonce of clientId. False when it has none or it expired.
+        bool takeNonce(uint32_t clientId, char *nonce, size_t size, unsigned long now);
+        void dropNonce(uint32_t clientId);
+
+        bool issueToken(char *token, size_t size, unsigned long now);
+        /// @brief Checks token and, when it is valid, replaces it with a fresh one in the same buffer.
+        bool resume(char *token, size_t size, unsigned long now);
+
+        const WsSessionStats &stats() const { return _stats; }
+
+        static void hmacHex(const uint8_t *key, size_t keyLength, const uint8_t *message, size_t messageLength, char *out);
+        /// @brief Compares two strings in time that only depends on the length of expected.
+        static bool equals(const char *actual, const char *expected);
+
+    private:
+        struct Nonce
+        {
+            uint32_t clientId;
+            unsigned long issuedAt;
+            bool used;
+            char value[WS_NONCE_SIZE];
+        };
+        struct Session
+        {
+            uint32_t id;
+            unsigned long expiresAt;
+            bool used;
+        };
+
+        void sign(const char *header, char *out) const;
+        bool expired(unsigned long expiresAt, unsigned long now) const { return (long)(expiresAt - now) <= 0; }
+
+        uint8_t _key[32] = {};
+        bool _keyed = false;
+        Nonce _nonces[WS_NONCE_SLOTS] = {};
+        Session _sessions[WS_SESSION_SLOTS] = {};
+        WsSessionStats _stats;
+};
+
+LAYOUT_CHECK(WsSessionStore);
+
+#endif
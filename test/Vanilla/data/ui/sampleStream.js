@@ -0,0 +1,42 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Decoder for the binary sample frames of the "stream" WebSocket topic (src/sampleBatcher.h).
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+/**
+ * Decodes one frame into [{ts, channel, values}]. Returns null for a layout version it does not know.
+ * Set ws.binaryType = "arraybuffer" and subscribe with {"sub": ["stream"]}.
+ */
+function decodeSampleFrame(buffer) {
+  var view = new DataView(buffer);
+  if (view.byteLength < 10 || view.getUint8(0) !== 1) {
+    return null;
+  }
+  var records = view.getUint8(1);
+  var baseTs = view.getUint32(2, true) + view.getUint32(6, true) * 4294967296;
+  var samples = [];
+  var offset = 10;
+  for (var r = 0; r < records && offset + 4 <= view.byteLength; r++) {
+    var ts = baseTs + view.getUint16(offset, true);
+    var channel = view.getUint8(offset + 2);
+    var count = view.getUint8(offset + 3);
+    offset += 4;
+    if (offset + count * 4 > view.byteLength) {
+      break;
+    }
+    var values = [];
+    for (var i = 0; i < count; i++) {
+      values.push(view.getFloat32(offset, true));
+      offset += 4;
+    }
+    samples.push({ ts: ts, channel: channel, values: values });
+  }
+  return samples;
+}
+
+if (typeof module !== "undefined") {
+  module.exports = { decodeSampleFrame: decodeSampleFrame };
+}
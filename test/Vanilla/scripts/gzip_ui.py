@@ -0,0 +1,51 @@
+# UDAWA - Universal Digital Agriculture Watering Assistant
+# PlatformIO pre script: stages the data directory with text assets gzip compressed before the
+# filesystem image is built, so the device serves them with Content-Encoding: gzip.
+# Enable with `extra_scripts = pre:scripts/gzip_ui.py`.
+# Licensed under aGPLv3
+
+import gzip
+import os
+import shutil
+
+Import("env")
+
+COMPRESS = (".html", ".htm", ".js", ".mjs", ".css", ".svg", ".json", ".map", ".txt", ".ico", ".xml")
+# Not worth a gzip wrapper below this size.
+MIN_SIZE = 256
+
+
+def stage(source, target):
+    if os.path.isdir(target):
+        shutil.rmtree(target)
+    raw_total = 0
+    sent_total = 0
+    for root, _, files in os.walk(source):
+        out_dir = os.path.join(target, os.path.relpath(root, source))
+        os.makedirs(out_dir, exist_ok=True)
+        for name in files:
+            path = os.path.join(root, name)
+            size = os.path.getsize(path)
+            raw_total += size
+            if name.lower().endswith(COMPRESS) and size >= MIN_SIZE:
+                with open(path, "rb") as f:
+                    data = f.read()
+                # mtime 0 keeps the output, and so the ETag on the device, stable across builds.
+                packed = gzip.compress(data, compresslevel=9, mtime=0)
+                if len(packed) < size:
+                    with open(os.path.join(out_dir, name + ".gz"), "wb") as f:
+                        f.write(packed)
+                    sent_total += len(packed)
+                    print("gzip_ui: %s %d -> %d bytes" % (os.path.relpath(path, source), size, len(packed)))
+                    continue
+            shutil.copy2(path, os.path.join(out_dir, name))
+            sent_total += size
+    print("gzip_ui: cold load %d bytes instead of %d, a warm load only exchanges 304 headers" % (sent_total, raw_total))
+
+
+fs_targets = ("buildfs", "uploadfs", "uploadfsota")
+if any(t in fs_targets for t in COMMAND_LINE_TARGETS):
+    source = env.subst("$PROJECT_DATA_DIR")
+    target = os.path.join(env.subst("$BUILD_DIR"), "data_gz")
+    stage(source, target)
+    env.Replace(PROJECT_DATA_DIR=target)
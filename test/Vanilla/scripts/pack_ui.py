@@ -0,0 +1,116 @@
+# UDAWA - Universal Digital Agriculture Watering Assistant
+# Packs a UI directory into one read-only bundle (layout in src/assetBundle.h) that the device
+# loads at boot and serves from, instead of opening one SPIFFS file per asset.
+# Usage: python scripts/pack_ui.py [data/ui] [data/ui.bundle]
+# Licensed under aGPLv3
+
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x42414455
+VERSION = 1
+HEADER = struct.Struct("<IBBHI")
+ENTRY = struct.Struct("<IIIIBBH")
+FLAG_GZIP = 0x01
+MAX_ENTRIES = 64
+
+# Same order as mimeTypes in src/assetBundle.cpp.
+MIME_TYPES = (
+    "application/octet-stream",
+    "text/html",
+    "application/javascript",
+    "text/css",
+    "application/json",
+    "image/svg+xml",
+    "image/png",
+    "image/x-icon",
+    "image/jpeg",
+    "font/woff2",
+    "text/plain",
+    "application/xml",
+)
+EXTENSIONS = {
+    ".html": 1, ".htm": 1,
+    ".js": 2, ".mjs": 2,
+    ".css": 3,
+    ".json": 4, ".map": 4,
+    ".svg": 5,
+    ".png": 6,
+    ".ico": 7,
+    ".jpg": 8, ".jpeg": 8,
+    ".woff2": 9,
+    ".txt": 10,
+    ".xml": 11,
+}
+COMPRESS = (1, 2, 3, 4, 5, 7, 10, 11)
+# Not worth a gzip wrapper below this size.
+MIN_GZIP = 256
+
+
+def fnv1a(path):
+    h = 2166136261
+    for b in path.encode("utf-8"):
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def collect(source):
+    assets = []
+    for root, _, files in os.walk(source):
+        for name in sorted(files):
+            full = os.path.join(root, name)
+            path = "/" + os.path.relpath(full, source).replace(os.sep, "/")
+            # Precompressed copies from gzip_ui.py are redundant, the packer compresses itself.
+            if path.endswith(".gz"):
+                continue
+            assets.append((path, full))
+    return sorted(assets)
+
+
+def pack(source, target):
+    assets = collect(source)
+    if not assets:
+        sys.exit("pack_ui: nothing to pack in %s" % source)
+    if len(assets) > MAX_ENTRIES:
+        sys.exit("pack_ui: %d assets, the device holds ASSET_BUNDLE_MAX_ENTRIES=%d" % (len(assets), MAX_ENTRIES))
+
+    entries = []
+    blobs = []
+    seen = {}
+    offset = HEADER.size + ENTRY.size * len(assets)
+    raw_total = 0
+    for path, full in assets:
+        h = fnv1a(path)
+        if h in seen:
+            sys.exit("pack_ui: %s and %s share hash %08x, rename one" % (seen[h], path, h))
+        seen[h] = path
+        with open(full, "rb") as f:
+            data = f.read()
+        raw_total += len(data)
+        mime = EXTENSIONS.get(os.path.splitext(path)[1].lower(), 0)
+        flags = 0
+        if mime in COMPRESS and len(data) >= MIN_GZIP:
+            # mtime 0 keeps the bytes, and so the ETag on the device, stable across builds.
+            packed = gzip.compress(data, compresslevel=9, mtime=0)
+            if len(packed) < len(data):
+                data = packed
+                flags |= FLAG_GZIP
+        entries.append(ENTRY.pack(h, offset, len(data), zlib.crc32(data) & 0xFFFFFFFF, mime, flags, 0))
+        blobs.append(data)
+        print("pack_ui: %-32s %-24s %6d bytes%s" % (path, MIME_TYPES[mime], len(data), " gzip" if flags & FLAG_GZIP else ""))
+        offset += len(data)
+
+    with open(target, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, 0, len(entries), offset))
+        for entry in entries:
+            f.write(entry)
+        for blob in blobs:
+            f.write(blob)
+    print("pack_ui: %d assets, %d bytes (%d unpacked) -> %s" % (len(entries), offset, raw_total, target))
+
+
+if __name__ == "__main__":
+    pack(sys.argv[1] if len(sys.argv) > 1 else "data/ui", sys.argv[2] if len(sys.argv) > 2 else "data/ui.bundle")
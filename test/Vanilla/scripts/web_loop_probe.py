@@ -0,0 +1,69 @@
+# UDAWA - Universal Digital Agriculture Watering Assistant
+# Measures the sync web loop (ifaceTR without USE_ASYNC_WEB) on a device from the "webLoop" block of
+# /api/metrics: idle passes per second and the share of CPU the loop took while nothing connected, then
+# request latency as the client sees it and as the device counts it, from wakeup to served.
+# Build once with WEB_EVENT_LOOP 1 and once with 0 and compare the two reports.
+# Usage: python scripts/web_loop_probe.py <host> <api key> [idle seconds] [requests]
+# Licensed under aGPLv3
+
+import json
+import sys
+import time
+import urllib.request
+
+
+def metrics(host, key):
+    request = urllib.request.Request("http://%s/api/metrics" % host, headers={"Authorization": "Bearer " + key})
+    with urllib.request.urlopen(request, timeout=10) as response:
+        return json.load(response)["webLoop"]
+
+
+def timed_get(host, key):
+    request = urllib.request.Request("http://%s/api/status" % host, headers={"Authorization": "Bearer " + key})
+    start = time.monotonic()
+    with urllib.request.urlopen(request, timeout=10) as response:
+        response.read()
+    return (time.monotonic() - start) * 1000
+
+
+def delta(after, before, key):
+    return after[key] - before[key]
+
+
+def probe(host, key, idle_seconds, requests):
+    # Idle: nothing but the two metrics requests around the window talks to the device.
+    before = metrics(host, key)
+    time.sleep(idle_seconds)
+    after = metrics(host, key)
+    elapsed_ms = delta(after, before, "uptimeMs")
+    print("idle %.1f s: %.1f passes/s, %.1f wakeups/s, %.1f timeouts/s, %d throttled, loop CPU %.2f%%" % (
+        elapsed_ms / 1000.0,
+        delta(after, before, "iterations") * 1000.0 / elapsed_ms,
+        delta(after, before, "wakeups") * 1000.0 / elapsed_ms,
+        delta(after, before, "timeouts") * 1000.0 / elapsed_ms,
+        delta(after, before, "throttled"),
+        delta(after, before, "busyUs") / (elapsed_ms * 10.0)))
+
+    # Requests spaced out at random phases against the loop's timers, one connection each like a browser poll.
+    before = after
+    latencies = []
+    for i in range(requests):
+        time.sleep(0.05 + (i * 37 % 100) / 1000.0)
+        latencies.append(timed_get(host, key))
+    after = metrics(host, key)
+    latencies.sort()
+    wakeups = delta(after, before, "wakeups")
+    print("%d requests: round trip mean %.2f ms, p50 %.2f ms, p99 %.2f ms" % (
+        requests, sum(latencies) / len(latencies), latencies[len(latencies) // 2], latencies[len(latencies) * 99 // 100]))
+    if wakeups > 0:
+        print("device: %d wakeups, wakeup to served mean %.3f ms, max %.3f ms since boot, %d throttled, %d waits skipped for buffered data" % (
+            wakeups, delta(after, before, "wakeLatencyUs") / 1000.0 / wakeups, after["wakeLatencyMaxUs"] / 1000.0,
+            delta(after, before, "throttled"), delta(after, before, "skippedWaits")))
+    else:
+        print("device: no wakeups counted, built with WEB_EVENT_LOOP 0")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        sys.exit("usage: web_loop_probe.py <host> <api key> [idle seconds] [requests]")
+    probe(sys.argv[1], sys.argv[2], float(sys.argv[3]) if len(sys.argv) > 3 else 30, int(sys.argv[4]) if len(sys.argv) > 4 else 200)
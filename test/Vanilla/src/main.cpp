@@ -9,11 +9,14 @@
 
 void setup()
 {
-  processSharedAttributeUpdateCb = &attUpdateCb;
+  attrDispatcher.bind(PSTR("itDt"), mySettings.itDt, &xSemaphoreSettings);
+  attrDispatcher.bind(PSTR("s1tx"), mySettings.s1tx, &xSemaphoreSettings);
+  attrDispatcher.bind(PSTR("s1rx"), mySettings.s1rx, &xSemaphoreSettings);
   onTbDisconnectedCb = &onTbDisconnected;
   onTbConnectedCb = &onTbConnected;
   processSetPanicCb = &setPanic;
   processGenericClientRPCCb = &genericClientRPC;
+  rpcRegister(PSTR("commandExample"), commandExample, true);
   emitAlarmCb = &onAlarm;
   onSyncClientAttrCb = &onSyncClientAttr;
   onSaveSettings = &saveSettings;
@@ -54,6 +57,12 @@ void setup()
       log_manager->warn(PSTR(__func__), PSTR("Task wsSendTelemetry has been created.\n"));
     }
   }
+  if(xHandleStreamSensors == NULL && !config.SM){
+    xReturnedStreamSensors = xTaskCreatePinnedToCore(streamSensorsTR, PSTR("streamSensors"), STACKSIZE_STREAMSENSORS, NULL, 1, &xHandleStreamSensors, 1);
+    if(xReturnedStreamSensors == pdPASS){
+      log_manager->warn(PSTR(__func__), PSTR("Task streamSensors has been created.\n"));
+    }
+  }
   #endif
 
   if(xHandleSensors == NULL && !config.SM){
@@ -116,25 +125,6 @@ void saveSettings()
 }
 
 
-void attUpdateCb(const Shared_Attribute_Data &data)
-{
-  if( xSemaphoreSettings != NULL ){
-    if( xSemaphoreTake( xSemaphoreSettings, ( TickType_t ) 1000 ) == pdTRUE )
-    {
-      if(data["itDt"] != nullptr){mySettings.itDt = data["itDt"].as<uint16_t>();}
-      
-      if(data["s1tx"] != nullptr){mySettings.s1tx = data["s1tx"].as<uint8_t>();}
-      if(data["s1rx"] != nullptr){mySettings.s1rx = data["s1rx"].as<uint8_t>();}
-
-      xSemaphoreGive( xSemaphoreSettings );
-    }
-    else
-    {
-      log_manager->verbose(PSTR(__func__), PSTR("No semaphore available.\n"));
-    }
-  }
-}
-
 void onTbConnected(){
   
 }
@@ -145,15 +135,17 @@ void onTbDisconnected(){
 
 
 
+void commandExample(const JsonVariantConst &params, JsonObject reply){
+  // Runs on the rpcWorker task, so it may take its time without stalling MQTT.
+  reply[PSTR("done")] = 1;
+}
+
 RPC_Response genericClientRPC(const RPC_Data &data){
   if(data[PSTR("cmd")] != nullptr){
       const char * cmd = data["cmd"].as<const char *>();
       log_manager->verbose(PSTR(__func__), PSTR("Received command: %s\n"), cmd);
 
-      if(strcmp(cmd, PSTR("commandExample")) == 0){
-        
-      }
-      else if(strcmp(cmd, PSTR("dlCfg")) == 0){
+      if(strcmp(cmd, PSTR("dlCfg")) == 0){
         if(data[PSTR("dlCfg")] != nullptr){
           if(data[PSTR("dlCfg")].as<uint8_t>() == 1){
             processSharedAttributeUpdate(data);
@@ -180,26 +172,23 @@ RPC_Response genericClientRPC(const RPC_Data &data){
 
 void deviceTelemetry(){
     if(config.provSent && tb.connected() && config.fIoT){
-      StaticJsonDocument<128> doc;
       char buffer[128];
-      
-      doc[PSTR("uptime")] = millis(); 
-      doc[PSTR("heap")] = heap_caps_get_free_size(MALLOC_CAP_8BIT); 
-      doc[PSTR("rssi")] = WiFi.RSSI(); 
-      doc[PSTR("dt")] = rtc.getEpoch(); 
-
-      serializeJson(doc, buffer);
+      serializeJsonLayout(jsonLayout(
+        jsonSlot(PSTR("uptime"), millis()),
+        jsonSlot(PSTR("heap"), heap_caps_get_free_size(MALLOC_CAP_8BIT)),
+        jsonSlot(PSTR("rssi"), WiFi.RSSI()),
+        jsonSlot(PSTR("dt"), rtc.getEpoch())), buffer, sizeof(buffer));
       tbSendAttribute(buffer);
     }
 }
 
 void onAlarm(int code){
   char buffer[32];
-  StaticJsonDocument<32> doc;
-  doc[PSTR("alarm")] = code;
-  serializeJson(doc, buffer);
   #ifdef USE_WEB_IFACE
-  wsBroadcastTXT(buffer);
+  if(wsHasSubscribers(WS_TOPIC_ALARM)){
+    serializeJsonLayout(jsonLayout(jsonSlot(PSTR("alarm"), code)), buffer, sizeof(buffer));
+    wsBroadcastTXT(buffer, WS_TOPIC_ALARM);
+  }
   #endif
 }
 
@@ -319,27 +308,26 @@ void wsSendTelemetryTR(void *arg){
   while(true){
     if(config.fIface && config.wsCount > 0){
       char buffer[128];
-      StaticJsonDocument<128> doc;
-      JsonObject devTel = doc.createNestedObject("devTel");
-      devTel[PSTR("heap")] = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-      devTel[PSTR("rssi")] = WiFi.RSSI();
-      devTel[PSTR("uptime")] = millis()/1000;
-      devTel[PSTR("dt")] = rtc.getEpoch();
-      devTel[PSTR("dts")] = rtc.getDateTime();
-      serializeJson(doc, buffer);
-      wsBroadcastTXT(buffer);
-      doc.clear();
+      if(wsHasSubscribers(WS_TOPIC_DEVTEL)){
+        serializeJsonLayout(jsonLayout(
+          jsonSlot("devTel", jsonLayout(
+            jsonSlot(PSTR("heap"), heap_caps_get_free_size(MALLOC_CAP_8BIT)),
+            jsonSlot(PSTR("rssi"), WiFi.RSSI()),
+            jsonSlot(PSTR("uptime"), millis()/1000),
+            jsonSlot(PSTR("dt"), rtc.getEpoch()),
+            jsonSlot(PSTR("dts"), rtc.getDateTime().c_str())))), buffer, sizeof(buffer));
+        wsBroadcastTXT(buffer, WS_TOPIC_DEVTEL);
+      }
   
       if( xQueueWsPayloadSensors != NULL ){
         WSPayloadSensors payload;
-        if( xQueueReceive( xQueueWsPayloadSensors,  &( payload ), ( TickType_t ) 0 ) == pdPASS )
+        if( xQueueReceive( xQueueWsPayloadSensors,  &( payload ), ( TickType_t ) 0 ) == pdPASS && wsHasSubscribers(WS_TOPIC_SENSORS) )
         {
-          JsonObject sensors = doc.createNestedObject("sensors");
-          sensors[PSTR("data1")] = payload.data1;
-          sensors[PSTR("data2")] = payload.data2;
-          serializeJson(doc, buffer);
-          wsBroadcastTXT(buffer);
-          doc.clear();
+          serializeJsonLayout(jsonLayout(
+            jsonSlot("sensors", jsonLayout(
+              jsonSlot(PSTR("data1"), payload.data1),
+              jsonSlot(PSTR("data2"), payload.data2)))), buffer, sizeof(buffer));
+          wsBroadcastTXT(buffer, WS_TOPIC_SENSORS);
         }
       }
 
@@ -356,6 +344,17 @@ void wsSendTelemetryTR(void *arg){
     vTaskDelay((const TickType_t) 1000 / portTICK_PERIOD_MS);
   }
 }
+
+void streamSensorsTR(void *arg){
+  while(true){
+    // Live charts subscribe to "stream", samples are batched into binary frames by the library.
+    if(wsHasSubscribers(WS_TOPIC_STREAM)){
+      float values[2] = {(float)random(17, 40), (float)random(0, 100)};
+      wsStreamSample(0, values, 2);
+    }
+    vTaskDelay((const TickType_t) STREAM_SENSORS_INTERVAL / portTICK_PERIOD_MS);
+  }
+}
 #endif
 
 void onMQTTUpdateStart(){
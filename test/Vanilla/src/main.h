@@ -62,6 +62,11 @@ ny6l9/duT2POAsUN5IwHGDu8b2NT+vCUQRFVHY31
 //#define USE_SDCARD_LOG
 //#define USE_SPIFFS_LOG
 //#define USE_DISK_LOG
+//#define USE_OFFLINE_STORE
+//#define USE_TLS_RESUMPTION
+//#define USE_TLS_SESSION_RTC
+//#define USE_TB_DELIVERY_ACK
+//#define USE_MSGPACK_PAYLOAD
 #define STACKSIZE_WIFIKEEPER 3000
 #define STACKSIZE_SETALARM 3700
 #define STACKSIZE_WIFIOTA 4096
@@ -70,6 +75,9 @@ ny6l9/duT2POAsUN5IwHGDu8b2NT+vCUQRFVHY31
 #define STACKSIZE_PUBLISHDEVTEL 4500 //6000
 #define STACKSIZE_WSSENDTELEMETRY 4500 //6000
 #define STACKSIZE_SENSORS 2048
+#define STACKSIZE_STREAMSENSORS 2048
+// Sample period of the binary sensor stream (20 Hz).
+#define STREAM_SENSORS_INTERVAL 50
 
 
 #include <libudawa.h>
@@ -106,25 +114,28 @@ Settings mySettings;
 BaseType_t xReturnedWsSendTelemetry;
 BaseType_t xReturnedPublishDevTel;
 BaseType_t xReturnedSensors;
+BaseType_t xReturnedStreamSensors;
 
 TaskHandle_t xHandleWsSendTelemetry = NULL;
 TaskHandle_t xHandlePublishDevTel = NULL;
 TaskHandle_t xHandleSensors = NULL;
+TaskHandle_t xHandleStreamSensors = NULL;
 
 SemaphoreHandle_t xSemaphoreSensors = NULL;
 
 void loadSettings();
 void saveSettings();
-void attUpdateCb(const Shared_Attribute_Data &data);
 void onTbConnected();
 void onTbDisconnected();
 RPC_Response genericClientRPC(const RPC_Data &data);
+void commandExample(const JsonVariantConst &params, JsonObject reply);
 void onReboot();
 void onAlarm(int code);
 void onSyncClientAttr(uint8_t direction);
 #ifdef USE_WEB_IFACE
 void onWsEvent(const JsonObject &data);
 void wsSendTelemetryTR(void *arg);
+void streamSensorsTR(void *arg);
 #endif
 void publishDeviceTelemetryTR(void * arg);
 void onMQTTUpdateStart();
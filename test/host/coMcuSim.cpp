@@ -0,0 +1,401 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include "coMcuSim.h"
+#include <poll.h>
+
+CoMCUSim::CoMCUSim(int fd, SocketStream &peer, uint32_t seed) :
+    _fd(fd), _peer(peer), _running(false), _mute(false), _baud(COMCU_SIM_DEFAULT_BAUD), _fallbackMs(600), _rng(seed),
+    _acceptedBauds{921600, 460800, 230400, 115200}, _unconfirmed(false), _baudChangedAt(0), _repliesSent(0), _badFrames(0), _fallbacks(0)
+{
+}
+
+CoMCUSim::~CoMCUSim()
+{
+    stop();
+}
+
+void CoMCUSim::start()
+{
+    _running = true;
+    _thread = std::thread(&CoMCUSim::run, this);
+}
+
+void CoMCUSim::stop()
+{
+    _running = false;
+    if(_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+void CoMCUSim::setFaults(const CoMCUSimFaults &faults)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _faults = faults;
+}
+
+void CoMCUSim::setAcceptedBauds(const std::vector<uint32_t> &bauds)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _acceptedBauds = bauds;
+}
+
+size_t CoMCUSim::received(const char *method)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    size_t count = 0;
+    for(const CoMCUSimFrame &frame : _frames)
+    {
+        count += frame.method == method;
+    }
+    return count;
+}
+
+bool CoMCUSim::waitReceived(const char *method, size_t count, unsigned long timeoutMs)
+{
+    unsigned long start = millis();
+    while(received(method) < count)
+    {
+        if(millis() - start >= timeoutMs)
+        {
+            return false;
+        }
+        delayMicroseconds(50);
+    }
+    return true;
+}
+
+std::vector<CoMCUSimFrame> CoMCUSim::frames()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _frames;
+}
+
+void CoMCUSim::clear()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _frames.clear();
+}
+
+uint16_t CoMCUSim::crc16(const uint8_t *data, size_t len)
+{
+    // Written from the CoMCU side on purpose rather than shared with the library.
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+bool CoMCUSim::field(const std::string &frame, const char *key, unsigned long &value)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t at = frame.find(pattern);
+    if(at == std::string::npos)
+    {
+        return false;
+    }
+    const char *start = frame.c_str() + at + pattern.size();
+    char *end = nullptr;
+    value = strtoul(start, &end, 10);
+    return end != start;
+}
+
+bool CoMCUSim::chance(double rate)
+{
+    return rate > 0 && std::uniform_real_distribution<double>(0, 1)(_rng) < rate;
+}
+
+void CoMCUSim::run()
+{
+    while(_running)
+    {
+        sendDue();
+        unsigned long now = micros();
+        unsigned long waitUs = 1000;
+        if(!_pending.empty())
+        {
+            waitUs = _pending.front().at > now ? _pending.front().at - now : 0;
+            waitUs = waitUs < 1000 ? waitUs : 1000;
+        }
+        pollfd pfd = {_fd, POLLIN, 0};
+        timespec wait = {0, (long)waitUs * 1000};
+        int ready = ppoll(&pfd, 1, &wait, nullptr);
+
+        if(_unconfirmed && millis() - _baudChangedAt > _fallbackMs)
+        {
+            _baud = COMCU_SIM_DEFAULT_BAUD;
+            _unconfirmed = false;
+            _fallbacks++;
+        }
+        if(ready <= 0 || !(pfd.revents & POLLIN))
+        {
+            continue;
+        }
+
+        uint8_t buffer[256];
+        ssize_t n = ::recv(_fd, buffer, sizeof(buffer), 0);
+        if(n <= 0)
+        {
+            break;
+        }
+        CoMCUSimFaults faults;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            faults = _faults;
+        }
+        bool mismatch = _peer.baudRate() != _baud;
+        unsigned long arrived = micros();
+        for(ssize_t i = 0; i < n; i++)
+        {
+            if(faults.pace)
+            {
+                // A byte is only there once its 10 bits crossed the wire. The wire clock runs from
+                // when the bytes were written, so oversleeping here does not slow the line down.
+                _rxFreeAt = (_rxFreeAt > arrived ? _rxFreeAt : arrived) + byteMicros();
+                now = micros();
+                if(_rxFreeAt > now + 200)
+                {
+                    delayMicroseconds(_rxFreeAt - now);
+                    sendDue();
+                }
+            }
+            uint8_t c = buffer[i];
+            if(chance(faults.dropRate))
+            {
+                continue;
+            }
+            if(chance(faults.corruptRate))
+            {
+                c ^= 1 << (_rng() % 8);
+            }
+            if(mismatch)
+            {
+                c = (uint8_t)_rng();
+            }
+            consume(c);
+        }
+    }
+}
+
+void CoMCUSim::resetFrame()
+{
+    _frame.clear();
+    _depth = 0;
+    _inString = false;
+    _escaped = false;
+}
+
+void CoMCUSim::consume(uint8_t c)
+{
+    if(handleByte(c))
+    {
+        if(_depth > 0)
+        {
+            resetFrame();
+        }
+        return;
+    }
+    if(_depth == 0 && c != '{')
+    {
+        return;
+    }
+    _frame += (char)c;
+    if(_inString)
+    {
+        if(_escaped)
+        {
+            _escaped = false;
+        }
+        else if(c == '\\')
+        {
+            _escaped = true;
+        }
+        else if(c == '"')
+        {
+            _inString = false;
+        }
+    }
+    else if(c == '"')
+    {
+        _inString = true;
+    }
+    else if(c == '{')
+    {
+        _depth++;
+    }
+    else if(c == '}' && --_depth == 0)
+    {
+        frameDone();
+        return;
+    }
+    // A CoMCU has a small receive buffer, a frame that never closes is dropped.
+    if(_frame.size() > 1024)
+    {
+        resetFrame();
+        _badFrames++;
+    }
+}
+
+void CoMCUSim::frameDone()
+{
+    std::string frame;
+    frame.swap(_frame);
+    resetFrame();
+
+    std::string method;
+    const char *tag = "\"method\":\"";
+    size_t at = frame.find(tag);
+    if(at != std::string::npos)
+    {
+        size_t start = at + strlen(tag);
+        size_t end = frame.find('"', start);
+        if(end != std::string::npos)
+        {
+            method = frame.substr(start, end - start);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _frames.push_back({method, frame, micros()});
+    }
+    if(handle(frame, method))
+    {
+        // The sBaud that switched the rate arrived at the old one, it confirms nothing.
+        if(method != "sBaud")
+        {
+            _unconfirmed = false;
+        }
+    }
+    else
+    {
+        _badFrames++;
+    }
+}
+
+bool CoMCUSim::handle(const std::string &frame, const std::string &method)
+{
+    unsigned long value = 0;
+    if(method == "ping")
+    {
+        if(!field(frame, "nonce", value))
+        {
+            return false;
+        }
+        uint32_t nonce = value;
+        uint8_t bytes[4] = {(uint8_t)nonce, (uint8_t)(nonce >> 8), (uint8_t)(nonce >> 16), (uint8_t)(nonce >> 24)};
+        char text[64];
+        snprintf(text, sizeof(text), "{\"nonce\":%lu,\"crc\":%u}", (unsigned long)nonce, (unsigned int)crc16(bytes, sizeof(bytes)));
+        reply(text);
+        return true;
+    }
+    if(method == "sBaud")
+    {
+        if(!field(frame, "baud", value))
+        {
+            return false;
+        }
+        bool accepted = false;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            for(uint32_t baud : _acceptedBauds)
+            {
+                accepted |= baud == value;
+            }
+        }
+        char text[32];
+        snprintf(text, sizeof(text), "{\"baud\":%lu}", accepted ? value : 0UL);
+        reply(text);
+        if(accepted && !_mute)
+        {
+            _baud = value;
+            _baudChangedAt = millis();
+            _unconfirmed = value != COMCU_SIM_DEFAULT_BAUD;
+        }
+        return true;
+    }
+    return method == "sCfg" || method == "sPin" || method == "sLed" || method == "sBuz";
+}
+
+void CoMCUSim::reply(const std::string &text)
+{
+    replyBytes((const uint8_t *)text.data(), text.size());
+}
+
+void CoMCUSim::replyBytes(const uint8_t *data, size_t len)
+{
+    if(_mute)
+    {
+        return;
+    }
+    CoMCUSimFaults faults;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        faults = _faults;
+    }
+    unsigned long now = micros();
+    unsigned long latency = faults.latencyUs;
+    if(faults.jitterUs > 0)
+    {
+        latency += _rng() % faults.jitterUs;
+    }
+    _busyUntil = (_busyUntil > now ? _busyUntil : now) + latency;
+
+    bool mismatch = _peer.baudRate() != _baud;
+    double corruptRate = faults.corruptRate + (faults.noisyAbove != 0 && _baud > faults.noisyAbove ? faults.noiseRate : 0);
+    Pending pending = {_busyUntil, std::string()};
+    pending.bytes.reserve(len);
+    for(size_t i = 0; i < len; i++)
+    {
+        uint8_t c = data[i];
+        if(chance(faults.dropRate))
+        {
+            continue;
+        }
+        if(chance(corruptRate))
+        {
+            c ^= 1 << (_rng() % 8);
+        }
+        pending.bytes += (char)(mismatch ? (uint8_t)_rng() : c);
+    }
+    if(faults.pace)
+    {
+        _txFreeAt = (_txFreeAt > pending.at ? _txFreeAt : pending.at) + pending.bytes.size() * byteMicros();
+        pending.at = _txFreeAt;
+    }
+    _pending.push_back(pending);
+    sendDue();
+}
+
+void CoMCUSim::sendDue()
+{
+    unsigned long now = micros();
+    while(!_pending.empty() && _pending.front().at <= now)
+    {
+        const std::string &bytes = _pending.front().bytes;
+        size_t sent = 0;
+        while(sent < bytes.size())
+        {
+            ssize_t n = ::send(_fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+            if(n <= 0)
+            {
+                break;
+            }
+            sent += n;
+        }
+        _pending.pop_front();
+        _repliesSent++;
+    }
+}
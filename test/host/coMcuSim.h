@@ -0,0 +1,152 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef COMCUSIM_H
+#define COMCUSIM_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "socketStream.h"
+
+#define COMCU_SIM_DEFAULT_BAUD 115200
+
+struct CoMCUSimFaults
+{
+    /// Processing time before every reply, plus up to jitterUs more. Replies are produced one
+    /// after the other, while the simulator keeps receiving like a UART with a FIFO would.
+    unsigned long latencyUs = 0;
+    unsigned long jitterUs = 0;
+    /// Probability per byte, both directions.
+    double corruptRate = 0;
+    double dropRate = 0;
+    /// Wire time of 10 bits per byte at the current baud rate is added when true.
+    bool pace = false;
+    /// Extra corruption per byte of replies while the rate is above noisyAbove, e.g. a cable
+    /// that cannot hold fast rates. The simulator keeps reading the other side cleanly.
+    uint32_t noisyAbove = 0;
+    double noiseRate = 0;
+};
+
+struct CoMCUSimFrame
+{
+    std::string method;
+    std::string frame;
+    /// micros() when the last byte of the frame arrived.
+    unsigned long receivedAt;
+};
+
+/**
+ * Plays the CoMCU on the far end of a socketpair. It frames the JSON it receives, records every
+ * frame by method and answers the RPCs the library waits for:
+ *
+ *   ping  {"params":{"nonce":N}} -> {"nonce":N,"crc":C}  C is CRC-16/CCITT of N, 4 bytes little endian
+ *   sBaud {"params":{"baud":B}}  -> {"baud":B}           B must be in the accepted list, else {"baud":0}
+ *
+ * Everything else (sCfg, sPin, sLed, sBuz, ...) is recorded only. Subclasses add protocols on top,
+ * handleByte() sees every received byte before the JSON framer does. After switching to a faster
+ * rate the simulator falls back to COMCU_SIM_DEFAULT_BAUD when no valid frame arrives within
+ * fallbackMs, as the CoMCU firmware does; once a frame confirmed the rate it stays there until the
+ * next sBaud. Bytes exchanged while the two sides disagree on the rate are garbled.
+ */
+class CoMCUSim
+{
+    public:
+        CoMCUSim(int fd, SocketStream &peer, uint32_t seed = 1);
+        virtual ~CoMCUSim();
+
+        void start();
+        void stop();
+
+        void setFaults(const CoMCUSimFaults &faults);
+        void setAcceptedBauds(const std::vector<uint32_t> &bauds);
+        void setFallbackMs(unsigned long ms) { _fallbackMs = ms; }
+        /// @brief Stops answering, e.g. a CoMCU that is not fitted or still booting.
+        void setMute(bool mute) { _mute = mute; }
+        bool muted() const { return _mute; }
+        uint32_t baud() const { return _baud; }
+        /// @brief Forces the simulated CoMCU rate, e.g. one it kept while the ESP32 restarted.
+        void setBaud(uint32_t baud) { _baud = baud; _unconfirmed = false; }
+
+        size_t received(const char *method);
+        bool waitReceived(const char *method, size_t count, unsigned long timeoutMs);
+        std::vector<CoMCUSimFrame> frames();
+        void clear();
+
+        uint32_t repliesSent() const { return _repliesSent; }
+        uint32_t badFrames() const { return _badFrames; }
+        uint32_t fallbacks() const { return _fallbacks; }
+
+        static uint16_t crc16(const uint8_t *data, size_t len);
+
+    protected:
+        /// @brief Handles one complete frame, returns false when it was not valid JSON for the simulator.
+        virtual bool handle(const std::string &frame, const std::string &method);
+        /// @brief Sees every byte first, e.g. for a binary bootloader stream. Returning true consumes it
+        /// and abandons a JSON frame in progress.
+        virtual bool handleByte(uint8_t c) { (void)c; return false; }
+        /// @brief Queues a reply, it goes out after the processing latency and its wire time.
+        void reply(const std::string &text);
+        void replyBytes(const uint8_t *data, size_t len);
+        bool chance(double rate);
+        /// @brief Confirms a new rate like a valid frame does, for traffic that is not a JSON frame.
+        void markValid() { _unconfirmed = false; }
+        static bool field(const std::string &frame, const char *key, unsigned long &value);
+
+        std::mutex _lock;
+
+    private:
+        struct Pending
+        {
+            unsigned long at;
+            std::string bytes;
+        };
+
+        void run();
+        void consume(uint8_t c);
+        void frameDone();
+        void resetFrame();
+        void sendDue();
+        unsigned long byteMicros() const { return 10000000UL / _baud; }
+
+        int _fd;
+        SocketStream &_peer;
+        std::thread _thread;
+        std::atomic<bool> _running;
+        std::atomic<bool> _mute;
+        std::atomic<uint32_t> _baud;
+        std::atomic<unsigned long> _fallbackMs;
+        std::mt19937 _rng;
+        CoMCUSimFaults _faults;
+        std::vector<uint32_t> _acceptedBauds;
+        std::vector<CoMCUSimFrame> _frames;
+
+        std::string _frame;
+        int _depth = 0;
+        bool _inString = false;
+        bool _escaped = false;
+        // Receive and transmit wires are independent, each busy until its *FreeAt in micros().
+        unsigned long _rxFreeAt = 0;
+        unsigned long _txFreeAt = 0;
+        unsigned long _busyUntil = 0;
+        std::deque<Pending> _pending;
+        // Set by a switch to a faster rate until a valid frame arrives at it.
+        std::atomic<bool> _unconfirmed;
+        std::atomic<unsigned long> _baudChangedAt;
+
+        std::atomic<uint32_t> _repliesSent;
+        std::atomic<uint32_t> _badFrames;
+        std::atomic<uint32_t> _fallbacks;
+};
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// Checks and timing helpers shared by the host tests. A test binary exits non-zero when a check failed.
+
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <Arduino.h>
+#include <algorithm>
+#include <vector>
+
+static int hostTestFailures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { hostTestFailures++; \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } } while(0)
+#define CHECK_EQ(a, b) do { long long _a = (long long)(a), _b = (long long)(b); if(_a != _b) { hostTestFailures++; \
+    fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); } } while(0)
+
+/// @brief Prints the verdict, return it from main().
+inline int hostTestResult()
+{
+    printf("%s\n", hostTestFailures == 0 ? "PASS" : "FAIL");
+    return hostTestFailures == 0 ? 0 : 1;
+}
+
+/// @brief Collects latency samples in microseconds and reports percentiles.
+class LatencySamples
+{
+    public:
+        void add(unsigned long us) { _samples.push_back(us); }
+        size_t count() const { return _samples.size(); }
+        unsigned long percentile(double p)
+        {
+            if(_samples.empty())
+            {
+                return 0;
+            }
+            std::sort(_samples.begin(), _samples.end());
+            size_t index = (size_t)(p / 100.0 * (_samples.size() - 1) + 0.5);
+            return _samples[index];
+        }
+
+    private:
+        std::vector<unsigned long> _samples;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#ifndef SOCKETSTREAM_H
+#define SOCKETSTREAM_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Stream over one end of a socketpair, stands in for Serial2 on the host. The baud rate is only
+ * bookkeeping: the simulator on the other end compares it with its own and garbles the bytes
+ * when the two sides disagree, like a UART would.
+ */
+class SocketStream : public Stream
+{
+    public:
+        explicit SocketStream(int fd, uint32_t baud = 115200) : _fd(fd), _baud(baud) {}
+
+        /// @brief Creates a connected pair, fds[0] for the SocketStream and fds[1] for the simulator.
+        static bool pair(int fds[2]) { return socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0; }
+
+        int available() override
+        {
+            int n = 0;
+            return ioctl(_fd, FIONREAD, &n) == 0 ? n : 0;
+        }
+        int read() override
+        {
+            uint8_t c;
+            if(available() <= 0 || ::recv(_fd, &c, 1, 0) != 1)
+            {
+                return -1;
+            }
+            return c;
+        }
+        int peek() override
+        {
+            uint8_t c;
+            if(available() <= 0 || ::recv(_fd, &c, 1, MSG_PEEK) != 1)
+            {
+                return -1;
+            }
+            return c;
+        }
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t *buffer, size_t size) override
+        {
+            size_t sent = 0;
+            while(sent < size)
+            {
+                ssize_t n = ::send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+                if(n <= 0)
+                {
+                    break;
+                }
+                sent += n;
+            }
+            return sent;
+        }
+        using Print::write;
+        /// @brief Waits until the peer has read everything, like HardwareSerial::flush() waits for
+        /// the TX FIFO to drain, so a rate change that follows does not garble bytes still queued.
+        void flush() override
+        {
+            int queued = 0;
+            while(ioctl(_fd, SIOCOUTQ, &queued) == 0 && queued > 0)
+            {
+                delayMicroseconds(20);
+            }
+        }
+
+        uint32_t baudRate() const { return _baud; }
+        void updateBaudRate(uint32_t baud) { _baud = baud; }
+
+    private:
+        int _fd;
+        std::atomic<uint32_t> _baud;
+};
+
+#endif
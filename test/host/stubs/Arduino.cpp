@@ -0,0 +1,87 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+#include <Arduino.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static std::atomic<unsigned long> millisOffset(0);
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+unsigned long hostMillisOffset()
+{
+    return millisOffset;
+}
+
+void hostAdvanceMillis(unsigned long ms)
+{
+    millisOffset += ms;
+}
+
+unsigned long millis()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count() + millisOffset;
+}
+
+unsigned long micros()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count() + millisOffset * 1000UL;
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+void randomSeed(unsigned long seed)
+{
+    randomState = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+long random(long max)
+{
+    if(max <= 0)
+    {
+        return 0;
+    }
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return (long)(randomState % (uint64_t)max);
+}
+
+long random(long min, long max)
+{
+    if(min >= max)
+    {
+        return min;
+    }
+    return random(max - min) + min;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if(size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
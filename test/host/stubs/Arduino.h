@@ -0,0 +1,204 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// Just enough of the Arduino core to build the self-contained library modules on Linux.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+
+#define PSTR(s) (s)
+#define F(s) (s)
+
+/// Milliseconds added to the real clock by hostAdvanceMillis(), lets tests skip ahead in time.
+unsigned long hostMillisOffset();
+void hostAdvanceMillis(unsigned long ms);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() {}
+// Arduino's random(): [0, max) and [min, max) from a generator randomSeed() makes repeatable.
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+// The FreeRTOS mutexes the ESP32 core pulls in with Arduino.h. Tests run single threaded, so a take
+// fails at once while the mutex is held; takes counts the successful ones.
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+struct HostSemaphore
+{
+    bool held = false;
+    uint32_t takes = 0;
+};
+typedef HostSemaphore *SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new HostSemaphore(); }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+    if(s->held)
+    {
+        return pdFALSE;
+    }
+    s->held = true;
+    s->takes++;
+    return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    if(!s->held)
+    {
+        return pdFALSE;
+    }
+    s->held = false;
+    return pdTRUE;
+}
+
+class String
+{
+    public:
+        String() {}
+        String(const char *s) : _s(s) {}
+        String(const std::string &s) : _s(s) {}
+        const char *c_str() const { return _s.c_str(); }
+        size_t length() const { return _s.size(); }
+        String &operator+=(char c) { _s += c; return *this; }
+        bool operator==(const char *s) const { return _s == s; }
+
+    private:
+        std::string _s;
+};
+
+class Print
+{
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size)
+        {
+            size_t n = 0;
+            while(n < size && write(buffer[n]))
+            {
+                n++;
+            }
+            return n;
+        }
+        size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+        size_t print(const char *s) { return write(s); }
+        size_t printf(const char *format, ...)
+        {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            return n > 0 ? write((const uint8_t *)buffer, (size_t)n < sizeof(buffer) ? n : sizeof(buffer) - 1) : 0;
+        }
+        virtual void flush() {}
+};
+
+class Stream : public Print
+{
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+        unsigned long getTimeout() const { return _timeout; }
+
+        size_t readBytes(uint8_t *buffer, size_t length)
+        {
+            size_t n = 0;
+            while(n < length)
+            {
+                int c = timedRead();
+                if(c < 0)
+                {
+                    break;
+                }
+                buffer[n++] = (uint8_t)c;
+            }
+            return n;
+        }
+        size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+
+        size_t readBytesUntil(char terminator, char *buffer, size_t length)
+        {
+            size_t n = 0;
+            while(n < length)
+            {
+                int c = timedRead();
+                if(c < 0 || c == terminator)
+                {
+                    break;
+                }
+                buffer[n++] = (char)c;
+            }
+            return n;
+        }
+
+        bool find(const char *target)
+        {
+            size_t len = strlen(target);
+            size_t matched = 0;
+            int c;
+            while(matched < len && (c = timedRead()) >= 0)
+            {
+                matched = c == target[matched] ? matched + 1 : (c == target[0] ? 1 : 0);
+            }
+            return matched == len;
+        }
+
+        String readStringUntil(char terminator)
+        {
+            std::string s;
+            int c;
+            while((c = timedRead()) >= 0 && c != terminator)
+            {
+                s += (char)c;
+            }
+            return String(s);
+        }
+
+    protected:
+        int timedRead()
+        {
+            unsigned long start = millis();
+            do
+            {
+                int c = read();
+                if(c >= 0)
+                {
+                    return c;
+                }
+                if(available() <= 0)
+                {
+                    delay(1);
+                }
+            } while(millis() - start < _timeout);
+            return -1;
+        }
+
+        unsigned long _timeout = 1000;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// In-memory stand-in for the ESP32 fs::FS, flat like SPIFFS: a "directory" lists the files whose
+// path starts with it. A capacity makes writes come up short like a full partition does.
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+struct FSFiles
+{
+    std::map<std::string, std::string> files;
+    size_t capacity = (size_t)-1;
+    uint32_t writes = 0;
+
+    size_t used() const
+    {
+        size_t total = 0;
+        for(const auto &file : files)
+        {
+            total += file.second.size();
+        }
+        return total;
+    }
+};
+
+class File : public Stream
+{
+    public:
+        File() {}
+        File(std::shared_ptr<FSFiles> files, const std::string &path, size_t pos) : _impl(new Impl{files, path, pos, false, {}, 0}) {}
+        File(std::shared_ptr<FSFiles> files, const std::string &path, const std::vector<std::string> &entries) :
+            _impl(new Impl{files, path, 0, true, entries, 0}) {}
+
+        explicit operator bool() const { return _impl != nullptr; }
+        bool isDirectory() const { return _impl != nullptr && _impl->directory; }
+        const char *name() const { return _impl->path.c_str(); }
+        size_t size() const { return _impl->directory ? 0 : data().size(); }
+        size_t position() const { return _impl->pos; }
+        bool seek(uint32_t pos)
+        {
+            _impl->pos = pos;
+            return pos <= size();
+        }
+        void close() { _impl.reset(); }
+
+        int available() override { return _impl->pos < size() ? (int)(size() - _impl->pos) : 0; }
+        int read() override { return _impl->pos < size() ? (uint8_t)data()[_impl->pos++] : -1; }
+        int peek() override { return _impl->pos < size() ? (uint8_t)data()[_impl->pos] : -1; }
+        size_t read(uint8_t *buffer, size_t len)
+        {
+            size_t n = _impl->pos < size() ? size() - _impl->pos : 0;
+            n = n < len ? n : len;
+            memcpy(buffer, data().data() + _impl->pos, n);
+            _impl->pos += n;
+            return n;
+        }
+
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t *buffer, size_t len) override
+        {
+            FSFiles &files = *_impl->files;
+            files.writes++;
+            size_t used = files.used();
+            size_t room = files.capacity > used ? files.capacity - used : 0;
+            len = len < room ? len : room;
+            std::string &bytes = files.files[_impl->path];
+            bytes.replace(_impl->pos < bytes.size() ? _impl->pos : bytes.size(), len, (const char *)buffer, len);
+            _impl->pos += len;
+            return len;
+        }
+        using Print::write;
+
+        File openNextFile()
+        {
+            if(_impl->next >= _impl->entries.size())
+            {
+                return File();
+            }
+            return File(_impl->files, _impl->entries[_impl->next++], 0);
+        }
+
+    private:
+        struct Impl
+        {
+            std::shared_ptr<FSFiles> files;
+            std::string path;
+            size_t pos;
+            bool directory;
+            std::vector<std::string> entries;
+            size_t next;
+        };
+
+        const std::string &data() const { return _impl->files->files[_impl->path]; }
+
+        std::shared_ptr<Impl> _impl;
+};
+
+class FS
+{
+    public:
+        FS() : _files(new FSFiles()) {}
+
+        File open(const char *path, const char *mode = FILE_READ)
+        {
+            std::string name(path);
+            auto it = _files->files.find(name);
+            if(mode[0] == 'w')
+            {
+                _files->files[name].clear();
+                return File(_files, name, 0);
+            }
+            if(mode[0] == 'a')
+            {
+                return File(_files, name, _files->files[name].size());
+            }
+            if(it != _files->files.end())
+            {
+                return File(_files, name, 0);
+            }
+            std::vector<std::string> entries;
+            std::string prefix = name + "/";
+            for(const auto &file : _files->files)
+            {
+                if(file.first.compare(0, prefix.size(), prefix) == 0)
+                {
+                    entries.push_back(file.first);
+                }
+            }
+            return entries.empty() ? File() : File(_files, name, entries);
+        }
+        bool exists(const char *path) { return _files->files.count(path) > 0; }
+        bool remove(const char *path) { return _files->files.erase(path) > 0; }
+        bool mkdir(const char *path) { return true; }
+
+        /// @brief Host side access, e.g. to plant a file or fill the partition.
+        FSFiles &files() { return *_files; }
+
+    private:
+        std::shared_ptr<FSFiles> _files;
+};
+
+}
+
+using fs::File;
+using fs::FS;
+
+#endif
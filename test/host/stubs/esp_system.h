@@ -0,0 +1,33 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// Host stand-in for the ESP-IDF random number API, seeded so test runs repeat.
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <random>
+
+inline uint32_t esp_random()
+{
+    static std::mt19937 rng(0x5eed);
+    return rng();
+}
+
+inline void esp_fill_random(void *buffer, size_t len)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    for(size_t i = 0; i < len; i++)
+    {
+        bytes[i] = (uint8_t)esp_random();
+    }
+}
+
+#endif
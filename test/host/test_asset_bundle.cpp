@@ -0,0 +1,262 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// AssetBundle on the in-memory file system: a full bundle of ASSET_BUNDLE_MAX_ENTRIES assets read
+// back in chunks, lookups and misses, bundles that are damaged or do not match the layout, and the
+// bundle scripts/pack_ui.py builds from test/Vanilla/data/ui when the Makefile could run it.
+
+#include "hostTest.h"
+#include "assetBundle.h"
+#include <string>
+#include <vector>
+
+#define BUNDLE_PATH "/ui.bundle"
+// Written by the Makefile with pack_ui.py, missing when python3 is not around.
+#define PACKED_BUNDLE "build/ui.bundle"
+#define PACKED_SOURCE "../Vanilla/data/ui"
+
+static uint32_t crc32(const std::string &data)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for(unsigned char c : data)
+    {
+        crc ^= c;
+        for(int k = 0; k < 8; k++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void putLe(std::string &out, uint32_t value, uint8_t bytes)
+{
+    for(uint8_t i = 0; i < bytes; i++)
+    {
+        out += (char)(value >> (8 * i));
+    }
+}
+
+struct Asset
+{
+    std::string path;
+    std::string data;
+    uint8_t mime;
+};
+
+/// @brief pack() of pack_ui.py without the gzip step.
+static std::string pack(const std::vector<Asset> &assets)
+{
+    std::string table;
+    std::string blobs;
+    uint32_t offset = ASSET_BUNDLE_HEADER + ASSET_BUNDLE_ENTRY * assets.size();
+    for(const Asset &asset : assets)
+    {
+        putLe(table, AssetBundle::pathHash(asset.path.c_str()), 4);
+        putLe(table, offset + blobs.size(), 4);
+        putLe(table, asset.data.size(), 4);
+        putLe(table, crc32(asset.data), 4);
+        putLe(table, asset.mime, 1);
+        putLe(table, 0, 1);
+        putLe(table, 0, 2);
+        blobs += asset.data;
+    }
+    std::string bundle;
+    putLe(bundle, ASSET_BUNDLE_MAGIC, 4);
+    putLe(bundle, ASSET_BUNDLE_VERSION, 1);
+    putLe(bundle, 0, 1);
+    putLe(bundle, assets.size(), 2);
+    putLe(bundle, offset + blobs.size(), 4);
+    return bundle + table + blobs;
+}
+
+static std::vector<Asset> sampleAssets(size_t count)
+{
+    std::vector<Asset> assets;
+    for(size_t i = 0; i < count; i++)
+    {
+        Asset asset;
+        asset.path = "/assets/chunk" + std::to_string(i) + (i % 3 == 0 ? ".js" : i % 3 == 1 ? ".css" : ".svg");
+        asset.mime = i % 3 == 0 ? 2 : i % 3 == 1 ? 3 : 5;
+        // Sizes around the read chunk, one empty, a few large.
+        size_t size = i == 5 ? 0 : (i * 997) % 3000 + (i % 16 == 0 ? 20000 : 1);
+        for(size_t b = 0; b < size; b++)
+        {
+            asset.data += (char)('a' + (b * 7 + i) % 26);
+        }
+        assets.push_back(asset);
+    }
+    assets[0].path = "/index.html";
+    assets[0].mime = 1;
+    return assets;
+}
+
+/// @brief Every stored byte of entry, read in chunks the way the web server streams it.
+static std::string readAll(AssetBundle &bundle, const AssetEntry &entry, size_t chunk)
+{
+    std::string out;
+    std::vector<uint8_t> buffer(chunk);
+    size_t n;
+    while((n = bundle.read(entry, out.size(), buffer.data(), buffer.size())) > 0)
+    {
+        out.append((const char *)buffer.data(), n);
+    }
+    return out;
+}
+
+static void testLookup()
+{
+    FS flash;
+    std::vector<Asset> assets = sampleAssets(ASSET_BUNDLE_MAX_ENTRIES);
+    flash.files().files[BUNDLE_PATH] = pack(assets);
+    AssetBundle *bundle = new AssetBundle();
+    CHECK(bundle->begin(flash, BUNDLE_PATH));
+    CHECK_EQ(bundle->count(), assets.size());
+
+    size_t intact = 0;
+    for(size_t i = 0; i < assets.size(); i++)
+    {
+        const AssetEntry *entry = bundle->find(assets[i].path.c_str());
+        if(entry == nullptr)
+        {
+            CHECK(entry != nullptr);
+            continue;
+        }
+        std::string data = readAll(*bundle, *entry, i % 2 == 0 ? 1460 : 97);
+        intact += data == assets[i].data && entry->crc == crc32(data) && entry->mime == assets[i].mime;
+    }
+    CHECK_EQ(intact, assets.size());
+    CHECK(strcmp(AssetBundle::mimeType(bundle->find("/index.html")->mime), "text/html") == 0);
+    CHECK(strcmp(AssetBundle::mimeType(200), "application/octet-stream") == 0);
+
+    // Reads past the end and misses.
+    const AssetEntry *entry = bundle->find("/index.html");
+    uint8_t buffer[64];
+    CHECK_EQ(bundle->read(*entry, entry->length, buffer, sizeof(buffer)), 0);
+    CHECK_EQ(bundle->read(*entry, entry->length - 3, buffer, sizeof(buffer)), 3);
+    CHECK(bundle->find("/missing.js") == nullptr);
+    CHECK(bundle->find("/INDEX.html") == nullptr);
+    CHECK(bundle->find("") == nullptr);
+
+    const int rounds = 100000;
+    unsigned long start = micros();
+    uint32_t found = 0;
+    for(int r = 0; r < rounds; r++)
+    {
+        found += bundle->find(assets[r % assets.size()].path.c_str()) != nullptr;
+    }
+    unsigned long elapsed = micros() - start;
+    printf("%u assets, %u bytes: %.3f us per lookup, %u hits, %u misses\n", bundle->count(),
+        (unsigned)flash.files().files[BUNDLE_PATH].size(), (double)elapsed / rounds, bundle->stats().hits, bundle->stats().misses);
+    CHECK_EQ(found, rounds);
+
+    bundle->end();
+    CHECK(!bundle->loaded());
+    CHECK(bundle->find("/index.html") == nullptr);
+    delete bundle;
+}
+
+/// @brief begin() refuses bundle after damage was applied to a good one.
+static bool refused(std::string bundle)
+{
+    FS flash;
+    flash.files().files[BUNDLE_PATH] = bundle;
+    AssetBundle *assets = new AssetBundle();
+    bool ok = !assets->begin(flash, BUNDLE_PATH) && !assets->loaded();
+    delete assets;
+    return ok;
+}
+
+static void testDamaged()
+{
+    std::vector<Asset> assets = sampleAssets(8);
+    const std::string good = pack(assets);
+    CHECK(!refused(good));
+
+    std::string bundle = good;
+    bundle[0] = 'X';
+    CHECK(refused(bundle));
+    bundle = good;
+    bundle[4] = ASSET_BUNDLE_VERSION + 1;
+    CHECK(refused(bundle));
+    // Cut short or grown since it was packed: the stored size does not match.
+    CHECK(refused(good.substr(0, good.size() - 1)));
+    CHECK(refused(good + "x"));
+    CHECK(refused(good.substr(0, ASSET_BUNDLE_HEADER - 1)));
+    CHECK(refused(pack(std::vector<Asset>())));
+    CHECK(refused(pack(sampleAssets(ASSET_BUNDLE_MAX_ENTRIES + 1))));
+    // An entry that points past the end of the file.
+    bundle = good;
+    bundle[ASSET_BUNDLE_HEADER + 8] = (char)0xFF;
+    bundle[ASSET_BUNDLE_HEADER + 9] = (char)0xFF;
+    CHECK(refused(bundle));
+    // Two paths with the same hash.
+    assets[1].path = assets[0].path;
+    CHECK(refused(pack(assets)));
+
+    FS empty;
+    AssetBundle bundleless;
+    CHECK(!bundleless.begin(empty, BUNDLE_PATH));
+}
+
+static bool readFile(const std::string &path, std::string &data)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if(f == nullptr)
+    {
+        return false;
+    }
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        data.append(buffer, n);
+    }
+    fclose(f);
+    return true;
+}
+
+static void testPackedBundle()
+{
+    FS flash;
+    std::string bundle;
+    if(!readFile(PACKED_BUNDLE, bundle))
+    {
+        printf("pack_ui.py: no %s, python3 missing, skipped\n", PACKED_BUNDLE);
+        return;
+    }
+    flash.files().files[BUNDLE_PATH] = bundle;
+    AssetBundle assets;
+    CHECK(assets.begin(flash, BUNDLE_PATH));
+    const char *paths[] = { "/index.html", "/sampleStream.js" };
+    for(const char *path : paths)
+    {
+        const AssetEntry *entry = assets.find(path);
+        CHECK(entry != nullptr);
+        if(entry == nullptr)
+        {
+            continue;
+        }
+        std::string stored = readAll(assets, *entry, 512);
+        CHECK_EQ(entry->crc, crc32(stored));
+        std::string source;
+        CHECK(readFile(std::string(PACKED_SOURCE) + path, source));
+        // Stored as is unless gzip made it smaller.
+        CHECK((entry->flags & ASSET_FLAG_GZIP) != 0 ? stored.size() < source.size() : stored == source);
+        printf("pack_ui.py: %-18s %-24s %5u bytes stored%s\n", path, AssetBundle::mimeType(entry->mime),
+            entry->length, (entry->flags & ASSET_FLAG_GZIP) != 0 ? ", gzip" : "");
+    }
+}
+
+int main()
+{
+    testLookup();
+    testDamaged();
+    testPackedBundle();
+    return hostTestResult();
+}
@@ -0,0 +1,368 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// AttrDispatcher bound like attrBindDefaults() plus the Vanilla settings: every type lands in its
+// field, unknown keys, setters, one lock take per run of keys, a held lock, a perfect hash for the
+// default keys, and time per update against the data["key"] != nullptr probes it replaced.
+
+#include "hostTest.h"
+#include "attrDispatcher.h"
+#include <string>
+
+// The fields of Config and ConfigCoMCU that are bound, sized as in libudawa.h.
+struct Config
+{
+    char model[16];
+    char group[16];
+    char broker[48];
+    uint16_t port;
+    char wssid[48];
+    char wpass[48];
+    char dssid[24];
+    char dpass[24];
+    char upass[64];
+    char accTkn[24];
+    char provDK[24];
+    char provDS[24];
+    uint8_t logLev;
+    int gmtOff;
+    char htU[24];
+    char htP[24];
+    bool fWOTA;
+    bool fIface;
+    bool fIoT;
+    char hname[40];
+    char logIP[16];
+    char webApiKey[32];
+    uint16_t logPrt;
+    uint8_t pEnc;
+};
+
+struct ConfigCoMCU
+{
+    bool fP;
+    uint16_t bFr;
+    bool fB;
+    uint8_t pBz;
+    uint8_t pLR;
+    uint8_t pLG;
+    uint8_t pLB;
+    uint8_t lON;
+};
+
+struct Settings
+{
+    uint16_t itDt;
+    uint8_t s1tx;
+    uint8_t s1rx;
+};
+
+static Config config;
+static ConfigCoMCU configcomcu;
+static Settings mySettings;
+static SemaphoreHandle_t xSemaphoreConfig = NULL;
+static SemaphoreHandle_t xSemaphoreConfigCoMCU = NULL;
+static SemaphoreHandle_t xSemaphoreSettings = NULL;
+static int logLevSet = -1;
+
+static void onLogLevAttr(JsonVariantConst value)
+{
+    logLevSet = value.as<int>();
+}
+
+static void bindDefaults(AttrDispatcher &dispatcher)
+{
+    dispatcher.bind("model", config.model, &xSemaphoreConfig);
+    dispatcher.bind("group", config.group, &xSemaphoreConfig);
+    dispatcher.bind("broker", config.broker, &xSemaphoreConfig);
+    dispatcher.bind("port", config.port, &xSemaphoreConfig);
+    dispatcher.bind("wssid", config.wssid, &xSemaphoreConfig);
+    dispatcher.bind("wpass", config.wpass, &xSemaphoreConfig);
+    dispatcher.bind("dssid", config.dssid, &xSemaphoreConfig);
+    dispatcher.bind("dpass", config.dpass, &xSemaphoreConfig);
+    dispatcher.bind("upass", config.upass, &xSemaphoreConfig);
+    dispatcher.bind("accTkn", config.accTkn, &xSemaphoreConfig);
+    dispatcher.bind("provDK", config.provDK, &xSemaphoreConfig);
+    dispatcher.bind("provDS", config.provDS, &xSemaphoreConfig);
+    dispatcher.bind("logLev", config.logLev, &xSemaphoreConfig, onLogLevAttr);
+    dispatcher.bind("gmtOff", config.gmtOff, &xSemaphoreConfig);
+    dispatcher.bind("htU", config.htU, &xSemaphoreConfig);
+    dispatcher.bind("htP", config.htP, &xSemaphoreConfig);
+    dispatcher.bind("fWOTA", config.fWOTA, &xSemaphoreConfig);
+    dispatcher.bind("fIface", config.fIface, &xSemaphoreConfig);
+    dispatcher.bind("fIoT", config.fIoT, &xSemaphoreConfig);
+    dispatcher.bind("hname", config.hname, &xSemaphoreConfig);
+    dispatcher.bind("logIP", config.logIP, &xSemaphoreConfig);
+    dispatcher.bind("webApiKey", config.webApiKey, &xSemaphoreConfig);
+    dispatcher.bind("logPrt", config.logPrt, &xSemaphoreConfig);
+    dispatcher.bind("pEnc", config.pEnc, &xSemaphoreConfig);
+
+    dispatcher.bind("fP", configcomcu.fP, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("bFr", configcomcu.bFr, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("fB", configcomcu.fB, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("pBz", configcomcu.pBz, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("pLR", configcomcu.pLR, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("pLG", configcomcu.pLG, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("pLB", configcomcu.pLB, &xSemaphoreConfigCoMCU);
+    dispatcher.bind("lON", configcomcu.lON, &xSemaphoreConfigCoMCU);
+
+    dispatcher.bind("itDt", mySettings.itDt, &xSemaphoreSettings);
+    dispatcher.bind("s1tx", mySettings.s1tx, &xSemaphoreSettings);
+    dispatcher.bind("s1rx", mySettings.s1rx, &xSemaphoreSettings);
+}
+
+/// @brief processSharedAttributeUpdate() and the Vanilla callback before the dispatcher.
+static void legacyUpdate(JsonObjectConst data)
+{
+    if( xSemaphoreTake( xSemaphoreConfig, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+        if(data["model"] != nullptr){strlcpy(config.model, data["model"].as<const char*>(), sizeof(config.model));}
+        if(data["group"] != nullptr){strlcpy(config.group, data["group"].as<const char*>(), sizeof(config.group));}
+        if(data["broker"] != nullptr){strlcpy(config.broker, data["broker"].as<const char*>(), sizeof(config.broker));}
+        if(data["port"] != nullptr){config.port = data["port"].as<uint16_t>();}
+        if(data["wssid"] != nullptr){strlcpy(config.wssid, data["wssid"].as<const char*>(), sizeof(config.wssid));}
+        if(data["wpass"] != nullptr){strlcpy(config.wpass, data["wpass"].as<const char*>(), sizeof(config.wpass));}
+        if(data["dssid"] != nullptr){strlcpy(config.dssid, data["dssid"].as<const char*>(), sizeof(config.dssid));}
+        if(data["dpass"] != nullptr){strlcpy(config.dpass, data["dpass"].as<const char*>(), sizeof(config.dpass));}
+        if(data["upass"] != nullptr){strlcpy(config.upass, data["upass"].as<const char*>(), sizeof(config.upass));}
+        if(data["accTkn"] != nullptr){strlcpy(config.accTkn, data["accTkn"].as<const char*>(), sizeof(config.accTkn));}
+        if(data["provDK"] != nullptr){strlcpy(config.provDK, data["provDK"].as<const char*>(), sizeof(config.provDK));}
+        if(data["provDS"] != nullptr){strlcpy(config.provDS, data["provDS"].as<const char*>(), sizeof(config.provDS));}
+        if(data["logLev"] != nullptr){config.logLev = data["logLev"].as<uint8_t>(); onLogLevAttr(data["logLev"]);}
+        if(data["gmtOff"] != nullptr){config.gmtOff = data["gmtOff"].as<int>();}
+        if(data["htU"] != nullptr){strlcpy(config.htU, data["htU"].as<const char*>(), sizeof(config.htU));}
+        if(data["htP"] != nullptr){strlcpy(config.htP, data["htP"].as<const char*>(), sizeof(config.htP));}
+        if(data["fWOTA"] != nullptr){config.fWOTA = data["fWOTA"].as<bool>();}
+        if(data["fIface"] != nullptr){config.fIface = data["fIface"].as<bool>();}
+        if(data["fIoT"] != nullptr){config.fIoT = data["fIoT"].as<bool>();}
+        if(data["hname"] != nullptr){strlcpy(config.hname, data["hname"].as<const char*>(), sizeof(config.hname));}
+        if(data["logIP"] != nullptr){strlcpy(config.logIP, data["logIP"].as<const char*>(), sizeof(config.logIP));}
+        if(data["webApiKey"] != nullptr){strlcpy(config.webApiKey, data["webApiKey"].as<const char*>(), sizeof(config.webApiKey));}
+        if(data["logPrt"] != nullptr){config.logPrt = data["logPrt"].as<uint16_t>();}
+        if(data["pEnc"] != nullptr){config.pEnc = data["pEnc"].as<uint8_t>();}
+        xSemaphoreGive( xSemaphoreConfig );
+    }
+    if( xSemaphoreTake( xSemaphoreConfigCoMCU, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+        if(data["fP"] != nullptr){configcomcu.fP = data["fP"].as<bool>();}
+        if(data["bFr"] != nullptr){configcomcu.bFr = data["bFr"].as<uint16_t>();}
+        if(data["fB"] != nullptr){configcomcu.fB = data["fB"].as<bool>();}
+        if(data["pBz"] != nullptr){configcomcu.pBz = data["pBz"].as<uint8_t>();}
+        if(data["pLR"] != nullptr){configcomcu.pLR = data["pLR"].as<uint8_t>();}
+        if(data["pLG"] != nullptr){configcomcu.pLG = data["pLG"].as<uint8_t>();}
+        if(data["pLB"] != nullptr){configcomcu.pLB = data["pLB"].as<uint8_t>();}
+        if(data["lON"] != nullptr){configcomcu.lON = data["lON"].as<uint8_t>();}
+        xSemaphoreGive( xSemaphoreConfigCoMCU );
+    }
+    if( xSemaphoreTake( xSemaphoreSettings, ( TickType_t ) 1000 ) == pdTRUE )
+    {
+        if(data["itDt"] != nullptr){mySettings.itDt = data["itDt"].as<uint16_t>();}
+        if(data["s1tx"] != nullptr){mySettings.s1tx = data["s1tx"].as<uint8_t>();}
+        if(data["s1rx"] != nullptr){mySettings.s1rx = data["s1rx"].as<uint8_t>();}
+        xSemaphoreGive( xSemaphoreSettings );
+    }
+}
+
+/// @brief Every bound key, in the order ThingsBoard sends the shared attributes after a connect.
+static void fullUpdate(JsonDocument &doc)
+{
+    doc.clear();
+    doc["model"] = "Vanilla";
+    doc["group"] = "PRITA";
+    doc["broker"] = "prita.undiknas.ac.id";
+    doc["port"] = 8883;
+    doc["wssid"] = "UDAWA-Farm";
+    doc["wpass"] = "greenhouse2026";
+    doc["dssid"] = "UDAWA";
+    doc["dpass"] = "defaultkey";
+    doc["upass"] = "defaultkey";
+    doc["accTkn"] = "q8mTLXWk3rHvNc2bPz7A";
+    doc["provDK"] = "m4k1vx9lq2w8";
+    doc["provDS"] = "f0r7zx1c3v5b";
+    doc["logLev"] = 4;
+    doc["gmtOff"] = 28800;
+    doc["htU"] = "admin";
+    doc["htP"] = "defaultkey";
+    doc["fWOTA"] = true;
+    doc["fIface"] = true;
+    doc["fIoT"] = true;
+    doc["hname"] = "vanilla-9f3c";
+    doc["logIP"] = "192.168.1.10";
+    doc["webApiKey"] = "d6f0b1e4c2a94c7e8f11";
+    doc["logPrt"] = 29515;
+    doc["pEnc"] = 1;
+    doc["fP"] = false;
+    doc["bFr"] = 600;
+    doc["fB"] = true;
+    doc["pBz"] = 32;
+    doc["pLR"] = 25;
+    doc["pLG"] = 26;
+    doc["pLB"] = 27;
+    doc["lON"] = 1;
+    doc["itDt"] = 30;
+    doc["s1tx"] = 33;
+    doc["s1rx"] = 32;
+}
+
+static void createLocks()
+{
+    if(xSemaphoreConfig == NULL)
+    {
+        xSemaphoreConfig = xSemaphoreCreateMutex();
+        xSemaphoreConfigCoMCU = xSemaphoreCreateMutex();
+        xSemaphoreSettings = xSemaphoreCreateMutex();
+    }
+}
+
+static void testRouting()
+{
+    createLocks();
+    AttrDispatcher *dispatcher = new AttrDispatcher();
+    bindDefaults(*dispatcher);
+    CHECK(dispatcher->build());
+    printf("routing: %u keys bound, perfect hash after %u seeds\n", dispatcher->size(), dispatcher->stats().seedTries);
+
+    DynamicJsonDocument doc(4096);
+    fullUpdate(doc);
+    doc["unknownKey"] = 1;
+    CHECK_EQ(dispatcher->dispatch(doc.as<JsonObjectConst>()), dispatcher->size());
+    CHECK_EQ(dispatcher->stats().unknown, 1);
+    CHECK(strcmp(config.broker, "prita.undiknas.ac.id") == 0);
+    CHECK(strcmp(config.webApiKey, "d6f0b1e4c2a94c7e8f11") == 0);
+    CHECK_EQ(config.port, 8883);
+    CHECK_EQ(config.gmtOff, 28800);
+    CHECK_EQ(config.logLev, 4);
+    CHECK_EQ(logLevSet, 4);
+    CHECK(config.fIoT);
+    CHECK(!configcomcu.fP);
+    CHECK_EQ(configcomcu.bFr, 600);
+    CHECK_EQ(mySettings.itDt, 30);
+
+    // Strings are cut to the field, keys bound twice keep the last target.
+    std::string longName(100, 'h');
+    doc.clear();
+    doc["hname"] = longName.c_str();
+    dispatcher->dispatch(doc.as<JsonObjectConst>());
+    CHECK_EQ(strlen(config.hname), sizeof(config.hname) - 1);
+    uint16_t other = 0;
+    CHECK(dispatcher->bind("itDt", other, &xSemaphoreSettings));
+    doc.clear();
+    doc["itDt"] = 45;
+    dispatcher->dispatch(doc.as<JsonObjectConst>());
+    CHECK_EQ(other, 45);
+    CHECK_EQ(mySettings.itDt, 30);
+    delete dispatcher;
+}
+
+static void testLocks()
+{
+    createLocks();
+    AttrDispatcher *dispatcher = new AttrDispatcher();
+    bindDefaults(*dispatcher);
+    DynamicJsonDocument doc(4096);
+    fullUpdate(doc);
+
+    // One take per run of keys behind the same lock.
+    uint32_t configTakes = xSemaphoreConfig->takes;
+    uint32_t coMcuTakes = xSemaphoreConfigCoMCU->takes;
+    dispatcher->dispatch(doc.as<JsonObjectConst>());
+    CHECK_EQ(xSemaphoreConfig->takes - configTakes, 1);
+    CHECK_EQ(xSemaphoreConfigCoMCU->takes - coMcuTakes, 1);
+    CHECK(!xSemaphoreConfig->held && !xSemaphoreConfigCoMCU->held && !xSemaphoreSettings->held);
+
+    // Keys behind a lock that cannot be taken are skipped, the others still apply.
+    config.port = 1;
+    configcomcu.bFr = 1;
+    xSemaphoreTake(xSemaphoreConfig, 0);
+    uint16_t applied = dispatcher->dispatch(doc.as<JsonObjectConst>());
+    xSemaphoreGive(xSemaphoreConfig);
+    CHECK_EQ(applied, 8 + 3);
+    CHECK_EQ(dispatcher->stats().lockTimeouts, 24);
+    CHECK_EQ(config.port, 1);
+    CHECK_EQ(configcomcu.bFr, 600);
+
+    // A lock created after bind() is picked up.
+    SemaphoreHandle_t late = NULL;
+    uint8_t value = 0;
+    dispatcher->bind("late", value, &late);
+    late = xSemaphoreCreateMutex();
+    doc.clear();
+    doc["late"] = 7;
+    dispatcher->dispatch(doc.as<JsonObjectConst>());
+    CHECK_EQ(value, 7);
+    CHECK_EQ(late->takes, 1);
+    delete late;
+    delete dispatcher;
+}
+
+/// @brief Mean time per update over rounds of the given update.
+static double timeUpdates(bool dispatch, AttrDispatcher &dispatcher, JsonObjectConst update, int rounds)
+{
+    unsigned long start = micros();
+    for(int i = 0; i < rounds; i++)
+    {
+        if(dispatch)
+        {
+            dispatcher.dispatch(update);
+        }
+        else
+        {
+            legacyUpdate(update);
+        }
+    }
+    return (double)(micros() - start) / rounds;
+}
+
+static void benchUpdates()
+{
+    createLocks();
+    AttrDispatcher *dispatcher = new AttrDispatcher();
+    bindDefaults(*dispatcher);
+    dispatcher->build();
+    const int rounds = 20000;
+
+    DynamicJsonDocument full(4096);
+    fullUpdate(full);
+    DynamicJsonDocument single(256);
+    single["itDt"] = 15;
+    DynamicJsonDocument few(512);
+    few["logLev"] = 5;
+    few["fIface"] = false;
+    few["s1tx"] = 4;
+
+    struct
+    {
+        const char *name;
+        JsonObjectConst update;
+    } cases[] = {
+        { "all keys", full.as<JsonObjectConst>() },
+        { "one key", single.as<JsonObjectConst>() },
+        { "three keys", few.as<JsonObjectConst>() },
+    };
+    for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        double probes = timeUpdates(false, *dispatcher, cases[c].update, rounds);
+        double dispatched = timeUpdates(true, *dispatcher, cases[c].update, rounds);
+        printf("%-10s (%2u fields): %.3f us per update probing every key, %.3f us dispatched, %.1fx\n",
+            cases[c].name, (unsigned)cases[c].update.size(), probes, dispatched, probes / dispatched);
+        if(c == 0)
+        {
+            // Probing is keys x fields string compares; dispatching one hash and one compare per field.
+            CHECK(dispatched * 2 < probes);
+        }
+    }
+    delete dispatcher;
+}
+
+int main()
+{
+    testRouting();
+    testLocks();
+    benchUpdates();
+    return hostTestResult();
+}
@@ -0,0 +1,330 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// AttributeShadow fed the groups syncClientAttr() builds: only changed keys go out, packed into
+// messages that fit the MQTT buffer, lost and rejected messages are sent again, full resync, and
+// messages and bytes per sync against one message per group.
+
+#include "hostTest.h"
+#include "attributeShadow.h"
+#include <string>
+#include <vector>
+
+#define ATTRIBUTE_TOPIC "v1/devices/me/attributes"
+// TB_PAYLOAD_MAX(TB_ATTRIBUTE_TOPIC) with the default DOCSIZE_MIN of 384.
+static const size_t DOCSIZE_MIN = 384;
+static const size_t MAX_PAYLOAD = DOCSIZE_MIN - 5 - 2 - (sizeof(ATTRIBUTE_TOPIC) - 1);
+
+/// @brief Hands out message ids and keeps what was published, refuses what PubSubClient would.
+struct FakePublisher
+{
+    uint32_t nextId = 0;
+    bool refuse = false;
+    std::vector<std::string> messages;
+    std::vector<uint32_t> ids;
+    uint32_t tooLarge = 0;
+
+    void clear()
+    {
+        messages.clear();
+        ids.clear();
+    }
+};
+
+static FakePublisher publisher;
+
+static uint32_t publish(const char *payload)
+{
+    if(publisher.refuse)
+    {
+        return 0;
+    }
+    if(5 + 2 + strlen(ATTRIBUTE_TOPIC) + strlen(payload) > DOCSIZE_MIN)
+    {
+        publisher.tooLarge++;
+        return 0;
+    }
+    publisher.messages.push_back(payload);
+    publisher.ids.push_back(++publisher.nextId);
+    return publisher.nextId;
+}
+
+/// @brief Device state behind the synced attributes, close to what a Vanilla board reports.
+struct DeviceState
+{
+    std::string ip = "192.168.1.57";
+    int dUsed = 184320;
+    int flFree = 1310720;
+    int logLev = 3;
+    std::string name = "Greenhouse North Bed 2";
+    int htU = 0;
+};
+
+static void addGroups(AttributeShadow &shadow, const DeviceState &state)
+{
+    StaticJsonDocument<DOCSIZE_MIN> doc;
+    doc["ipad"] = state.ip.c_str();
+    doc["compdate"] = "Oct 19 2026 07:12:44";
+    doc["fmTitle"] = "Vanilla";
+    doc["fmVersion"] = "0.0.1";
+    doc["stamac"] = "24:0A:C4:12:9F:3C";
+    doc["apmac"] = "24:0A:C4:12:9F:3D";
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["flFree"] = state.flFree;
+    doc["fwSize"] = 1185232;
+    doc["flSize"] = 4194304;
+    doc["dSize"] = 1378241;
+    doc["dUsed"] = state.dUsed;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["sdkVer"] = "v4.4.4";
+    doc["model"] = "Vanilla";
+    doc["name"] = state.name.c_str();
+    doc["group"] = "PRITA";
+    doc["broker"] = "prita.undiknas.ac.id";
+    doc["port"] = 1883;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["wssid"] = "UDAWA-Farm";
+    doc["ap"] = "UDAWA-Farm";
+    doc["wpass"] = "greenhouse2026";
+    doc["dssid"] = "UDAWA";
+    doc["dpass"] = "defaultkey";
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["upass"] = "defaultkey";
+    doc["accTkn"] = "q8mTLXWk3rHvNc2bPz7A";
+    doc["webApiKey"] = "d6f0b1e4c2a94c7e8f11";
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["provDK"] = "m4k1vx9lq2w8";
+    doc["provDS"] = "f0r7zx1c3v5b";
+    doc["logLev"] = state.logLev;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["gmtOff"] = 28800;
+    doc["bFr"] = 600;
+    doc["fP"] = 0;
+    doc["fB"] = 1;
+    doc["fIoT"] = 1;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["fWOTA"] = 1;
+    doc["fIface"] = 1;
+    doc["hname"] = "vanilla-9f3c";
+    doc["logIP"] = "192.168.1.10";
+    doc["logPrt"] = 29514;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["pBz"] = 32;
+    doc["pLR"] = 25;
+    doc["pLG"] = 26;
+    doc["pLB"] = 27;
+    doc["htU"] = state.htU;
+    shadow.add(doc.as<JsonObjectConst>());
+    doc.clear();
+    doc["htP"] = "defaultkey";
+    doc["lON"] = 1;
+    doc["pEnc"] = 0;
+    shadow.add(doc.as<JsonObjectConst>());
+}
+
+/// @brief One syncClientAttr() pass.
+static void sync(AttributeShadow &shadow, const DeviceState &state, bool full = false)
+{
+    publisher.clear();
+    shadow.begin(full);
+    addGroups(shadow, state);
+    shadow.end();
+}
+
+static void ackAll(AttributeShadow &shadow, bool delivered = true)
+{
+    for(uint32_t id : publisher.ids)
+    {
+        shadow.complete(id, delivered);
+    }
+}
+
+static size_t countKeys()
+{
+    size_t keys = 0;
+    for(const std::string &m : publisher.messages)
+    {
+        StaticJsonDocument<DOCSIZE_MIN> doc;
+        CHECK(deserializeJson(doc, m.c_str()) == DeserializationError::Ok);
+        keys += doc.as<JsonObjectConst>().size();
+    }
+    return keys;
+}
+
+static bool sent(const char *key)
+{
+    std::string quoted = std::string("\"") + key + "\":";
+    for(const std::string &m : publisher.messages)
+    {
+        if(m.find(quoted) != std::string::npos)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void testFirstSync()
+{
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    DeviceState state;
+    sync(*shadow, state);
+    const AttributeShadowStats &stats = shadow->stats();
+    printf("first sync: %u keys in %u messages (%llu bytes), %u messages (%llu bytes) one per group\n",
+        (unsigned)countKeys(), stats.sentMessages, (unsigned long long)stats.sentBytes, stats.legacyMessages,
+        (unsigned long long)stats.legacyBytes);
+    CHECK_EQ(countKeys(), stats.keysChecked);
+    CHECK_EQ(stats.keysDropped, 0);
+    CHECK(stats.sentMessages < stats.legacyMessages);
+    CHECK_EQ(publisher.tooLarge, 0);
+    for(const std::string &m : publisher.messages)
+    {
+        CHECK(m.size() <= MAX_PAYLOAD);
+    }
+    delete shadow;
+}
+
+static void testDelta()
+{
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    DeviceState state;
+    sync(*shadow, state);
+    ackAll(*shadow);
+
+    sync(*shadow, state);
+    CHECK(publisher.messages.empty());
+
+    state.dUsed += 4096;
+    state.ip = "192.168.1.58";
+    sync(*shadow, state);
+    CHECK_EQ(publisher.messages.size(), 1);
+    CHECK_EQ(countKeys(), 2);
+    CHECK(sent("dUsed") && sent("ipad"));
+    ackAll(*shadow);
+
+    sync(*shadow, state, true);
+    CHECK_EQ(countKeys(), shadow->stats().keysChecked / shadow->stats().syncs);
+    delete shadow;
+}
+
+static void testLost()
+{
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    DeviceState state;
+    sync(*shadow, state);
+    ackAll(*shadow);
+
+    state.logLev = 5;
+    sync(*shadow, state);
+    CHECK(sent("logLev"));
+    // Still in flight: the same value is not sent twice.
+    std::vector<uint32_t> inFlight = publisher.ids;
+    sync(*shadow, state);
+    CHECK(publisher.messages.empty());
+    // Lost: the next sync sends it again.
+    for(uint32_t id : inFlight)
+    {
+        shadow->complete(id, false);
+    }
+    sync(*shadow, state);
+    CHECK(sent("logLev"));
+    CHECK_EQ(countKeys(), 1);
+    ackAll(*shadow);
+
+    // A value that changes while the old one is in flight goes out right away.
+    state.htU = 1;
+    sync(*shadow, state);
+    inFlight = publisher.ids;
+    state.htU = 2;
+    sync(*shadow, state);
+    CHECK(sent("htU"));
+    for(uint32_t id : inFlight)
+    {
+        shadow->complete(id, true);
+    }
+    ackAll(*shadow);
+    sync(*shadow, state);
+    CHECK(publisher.messages.empty());
+    delete shadow;
+}
+
+static void testRefused()
+{
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    DeviceState state;
+    publisher.refuse = true;
+    sync(*shadow, state);
+    CHECK(shadow->stats().failedMessages > 0);
+    publisher.refuse = false;
+    sync(*shadow, state);
+    CHECK_EQ(countKeys(), shadow->stats().keysChecked / 2);
+    delete shadow;
+}
+
+static void testOversize()
+{
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    StaticJsonDocument<DOCSIZE_MIN> doc;
+    std::string large(ATTR_SHADOW_VALUE_SIZE, 'x');
+    doc["large"] = large.c_str();
+    doc["small"] = 1;
+    publisher.clear();
+    shadow->begin();
+    shadow->add(doc.as<JsonObjectConst>());
+    shadow->end();
+    CHECK_EQ(shadow->stats().keysDropped, 1);
+    CHECK(sent("small") && !sent("large"));
+    delete shadow;
+}
+
+static void benchSyncs()
+{
+    // A day of syncs after connects and shared attribute updates, dUsed and flFree drift every time.
+    AttributeShadow *shadow = new AttributeShadow(publish, MAX_PAYLOAD);
+    DeviceState state;
+    const int syncs = 200;
+    unsigned long start = micros();
+    for(int i = 0; i < syncs; i++)
+    {
+        state.dUsed += 512;
+        if(i % 10 == 0)
+        {
+            state.flFree -= 4096;
+        }
+        sync(*shadow, state, i % 50 == 0);
+        ackAll(*shadow);
+    }
+    unsigned long elapsed = micros() - start;
+    const AttributeShadowStats &stats = shadow->stats();
+    printf("%d syncs: %u messages (%llu bytes) with the shadow, %u messages (%llu bytes) without, %.1f us per sync\n",
+        syncs, stats.sentMessages, (unsigned long long)stats.sentBytes, stats.legacyMessages,
+        (unsigned long long)stats.legacyBytes, (double)elapsed / syncs);
+    CHECK(stats.sentBytes * 4 < stats.legacyBytes);
+    CHECK(stats.sentMessages * 4 < stats.legacyMessages);
+    CHECK_EQ(publisher.tooLarge, 0);
+    delete shadow;
+}
+
+int main()
+{
+    testFirstSync();
+    testDelta();
+    testLost();
+    testRefused();
+    testOversize();
+    benchSyncs();
+    return hostTestResult();
+}
@@ -0,0 +1,237 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// BackoffPolicy: growth of the window up to its cap, the range of the drawn delays, failures()
+// saturating and reset(). Then a fleet of devices that lost the broker at the same moment, retrying
+// with full jitter like TBTR against the old retry every second, and the connects per second the
+// broker sees while it is down and once it is back.
+
+#include "hostTest.h"
+#include "backoffPolicy.h"
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+// The TLS policy of libudawa.h, the one an unreachable broker runs into.
+#define TB_BACKOFF_TLS_BASE 1000
+#define TB_BACKOFF_TLS_CAP 60000
+// TBTR before the state machine: tb.connect() and vTaskDelay(1000) until it connected.
+#define LOCKSTEP_RETRY_MS 1000
+
+#define FLEET_SIZE 1000
+// The broker drops every connection at once, the devices notice within this many ms.
+#define FLEET_LOSS_SPREAD_MS 100
+// TLS handshakes the broker completes per second once it is back, the rest are refused.
+#define BROKER_HANDSHAKES_PER_SECOND 100
+// Seconds simulated after the broker is back.
+#define FLEET_RECOVERY_S 180
+
+static void testCeiling()
+{
+    BackoffPolicy policy(TB_BACKOFF_TLS_BASE, TB_BACKOFF_TLS_CAP);
+    CHECK_EQ(policy.failures(), 0);
+    CHECK_EQ(policy.ceiling(), TB_BACKOFF_TLS_BASE);
+    const unsigned long expected[] = {1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000, 60000};
+    for(unsigned long window : expected)
+    {
+        CHECK_EQ(policy.ceiling(), window);
+        unsigned long delayMs = policy.next();
+        CHECK(delayMs <= window);
+    }
+    CHECK_EQ(policy.failures(), 9);
+
+    // A base that doubles straight onto the cap, and a cap below the base.
+    BackoffPolicy even(5000, 20000);
+    even.next();
+    even.next();
+    CHECK_EQ(even.ceiling(), 20000);
+    even.next();
+    CHECK_EQ(even.ceiling(), 20000);
+    BackoffPolicy capped(5000, 3000);
+    CHECK_EQ(capped.ceiling(), 3000);
+    CHECK(capped.next() <= 3000);
+
+    // Full jitter: both ends of the window come up and the mean sits in the middle.
+    BackoffPolicy small(4, 4);
+    uint32_t seen[5] = {};
+    for(int i = 0; i < 1000; i++)
+    {
+        unsigned long delayMs = small.next();
+        CHECK(delayMs <= 4);
+        seen[delayMs <= 4 ? delayMs : 0]++;
+    }
+    for(uint32_t count : seen)
+    {
+        CHECK(count > 100);
+    }
+    BackoffPolicy wide(TB_BACKOFF_TLS_CAP, TB_BACKOFF_TLS_CAP);
+    double sum = 0;
+    for(int i = 0; i < 100000; i++)
+    {
+        sum += wide.next();
+    }
+    double mean = sum / 100000;
+    CHECK(mean > TB_BACKOFF_TLS_CAP * 0.49 && mean < TB_BACKOFF_TLS_CAP * 0.51);
+}
+
+static void testSaturation()
+{
+    BackoffPolicy policy(TB_BACKOFF_TLS_BASE, TB_BACKOFF_TLS_CAP);
+    for(uint32_t i = 0; i < UINT16_MAX + 10UL; i++)
+    {
+        policy.next();
+    }
+    CHECK_EQ(policy.failures(), UINT16_MAX);
+    CHECK_EQ(policy.ceiling(), TB_BACKOFF_TLS_CAP);
+    CHECK(policy.next() <= TB_BACKOFF_TLS_CAP);
+    CHECK_EQ(policy.failures(), UINT16_MAX);
+
+    policy.reset();
+    CHECK_EQ(policy.failures(), 0);
+    CHECK_EQ(policy.ceiling(), TB_BACKOFF_TLS_BASE);
+    CHECK(policy.next() <= TB_BACKOFF_TLS_BASE);
+    CHECK_EQ(policy.failures(), 1);
+    CHECK_EQ(policy.ceiling(), 2 * TB_BACKOFF_TLS_BASE);
+}
+
+struct FleetRun
+{
+    std::vector<uint32_t> attemptsPerSecond;
+    uint32_t attempts = 0;
+    uint32_t refused = 0;
+    uint32_t connected = 0;
+    unsigned long lastConnectMs = 0;
+    uint32_t peakDown = 0;
+    uint32_t peakUp = 0;
+};
+
+/// @brief FLEET_SIZE devices lose the broker at 0 ms, it is back at outageMs.
+static FleetRun simulateFleet(bool jitter, unsigned long outageMs)
+{
+    typedef std::pair<unsigned long, uint16_t> Attempt;
+    std::priority_queue<Attempt, std::vector<Attempt>, std::greater<Attempt>> attempts;
+    std::vector<BackoffPolicy> policies(FLEET_SIZE, BackoffPolicy(TB_BACKOFF_TLS_BASE, TB_BACKOFF_TLS_CAP));
+    const size_t seconds = outageMs / 1000 + FLEET_RECOVERY_S;
+    std::vector<uint32_t> accepted(seconds, 0);
+    FleetRun run;
+    run.attemptsPerSecond.assign(seconds, 0);
+
+    randomSeed(1);
+    for(uint16_t i = 0; i < FLEET_SIZE; i++)
+    {
+        // tbBackoff() runs on the disconnect already, the old loop connected again at once.
+        unsigned long lostAt = random(0, FLEET_LOSS_SPREAD_MS);
+        attempts.push(Attempt(lostAt + (jitter ? policies[i].next() : 0), i));
+    }
+    while(!attempts.empty())
+    {
+        Attempt attempt = attempts.top();
+        attempts.pop();
+        size_t second = attempt.first / 1000;
+        if(second >= seconds)
+        {
+            break;
+        }
+        run.attempts++;
+        run.attemptsPerSecond[second]++;
+        if(attempt.first >= outageMs)
+        {
+            if(accepted[second] < BROKER_HANDSHAKES_PER_SECOND)
+            {
+                accepted[second]++;
+                run.connected++;
+                run.lastConnectMs = attempt.first;
+                continue;
+            }
+            run.refused++;
+        }
+        BackoffPolicy &policy = policies[attempt.second];
+        attempts.push(Attempt(attempt.first + (jitter ? policy.next() : LOCKSTEP_RETRY_MS), attempt.second));
+    }
+    for(size_t s = 0; s < seconds; s++)
+    {
+        uint32_t &peak = s < outageMs / 1000 ? run.peakDown : run.peakUp;
+        peak = run.attemptsPerSecond[s] > peak ? run.attemptsPerSecond[s] : peak;
+    }
+    return run;
+}
+
+static void printRun(const char *name, unsigned long outageMs, const FleetRun &run)
+{
+    printf("%-9s %3lus outage: %6u attempts, peak %4u/s down, %4u/s back up, %5u refused, %4u of %u back %5.1fs after the broker\n",
+        name, outageMs / 1000, run.attempts, run.peakDown, run.peakUp, run.refused, run.connected, FLEET_SIZE,
+        (double)(run.lastConnectMs - outageMs) / 1000);
+}
+
+/// @brief Attempts per second of both runs, averaged over buckets of bucketS seconds.
+static void plot(const FleetRun &lockstep, const FleetRun &jitter, size_t bucketS)
+{
+    const int width = 30;
+    printf("connects/s  lockstep every %ds %*s full jitter\n", LOCKSTEP_RETRY_MS / 1000, width - 6, "");
+    // Up to the last attempt of either run.
+    size_t end = lockstep.attemptsPerSecond.size();
+    while(end > 0 && lockstep.attemptsPerSecond[end - 1] == 0 && jitter.attemptsPerSecond[end - 1] == 0)
+    {
+        end--;
+    }
+    for(size_t start = 0; start < end; start += bucketS)
+    {
+        double rates[2] = {0, 0};
+        const FleetRun *runs[2] = {&lockstep, &jitter};
+        for(int r = 0; r < 2; r++)
+        {
+            for(size_t s = start; s < start + bucketS && s < runs[r]->attemptsPerSecond.size(); s++)
+            {
+                rates[r] += runs[r]->attemptsPerSecond[s];
+            }
+            rates[r] /= bucketS;
+        }
+        printf("%4zus", start);
+        for(int r = 0; r < 2; r++)
+        {
+            int bar = (int)(rates[r] * width / FLEET_SIZE + 0.5);
+            bar = rates[r] > 0 && bar == 0 ? 1 : bar;
+            printf(r == 0 ? " %7.1f %-*s" : " %7.1f %.*s", rates[r], width, std::string(bar, '#').c_str());
+        }
+        printf("\n");
+    }
+}
+
+static void testFleet()
+{
+    const unsigned long outages[] = {10000, 300000};
+    for(unsigned long outageMs : outages)
+    {
+        FleetRun lockstep = simulateFleet(false, outageMs);
+        FleetRun jitter = simulateFleet(true, outageMs);
+        printRun("lockstep", outageMs, lockstep);
+        printRun("jitter", outageMs, jitter);
+        CHECK_EQ(lockstep.connected, FLEET_SIZE);
+        CHECK_EQ(jitter.connected, FLEET_SIZE);
+        // The old loop hits the broker with the whole fleet every second it is down and the second
+        // it is back. Jittered retries stay under what it can take once they are spread over the cap.
+        CHECK(lockstep.peakUp >= FLEET_SIZE * 9 / 10);
+        CHECK(jitter.attempts < lockstep.attempts);
+        if(outageMs >= 2 * TB_BACKOFF_TLS_CAP)
+        {
+            CHECK(jitter.peakUp < BROKER_HANDSHAKES_PER_SECOND);
+            CHECK_EQ(jitter.refused, 0);
+            CHECK(jitter.lastConnectMs - outageMs <= TB_BACKOFF_TLS_CAP);
+            plot(lockstep, jitter, 15);
+        }
+    }
+}
+
+int main()
+{
+    testCeiling();
+    testSaturation();
+    testFleet();
+    return hostTestResult();
+}
@@ -0,0 +1,199 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// CoMCUBaudNegotiator against the simulator: persisted rates, refused and noisy rates, recovery of
+// a link that went bad at a fast rate, a CoMCU that kept its rate across an ESP32 restart, and
+// pings/s at the default against the agreed rate.
+
+#include "hostTest.h"
+#include "coMcuSim.h"
+#include "coMcuBaud.h"
+
+static const unsigned long REPLY_TIMEOUT = 50;
+static const unsigned long FALLBACK_MS = 100;
+static const uint32_t RATES[] = {921600, 460800, 230400, 115200};
+static const size_t RATE_COUNT = sizeof(RATES) / sizeof(RATES[0]);
+
+struct Bench
+{
+    int fds[2];
+    SocketStream *serial;
+    CoMCUSim *sim;
+    CoMCULink link;
+    CoMCUBaudNegotiator<SocketStream> *negotiator;
+
+    Bench(uint32_t seed = 1)
+    {
+        SocketStream::pair(fds);
+        serial = new SocketStream(fds[0]);
+        sim = new CoMCUSim(fds[1], *serial, seed);
+        sim->setFallbackMs(FALLBACK_MS);
+        link.begin(*serial);
+        negotiator = new CoMCUBaudNegotiator<SocketStream>(link, *serial, REPLY_TIMEOUT, FALLBACK_MS);
+        sim->start();
+    }
+    ~Bench()
+    {
+        sim->stop();
+        delete negotiator;
+        delete sim;
+        delete serial;
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    uint32_t negotiate(uint32_t persisted)
+    {
+        uint32_t agreed = negotiator->negotiate(RATES, RATE_COUNT, persisted);
+        const CoMCUBaudStats &stats = negotiator->stats();
+        printf("  persisted %6u -> %6u in %4lu ms, %u probes, %u refused, %u fallbacks, %u/%u pings failed\n",
+            persisted, agreed, stats.elapsedMs, stats.probes, stats.refused, stats.fallbacks, stats.pingFailures, stats.pings);
+        return agreed;
+    }
+
+    /// @brief Both sides on rate and the link answering there.
+    void checkLinked(uint32_t baud)
+    {
+        CHECK_EQ(serial->baudRate(), baud);
+        CHECK_EQ(sim->baud(), baud);
+        CHECK(negotiator->ping(5));
+    }
+};
+
+static void testFreshBoot()
+{
+    printf("fresh boot:\n");
+    Bench bench;
+    CHECK_EQ(bench.negotiate(0), 921600);
+    bench.checkLinked(921600);
+}
+
+static void testPersistedDefault()
+{
+    // configCoMCUReset() stores the default, which must not end the search at the default.
+    printf("persisted default:\n");
+    Bench bench;
+    CHECK_EQ(bench.negotiate(COMCU_BAUD_DEFAULT), 921600);
+    CHECK_EQ(bench.negotiator->stats().probes, 1);
+    bench.checkLinked(921600);
+}
+
+static void testPersistedFirst()
+{
+    printf("persisted rate:\n");
+    Bench bench;
+    CHECK_EQ(bench.negotiate(460800), 460800);
+    CHECK_EQ(bench.negotiator->stats().probes, 1);
+    bench.checkLinked(460800);
+}
+
+static void testRefused()
+{
+    printf("CoMCU limited to 230400:\n");
+    Bench bench;
+    bench.sim->setAcceptedBauds({230400, 115200});
+    CHECK_EQ(bench.negotiate(0), 230400);
+    CHECK_EQ(bench.negotiator->stats().refused, 2);
+    CHECK_EQ(bench.negotiator->stats().fallbacks, 0);
+    bench.checkLinked(230400);
+}
+
+static void testNoisy()
+{
+    printf("replies garbled above 230400:\n");
+    Bench bench;
+    CoMCUSimFaults faults;
+    faults.noisyAbove = 230400;
+    faults.noiseRate = 0.3;
+    bench.sim->setFaults(faults);
+    CHECK_EQ(bench.negotiate(921600), 230400);
+    CHECK_EQ(bench.negotiator->stats().fallbacks, 2);
+    bench.checkLinked(230400);
+}
+
+static void testRenegotiate()
+{
+    // A link agreed at 921600 starts garbling replies; both sides go back to the default before
+    // anything is probed, instead of pinging at the broken rate and keeping it.
+    printf("link going bad at 921600:\n");
+    Bench bench;
+    CHECK_EQ(bench.negotiate(0), 921600);
+    CoMCUSimFaults faults;
+    faults.noisyAbove = 460800;
+    faults.noiseRate = 0.3;
+    bench.sim->setFaults(faults);
+    CHECK(!bench.negotiator->ping(3));
+    bench.sim->clear();
+    CHECK_EQ(bench.negotiate(921600), 460800);
+    std::vector<CoMCUSimFrame> frames = bench.sim->frames();
+    CHECK(!frames.empty() && frames.front().method == "sBaud" &&
+        frames.front().frame.find("115200") != std::string::npos);
+    bench.checkLinked(460800);
+}
+
+static void testRestartedSide()
+{
+    // The ESP32 restarted at the default while the CoMCU kept the rate agreed before.
+    printf("CoMCU kept 921600 across an ESP32 restart:\n");
+    Bench bench;
+    bench.sim->setBaud(921600);
+    CHECK_EQ(bench.negotiate(921600), 921600);
+    bench.checkLinked(921600);
+}
+
+static void testMute()
+{
+    printf("CoMCU not answering:\n");
+    Bench bench;
+    bench.serial->updateBaudRate(921600);
+    bench.sim->setMute(true);
+    CHECK_EQ(bench.negotiate(921600), 0);
+    CHECK_EQ(bench.serial->baudRate(), COMCU_BAUD_DEFAULT);
+}
+
+static void benchRates()
+{
+    printf("pings/s with 10 bits per byte on the wire and 100 us CoMCU latency:\n");
+    Bench bench;
+    CoMCUSimFaults faults;
+    faults.pace = true;
+    faults.latencyUs = 100;
+    bench.sim->setFaults(faults);
+    const uint32_t count = 300;
+    printf("%8s %8s %10s\n", "baud", "pings", "pings/s");
+    for(int round = 0; round < 2; round++)
+    {
+        if(round == 1)
+        {
+            CHECK_EQ(bench.negotiate(0), 921600);
+        }
+        uint32_t ok = 0;
+        unsigned long start = micros();
+        for(uint32_t i = 0; i < count; i++)
+        {
+            ok += bench.negotiator->ping(1);
+        }
+        unsigned long elapsed = micros() - start;
+        CHECK_EQ(ok, count);
+        printf("%8u %8u %10.0f\n", bench.serial->baudRate(), count, count * 1e6 / elapsed);
+    }
+}
+
+int main()
+{
+    testFreshBoot();
+    testPersistedDefault();
+    testPersistedFirst();
+    testRefused();
+    testNoisy();
+    testRenegotiate();
+    testRestartedSide();
+    testMute();
+    benchRates();
+    return hostTestResult();
+}
@@ -0,0 +1,330 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// CoMCU link conformance and throughput against the simulator. The frames are the ones
+// serialWriteToCoMcu(), setCoMCUPin(), syncConfigCoMCU(), setLed(), setBuzzer() and CoMCUBaudNegotiator
+// put on the wire, the reply handling mirrors serialReadFromCoMcu().
+
+#include "hostTest.h"
+#include "coMcuSim.h"
+#include "coMcuLink.h"
+#include "jsonLayout.h"
+
+using namespace libudawa;
+
+static const unsigned long REPLY_TIMEOUT = 50;
+
+struct Bench
+{
+    int fds[2];
+    SocketStream *serial;
+    CoMCUSim *sim;
+    CoMCULink link;
+
+    Bench(uint32_t seed = 1)
+    {
+        SocketStream::pair(fds);
+        serial = new SocketStream(fds[0]);
+        sim = new CoMCUSim(fds[1], *serial, seed);
+        link.begin(*serial);
+        sim->start();
+    }
+    ~Bench()
+    {
+        sim->stop();
+        delete sim;
+        delete serial;
+        close(fds[0]);
+        close(fds[1]);
+    }
+};
+
+static bool replyField(const char *frame, const char *key, unsigned long &value)
+{
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *at = strstr(frame, pattern);
+    if(at == nullptr)
+    {
+        return false;
+    }
+    char *end = nullptr;
+    value = strtoul(at + strlen(pattern), &end, 10);
+    return end != at + strlen(pattern);
+}
+
+/// @brief One RPC exchange as serialWriteToCoMcu(doc, true) does it.
+static size_t rpc(CoMCULink &link, const char *frame, char *reply, size_t size, unsigned long timeout = REPLY_TIMEOUT)
+{
+    link.flush();
+    link.write(frame, strlen(frame));
+    return link.readFrame(reply, size, timeout);
+}
+
+static size_t pingFrame(char *buffer, size_t size, uint32_t nonce)
+{
+    return serializeJsonLayout(jsonLayout(
+        jsonSlot("method", "ping"),
+        jsonSlot("params", jsonLayout(jsonSlot("nonce", nonce)))), buffer, size);
+}
+
+/// @brief pingCoMCU(1): the echo must carry the nonce and its CRC.
+static bool ping(CoMCULink &link, uint32_t nonce, unsigned long timeout = REPLY_TIMEOUT)
+{
+    char frame[64];
+    char reply[64];
+    pingFrame(frame, sizeof(frame), nonce);
+    if(rpc(link, frame, reply, sizeof(reply), timeout) == 0)
+    {
+        return false;
+    }
+    unsigned long gotNonce = 0;
+    unsigned long gotCrc = 0;
+    uint8_t bytes[4] = {(uint8_t)nonce, (uint8_t)(nonce >> 8), (uint8_t)(nonce >> 16), (uint8_t)(nonce >> 24)};
+    return replyField(reply, "nonce", gotNonce) && replyField(reply, "crc", gotCrc) &&
+        gotNonce == nonce && gotCrc == CoMCUSim::crc16(bytes, sizeof(bytes));
+}
+
+struct Command
+{
+    const char *method;
+    bool rpc;
+    char frame[160];
+};
+
+static void buildCommands(Command (&commands)[6], uint32_t n, uint32_t baud = 115200)
+{
+    commands[0] = {"ping", true, {}};
+    pingFrame(commands[0].frame, sizeof(commands[0].frame), n);
+    commands[1] = {"sBaud", true, {}};
+    serializeJsonLayout(jsonLayout(
+        jsonSlot("method", "sBaud"),
+        jsonSlot("params", jsonLayout(jsonSlot("baud", baud)))), commands[1].frame, sizeof(commands[1].frame));
+    commands[2] = {"sCfg", false, {}};
+    serializeJsonLayout(jsonLayout(
+        jsonSlot("fP", (uint8_t)1),
+        jsonSlot("bFr", (uint16_t)600),
+        jsonSlot("fB", true),
+        jsonSlot("pBz", (uint8_t)2),
+        jsonSlot("method", "sCfg")), commands[2].frame, sizeof(commands[2].frame));
+    commands[3] = {"sPin", false, {}};
+    serializeJsonLayout(jsonLayout(
+        jsonSlot("params", jsonLayout(
+            jsonSlot("pin", (uint8_t)(n % 16)),
+            jsonSlot("mode", (uint8_t)1),
+            jsonSlot("op", (uint8_t)3),
+            jsonSlot("state", (uint8_t)(n & 1)),
+            jsonSlot("aval", (uint16_t)(n % 1024)))),
+        jsonSlot("method", "sPin")), commands[3].frame, sizeof(commands[3].frame));
+    commands[4] = {"sLed", false, {}};
+    serializeJsonLayout(jsonLayout(
+        jsonSlot("method", "sLed"),
+        jsonSlot("params", jsonLayout(
+            jsonSlot("r", (uint8_t)255),
+            jsonSlot("g", (uint8_t)0),
+            jsonSlot("b", (uint8_t)(n & 0xFF)),
+            jsonSlot("isBlink", (uint8_t)1),
+            jsonSlot("blinkCount", (int32_t)-1),
+            jsonSlot("blinkDelay", (uint16_t)250)))), commands[4].frame, sizeof(commands[4].frame));
+    commands[5] = {"sBuz", false, {}};
+    serializeJsonLayout(jsonLayout(
+        jsonSlot("params", jsonLayout(
+            jsonSlot("beepCount", (int32_t)3),
+            jsonSlot("beepDelay", (uint16_t)50))),
+        jsonSlot("method", "sBuz")), commands[5].frame, sizeof(commands[5].frame));
+}
+
+static void testConformance()
+{
+    Bench bench;
+    Command commands[6];
+    buildCommands(commands, 7);
+
+    // Every command arrives as sent, one frame each, in order.
+    for(Command &command : commands)
+    {
+        if(command.rpc)
+        {
+            char reply[64];
+            CHECK(rpc(bench.link, command.frame, reply, sizeof(reply)) > 0);
+        }
+        else
+        {
+            CHECK(bench.link.write(command.frame, strlen(command.frame)));
+        }
+    }
+    CHECK(bench.sim->waitReceived("sBuz", 1, 1000));
+    std::vector<CoMCUSimFrame> frames = bench.sim->frames();
+    CHECK_EQ(frames.size(), 6);
+    for(size_t i = 0; i < frames.size() && i < 6; i++)
+    {
+        CHECK(frames[i].method == commands[i].method);
+        CHECK(frames[i].frame == commands[i].frame);
+    }
+    CHECK_EQ(bench.sim->badFrames(), 0);
+
+    CHECK(ping(bench.link, 0));
+    CHECK(ping(bench.link, 0xFFFFFFFF));
+    char reply[64];
+    char frame[64];
+    snprintf(frame, sizeof(frame), "{\"method\":\"sBaud\",\"params\":{\"baud\":%u}}", 1234u);
+    unsigned long baud = 1;
+    CHECK(rpc(bench.link, frame, reply, sizeof(reply)) > 0 && replyField(reply, "baud", baud) && baud == 0);
+    CHECK_EQ(bench.sim->baud(), COMCU_SIM_DEFAULT_BAUD);
+}
+
+/// @brief Feeds raw bytes as if the CoMCU had sent them and reads one frame.
+static size_t readRaw(Bench &bench, const char *raw, char *buffer, size_t size, size_t len = 0)
+{
+    ::send(bench.fds[1], raw, len > 0 ? len : strlen(raw), 0);
+    return bench.link.readFrame(buffer, size, 50);
+}
+
+static void testFraming()
+{
+    Bench bench;
+    bench.sim->stop();
+    char buffer[64];
+
+    CHECK_EQ(readRaw(bench, "\x00\xff garbage{\"a\":1}", buffer, sizeof(buffer), 17), 7);
+    CHECK(strcmp(buffer, "{\"a\":1}") == 0);
+    CHECK_EQ(bench.link.stats().garbage, 10);
+
+    const char *quoted = "{\"s\":\"}{\\\"}\",\"o\":{\"x\":[1,{}]}}";
+    CHECK_EQ(readRaw(bench, quoted, buffer, sizeof(buffer)), strlen(quoted));
+    CHECK(strcmp(buffer, quoted) == 0);
+
+    // Too long for the buffer: consumed whole, the next frame is intact.
+    char small[8];
+    CHECK_EQ(readRaw(bench, "{\"long\":123456}{\"b\":2}", small, sizeof(small)), 0);
+    CHECK_EQ(bench.link.stats().oversized, 1);
+    CHECK_EQ(bench.link.readFrame(small, sizeof(small), 50), 7);
+    CHECK(strcmp(small, "{\"b\":2}") == 0);
+
+    // A truncated frame times out, the flush of the next exchange drops what is left of it.
+    CHECK_EQ(readRaw(bench, "{\"nonce\":1,", buffer, sizeof(buffer)), 0);
+    CHECK_EQ(bench.link.stats().timeouts, 1);
+    ::send(bench.fds[1], "\"crc\":", 6, 0);
+    delay(5);
+    bench.link.flush();
+    CHECK_EQ(readRaw(bench, "{\"c\":3}", buffer, sizeof(buffer)), 7);
+
+    CHECK_EQ(bench.link.readFrame(buffer, sizeof(buffer), 20), 0);
+    CHECK_EQ(bench.link.readFrame(buffer, 2, 20), 0);
+}
+
+static void testFaults()
+{
+    Bench bench(7);
+    CoMCUSimFaults faults;
+    faults.latencyUs = 200;
+    faults.jitterUs = 400;
+    faults.corruptRate = 0.003;
+    faults.dropRate = 0.003;
+    bench.sim->setFaults(faults);
+
+    const uint32_t count = 1000;
+    uint32_t ok = 0;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        ok += ping(bench.link, 0x1000 + i, 20);
+    }
+    const CoMCULinkStats &stats = bench.link.stats();
+    printf("faults: %u/%u pings ok, %u timeouts, %u garbage bytes, %u sim bad frames\n",
+        ok, count, stats.timeouts, stats.garbage, bench.sim->badFrames());
+    // About 70 bytes cross the link per ping, so roughly a third should fail at these rates.
+    CHECK(ok > count / 3);
+    CHECK(ok < count);
+
+    // Once the line is clean again the very next exchange succeeds, nothing stays out of step.
+    bench.sim->setFaults(CoMCUSimFaults());
+    for(uint32_t i = 0; i < 50; i++)
+    {
+        CHECK(ping(bench.link, 0x9000 + i));
+    }
+}
+
+static void benchCommands(uint32_t baud, bool pace)
+{
+    Bench bench;
+    bench.serial->updateBaudRate(baud);
+    bench.sim->setBaud(baud);
+    CoMCUSimFaults faults;
+    faults.pace = pace;
+    faults.latencyUs = 100;
+    bench.sim->setFaults(faults);
+
+    const uint32_t count = pace ? 200 : 1000;
+    Command commands[6];
+    buildCommands(commands, 0, baud);
+    printf("%-7s %7s %10s %9s %9s %9s\n", "command", "msgs", "msgs/s", "p50 us", "p99 us", "max us");
+    for(uint8_t c = 0; c < 6; c++)
+    {
+        LatencySamples latency;
+        uint32_t failed = 0;
+        bench.sim->clear();
+        unsigned long start = micros();
+        unsigned long elapsed = 0;
+        if(commands[c].rpc)
+        {
+            for(uint32_t i = 0; i < count; i++)
+            {
+                buildCommands(commands, i, baud);
+                char reply[64];
+                unsigned long sent = micros();
+                if(rpc(bench.link, commands[c].frame, reply, sizeof(reply)) == 0)
+                {
+                    failed++;
+                    continue;
+                }
+                latency.add(micros() - sent);
+            }
+            elapsed = micros() - start;
+        }
+        else
+        {
+            // Back to back for the rate, then one at a time for the latency without queueing.
+            for(uint32_t i = 0; i < count; i++)
+            {
+                buildCommands(commands, i, baud);
+                bench.link.write(commands[c].frame, strlen(commands[c].frame));
+            }
+            CHECK(bench.sim->waitReceived(commands[c].method, count, 10000));
+            failed = count - bench.sim->received(commands[c].method);
+            elapsed = micros() - start;
+            for(uint32_t i = 0; i < count / 4; i++)
+            {
+                unsigned long sent = micros();
+                bench.link.write(commands[c].frame, strlen(commands[c].frame));
+                if(!bench.sim->waitReceived(commands[c].method, count + i + 1, 1000))
+                {
+                    failed++;
+                    continue;
+                }
+                latency.add(bench.sim->frames().back().receivedAt - sent);
+            }
+        }
+        CHECK_EQ(failed, 0);
+        printf("%-7s %7u %10.0f %9lu %9lu %9lu\n", commands[c].method, count, count * 1e6 / elapsed,
+            latency.percentile(50), latency.percentile(99), latency.percentile(100));
+    }
+}
+
+int main()
+{
+    testConformance();
+    testFraming();
+    testFaults();
+    printf("throughput, unpaced socketpair:\n");
+    benchCommands(115200, false);
+    printf("throughput, paced at 115200 baud:\n");
+    benchCommands(115200, true);
+    printf("throughput, paced at 921600 baud:\n");
+    benchCommands(921600, true);
+    return hostTestResult();
+}
@@ -0,0 +1,358 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// CoMCUUpdater against a simulated bootloader: clean and lossy transfers, resume after a cut,
+// images without a CRC, and throughput at the UART rates the CoMCU link runs at.
+
+#include "hostTest.h"
+#include "coMcuSim.h"
+#include "coMcuUpdater.h"
+
+/// @brief Image source in memory, counts what was read from it.
+class MemoryStream : public Stream
+{
+    public:
+        explicit MemoryStream(const std::vector<uint8_t> &data) : _data(data) {}
+        int available() override { return _data.size() - _pos; }
+        int read() override { return _pos < _data.size() ? _data[_pos++] : -1; }
+        int peek() override { return _pos < _data.size() ? _data[_pos] : -1; }
+        size_t write(uint8_t c) override { return 0; }
+
+    private:
+        const std::vector<uint8_t> &_data;
+        size_t _pos = 0;
+};
+
+/// @brief The bootloader side of the protocol documented in coMcuUpdater.h.
+class BootloaderSim : public CoMCUSim
+{
+    public:
+        using CoMCUSim::CoMCUSim;
+
+        /// Resume by size alone when fwBegin has no CRC, what the protocol forbids.
+        bool resumeWithoutCrc = false;
+        /// Goes quiet after accepting this many blocks in one session, like a CoMCU losing power.
+        size_t cutAfterBlocks = SIZE_MAX;
+
+        std::vector<uint8_t> flash()
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            return _flash;
+        }
+        bool committed() const { return _committed; }
+        uint32_t naks() const { return _naks; }
+        void reboot()
+        {
+            setMute(false);
+            std::lock_guard<std::mutex> guard(_lock);
+            _active = false;
+            _block.clear();
+        }
+
+        static uint32_t crc32(const uint8_t *data, size_t len)
+        {
+            uint32_t crc = 0xFFFFFFFF;
+            for(size_t i = 0; i < len; i++)
+            {
+                crc ^= data[i];
+                for(int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+                }
+            }
+            return ~crc;
+        }
+
+    protected:
+        bool handle(const std::string &frame, const std::string &method) override
+        {
+            unsigned long size = 0;
+            unsigned long crc = 0;
+            char text[48];
+            if(method == "fwBegin" && field(frame, "size", size) && field(frame, "crc", crc))
+            {
+                std::lock_guard<std::mutex> guard(_lock);
+                bool resume = size == _size && (crc != 0 ? crc == _crc : resumeWithoutCrc);
+                if(!resume)
+                {
+                    _flash.clear();
+                }
+                _size = size;
+                _crc = crc;
+                _expect = _flash.size() / COMCU_UPDATE_BLOCK_SIZE;
+                _flash.resize(_expect * COMCU_UPDATE_BLOCK_SIZE);
+                _accepted = 0;
+                _active = true;
+                _committed = false;
+                snprintf(text, sizeof(text), "{\"offset\":%u}", (unsigned int)_flash.size());
+            }
+            else if(method == "fwEnd" && field(frame, "crc", crc))
+            {
+                std::lock_guard<std::mutex> guard(_lock);
+                _committed = _flash.size() == _size && crc32(_flash.data(), _flash.size()) == crc;
+                _active = false;
+                snprintf(text, sizeof(text), "{\"fwEnd\":%d}", _committed ? 1 : 0);
+            }
+            else
+            {
+                return CoMCUSim::handle(frame, method);
+            }
+            reply(text);
+            return true;
+        }
+
+        bool handleByte(uint8_t c) override
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            if(muted())
+            {
+                // Powered off, nothing is received.
+                return true;
+            }
+            unsigned long now = micros();
+            if(!_block.empty() && now - _lastByteAt > 50000)
+            {
+                // A block that stalled is abandoned, so whatever comes next is read afresh.
+                _block.clear();
+            }
+            _lastByteAt = now;
+            if(!_active || (_block.empty() && c != COMCU_UPDATE_FRAME_DATA))
+            {
+                return false;
+            }
+            _block.push_back(c);
+            if(_block.size() < 5)
+            {
+                return true;
+            }
+            uint16_t len = _block[3] | (_block[4] << 8);
+            if(len > COMCU_UPDATE_BLOCK_SIZE)
+            {
+                _block.clear();
+                return true;
+            }
+            if(_block.size() < 7u + len)
+            {
+                return true;
+            }
+            uint16_t seq = _block[1] | (_block[2] << 8);
+            uint16_t crc = crc16(_block.data() + 1, 4 + len);
+            uint16_t got = _block[5 + len] | (_block[6 + len] << 8);
+            uint8_t type = 0;
+            if(crc != got || (seq != (uint16_t)_expect && (uint16_t)(seq - _expect) < 0x8000))
+            {
+                // Bad, or ahead of a block that went missing.
+                type = COMCU_UPDATE_FRAME_NAK;
+                _naks++;
+            }
+            else if(seq == (uint16_t)_expect)
+            {
+                _flash.insert(_flash.end(), _block.begin() + 5, _block.begin() + 5 + len);
+                _expect++;
+                markValid();
+                type = COMCU_UPDATE_FRAME_ACK;
+                if(++_accepted >= cutAfterBlocks)
+                {
+                    setMute(true);
+                }
+            }
+            _block.clear();
+            if(type != 0)
+            {
+                uint16_t seqOut = type == COMCU_UPDATE_FRAME_ACK ? (uint16_t)(_expect - 1) : (uint16_t)_expect;
+                uint8_t ack[3] = {type, (uint8_t)seqOut, (uint8_t)(seqOut >> 8)};
+                guard.unlock();
+                replyBytes(ack, sizeof(ack));
+            }
+            return true;
+        }
+
+    private:
+        std::vector<uint8_t> _flash;
+        std::vector<uint8_t> _block;
+        size_t _size = 0;
+        uint32_t _crc = 0;
+        uint32_t _expect = 0;
+        size_t _accepted = 0;
+        unsigned long _lastByteAt = 0;
+        bool _active = false;
+        std::atomic<bool> _committed{false};
+        std::atomic<uint32_t> _naks{0};
+};
+
+struct Bench
+{
+    int fds[2];
+    SocketStream *serial;
+    BootloaderSim *boot;
+
+    Bench(uint32_t seed = 1)
+    {
+        SocketStream::pair(fds);
+        serial = new SocketStream(fds[0]);
+        boot = new BootloaderSim(fds[1], *serial, seed);
+        boot->start();
+    }
+    ~Bench()
+    {
+        boot->stop();
+        delete boot;
+        delete serial;
+        close(fds[0]);
+        close(fds[1]);
+    }
+    int update(const std::vector<uint8_t> &image, uint32_t crc, CoMCUUpdateStats *stats = nullptr)
+    {
+        MemoryStream source(image);
+        CoMCUUpdater updater(*serial);
+        int res = updater.update(source, image.size(), crc);
+        if(stats != nullptr)
+        {
+            *stats = updater.stats();
+        }
+        return res;
+    }
+};
+
+static std::vector<uint8_t> makeImage(size_t size, uint8_t salt)
+{
+    std::vector<uint8_t> image(size);
+    for(size_t i = 0; i < size; i++)
+    {
+        image[i] = (uint8_t)((i * 7) ^ (i >> 3) ^ salt);
+    }
+    return image;
+}
+
+static uint32_t crcOf(const std::vector<uint8_t> &image)
+{
+    return CoMCUUpdater::crc32(image.data(), image.size());
+}
+
+static void testClean()
+{
+    Bench bench;
+    std::vector<uint8_t> image = makeImage(20000, 1);
+    CHECK_EQ(crcOf(image), BootloaderSim::crc32(image.data(), image.size()));
+    CHECK_EQ(bench.update(image, crcOf(image)), COMCU_UPDATE_OK);
+    CHECK(bench.boot->flash() == image);
+    CHECK(bench.boot->committed());
+
+    // Without a CRC the image is still verified at fwEnd with the CRC of what was streamed.
+    std::vector<uint8_t> other = makeImage(20000, 2);
+    CHECK_EQ(bench.update(other, 0), COMCU_UPDATE_OK);
+    CHECK(bench.boot->flash() == other);
+    CHECK(bench.boot->committed());
+}
+
+static void testLossy()
+{
+    Bench bench(3);
+    CoMCUSimFaults faults;
+    faults.corruptRate = 0.0003;
+    faults.dropRate = 0.0003;
+    bench.boot->setFaults(faults);
+    std::vector<uint8_t> image = makeImage(30000, 3);
+    int res = COMCU_UPDATE_ERROR_BEGIN;
+    CoMCUUpdateStats stats;
+    for(int attempt = 0; attempt < 5 && res != COMCU_UPDATE_OK; attempt++)
+    {
+        res = bench.update(image, crcOf(image), &stats);
+        printf("lossy: attempt %d res %d resumed at %u, %u blocks sent, %u resent, %u timeouts\n",
+            attempt, res, (unsigned int)stats.resumedAt, stats.blocksSent, stats.blocksResent, stats.timeouts);
+    }
+    CHECK_EQ(res, COMCU_UPDATE_OK);
+    CHECK(bench.boot->flash() == image);
+    CHECK(stats.blocksResent > 0 || stats.resumedAt > 0);
+}
+
+static void testResume()
+{
+    Bench bench;
+    std::vector<uint8_t> image = makeImage(16384, 4);
+    bench.boot->cutAfterBlocks = 40;
+    CoMCUUpdateStats stats;
+    CHECK(bench.update(image, crcOf(image), &stats) != COMCU_UPDATE_OK);
+    bench.boot->cutAfterBlocks = SIZE_MAX;
+    bench.boot->reboot();
+
+    CHECK_EQ(bench.update(image, crcOf(image), &stats), COMCU_UPDATE_OK);
+    CHECK_EQ(stats.resumedAt, 40 * COMCU_UPDATE_BLOCK_SIZE);
+    CHECK(bench.boot->flash() == image);
+    CHECK(bench.boot->committed());
+}
+
+static void testUnknownCrcNeverResumes()
+{
+    Bench bench;
+    std::vector<uint8_t> first = makeImage(16384, 5);
+    std::vector<uint8_t> second = makeImage(16384, 6);
+    bench.boot->cutAfterBlocks = 40;
+    CHECK(bench.update(first, 0) != COMCU_UPDATE_OK);
+    bench.boot->cutAfterBlocks = SIZE_MAX;
+    bench.boot->reboot();
+
+    // Same size, different image: a bootloader following the protocol starts over.
+    CoMCUUpdateStats stats;
+    CHECK_EQ(bench.update(second, 0, &stats), COMCU_UPDATE_OK);
+    CHECK_EQ(stats.resumedAt, 0);
+    CHECK(bench.boot->flash() == second);
+
+    // One that offers to resume anyway is refused instead of getting the tail spliced on.
+    bench.boot->cutAfterBlocks = 40;
+    CHECK(bench.update(first, 0) != COMCU_UPDATE_OK);
+    bench.boot->cutAfterBlocks = SIZE_MAX;
+    bench.boot->reboot();
+    bench.boot->resumeWithoutCrc = true;
+    CHECK_EQ(bench.update(second, 0), COMCU_UPDATE_ERROR_REJECTED);
+    CHECK(!bench.boot->committed());
+}
+
+static void testCorruptSource()
+{
+    Bench bench;
+    std::vector<uint8_t> image = makeImage(8192, 7);
+    uint32_t crc = crcOf(image);
+    image[5000] ^= 0x01;
+    CHECK_EQ(bench.update(image, crc), COMCU_UPDATE_ERROR_VERIFY);
+    CHECK(!bench.boot->committed());
+    CHECK_EQ(bench.boot->received("fwEnd"), 0);
+}
+
+static void benchThroughput(uint32_t baud)
+{
+    Bench bench;
+    bench.serial->updateBaudRate(baud);
+    bench.boot->setBaud(baud);
+    CoMCUSimFaults faults;
+    faults.pace = true;
+    // Flash write time per block before the acknowledgement goes out.
+    faults.latencyUs = 1500;
+    bench.boot->setFaults(faults);
+
+    std::vector<uint8_t> image = makeImage(baud >= 460800 ? 65536 : 16384, 8);
+    CoMCUUpdateStats stats;
+    CHECK_EQ(bench.update(image, crcOf(image), &stats), COMCU_UPDATE_OK);
+    CHECK(bench.boot->flash() == image);
+    double wire = baud / 10.0;
+    double rate = stats.elapsedMs > 0 ? stats.imageSize * 1000.0 / stats.elapsedMs : 0;
+    printf("throughput at %u baud: %u bytes in %lu ms, %.0f B/s, %.0f%% of the raw line rate, %u blocks resent, %u timeouts\n",
+        baud, (unsigned int)stats.imageSize, stats.elapsedMs, rate, rate * 100 / wire, stats.blocksResent, stats.timeouts);
+}
+
+int main()
+{
+    testClean();
+    testLossy();
+    testResume();
+    testUnknownCrcNeverResumes();
+    testCorruptSource();
+    benchThroughput(115200);
+    benchThroughput(921600);
+    return hostTestResult();
+}
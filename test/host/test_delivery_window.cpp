@@ -0,0 +1,416 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// DeliveryWindow against a simulated broker connection: fences, retransmits after a reconnect,
+// answers that come too late or never, fences that cannot be requested, payloads too large once
+// stamped, a message the connection keeps refusing, a connection that is down, and at least once
+// delivery through a flaky session that loses messages and fence answers.
+
+#include "hostTest.h"
+#include "deliveryWindow.h"
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
+// TB_PUBLISH_PAYLOAD_SIZE and TB_STAMP_SIZE with the default DOCSIZE_MIN of 384.
+static const size_t PAYLOAD_SIZE = 384 - 5 - 2 - (sizeof(TELEMETRY_TOPIC) - 1) + 1;
+static const size_t STAMP_SIZE = sizeof("{\"ts\":,\"values\":}") - 1 + 20;
+
+/// @brief The broker side: what arrived, and whether the connection is up.
+struct FakeConnection
+{
+    bool up = true;
+    /// Sent messages wait here until the broker gets to them, a drop loses them.
+    bool queued = false;
+    std::deque<uint32_t> inflight;
+    std::string refuse;
+    std::vector<uint32_t> received;
+    std::vector<std::string> payloads;
+    std::vector<uint32_t> delivered;
+    std::vector<uint32_t> dropped;
+};
+
+static FakeConnection conn;
+
+static uint8_t send(const DeliveryEntry &entry)
+{
+    if(!conn.up)
+    {
+        return DELIVERY_SEND_RETRY;
+    }
+    if(!conn.refuse.empty() && strstr(entry.payload, conn.refuse.c_str()) != nullptr)
+    {
+        return DELIVERY_SEND_REFUSED;
+    }
+    if(conn.queued)
+    {
+        conn.inflight.push_back(entry.id);
+        return DELIVERY_SEND_OK;
+    }
+    conn.received.push_back(entry.id);
+    conn.payloads.push_back(entry.payload);
+    return DELIVERY_SEND_OK;
+}
+
+static void done(DeliveryEntry &entry, bool delivered)
+{
+    (delivered ? conn.delivered : conn.dropped).push_back(entry.id);
+}
+
+static DeliveryEntry entry(uint32_t id, const char *payload, uint64_t ts = 0)
+{
+    DeliveryEntry e = {};
+    e.id = id;
+    e.payload = const_cast<char *>(payload);
+    e.ts = ts;
+    return e;
+}
+
+static char slots[DELIVERY_WINDOW_SIZE * PAYLOAD_SIZE];
+
+/// @brief Requests a fence the way tbPublishDrain() does and returns its slot, -1 when none was free.
+static int8_t requestFence(DeliveryWindow *window, unsigned long now)
+{
+    int8_t slot = window->fenceSlot();
+    if(slot < 0)
+    {
+        window->fenceFailed(now);
+        return -1;
+    }
+    window->openFence(slot, now);
+    return slot;
+}
+
+static void testFences()
+{
+    conn = FakeConnection();
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    char buffer[32];
+    for(uint32_t id = 1; id <= DELIVERY_WINDOW_SIZE; id++)
+    {
+        snprintf(buffer, sizeof(buffer), "{\"i\":%u}", id);
+        CHECK(window->add(entry(id, buffer)));
+    }
+    CHECK(!window->add(entry(99, "{\"i\":99}")));
+    CHECK_EQ(window->pump(send, 4), 4);
+    CHECK(window->needsFence());
+    int8_t slot = requestFence(window, 0);
+    CHECK_EQ(window->pump(send, 4), 4);
+    CHECK(!window->needsFence());
+    CHECK(window->fenceAcked(slot, 10));
+    CHECK_EQ(conn.delivered.size(), 4);
+    CHECK(window->needsFence());
+
+    // The connection drops with the fence open: nothing more is confirmed, the rest goes out again.
+    slot = requestFence(window, 20);
+    window->connectionLost();
+    CHECK(!window->fenceAcked(slot, 30));
+    CHECK_EQ(conn.delivered.size(), 4);
+    CHECK_EQ(window->pump(send, DELIVERY_WINDOW_SIZE), 4);
+    CHECK_EQ(window->stats().retransmits, 4);
+
+    // No answer in time: nothing is confirmed, the messages go out again on the same connection.
+    requestFence(window, 40);
+    CHECK(!window->expireFence(50, 100));
+    CHECK(window->expireFence(200, 100));
+    CHECK_EQ(conn.delivered.size(), 4);
+    CHECK_EQ(window->count(), 4);
+    CHECK_EQ(window->pump(send, DELIVERY_WINDOW_SIZE), 4);
+    CHECK_EQ(window->stats().retransmits, 8);
+    slot = requestFence(window, 210);
+    CHECK(window->fenceAcked(slot, 220));
+    CHECK(window->empty());
+    CHECK_EQ(conn.delivered.size(), DELIVERY_WINDOW_SIZE);
+    for(uint32_t i = 0; i < conn.delivered.size(); i++)
+    {
+        CHECK_EQ(conn.delivered[i], i + 1);
+    }
+    // The slots were copied: the caller's buffer was reused for every add.
+    CHECK(conn.payloads.front() == "{\"i\":1}");
+
+    CHECK(window->add(entry(20, "{\"i\":20}")));
+    CHECK(!window->add(entry(20, "{\"i\":20}")));
+    CHECK_EQ(window->stats().duplicates, 1);
+    delete window;
+}
+
+static void testLateAnswer()
+{
+    conn = FakeConnection();
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    window->add(entry(1, "{\"i\":1}"));
+    window->add(entry(2, "{\"i\":2}"));
+    window->pump(send, 4);
+    int8_t first = requestFence(window, 0);
+    CHECK(window->expireFence(100, 100));
+    CHECK_EQ(window->pump(send, 4), 2);
+    window->add(entry(3, "{\"i\":3}"));
+    window->pump(send, 4);
+    int8_t second = requestFence(window, 110);
+    CHECK(second >= 0 && second != first);
+
+    // The answer to the first fence arrives now. It proves nothing about 3 and must not confirm it.
+    CHECK(!window->fenceAcked(first, 120));
+    CHECK_EQ(window->stats().staleAnswers, 1);
+    CHECK(conn.delivered.empty());
+    CHECK(window->fenceOpen());
+    CHECK(window->fenceAcked(second, 130));
+    CHECK_EQ(conn.delivered.size(), 3);
+    // Answered once, a repeat of it is ignored.
+    CHECK(!window->fenceAcked(second, 140));
+    CHECK_EQ(window->stats().fenceRttLast, 20);
+    delete window;
+}
+
+static void testFenceSlots()
+{
+    // Fences that are never answered hold their slots, until none is left to request one through.
+    conn = FakeConnection();
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    window->add(entry(1, "{\"i\":1}"));
+    unsigned long now = 0;
+    for(int i = 0; i < DELIVERY_FENCE_SLOTS; i++)
+    {
+        window->pump(send, 4);
+        CHECK(requestFence(window, now) >= 0);
+        now += 100;
+        CHECK(window->expireFence(now, 100));
+    }
+    CHECK_EQ(window->stats().fenceTimeouts, DELIVERY_FENCE_SLOTS);
+    CHECK_EQ(window->stats().retransmits, DELIVERY_FENCE_SLOTS - 1);
+    window->pump(send, 4);
+    CHECK_EQ(window->fenceSlot(), -1);
+    CHECK_EQ(requestFence(window, now), -1);
+    CHECK(window->needsFence());
+    CHECK(!window->fenceStalled(now + 50, 100));
+    // Retried on every drain, each failure is counted.
+    CHECK_EQ(requestFence(window, now + 60), -1);
+    CHECK_EQ(window->stats().fenceFailures, 2);
+    CHECK(window->fenceStalled(now + 100, 100));
+    CHECK(conn.delivered.empty());
+
+    // The caller reconnects: the slots are free again and the message goes out once more.
+    window->connectionLost();
+    CHECK(!window->fenceStalled(now + 200, 100));
+    CHECK_EQ(window->pump(send, 4), 1);
+    int8_t slot = requestFence(window, now + 200);
+    CHECK(slot >= 0);
+    CHECK(window->fenceAcked(slot, now + 210));
+    CHECK_EQ(conn.delivered.size(), 1);
+    CHECK(window->empty());
+    delete window;
+}
+
+static void testOversize()
+{
+    conn = FakeConnection();
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    std::string payload = "{\"blob\":\"" + std::string(PAYLOAD_SIZE - 1 - 11, 'x') + "\"}";
+    CHECK_EQ(payload.size(), PAYLOAD_SIZE - 1);
+    // Fits the slot, but not once it is stamped with its time.
+    CHECK(window->add(entry(1, payload.c_str())));
+    CHECK(!window->add(entry(2, payload.c_str(), 1700000000000ULL)));
+    payload.resize(PAYLOAD_SIZE - 1 - STAMP_SIZE - 2);
+    payload += "\"}";
+    CHECK(window->add(entry(3, payload.c_str(), 1700000000000ULL)));
+    payload.insert(9, "x");
+    CHECK(!window->add(entry(4, payload.c_str(), 1700000000000ULL)));
+    CHECK_EQ(window->stats().oversize, 2);
+    CHECK_EQ(window->count(), 2);
+    delete window;
+}
+
+static void testRefused()
+{
+    // The connection refuses one message every time; it must not hold up the ones behind it.
+    conn = FakeConnection();
+    conn.refuse = "poison";
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    char buffer[32];
+    uint32_t id = 0;
+    for(int round = 0; round < 3; round++)
+    {
+        while(!window->full())
+        {
+            id++;
+            snprintf(buffer, sizeof(buffer), id % 5 == 0 ? "{\"poison\":%u}" : "{\"i\":%u}", id);
+            window->add(entry(id, buffer));
+        }
+        window->pump(send, DELIVERY_WINDOW_SIZE);
+        window->fenceAcked(requestFence(window, round), round);
+    }
+    printf("refused: %u delivered, %u dropped, %u still held\n", (unsigned)conn.delivered.size(), (unsigned)conn.dropped.size(), window->count());
+    CHECK(window->empty());
+    CHECK_EQ(conn.delivered.size() + conn.dropped.size(), id);
+    CHECK_EQ(conn.dropped.size(), id / 5);
+    CHECK_EQ(window->stats().refused, id / 5);
+    // Every payload went out intact from the slot it was copied to, in order.
+    for(size_t i = 0; i < conn.received.size(); i++)
+    {
+        snprintf(buffer, sizeof(buffer), "{\"i\":%u}", conn.received[i]);
+        CHECK(conn.payloads[i] == buffer);
+        CHECK(i == 0 || conn.received[i] > conn.received[i - 1]);
+    }
+    delete window;
+}
+
+static void testConnectionDown()
+{
+    conn = FakeConnection();
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    window->add(entry(1, "{\"i\":1}"));
+    window->add(entry(2, "{\"i\":2}"));
+    conn.up = false;
+    CHECK_EQ(window->pump(send, 4), 0);
+    CHECK_EQ(window->count(), 2);
+    CHECK(conn.dropped.empty());
+    conn.up = true;
+    CHECK_EQ(window->pump(send, 4), 2);
+    CHECK_EQ(conn.received.size(), 2);
+    CHECK_EQ(conn.received[0], 1);
+    delete window;
+}
+
+struct FenceAnswer
+{
+    uint8_t slot;
+    unsigned long at;
+};
+
+static void benchFlakySession()
+{
+    // A day of one message a minute over a connection that drops now and then, losing what the broker
+    // did not get to yet. Fence answers come late or not at all.
+    conn = FakeConnection();
+    conn.queued = true;
+    DeliveryWindow *window = new DeliveryWindow(done, slots, PAYLOAD_SIZE, STAMP_SIZE);
+    srand(7);
+    const uint32_t messages = 24 * 60;
+    const unsigned long fenceTimeout = 10000;
+    char buffer[64];
+    uint32_t id = 0;
+    uint32_t drops = 0;
+    uint32_t stalls = 0;
+    unsigned long now = 0;
+    std::deque<uint8_t> fences;
+    std::vector<FenceAnswer> answers;
+    std::set<uint32_t> received;
+    while(conn.delivered.size() < messages && now < 100UL * 24 * 3600 * 1000)
+    {
+        now += 1000;
+        if(id < messages && !window->full())
+        {
+            id++;
+            snprintf(buffer, sizeof(buffer), "{\"temp\":%u.5,\"seq\":%u}", id % 40, id);
+            CHECK(window->add(entry(id, buffer, 1700000000000ULL + id * 60000ULL)));
+        }
+        if(conn.up && rand() % 100 == 0)
+        {
+            conn.up = false;
+            conn.inflight.clear();
+            fences.clear();
+            answers.clear();
+            window->connectionLost();
+            drops++;
+        }
+        else if(!conn.up && rand() % 5 == 0)
+        {
+            conn.up = true;
+        }
+        if(!conn.up)
+        {
+            continue;
+        }
+        // The broker works through what arrived in order. A fence is answered up to 15 s later, or never.
+        for(int n = 0; n < 2 && !conn.inflight.empty(); n++)
+        {
+            uint32_t head = conn.inflight.front();
+            conn.inflight.pop_front();
+            if(head != 0)
+            {
+                received.insert(head);
+                continue;
+            }
+            uint8_t slot = fences.front();
+            fences.pop_front();
+            if(rand() % 10 != 0)
+            {
+                answers.push_back(FenceAnswer{slot, now + (rand() % 16) * 1000UL});
+            }
+        }
+        for(size_t a = 0; a < answers.size(); )
+        {
+            if(answers[a].at <= now)
+            {
+                window->fenceAcked(answers[a].slot, now);
+                answers.erase(answers.begin() + a);
+            }
+            else
+            {
+                a++;
+            }
+        }
+        window->expireFence(now, fenceTimeout);
+        window->pump(send, 4);
+        if(window->needsFence())
+        {
+            int8_t slot = requestFence(window, now);
+            if(slot >= 0)
+            {
+                // A fence goes through the same connection, id 0 marks it.
+                conn.inflight.push_back(0);
+                fences.push_back(slot);
+            }
+        }
+        if(window->fenceStalled(now, fenceTimeout))
+        {
+            conn.up = false;
+            conn.inflight.clear();
+            fences.clear();
+            answers.clear();
+            window->connectionLost();
+            stalls++;
+        }
+    }
+    const DeliveryWindowStats &stats = window->stats();
+    uint32_t unreceived = 0;
+    for(uint32_t delivered : conn.delivered)
+    {
+        unreceived += received.count(delivered) == 0;
+    }
+    printf("flaky session: %u messages, %u connection drops, %u reconnects for stalled fences, %u sends, %u retransmits, "
+        "%u fences (%u timed out, %u answered late, %u not requested), %u confirmed but never received\n",
+        messages, drops, stalls, stats.sent, stats.retransmits, stats.fences, stats.fenceTimeouts, stats.staleAnswers,
+        stats.fenceFailures, unreceived);
+    CHECK_EQ(stats.delivered, messages);
+    CHECK_EQ(stats.sent, messages + stats.retransmits);
+    CHECK(stats.fenceTimeouts > 0);
+    CHECK(stats.staleAnswers > 0);
+    CHECK_EQ(unreceived, 0);
+    CHECK(conn.dropped.empty());
+    CHECK_EQ(conn.delivered.size(), messages);
+    for(uint32_t i = 0; i < conn.delivered.size(); i++)
+    {
+        CHECK_EQ(conn.delivered[i], i + 1);
+    }
+    delete window;
+}
+
+int main()
+{
+    testFences();
+    testLateAnswer();
+    testFenceSlots();
+    testOversize();
+    testRefused();
+    testConnectionDown();
+    benchFlakySession();
+    return hostTestResult();
+}
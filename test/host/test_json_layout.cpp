@@ -0,0 +1,418 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// serializeJsonLayout() against serializeJson() of the same document, byte for byte: the setBuzzer,
+// setLed, emitAlarm messages of the library and the deviceTelemetry, devTel and sensors messages of
+// the Vanilla sketch with edge and random values, escapes, integer limits, floats around the 1e-5
+// and 1e7 exponent thresholds, NaN and infinities. Then messages that do not fit, heap allocations,
+// and the time per message of both writers.
+
+#include "hostTest.h"
+#include "jsonLayout.h"
+#include <ArduinoJson.h>
+#include <float.h>
+#include <limits.h>
+#include <new>
+#include <string>
+
+using namespace libudawa;
+
+static uint32_t allocations = 0;
+
+// Counts every allocation of the binary. Not inlined, so the compiler does not pair malloc with delete.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+static uint32_t randomState = 0x2545F491;
+
+static uint32_t nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+/// @brief Collects what the Print overload of serializeJsonLayout() writes.
+class StringPrint : public Print
+{
+    public:
+        size_t write(uint8_t c) override
+        {
+            text += (char)c;
+            return 1;
+        }
+        size_t write(const uint8_t *buffer, size_t size) override
+        {
+            text.append((const char *)buffer, size);
+            return size;
+        }
+        std::string text;
+};
+
+static uint32_t compared = 0;
+static uint32_t mismatches = 0;
+
+/// @brief Both overloads of serializeJsonLayout() must write what serializeJson() writes for doc.
+template <typename TLayout>
+static std::string compare(const TLayout &layout, const JsonDocument &doc)
+{
+    char expected[256];
+    char actual[256];
+    size_t expectedLength = serializeJson(doc, expected, sizeof(expected));
+    size_t actualLength = serializeJsonLayout(layout, actual, sizeof(actual));
+    StringPrint print;
+    size_t printed = serializeJsonLayout(layout, print);
+    compared++;
+    if(actualLength != expectedLength || strcmp(actual, expected) != 0 || printed != actualLength || print.text != actual)
+    {
+        // The first few are enough to see what differs.
+        if(mismatches++ < 8)
+        {
+            fprintf(stderr, "serializeJson:       %s\nserializeJsonLayout: %s\n", expected, actual);
+        }
+    }
+    return actual;
+}
+
+static std::string setBuzzer(int32_t beepCount, uint16_t beepDelay)
+{
+    StaticJsonDocument<128> doc;
+    JsonObject params = doc.createNestedObject("params");
+    params["beepCount"] = beepCount;
+    params["beepDelay"] = beepDelay;
+    doc["method"] = "sBuz";
+    return compare(jsonLayout(
+        jsonSlot("params", jsonLayout(
+            jsonSlot("beepCount", beepCount),
+            jsonSlot("beepDelay", beepDelay))),
+        jsonSlot("method", "sBuz")), doc);
+}
+
+/// @brief setLed(r, g, b, ...) puts params first, setLed(color, ...) puts method first.
+static std::string setLed(uint8_t r, uint8_t g, uint8_t b, uint8_t isBlink, int32_t blinkCount, uint16_t blinkDelay, bool methodFirst)
+{
+    StaticJsonDocument<192> doc;
+    if(methodFirst)
+    {
+        doc["method"] = "sLed";
+    }
+    JsonObject params = doc.createNestedObject("params");
+    params["r"] = r;
+    params["g"] = g;
+    params["b"] = b;
+    params["isBlink"] = isBlink;
+    params["blinkCount"] = blinkCount;
+    params["blinkDelay"] = blinkDelay;
+    if(!methodFirst)
+    {
+        doc["method"] = "sLed";
+        return compare(jsonLayout(
+            jsonSlot("params", jsonLayout(
+                jsonSlot("r", r),
+                jsonSlot("g", g),
+                jsonSlot("b", b),
+                jsonSlot("isBlink", isBlink),
+                jsonSlot("blinkCount", blinkCount),
+                jsonSlot("blinkDelay", blinkDelay))),
+            jsonSlot("method", "sLed")), doc);
+    }
+    return compare(jsonLayout(
+        jsonSlot("method", "sLed"),
+        jsonSlot("params", jsonLayout(
+            jsonSlot("r", r),
+            jsonSlot("g", g),
+            jsonSlot("b", b),
+            jsonSlot("isBlink", isBlink),
+            jsonSlot("blinkCount", blinkCount),
+            jsonSlot("blinkDelay", blinkDelay)))), doc);
+}
+
+static std::string emitAlarm(int code)
+{
+    StaticJsonDocument<32> doc;
+    doc["alarm"] = code;
+    return compare(jsonLayout(jsonSlot("alarm", code)), doc);
+}
+
+static std::string deviceTelemetry(unsigned long uptime, uint32_t heap, int8_t rssi, unsigned long dt)
+{
+    StaticJsonDocument<128> doc;
+    doc["uptime"] = uptime;
+    doc["heap"] = heap;
+    doc["rssi"] = rssi;
+    doc["dt"] = dt;
+    return compare(jsonLayout(
+        jsonSlot("uptime", uptime),
+        jsonSlot("heap", heap),
+        jsonSlot("rssi", rssi),
+        jsonSlot("dt", dt)), doc);
+}
+
+static std::string devTel(uint32_t heap, int8_t rssi, unsigned long uptime, unsigned long dt, const char *dts)
+{
+    StaticJsonDocument<192> doc;
+    JsonObject tel = doc.createNestedObject("devTel");
+    tel["heap"] = heap;
+    tel["rssi"] = rssi;
+    tel["uptime"] = uptime;
+    tel["dt"] = dt;
+    tel["dts"] = dts;
+    return compare(jsonLayout(
+        jsonSlot("devTel", jsonLayout(
+            jsonSlot("heap", heap),
+            jsonSlot("rssi", rssi),
+            jsonSlot("uptime", uptime),
+            jsonSlot("dt", dt),
+            jsonSlot("dts", dts)))), doc);
+}
+
+template <typename T1, typename T2>
+static std::string sensors(T1 data1, T2 data2)
+{
+    StaticJsonDocument<128> doc;
+    JsonObject values = doc.createNestedObject("sensors");
+    values["data1"] = data1;
+    values["data2"] = data2;
+    return compare(jsonLayout(
+        jsonSlot("sensors", jsonLayout(
+            jsonSlot("data1", data1),
+            jsonSlot("data2", data2)))), doc);
+}
+
+static void testShapes()
+{
+    CHECK(setBuzzer(3, 250) == "{\"params\":{\"beepCount\":3,\"beepDelay\":250},\"method\":\"sBuz\"}");
+    setBuzzer(0, 0);
+    setBuzzer(-1, 65535);
+    setBuzzer(INT32_MIN, 1);
+    setBuzzer(INT32_MAX, 100);
+    CHECK(setLed(255, 0, 128, 1, -1, 50, false) ==
+        "{\"params\":{\"r\":255,\"g\":0,\"b\":128,\"isBlink\":1,\"blinkCount\":-1,\"blinkDelay\":50},\"method\":\"sLed\"}");
+    CHECK(setLed(0, 255, 0, 0, 0, 0, true) ==
+        "{\"method\":\"sLed\",\"params\":{\"r\":0,\"g\":255,\"b\":0,\"isBlink\":0,\"blinkCount\":0,\"blinkDelay\":0}}");
+    setLed(255, 255, 255, 255, INT32_MIN, 65535, false);
+    setLed(1, 2, 3, 1, INT32_MAX, 1, true);
+    CHECK(emitAlarm(110) == "{\"alarm\":110}");
+    emitAlarm(0);
+    emitAlarm(-1);
+    emitAlarm(INT_MIN);
+    emitAlarm(INT_MAX);
+    CHECK(deviceTelemetry(86400000UL, 182344, -61, 1792396800UL) == "{\"uptime\":86400000,\"heap\":182344,\"rssi\":-61,\"dt\":1792396800}");
+    deviceTelemetry(0, 0, 0, 0);
+    deviceTelemetry(UINT32_MAX, UINT32_MAX, INT8_MIN, UINT32_MAX);
+    deviceTelemetry(1, 1, INT8_MAX, 1);
+    CHECK(devTel(182344, -61, 86400, 1792396800UL, "2026-10-19 07:12:44") ==
+        "{\"devTel\":{\"heap\":182344,\"rssi\":-61,\"uptime\":86400,\"dt\":1792396800,\"dts\":\"2026-10-19 07:12:44\"}}");
+    devTel(0, INT8_MIN, 0, 0, "");
+
+    // Random values through every shape.
+    for(int i = 0; i < 20000; i++)
+    {
+        setBuzzer((int32_t)nextRandom(), (uint16_t)nextRandom());
+        setLed(nextRandom(), nextRandom(), nextRandom(), nextRandom() % 2, (int32_t)nextRandom(), nextRandom(), i % 2 == 0);
+        emitAlarm((int)nextRandom() % 1000);
+        deviceTelemetry(nextRandom(), nextRandom() % 320000, -(int8_t)(nextRandom() % 100), nextRandom());
+    }
+}
+
+static void testEscapes()
+{
+    // What ArduinoJson escapes, and what it writes as is: '/', other control characters, UTF-8.
+    CHECK(devTel(1, -1, 1, 1, "quote \" backslash \\ slash /") ==
+        "{\"devTel\":{\"heap\":1,\"rssi\":-1,\"uptime\":1,\"dt\":1,\"dts\":\"quote \\\" backslash \\\\ slash /\"}}");
+    CHECK(devTel(1, -1, 1, 1, "\b\f\n\r\t") == "{\"devTel\":{\"heap\":1,\"rssi\":-1,\"uptime\":1,\"dt\":1,\"dts\":\"\\b\\f\\n\\r\\t\"}}");
+    devTel(1, -1, 1, 1, "\x01\x1f\x7f");
+    devTel(1, -1, 1, 1, "Suhu 25\xc2\xb0" "C, kelembapan \xe2\x89\x88 80%");
+    devTel(1, -1, 1, 1, "\\\\\"\"\n\n");
+    devTel(1, -1, 1, 1, "\"");
+    // Every byte in every position of a short string.
+    char text[4] = {'a', 0, 'z', 0};
+    for(int c = 1; c < 256; c++)
+    {
+        text[1] = (char)c;
+        devTel(1, -1, 1, 1, text);
+        text[0] = (char)c;
+        devTel(1, -1, 1, 1, text);
+        text[0] = 'a';
+    }
+}
+
+static void testFloats()
+{
+    // Written by hand, they hold even where the two writers agree on a mistake.
+    CHECK(sensors(0.5, -2.25) == "{\"sensors\":{\"data1\":0.5,\"data2\":-2.25}}");
+    CHECK(sensors(1e7, 1e-5) == "{\"sensors\":{\"data1\":1e7,\"data2\":1e-5}}");
+    CHECK(sensors(9999999.0, 12345678.0) == "{\"sensors\":{\"data1\":9999999,\"data2\":1.2345678e7}}");
+    CHECK(sensors(0.0, -1e-7) == "{\"sensors\":{\"data1\":0,\"data2\":-1e-7}}");
+    CHECK(sensors(NAN, -NAN) == "{\"sensors\":{\"data1\":null,\"data2\":null}}");
+    CHECK(sensors(INFINITY, -INFINITY) == "{\"sensors\":{\"data1\":null,\"data2\":null}}");
+
+    // Both sides of the exponent thresholds, as double and as the float of the sensor queue.
+    const double edges[] = {1e-5, 0.0000123, 9.99999e-6, 1.00001e-5, 0.00001000000001, 1e-6, 1e-300, 5e-324,
+        9999999.0, 9999999.5, 9999999.999999, 10000000.5, 12345678.9, 99999999.99, 1e300, DBL_MAX,
+        3.14159, 0.1, 25.4, 1.999999999, 0.9999999995, 4294967295.0, 4294967296.0};
+    for(double edge : edges)
+    {
+        sensors(edge, -edge);
+        sensors((float)edge, -(float)edge);
+    }
+    sensors(FLT_MAX, FLT_MIN);
+    sensors(-0.0, -0.0f);
+
+    // Random values from 1e-18 to 1e18.
+    for(int i = 0; i < 100000; i++)
+    {
+        double mantissa = 1.0 + (double)(nextRandom() % 10000000) / 10000000.0;
+        double value = ldexp(mantissa, (int)(nextRandom() % 120) - 60);
+        sensors(i % 2 == 0 ? value : -value, (double)(float)value);
+        sensors((float)value, (float)(value / 3));
+    }
+}
+
+static void testOverflow()
+{
+    char buffer[128];
+    const std::string full = setLed(255, 255, 255, 1, INT32_MIN, 65535, false);
+    StaticJsonDocument<32> doc;
+    doc["alarm"] = 110;
+
+    // Fits with its terminator, refused one byte shorter where serializeJson() cuts the message.
+    for(size_t size = 1; size <= full.size() + 1; size++)
+    {
+        memset(buffer, 'x', sizeof(buffer));
+        size_t n = serializeJsonLayout(jsonLayout(
+            jsonSlot("params", jsonLayout(
+                jsonSlot("r", (uint8_t)255),
+                jsonSlot("g", (uint8_t)255),
+                jsonSlot("b", (uint8_t)255),
+                jsonSlot("isBlink", (uint8_t)1),
+                jsonSlot("blinkCount", (int32_t)INT32_MIN),
+                jsonSlot("blinkDelay", (uint16_t)65535))),
+            jsonSlot("method", "sLed")), buffer, size);
+        if(size > full.size())
+        {
+            CHECK_EQ(n, full.size());
+            CHECK(full == buffer);
+        }
+        else if(n != 0 || buffer[0] != '\0' || buffer[size] != 'x')
+        {
+            CHECK_EQ(n, 0);
+            CHECK_EQ(buffer[0], '\0');
+            CHECK_EQ(buffer[size], 'x');
+        }
+    }
+    buffer[0] = 'x';
+    CHECK_EQ(serializeJsonLayout(jsonLayout(jsonSlot("alarm", 110)), buffer, 0), 0);
+    CHECK_EQ(buffer[0], 'x');
+
+    // serializeJson() keeps what fits.
+    CHECK_EQ(serializeJson(doc, buffer, 8), 7);
+    CHECK(strcmp(buffer, "{\"alarm") == 0);
+    CHECK_EQ(serializeJsonLayout(jsonLayout(jsonSlot("alarm", 110)), buffer, 8), 0);
+    CHECK_EQ(buffer[0], '\0');
+}
+
+static void bench()
+{
+    const int rounds = 200000;
+    char buffer[128];
+    size_t bytes = 0;
+
+    uint32_t before = allocations;
+    unsigned long start = micros();
+    for(int i = 0; i < rounds; i++)
+    {
+        uint32_t heap = 180000 + i % 5000;
+        bytes += serializeJsonLayout(jsonLayout(
+            jsonSlot("devTel", jsonLayout(
+                jsonSlot("heap", heap),
+                jsonSlot("rssi", (int8_t)(-40 - i % 50)),
+                jsonSlot("uptime", (unsigned long)i),
+                jsonSlot("dt", 1792396800UL + i),
+                jsonSlot("dts", "2026-10-19 07:12:44")))), buffer, sizeof(buffer));
+        bytes += serializeJsonLayout(jsonLayout(
+            jsonSlot("sensors", jsonLayout(
+                jsonSlot("data1", 25.4f + (float)(i % 100) / 10),
+                jsonSlot("data2", 61.25f - (float)(i % 7))))), buffer, sizeof(buffer));
+    }
+    unsigned long layoutUs = micros() - start;
+    uint32_t layoutAllocations = allocations - before;
+
+    before = allocations;
+    start = micros();
+    for(int i = 0; i < rounds; i++)
+    {
+        StaticJsonDocument<192> doc;
+        JsonObject tel = doc.createNestedObject("devTel");
+        tel["heap"] = 180000 + i % 5000;
+        tel["rssi"] = (int8_t)(-40 - i % 50);
+        tel["uptime"] = (unsigned long)i;
+        tel["dt"] = 1792396800UL + i;
+        tel["dts"] = "2026-10-19 07:12:44";
+        bytes -= serializeJson(doc, buffer, sizeof(buffer));
+        doc.clear();
+        JsonObject values = doc.createNestedObject("sensors");
+        values["data1"] = 25.4f + (float)(i % 100) / 10;
+        values["data2"] = 61.25f - (float)(i % 7);
+        bytes -= serializeJson(doc, buffer, sizeof(buffer));
+    }
+    unsigned long documentUs = micros() - start;
+    uint32_t documentAllocations = allocations - before;
+
+    printf("devTel + sensors: serializeJsonLayout %.3f us, %u allocations; StaticJsonDocument + serializeJson %.3f us, %u allocations per pair\n",
+        (double)layoutUs / rounds, layoutAllocations / rounds, (double)documentUs / rounds, documentAllocations / rounds);
+    // Same bytes out of both.
+    CHECK_EQ(bytes, 0);
+    CHECK_EQ(layoutAllocations, 0);
+}
+
+int main()
+{
+    testShapes();
+    testEscapes();
+    testFloats();
+    testOverflow();
+    printf("%u messages compared, %u differ\n", compared, mismatches);
+    CHECK_EQ(mismatches, 0);
+    bench();
+    return hostTestResult();
+}
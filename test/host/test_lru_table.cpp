@@ -0,0 +1,274 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// LruTable fuzzed against a std::map with a std::list for the use order, then sized like the
+// WebSocket client and login attempt tables through thousands of simulated connections, many of
+// them never closed cleanly: contents, eviction order, lookup cost and no heap allocations.
+
+#include "hostTest.h"
+#include "lruTable.h"
+#include <list>
+#include <map>
+#include <new>
+#include <random>
+
+static uint32_t allocations = 0;
+
+// Counts every allocation of the binary. Not inlined, so the compiler does not pair malloc with delete.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+/// @brief IPAddress as the table sees it: compared with ==, hashed through its uint32_t conversion.
+struct IPAddress
+{
+    uint32_t addr = 0;
+    IPAddress() {}
+    explicit IPAddress(uint32_t a) : addr(a) {}
+    operator uint32_t() const { return addr; }
+    bool operator==(const IPAddress &other) const { return addr == other.addr; }
+};
+
+/// @brief What LruTable should behave like, built from the standard containers.
+template <typename K, typename V, uint16_t N>
+class ReferenceLru
+{
+    public:
+        V *find(const K &key)
+        {
+            auto it = _values.find(key);
+            if(it == _values.end())
+            {
+                return nullptr;
+            }
+            _order.remove(key);
+            _order.push_front(key);
+            return &it->second;
+        }
+        V &put(const K &key, const V &value)
+        {
+            V *current = find(key);
+            if(current != nullptr)
+            {
+                *current = value;
+                return *current;
+            }
+            if(_values.size() == N)
+            {
+                _values.erase(_order.back());
+                _order.pop_back();
+                evictions++;
+            }
+            _order.push_front(key);
+            return _values[key] = value;
+        }
+        bool erase(const K &key)
+        {
+            _order.remove(key);
+            return _values.erase(key) > 0;
+        }
+        bool contains(const K &key) const { return _values.count(key) > 0; }
+        size_t size() const { return _values.size(); }
+        const std::map<K, V> &values() const { return _values; }
+
+        uint32_t evictions = 0;
+
+    private:
+        std::map<K, V> _values;
+        std::list<K> _order;
+};
+
+/// @brief Same size, same entries with the same values.
+template <typename K, typename V, uint16_t N>
+static bool same(LruTable<K, V, N> &table, const ReferenceLru<K, V, N> &reference)
+{
+    if(table.size() != reference.size())
+    {
+        return false;
+    }
+    size_t visited = 0;
+    for(auto &entry : table)
+    {
+        auto it = reference.values().find(entry.key);
+        if(it == reference.values().end() || !(it->second == entry.value))
+        {
+            return false;
+        }
+        visited++;
+    }
+    return visited == reference.size();
+}
+
+static void testFuzz()
+{
+    // Few keys keep the table busy with hits and evictions, many keys with misses and long probe runs.
+    const uint32_t keyRanges[] = { 24, 64, 100000 };
+    for(uint32_t range : keyRanges)
+    {
+        LruTable<uint32_t, uint32_t, 16> *table = new LruTable<uint32_t, uint32_t, 16>();
+        ReferenceLru<uint32_t, uint32_t, 16> reference;
+        std::mt19937 rng(range);
+        uint32_t mismatches = 0;
+        for(int step = 0; step < 200000; step++)
+        {
+            uint32_t key = rng() % range;
+            switch(rng() % 5)
+            {
+                case 0:
+                case 1:
+                    table->put(key, step);
+                    reference.put(key, step);
+                    break;
+                case 2:
+                {
+                    uint32_t *value = table->find(key);
+                    uint32_t *expected = reference.find(key);
+                    mismatches += (value == nullptr) != (expected == nullptr) || (value != nullptr && *value != *expected);
+                    break;
+                }
+                case 3:
+                    mismatches += table->erase(key) != reference.erase(key);
+                    break;
+                case 4:
+                    mismatches += table->contains(key) != reference.contains(key);
+                    // operator[] inserts a value initialized entry like std::map.
+                    if(rng() % 4 == 0)
+                    {
+                        (*table)[key]++;
+                        uint32_t *expected = reference.find(key);
+                        if(expected != nullptr)
+                        {
+                            (*expected)++;
+                        }
+                        else
+                        {
+                            reference.put(key, 1);
+                        }
+                    }
+                    break;
+            }
+            if(step % 64 == 0 && !same(*table, reference))
+            {
+                mismatches++;
+            }
+        }
+        printf("fuzz, %6u keys: %u evictions, %u mismatches against the reference\n", range, table->evictions(), mismatches);
+        CHECK_EQ(mismatches, 0);
+        CHECK(same(*table, reference));
+        CHECK_EQ(table->evictions(), reference.evictions);
+        delete table;
+    }
+}
+
+static void testEvictionOrder()
+{
+    LruTable<uint32_t, bool, 4> table;
+    for(uint32_t id = 1; id <= 4; id++)
+    {
+        table.put(id, true);
+    }
+    // Lookups move an entry to the front, iterating and contains() do not.
+    table.find(1);
+    CHECK(table.contains(2));
+    for(auto &entry : table)
+    {
+        (void)entry;
+    }
+    table.put(5, true);
+    CHECK(!table.contains(2));
+    CHECK(table.contains(1));
+    table.erase(3);
+    table.put(6, true);
+    CHECK_EQ(table.evictions(), 1);
+    table.put(7, true);
+    CHECK(!table.contains(4));
+    CHECK_EQ(table.size(), 4);
+}
+
+static void benchConnections()
+{
+    // WS_CLIENT_TABLE_SIZE and WS_IP_TABLE_SIZE as built by default.
+    static LruTable<uint32_t, bool, 16> clientAuthenticationStatus;
+    static LruTable<IPAddress, unsigned long, 32> clientAuthAttemptTimestamps;
+    std::mt19937 rng(1);
+    std::vector<uint32_t> open;
+    open.reserve(1024);
+    uint32_t nextId = 1;
+    uint32_t lost = 0;
+    uint32_t unknown = 0;
+    const int connections = 50000;
+    uint32_t before = allocations;
+    unsigned long start = micros();
+    for(int c = 0; c < connections; c++)
+    {
+        // A dashboard connects from one of a few thousand addresses and tries to log in.
+        uint32_t id = nextId++;
+        IPAddress ip(0xC0A80000 | (rng() % 4000));
+        unsigned long &last = clientAuthAttemptTimestamps[ip];
+        last = (unsigned long)c;
+        clientAuthenticationStatus[id] = rng() % 4 != 0;
+        open.push_back(id);
+
+        // Traffic on an open connection.
+        uint32_t active = open[rng() % open.size()];
+        unknown += clientAuthenticationStatus.find(active) == nullptr;
+
+        // Most connections close cleanly, a third just vanish.
+        if(open.size() > 8)
+        {
+            size_t k = rng() % open.size();
+            if(rng() % 3 != 0)
+            {
+                clientAuthenticationStatus.erase(open[k]);
+            }
+            else
+            {
+                lost++;
+            }
+            open[k] = open.back();
+            open.pop_back();
+        }
+    }
+    unsigned long elapsed = micros() - start;
+    uint32_t counted = allocations - before;
+    printf("%d connections (%u never closed, %u open ones evicted): %u client and %u address entries, %u and %u evicted, "
+        "%u heap allocations, %u bytes fixed, %.3f us per connection\n",
+        connections, lost, unknown, clientAuthenticationStatus.size(), clientAuthAttemptTimestamps.size(),
+        clientAuthenticationStatus.evictions(), clientAuthAttemptTimestamps.evictions(), counted,
+        (unsigned)(sizeof(clientAuthenticationStatus) + sizeof(clientAuthAttemptTimestamps)), (double)elapsed / connections);
+    CHECK_EQ(counted, 0);
+    CHECK(clientAuthenticationStatus.size() <= clientAuthenticationStatus.capacity());
+    CHECK_EQ(clientAuthAttemptTimestamps.size(), clientAuthAttemptTimestamps.capacity());
+    // Connections that vanished were evicted instead of piling up.
+    CHECK(clientAuthenticationStatus.evictions() > 0);
+}
+
+int main()
+{
+    testFuzz();
+    testEvictionOrder();
+    benchConnections();
+    return hostTestResult();
+}
@@ -0,0 +1,214 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// OfflineStore through a simulated day long outage on an in-memory file system: replay order and
+// timestamps, a reboot halfway through the replay, records too large to publish, a record the
+// broker keeps refusing, RAM only operation and a full partition.
+
+#include "hostTest.h"
+#include "offlineStore.h"
+
+// TB_PAYLOAD_MAX(TB_ATTRIBUTE_TOPIC) with the default DOCSIZE_MIN of 384.
+static const size_t MAX_PAYLOAD = 384 - 5 - 2 - 24;
+
+static size_t telemetry(char *buffer, size_t size, int minute)
+{
+    return snprintf(buffer, size, "{\"temp\":%d.5,\"hum\":%d,\"seq\":%d,\"pad\":\"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"}",
+        minute % 40, minute % 100, minute);
+}
+
+static int seqOf(const char *record)
+{
+    const char *at = strstr(record, "\"seq\":");
+    return at != nullptr ? atoi(at + 6) : -1;
+}
+
+static void testOutage()
+{
+    FS flash;
+    OfflineStore *store = new OfflineStore();
+    CHECK(store->begin(flash, OFFLINE_STORE_DIR, MAX_PAYLOAD));
+    const uint64_t ts0 = 1700000000000ULL;
+    char buffer[OFFLINE_STORE_RECORD_SIZE];
+    const int minutes = 24 * 60;
+    for(int m = 0; m < minutes; m++)
+    {
+        telemetry(buffer, sizeof(buffer), m);
+        CHECK(store->append(OFFLINE_RECORD_TELEMETRY, buffer, ts0 + m * 60000ULL));
+        if(m % 10 == 0)
+        {
+            snprintf(buffer, sizeof(buffer), "{\"state\":%d}", m);
+            CHECK(store->append(OFFLINE_RECORD_ATTRIBUTE, buffer));
+        }
+    }
+    const OfflineStoreStats &stats = store->stats();
+    printf("outage: %u records, %u bytes on flash in %u writes, %u bytes in RAM, pressure %u%%, %u segments evicted\n",
+        stats.stored, (unsigned)store->diskBytes(), flash.files().writes, (unsigned)store->ramBytes(), store->pressure(), stats.evictedSegments);
+    // Flash sees one write per RAM buffer, not one per record.
+    CHECK(flash.files().writes * 20 < stats.stored);
+
+    // Replay some, then reboot without a clean shutdown.
+    char type = 0;
+    int replayed = 0;
+    int last = -1;
+    for(int i = 0; i < 100; i++)
+    {
+        CHECK(store->peek(type, buffer, sizeof(buffer)) > 0);
+        if(type == OFFLINE_RECORD_TELEMETRY)
+        {
+            last = seqOf(buffer);
+        }
+        store->pop();
+        replayed++;
+    }
+    store->sync();
+    delete store;
+    store = new OfflineStore();
+    CHECK(store->begin(flash, OFFLINE_STORE_DIR, MAX_PAYLOAD));
+
+    int first = -1;
+    int duplicates = 0;
+    bool ordered = true;
+    bool stamped = true;
+    while(store->peek(type, buffer, sizeof(buffer)) > 0)
+    {
+        if(type == OFFLINE_RECORD_TELEMETRY)
+        {
+            int seq = seqOf(buffer);
+            if(first < 0)
+            {
+                first = seq;
+                duplicates = last - seq + 1;
+            }
+            else
+            {
+                ordered &= seq > last;
+            }
+            last = seq;
+            stamped &= strncmp(buffer, "{\"ts\":", 6) == 0;
+        }
+        store->pop();
+        replayed++;
+    }
+    printf("reboot mid replay: resumed at seq %d, %d duplicates, last seq %d, %d records replayed\n", first, duplicates, last, replayed);
+    CHECK(ordered);
+    CHECK(stamped);
+    CHECK(duplicates >= 0 && duplicates <= OFFLINE_STORE_CURSOR_EVERY);
+    CHECK_EQ(last, minutes - 1);
+    CHECK(store->empty());
+    delete store;
+}
+
+static void testOversize()
+{
+    FS flash;
+    OfflineStore store;
+    store.begin(flash, OFFLINE_STORE_DIR, MAX_PAYLOAD);
+    std::string payload = "{\"blob\":\"" + std::string(MAX_PAYLOAD - 11, 'x') + "\"}";
+    CHECK_EQ(payload.size(), MAX_PAYLOAD);
+    CHECK(store.append(OFFLINE_RECORD_ATTRIBUTE, payload.c_str()));
+    // Fits on its own, but not once it is stamped with its time.
+    CHECK(!store.append(OFFLINE_RECORD_TELEMETRY, payload.c_str(), 1700000000000ULL));
+    payload.insert(9, "x");
+    CHECK(!store.append(OFFLINE_RECORD_ATTRIBUTE, payload.c_str()));
+    CHECK_EQ(store.stats().stored, 1);
+    CHECK_EQ(store.stats().dropped, 2);
+}
+
+static void testRefusedRecord()
+{
+    // The publisher refuses one record every time; it must not hold up the ones behind it.
+    FS flash;
+    OfflineStore store;
+    store.begin(flash, OFFLINE_STORE_DIR, MAX_PAYLOAD);
+    char buffer[OFFLINE_STORE_RECORD_SIZE];
+    for(int i = 0; i < 10; i++)
+    {
+        snprintf(buffer, sizeof(buffer), i == 3 ? "{\"poison\":%d}" : "{\"i\":%d}", i);
+        store.append(OFFLINE_RECORD_ATTRIBUTE, buffer);
+    }
+    char type = 0;
+    int published = 0;
+    int attempts = 0;
+    while(store.peek(type, buffer, sizeof(buffer)) > 0 && attempts < 100)
+    {
+        attempts++;
+        if(strstr(buffer, "poison") != nullptr)
+        {
+            store.fail();
+            continue;
+        }
+        store.pop();
+        published++;
+    }
+    printf("refused record: %d published, %u dropped after %d attempts in total\n", published, store.stats().dropped, attempts);
+    CHECK(store.empty());
+    CHECK_EQ(published, 9);
+    CHECK_EQ(store.stats().dropped, 1);
+    CHECK_EQ(attempts, 9 + OFFLINE_STORE_MAX_ATTEMPTS);
+    CHECK_EQ(store.stats().replayed, 9);
+}
+
+static void testRamOnly()
+{
+    OfflineStore store;
+    char buffer[64];
+    for(int i = 0; i < 1000; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "{\"i\":%d}", i);
+        store.append(OFFLINE_RECORD_TELEMETRY, buffer);
+    }
+    char type = 0;
+    CHECK(store.peek(type, buffer, sizeof(buffer)) > 0);
+    printf("RAM only: oldest kept %s, %u evicted, pressure %u%%\n", buffer, store.stats().evictedRamRecords, store.pressure());
+    CHECK(store.stats().evictedRamRecords > 0);
+    // The newest records survive.
+    int last = -1;
+    while(store.peek(type, buffer, sizeof(buffer)) > 0)
+    {
+        last = atoi(buffer + 5);
+        store.pop();
+    }
+    CHECK_EQ(last, 999);
+}
+
+static void testFullPartition()
+{
+    FS flash;
+    flash.files().capacity = 9000;
+    OfflineStore store;
+    store.begin(flash, OFFLINE_STORE_DIR, MAX_PAYLOAD);
+    char buffer[64];
+    for(int i = 0; i < 2000; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "{\"i\":%d,\"p\":\"yyyyyyyyyyyyyyyyyyyy\"}", i);
+        store.append(OFFLINE_RECORD_TELEMETRY, buffer);
+    }
+    char type = 0;
+    CHECK(store.peek(type, buffer, sizeof(buffer)) > 0);
+    printf("full partition: oldest kept %s, %u bytes on flash, %u bytes evicted\n", buffer, (unsigned)store.diskBytes(), (unsigned)store.stats().evictedBytes);
+    CHECK(flash.files().used() <= 9000);
+    CHECK(store.stats().evictedBytes > 0);
+    int last = -1;
+    while(store.peek(type, buffer, sizeof(buffer)) > 0)
+    {
+        last = atoi(buffer + 5);
+        store.pop();
+    }
+    CHECK_EQ(last, 1999);
+}
+
+int main()
+{
+    testOutage();
+    testOversize();
+    testRefusedRecord();
+    testRamOnly();
+    testFullPartition();
+    return hostTestResult();
+}
@@ -0,0 +1,348 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// PayloadCodec on payloads captured from the library code that publishes them: device telemetry,
+// stamped and batched telemetry, attribute sync messages and RPC replies. Checks the MessagePack is
+// well formed and carries every key, the JSON fallbacks, and prints the compression ratio and the
+// encode time per payload class.
+
+#include "hostTest.h"
+#include "payloadCodec.h"
+#include "telemetryBatcher.h"
+#include "attributeShadow.h"
+#include "jsonLayout.h"
+#include <string>
+#include <vector>
+
+using namespace libudawa;
+
+static const size_t DOCSIZE_MIN = 384;
+#define MSGPACK_TELEMETRY_TOPIC "v1/devices/me/telemetry/msgpack"
+// TB_PAYLOAD_MAX(TB_MSGPACK_TELEMETRY_TOPIC) with the default DOCSIZE_MIN.
+static const size_t MAX_PACKED = DOCSIZE_MIN - 5 - 2 - (sizeof(MSGPACK_TELEMETRY_TOPIC) - 1);
+
+struct PayloadClass
+{
+    const char *name;
+    std::vector<std::string> payloads;
+};
+
+static std::vector<std::string> *capture = nullptr;
+
+static bool captureTelemetry(const char *payload)
+{
+    capture->push_back(payload);
+    return true;
+}
+
+static uint32_t captureAttribute(const char *payload)
+{
+    capture->push_back(payload);
+    return (uint32_t)capture->size();
+}
+
+/// @brief deviceTelemetry() of the Vanilla sketch over a day at one message a minute.
+static PayloadClass deviceTelemetry()
+{
+    PayloadClass c = {"device telemetry", {}};
+    char buffer[128];
+    for(uint32_t i = 0; i < 1440; i++)
+    {
+        unsigned long uptime = 60000UL * i + (i * 7919) % 1000;
+        uint32_t heap = 182000 - (i * 37) % 9000;
+        int rssi = -48 - (int)((i * 13) % 31);
+        unsigned long epoch = 1792396800UL + i * 60;
+        serializeJsonLayout(jsonLayout(
+            jsonSlot("uptime", uptime),
+            jsonSlot("heap", heap),
+            jsonSlot("rssi", rssi),
+            jsonSlot("dt", epoch)), buffer, sizeof(buffer));
+        c.payloads.push_back(buffer);
+    }
+    return c;
+}
+
+/// @brief Single sensor readings as tbSendPayload() stamps them with the time they were taken.
+static PayloadClass stampedTelemetry()
+{
+    PayloadClass c = {"stamped telemetry", {}};
+    char values[160];
+    char buffer[256];
+    for(uint32_t i = 0; i < 1440; i++)
+    {
+        serializeJsonLayout(jsonLayout(
+            jsonSlot("temp", 24.0f + (float)((i * 17) % 80) / 10.0f),
+            jsonSlot("hum", 55.0f + (float)((i * 23) % 300) / 10.0f),
+            jsonSlot("soil", (int)(410 + (i * 31) % 200)),
+            jsonSlot("lux", (uint32_t)(i % 720 < 360 ? 18000 + i * 11 % 5000 : 0)),
+            jsonSlot("pump", i % 15 == 0)), values, sizeof(values));
+        snprintf(buffer, sizeof(buffer), "{\"ts\":%llu,\"values\":%s}", 1792396800000ULL + i * 60000ULL, values);
+        c.payloads.push_back(buffer);
+    }
+    return c;
+}
+
+/// @brief Batches TelemetryBatcher builds in the default TELEMETRY_BATCH_SIZE buffer.
+static PayloadClass batchedTelemetry()
+{
+    PayloadClass c = {"batched telemetry", {}};
+    capture = &c.payloads;
+    char buffer[DOCSIZE_MIN - 5 - 2 - 23 + 1];
+    TelemetryBatcher batcher(captureTelemetry, buffer, sizeof(buffer));
+    for(uint32_t i = 0; i < 1440; i++)
+    {
+        uint64_t ts = 1792396800000ULL + i * 10000ULL;
+        batcher.add("temp", 24.0f + (float)((i * 17) % 80) / 10.0f, ts);
+        batcher.add("hum", 55.0f + (float)((i * 23) % 300) / 10.0f, ts);
+        batcher.add("soil", (int)(410 + (i * 31) % 200), ts);
+    }
+    batcher.flush();
+    capture = nullptr;
+    return c;
+}
+
+/// @brief The messages a full attribute sync packs the syncClientAttr() groups into.
+static PayloadClass attributeSync()
+{
+    PayloadClass c = {"attribute sync", {}};
+    capture = &c.payloads;
+    AttributeShadow *shadow = new AttributeShadow(captureAttribute, DOCSIZE_MIN - 5 - 2 - 24);
+    for(int round = 0; round < 20; round++)
+    {
+        StaticJsonDocument<DOCSIZE_MIN> doc;
+        shadow->begin(true);
+        doc["ipad"] = round % 2 ? "192.168.1.57" : "10.21.4.112";
+        doc["compdate"] = "Oct 19 2026 07:12:44";
+        doc["fmTitle"] = "Vanilla";
+        doc["fmVersion"] = "0.0.1";
+        doc["stamac"] = "24:0A:C4:12:9F:3C";
+        doc["apmac"] = "24:0A:C4:12:9F:3D";
+        shadow->add(doc.as<JsonObjectConst>());
+        doc.clear();
+        doc["flFree"] = 1310720 - round * 4096;
+        doc["fwSize"] = 1185232;
+        doc["flSize"] = 4194304;
+        doc["dSize"] = 1378241;
+        doc["dUsed"] = 184320 + round * 512;
+        doc["sdkVer"] = "v4.4.4";
+        doc["model"] = "Vanilla";
+        doc["name"] = "Greenhouse North Bed 2";
+        doc["group"] = "PRITA";
+        doc["broker"] = "prita.undiknas.ac.id";
+        doc["port"] = 1883;
+        shadow->add(doc.as<JsonObjectConst>());
+        doc.clear();
+        doc["logLev"] = 3;
+        doc["gmtOff"] = 28800;
+        doc["bFr"] = 600;
+        doc["fP"] = 0;
+        doc["fB"] = 1;
+        doc["fIoT"] = 1;
+        doc["fWOTA"] = 1;
+        doc["fIface"] = 1;
+        doc["hname"] = "vanilla-9f3c";
+        doc["logIP"] = "192.168.1.10";
+        doc["logPrt"] = 29514;
+        doc["pBz"] = 32;
+        doc["pLR"] = 25;
+        doc["pLG"] = 26;
+        doc["pLB"] = 27;
+        doc["htU"] = 0;
+        doc["lON"] = 1;
+        doc["pEnc"] = 1;
+        shadow->add(doc.as<JsonObjectConst>());
+        shadow->end();
+    }
+    delete shadow;
+    capture = nullptr;
+    return c;
+}
+
+/// @brief Replies rpcWorkerTR() publishes for async handlers.
+static PayloadClass rpcReplies()
+{
+    PayloadClass c = {"RPC replies", {}};
+    static const char *methods[] = {"setRelay", "sBuz", "getSensors", "calibrate"};
+    for(uint32_t i = 0; i < 500; i++)
+    {
+        StaticJsonDocument<DOCSIZE_MIN> doc;
+        JsonObject reply = doc.createNestedObject("rpcRes");
+        reply["cmd"] = methods[i % 4];
+        reply["rid"] = (int)(100 + i);
+        reply["status"] = i % 9 == 0 ? "busy" : "ok";
+        if(i % 4 == 2)
+        {
+            reply["temp"] = 24.5f + (float)(i % 10) / 10.0f;
+            reply["hum"] = 61;
+        }
+        char buffer[DOCSIZE_MIN];
+        serializeJson(doc, buffer, sizeof(buffer));
+        c.payloads.push_back(buffer);
+    }
+    return c;
+}
+
+/// @brief Walks one MessagePack value, counting map keys. False when it is malformed.
+static bool walk(const uint8_t *&p, const uint8_t *end, size_t &keys)
+{
+    if(p >= end)
+    {
+        return false;
+    }
+    uint8_t b = *p++;
+    size_t skip = 0;
+    size_t items = 0;
+    bool map = false;
+    if(b <= 0x7f || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3)
+    {
+        return true;
+    }
+    if((b & 0xe0) == 0xa0)
+    {
+        skip = b & 0x1f;
+    }
+    else if((b & 0xf0) == 0x80 || (b & 0xf0) == 0x90)
+    {
+        items = b & 0x0f;
+        map = (b & 0xf0) == 0x80;
+    }
+    else
+    {
+        switch(b)
+        {
+            case 0xcc: case 0xd0: skip = 1; break;
+            case 0xcd: case 0xd1: skip = 2; break;
+            case 0xce: case 0xd2: case 0xca: skip = 4; break;
+            case 0xcf: case 0xd3: case 0xcb: skip = 8; break;
+            case 0xd9: if(end - p < 1) return false; skip = p[0]; p += 1; break;
+            case 0xda: if(end - p < 2) return false; skip = (p[0] << 8) | p[1]; p += 2; break;
+            case 0xdc: case 0xde:
+                if(end - p < 2) return false;
+                items = (p[0] << 8) | p[1];
+                map = b == 0xde;
+                p += 2;
+                break;
+            default: return false;
+        }
+    }
+    if((size_t)(end - p) < skip)
+    {
+        return false;
+    }
+    p += skip;
+    for(size_t i = 0; i < items * (map ? 2 : 1); i++)
+    {
+        if(!walk(p, end, keys))
+        {
+            return false;
+        }
+    }
+    keys += map ? items : 0;
+    return true;
+}
+
+/// @brief Keys in a JSON message, for comparison with the map keys of its MessagePack.
+static size_t jsonKeys(const std::string &json)
+{
+    // Every key is a string directly followed by a colon.
+    size_t keys = 0;
+    bool inString = false;
+    for(size_t i = 0; i < json.size(); i++)
+    {
+        if(json[i] == '\\')
+        {
+            i++;
+            continue;
+        }
+        if(json[i] == '"')
+        {
+            inString = !inString;
+            if(!inString && i + 1 < json.size() && json[i + 1] == ':')
+            {
+                keys++;
+            }
+        }
+    }
+    return keys;
+}
+
+static void bench(const PayloadClass &c, uint64_t &jsonTotal, uint64_t &packedTotal)
+{
+    PayloadCodec *codec = new PayloadCodec();
+    LatencySamples samples;
+    uint8_t packed[MAX_PACKED];
+    uint64_t jsonBytes = 0;
+    uint64_t packedBytes = 0;
+    size_t sent = 0;
+    bool wellFormed = true;
+    for(const std::string &json : c.payloads)
+    {
+        size_t length = 0;
+        // Repeated so the clock sees more than its resolution.
+        const int reps = 20;
+        unsigned long start = micros();
+        for(int r = 0; r < reps; r++)
+        {
+            length = codec->encodeMsgPack(json.c_str(), packed, sizeof(packed));
+        }
+        samples.add((micros() - start) * 1000 / reps);
+        jsonBytes += json.size();
+        if(length == 0)
+        {
+            packedBytes += json.size();
+            continue;
+        }
+        sent++;
+        packedBytes += length;
+        const uint8_t *p = packed;
+        size_t keys = 0;
+        wellFormed &= walk(p, packed + length, keys) && p == packed + length && keys == jsonKeys(json);
+    }
+    printf("%-18s %5u %7.1f %7.1f %6.1f%% %9.2f %9.2f %5u\n", c.name, (unsigned)c.payloads.size(),
+        (double)jsonBytes / c.payloads.size(), (double)packedBytes / c.payloads.size(),
+        100.0 * packedBytes / jsonBytes, samples.percentile(50) / 1000.0, samples.percentile(99) / 1000.0,
+        (unsigned)(c.payloads.size() - sent));
+    CHECK(wellFormed);
+    CHECK(packedBytes < jsonBytes);
+    CHECK_EQ(codec->stats().failed, 0);
+    jsonTotal += jsonBytes;
+    packedTotal += packedBytes;
+    delete codec;
+}
+
+static void testFallbacks()
+{
+    PayloadCodec *codec = new PayloadCodec();
+    uint8_t packed[MAX_PACKED];
+    // Not JSON: sent as is.
+    CHECK_EQ(codec->encodeMsgPack("{\"temp\":", packed, sizeof(packed)), 0);
+    CHECK_EQ(codec->stats().failed, 1);
+    // Does not fit the room left for the MessagePack topic.
+    std::string large = "{\"log\":\"" + std::string(MAX_PACKED + 10, 'x') + "\"}";
+    CHECK_EQ(codec->encodeMsgPack(large.c_str(), packed, sizeof(packed)), 0);
+    CHECK_EQ(codec->stats().skipped, 1);
+    CHECK(codec->encodeMsgPack("{\"alarm\":151}", packed, sizeof(packed)) > 0);
+    CHECK_EQ(codec->stats().encoded, 1);
+    delete codec;
+}
+
+int main()
+{
+    testFallbacks();
+    printf("%-18s %5s %7s %7s %7s %9s %9s %5s\n", "payloads", "count", "JSON B", "MsgPack", "ratio", "p50 us", "p99 us", "JSON");
+    uint64_t jsonTotal = 0;
+    uint64_t packedTotal = 0;
+    bench(deviceTelemetry(), jsonTotal, packedTotal);
+    bench(stampedTelemetry(), jsonTotal, packedTotal);
+    bench(batchedTelemetry(), jsonTotal, packedTotal);
+    bench(attributeSync(), jsonTotal, packedTotal);
+    bench(rpcReplies(), jsonTotal, packedTotal);
+    printf("total: %llu JSON bytes, %llu on the wire with MessagePack (%.1f%%)\n",
+        (unsigned long long)jsonTotal, (unsigned long long)packedTotal, 100.0 * packedTotal / jsonTotal);
+    return hostTestResult();
+}
@@ -0,0 +1,245 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// SampleBatcher frames read back with the decoder of data/ui/sampleStream.js ported line by line:
+// the byte layout of a known frame, size, timestamp and age flushes, rejected samples, a refused
+// frame, and frames and bytes for a minute of 4 channels at 10 and 50 Hz against a JSON text frame
+// per sample.
+
+#include "hostTest.h"
+#include "sampleBatcher.h"
+#include <string>
+#include <vector>
+
+struct Sample
+{
+    uint64_t ts;
+    uint8_t channel;
+    std::vector<float> values;
+};
+
+static uint16_t getU16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t getU32(const uint8_t *p) { return getU16(p) | ((uint32_t)getU16(p + 2) << 16); }
+
+/// @brief decodeSampleFrame() of sampleStream.js, false for a version it does not know.
+static bool decodeSampleFrame(const uint8_t *frame, size_t length, std::vector<Sample> &samples)
+{
+    if(length < 10 || frame[0] != 1)
+    {
+        return false;
+    }
+    uint8_t records = frame[1];
+    uint64_t baseTs = getU32(frame + 2) + (uint64_t)getU32(frame + 6) * 4294967296ULL;
+    size_t offset = 10;
+    for(uint8_t r = 0; r < records && offset + 4 <= length; r++)
+    {
+        Sample sample;
+        sample.ts = baseTs + getU16(frame + offset);
+        sample.channel = frame[offset + 2];
+        uint8_t count = frame[offset + 3];
+        offset += 4;
+        if(offset + count * 4 > length)
+        {
+            break;
+        }
+        for(uint8_t i = 0; i < count; i++)
+        {
+            uint32_t bits = getU32(frame + offset);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            sample.values.push_back(value);
+            offset += 4;
+        }
+        samples.push_back(sample);
+    }
+    return true;
+}
+
+/// @brief The WebSocket side: every frame published, decoded.
+struct FakeStream
+{
+    bool refuse = false;
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<Sample> samples;
+    bool decoded = true;
+};
+
+static FakeStream stream;
+
+static bool publish(const uint8_t *frame, size_t length)
+{
+    if(stream.refuse)
+    {
+        return false;
+    }
+    stream.frames.push_back(std::vector<uint8_t>(frame, frame + length));
+    stream.decoded &= decodeSampleFrame(frame, length, stream.samples);
+    return true;
+}
+
+static void testLayout()
+{
+    stream = FakeStream();
+    SampleBatcher batcher(publish);
+    const float values[] = { 1.5f, -2.0f };
+    const float one[] = { 0.25f };
+    CHECK(batcher.add(3, values, 2, 1700000000000ULL));
+    CHECK(batcher.add(7, one, 1, 1700000000020ULL));
+    CHECK(batcher.flush());
+    CHECK(!batcher.flush());
+    const uint8_t expected[] = {
+        0x01, 0x02,                                     // version, records
+        0x00, 0x68, 0xe5, 0xcf, 0x8b, 0x01, 0x00, 0x00, // baseTs 1700000000000
+        0x00, 0x00, 0x03, 0x02,                         // offset 0, channel 3, 2 values
+        0x00, 0x00, 0xc0, 0x3f, 0x00, 0x00, 0x00, 0xc0, // 1.5, -2.0
+        0x14, 0x00, 0x07, 0x01,                         // offset 20, channel 7, 1 value
+        0x00, 0x00, 0x80, 0x3e,                         // 0.25
+    };
+    CHECK_EQ(stream.frames.size(), 1);
+    CHECK_EQ(stream.frames[0].size(), sizeof(expected));
+    CHECK(memcmp(stream.frames[0].data(), expected, sizeof(expected)) == 0);
+    CHECK(stream.decoded);
+    CHECK_EQ(stream.samples.size(), 2);
+    CHECK_EQ(stream.samples[1].ts, 1700000000020ULL);
+    CHECK_EQ(stream.samples[1].channel, 7);
+    CHECK(stream.samples[0].values[1] == -2.0f);
+
+    // A decoder for another version leaves the frame alone.
+    std::vector<Sample> samples;
+    uint8_t future[sizeof(expected)];
+    memcpy(future, expected, sizeof(expected));
+    future[0] = SAMPLE_FRAME_VERSION + 1;
+    CHECK(!decodeSampleFrame(future, sizeof(future), samples));
+}
+
+static void testFlushes()
+{
+    stream = FakeStream();
+    SampleBatcher batcher(publish);
+    float values[SAMPLE_MAX_VALUES];
+    for(uint8_t i = 0; i < SAMPLE_MAX_VALUES; i++)
+    {
+        values[i] = i * 0.5f;
+    }
+    const uint64_t ts0 = 1700000000000ULL;
+    // Full frames: nothing goes past SAMPLE_FRAME_SIZE.
+    int added = 0;
+    for(; added < 40; added++)
+    {
+        batcher.add(1, values, SAMPLE_MAX_VALUES, ts0 + added);
+    }
+    CHECK(batcher.stats().sizeFlushes > 0);
+    for(const std::vector<uint8_t> &frame : stream.frames)
+    {
+        CHECK(frame.size() <= SAMPLE_FRAME_SIZE);
+        CHECK(frame.size() + SAMPLE_RECORD_HEADER + SAMPLE_MAX_VALUES * 4 > SAMPLE_FRAME_SIZE);
+    }
+
+    // Offsets are 16 bit: a sample more than 65535 ms on, or one that goes back, starts a new frame.
+    batcher.flush();
+    size_t frames = stream.frames.size();
+    batcher.add(2, values, 1, ts0);
+    batcher.add(2, values, 1, ts0 + 65535);
+    CHECK_EQ(stream.frames.size(), frames);
+    batcher.add(2, values, 1, ts0 + 65536);
+    CHECK_EQ(stream.frames.size(), frames + 1);
+    batcher.add(2, values, 1, ts0 + 1000);
+    CHECK_EQ(stream.frames.size(), frames + 2);
+    batcher.flush();
+    CHECK_EQ(stream.samples.back().ts, ts0 + 1000);
+    CHECK_EQ(stream.samples[stream.samples.size() - 3].ts, ts0 + 65535);
+
+    // Age: poll() hands the frame over once its first sample waited maxAgeMs.
+    frames = stream.frames.size();
+    batcher.add(3, values, 2, ts0);
+    CHECK(!batcher.poll());
+    hostAdvanceMillis(SAMPLE_FRAME_MAX_AGE);
+    CHECK(batcher.poll());
+    CHECK_EQ(stream.frames.size(), frames + 1);
+    CHECK_EQ(batcher.stats().ageFlushes, 1);
+
+    CHECK(stream.decoded);
+    CHECK_EQ(stream.samples.size(), batcher.stats().samplesAdded);
+    CHECK_EQ(batcher.stats().samplesDropped, 0);
+}
+
+static void testRejected()
+{
+    stream = FakeStream();
+    SampleBatcher batcher(publish);
+    float values[SAMPLE_MAX_VALUES + 1] = {};
+    CHECK(!batcher.add(1, values, 0, 1));
+    CHECK(!batcher.add(1, values, SAMPLE_MAX_VALUES + 1, 1));
+    CHECK(!batcher.add(1, nullptr, 1, 1));
+    CHECK_EQ(batcher.stats().samplesDropped, 3);
+    CHECK(batcher.empty());
+
+    // A refused frame is counted and dropped, the next one starts clean.
+    batcher.add(1, values, 4, 1);
+    batcher.add(1, values, 4, 2);
+    stream.refuse = true;
+    CHECK(!batcher.flush());
+    CHECK_EQ(batcher.stats().framesFailed, 1);
+    CHECK_EQ(batcher.stats().samplesDropped, 5);
+    stream.refuse = false;
+    batcher.add(1, values, 4, 3);
+    CHECK(batcher.flush());
+    CHECK_EQ(stream.samples.size(), 1);
+    CHECK_EQ(stream.samples[0].ts, 3);
+}
+
+static void benchStream(int rate)
+{
+    // A minute of 4 channels with 3 values each, polled like wsStreamPoll() every 10 ms.
+    stream = FakeStream();
+    SampleBatcher batcher(publish);
+    const int seconds = 60;
+    const uint64_t ts0 = 1700000000000ULL;
+    size_t jsonBytes = 0;
+    char json[160];
+    unsigned long start = micros();
+    for(int tick = 0; tick < seconds * 100; tick++)
+    {
+        uint64_t ts = ts0 + tick * 10ULL;
+        if(tick % (100 / rate) == 0)
+        {
+            for(uint8_t channel = 0; channel < 4; channel++)
+            {
+                float values[3] = { 20.0f + channel + tick * 0.01f, 60.5f - channel, 1013.25f };
+                batcher.add(channel, values, 3, ts);
+                jsonBytes += snprintf(json, sizeof(json), "{\"stream\":{\"ts\":%llu,\"ch\":%u,\"v\":[%.2f,%.2f,%.2f]}}",
+                    (unsigned long long)ts, channel, values[0], values[1], values[2]);
+            }
+        }
+        hostAdvanceMillis(10);
+        batcher.poll();
+    }
+    batcher.flush();
+    // Less the time skipped with hostAdvanceMillis().
+    unsigned long elapsed = micros() - start - seconds * 1000000UL;
+    const SampleBatchStats &stats = batcher.stats();
+    printf("%d Hz x 4 channels for %d s: %u samples in %u frames (%.1f frames/s, %llu bytes), %u JSON text frames (%u bytes), %.2f us per sample\n",
+        rate, seconds, stats.samplesAdded, stats.framesSent, (double)stats.framesSent / seconds,
+        (unsigned long long)stats.frameBytes, stats.samplesAdded, (unsigned)jsonBytes, (double)elapsed / stats.samplesAdded);
+    CHECK(stream.decoded);
+    CHECK_EQ(stream.samples.size(), (size_t)rate * seconds * 4);
+    CHECK(stats.frameBytes * 2 < jsonBytes);
+    CHECK(stats.framesSent * 4 < stats.samplesAdded);
+    // Frames fill up at 50 Hz, at 10 Hz age flushes keep the latency a chart sees at SAMPLE_FRAME_MAX_AGE.
+    CHECK(rate < 50 ? stats.ageFlushes > 0 : stats.sizeFlushes > 0);
+}
+
+int main()
+{
+    testLayout();
+    testFlushes();
+    testRejected();
+    benchStream(10);
+    benchStream(50);
+    return hostTestResult();
+}
@@ -0,0 +1,141 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// TelemetryBatcher against a fake MQTT client that applies PubSubClient's size check: batches built
+// in a TELEMETRY_BATCH_SIZE buffer are always accepted, format and flush reasons, messages saved.
+
+#include "hostTest.h"
+#include "telemetryBatcher.h"
+#include <string>
+
+#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
+
+/// @brief Accepts a publish the way PubSubClient does, only when header, topic and payload fit its buffer.
+struct FakeMqtt
+{
+    size_t bufferSize = 0;
+    uint32_t published = 0;
+    uint32_t rejected = 0;
+    size_t largest = 0;
+    std::string last;
+
+    bool publish(const char *topic, const char *payload)
+    {
+        size_t len = strlen(payload);
+        if(5 + 2 + strlen(topic) + len > bufferSize)
+        {
+            rejected++;
+            return false;
+        }
+        published++;
+        largest = len > largest ? len : largest;
+        last = payload;
+        return true;
+    }
+};
+
+static FakeMqtt mqtt;
+
+static bool publishTelemetry(const char *payload)
+{
+    return mqtt.publish(TELEMETRY_TOPIC, payload);
+}
+
+/// @brief The libudawa.h default for a given DOCSIZE_MIN.
+static size_t batchSize(size_t docSizeMin)
+{
+    return docSizeMin - 5 - 2 - (sizeof(TELEMETRY_TOPIC) - 1) + 1;
+}
+
+static void testFormat()
+{
+    mqtt = FakeMqtt();
+    mqtt.bufferSize = 384;
+    char buffer[256];
+    TelemetryBatcher batcher(publishTelemetry, buffer, sizeof(buffer));
+    CHECK(batcher.add("temp", 24.5f, 1000ULL));
+    CHECK(batcher.add("hum", 61, 1000ULL));
+    CHECK(batcher.add("on", true, 2000ULL));
+    CHECK(batcher.add("s", "a\"b", 2000ULL));
+    CHECK_EQ(batcher.pendingPoints(), 4);
+    CHECK(batcher.flush());
+    CHECK(mqtt.last == "[{\"ts\":1000,\"values\":{\"temp\":24.5,\"hum\":61}},{\"ts\":2000,\"values\":{\"on\":true,\"s\":\"a\\\"b\"}}]");
+    CHECK(batcher.empty());
+}
+
+static void testAge()
+{
+    mqtt = FakeMqtt();
+    mqtt.bufferSize = 384;
+    char buffer[256];
+    TelemetryBatcher batcher(publishTelemetry, buffer, sizeof(buffer), 50);
+    CHECK(batcher.add("k", 1, 1000ULL));
+    CHECK(batcher.poll());
+    CHECK_EQ(mqtt.published, 0);
+    hostAdvanceMillis(60);
+    CHECK(batcher.poll());
+    CHECK_EQ(mqtt.published, 1);
+    CHECK_EQ(batcher.stats().ageFlushes, 1);
+}
+
+/// @brief Floods a batcher sized for docSizeMin plus extra bytes with points of varying size.
+static void flood(size_t docSizeMin, size_t extra)
+{
+    mqtt = FakeMqtt();
+    mqtt.bufferSize = docSizeMin;
+    size_t size = batchSize(docSizeMin) + extra;
+    std::vector<char> buffer(size);
+    TelemetryBatcher batcher(publishTelemetry, buffer.data(), size);
+    char key[16];
+    char text[48];
+    for(uint32_t i = 0; i < 5000; i++)
+    {
+        snprintf(key, sizeof(key), "k%u", i % 37);
+        uint64_t ts = 1700000000000ULL + (i / 5) * 1000;
+        if(i % 3 == 0)
+        {
+            memset(text, 'x', i % 40);
+            text[i % 40] = '\0';
+            batcher.add(key, (const char *)text, ts);
+        }
+        else
+        {
+            batcher.add(key, (float)i / 7, ts);
+        }
+    }
+    batcher.flush();
+    const TelemetryBatchStats &stats = batcher.stats();
+    printf("DOCSIZE_MIN %4u, batch buffer %4u: %5u points in %4u messages, largest %3u bytes, %u rejected, %u messages and %lld bytes saved\n",
+        (unsigned)docSizeMin, (unsigned)size, stats.pointsAdded, mqtt.published, (unsigned)mqtt.largest, mqtt.rejected,
+        stats.messagesSaved(), (long long)stats.bytesSaved());
+    if(extra == 0)
+    {
+        CHECK_EQ(mqtt.rejected, 0);
+        CHECK_EQ(stats.pointsDropped, 0);
+        CHECK_EQ(stats.messagesFailed, 0);
+        CHECK(stats.sizeFlushes > 0);
+        // Full batches come close to the limit, the bound is not wasting the buffer.
+        CHECK(mqtt.largest + 40 > size - 1);
+    }
+    else
+    {
+        CHECK(mqtt.rejected > 0);
+    }
+}
+
+int main()
+{
+    testFormat();
+    testAge();
+    flood(384, 0);
+    flood(512, 0);
+    flood(1024, 0);
+    // One byte more than the default and full batches no longer fit the MQTT buffer.
+    flood(384, 1);
+    return hostTestResult();
+}
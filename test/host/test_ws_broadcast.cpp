@@ -0,0 +1,263 @@
+/**
+ * UDAWA - Universal Digital Agriculture Watering Assistant
+ * Function helper library for ESP32 based UDAWA multi-device firmware development
+ * Licensed under aGPLv3
+ * Researched and developed by PRITA Research Group & Narin Laboratory
+ * prita.undiknas.ac.id | narin.co.id
+**/
+
+// Heap allocations per WebSocket broadcast to N clients, one payload copy per client against one
+// SharedBufferPool buffer queued to all of them from two clients on, buffers freed once the clients
+// sent them, and the copy fallback when every buffer is still queued.
+
+#include "hostTest.h"
+#include "sharedBufferPool.h"
+#include <new>
+#include <vector>
+
+static uint32_t allocations = 0;
+static uint32_t frees = 0;
+
+// Counts every allocation of the binary. Not inlined, so the compiler does not pair malloc with delete.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    if(p != nullptr)
+    {
+        frees++;
+    }
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+// The message classes of ESPAsyncWebServer 1.2, down to what they allocate: a text message copies the
+// payload, a message of a shared buffer only references it.
+class AsyncWebSocketMessageBuffer
+{
+    public:
+        AsyncWebSocketMessageBuffer(uint8_t *data, size_t size) : _data(new uint8_t[size + 1]), _len(size)
+        {
+            memcpy(_data, data, size);
+            _data[size] = 0;
+        }
+        ~AsyncWebSocketMessageBuffer() { delete[] _data; }
+        void operator++(int) { _count++; }
+        void operator--(int) { _count--; }
+        void lock() { _lock = true; }
+        void unlock() { _lock = false; }
+        uint8_t *get() { return _data; }
+        size_t length() const { return _len; }
+        bool canDelete() const { return _count == 0 && !_lock; }
+
+    private:
+        uint8_t *_data;
+        size_t _len;
+        uint32_t _count = 0;
+        bool _lock = false;
+};
+
+class AsyncWebSocketMessage
+{
+    public:
+        virtual ~AsyncWebSocketMessage() {}
+};
+
+class AsyncWebSocketBasicMessage : public AsyncWebSocketMessage
+{
+    public:
+        AsyncWebSocketBasicMessage(const char *data, size_t len) : _data(new uint8_t[len + 1])
+        {
+            memcpy(_data, data, len);
+        }
+        ~AsyncWebSocketBasicMessage() { delete[] _data; }
+
+    private:
+        uint8_t *_data;
+};
+
+class AsyncWebSocketMultiMessage : public AsyncWebSocketMessage
+{
+    public:
+        AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer *buffer) : _buffer(buffer) { (*_buffer)++; }
+        ~AsyncWebSocketMultiMessage() { (*_buffer)--; }
+
+    private:
+        AsyncWebSocketMessageBuffer *_buffer;
+};
+
+class AsyncWebSocketClient
+{
+    public:
+        // Reserved up front, so only what the library allocates per message is counted.
+        AsyncWebSocketClient() { _queue.reserve(32); }
+        ~AsyncWebSocketClient() { sent(); }
+        void text(const char *message, size_t len) { _queue.push_back(new AsyncWebSocketBasicMessage(message, len)); }
+        void text(AsyncWebSocketMessageBuffer *buffer) { _queue.push_back(new AsyncWebSocketMultiMessage(buffer)); }
+        /// @brief The TCP stack took everything queued.
+        void sent()
+        {
+            for(AsyncWebSocketMessage *message : _queue)
+            {
+                delete message;
+            }
+            _queue.clear();
+        }
+        size_t queued() const { return _queue.size(); }
+
+    private:
+        std::vector<AsyncWebSocketMessage *> _queue;
+};
+
+static SharedBufferPool<AsyncWebSocketMessageBuffer, 8> *pool = nullptr;
+
+/// @brief The send path of wsBroadcastFrame(): one shared buffer for two or more clients, a copy each without one.
+static bool broadcast(std::vector<AsyncWebSocketClient *> &clients, const char *buffer, bool shared)
+{
+    size_t length = strlen(buffer);
+    AsyncWebSocketMessageBuffer *message = shared && clients.size() > 1 ? pool->make((const uint8_t *)buffer, length) : nullptr;
+    if(message != nullptr)
+    {
+        message->lock();
+    }
+    for(AsyncWebSocketClient *client : clients)
+    {
+        if(message != nullptr)
+        {
+            client->text(message);
+        }
+        else
+        {
+            client->text(buffer, length);
+        }
+    }
+    if(message != nullptr)
+    {
+        message->unlock();
+    }
+    return message != nullptr;
+}
+
+static const char *telemetry = "{\"devTel\":{\"heap\":182344,\"rssi\":-61,\"uptime\":86400,\"dts\":\"2026-10-19 07:12:44\"}}";
+
+/// @brief Allocations per broadcast over rounds of broadcasts, each followed by the clients sending what they queued.
+static double allocationsPerBroadcast(uint8_t clientCount, bool shared, int rounds)
+{
+    std::vector<AsyncWebSocketClient *> clients;
+    for(uint8_t i = 0; i < clientCount; i++)
+    {
+        clients.push_back(new AsyncWebSocketClient());
+    }
+    uint32_t before = allocations;
+    for(int r = 0; r < rounds; r++)
+    {
+        broadcast(clients, telemetry, shared);
+        for(AsyncWebSocketClient *client : clients)
+        {
+            client->sent();
+        }
+    }
+    uint32_t counted = allocations - before;
+    for(AsyncWebSocketClient *client : clients)
+    {
+        delete client;
+    }
+    return (double)counted / rounds;
+}
+
+static void benchAllocations()
+{
+    pool = new SharedBufferPool<AsyncWebSocketMessageBuffer, 8>();
+    const int rounds = 1000;
+    printf("clients  copies: allocs/broadcast  shared: allocs/broadcast\n");
+    for(uint8_t n = 1; n <= 8; n *= 2)
+    {
+        double copies = allocationsPerBroadcast(n, false, rounds);
+        double shared = allocationsPerBroadcast(n, true, rounds);
+        printf("%7u  %24.2f  %23.2f\n", n, copies, shared);
+        // A message and a payload copy per client, against a message per client and one buffer and payload.
+        // A single client is sent a copy, which is cheaper than the buffer.
+        CHECK_EQ(copies, 2 * n);
+        CHECK_EQ(shared, n == 1 ? 2 : n + 2);
+        CHECK(shared <= copies);
+    }
+    CHECK_EQ(pool->stats().exhausted, 0);
+    delete pool;
+}
+
+static void testRelease()
+{
+    pool = new SharedBufferPool<AsyncWebSocketMessageBuffer, 8>();
+    std::vector<AsyncWebSocketClient *> clients;
+    for(int i = 0; i < 3; i++)
+    {
+        clients.push_back(new AsyncWebSocketClient());
+    }
+    uint32_t allocated = allocations;
+    uint32_t freed = frees;
+
+    // A slow client keeps every buffer referenced: the pool runs out and the broadcast falls back to copies.
+    for(int i = 0; i < 8; i++)
+    {
+        CHECK(broadcast(clients, telemetry, true));
+    }
+    CHECK(!broadcast(clients, telemetry, true));
+    CHECK_EQ(pool->stats().exhausted, 1);
+    CHECK_EQ(clients[0]->queued(), 9);
+    CHECK_EQ(pool->release(), 8);
+
+    // Once every client sent them the buffers are freed and reused.
+    for(AsyncWebSocketClient *client : clients)
+    {
+        client->sent();
+    }
+    CHECK(broadcast(clients, telemetry, true));
+    CHECK_EQ(pool->stats().freed, 8);
+    for(AsyncWebSocketClient *client : clients)
+    {
+        client->sent();
+    }
+    CHECK_EQ(pool->release(), 0);
+    CHECK_EQ(allocations - allocated, frees - freed);
+
+    for(AsyncWebSocketClient *client : clients)
+    {
+        delete client;
+    }
+    delete pool;
+}
+
+int main()
+{
+    benchAllocations();
+    testRelease();
+    return hostTestResult();
+}